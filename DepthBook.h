@@ -0,0 +1,78 @@
+#ifndef DEPTHBOOK_H
+#define DEPTHBOOK_H
+
+#include "OrderUtils.h"
+#include "ExecutionReports.h"
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// L2 image of one book kept current from its LEVEL reports, for market-data publishers and consumers.
+// each report costs one binary search plus a shift of the levels better than it, which is short because
+// changes cluster at the touch. both sides are stored worst to best so the touch sits at the back.
+class DepthBook {
+public:
+    inline void apply(const ExecutionReport& report) {
+        if (report.type == ReportType::LEVEL) {
+            update(report.side, report.price, report.quantity);
+        }
+    }
+
+    // quantity 0 removes the level
+    inline void update(Side side, uint32_t price, uint32_t quantity) {
+        if (side == Side::BUY) {
+            update(bids, price, quantity, [](uint32_t a, uint32_t b) { return a < b; });
+        } else {
+            update(asks, price, quantity, [](uint32_t a, uint32_t b) { return a > b; });
+        }
+    }
+
+    // same layout as BasicOrderbook::get_depth
+    void get_depth(uint32_t n, Depth& depth) const {
+        depth.bids.assign(bids.rbegin(), bids.rbegin() + min<size_t>(n, bids.size()));
+        depth.asks.assign(asks.rbegin(), asks.rbegin() + min<size_t>(n, asks.size()));
+    }
+
+    uint32_t bid_levels() const { return bids.size(); }
+    uint32_t ask_levels() const { return asks.size(); }
+
+    void clear() {
+        bids.clear();
+        asks.clear();
+    }
+
+private:
+    template <typename Worse>
+    static inline void update(vector<DepthLevel>& levels, uint32_t price, uint32_t quantity, Worse worse) {
+        auto it = lower_bound(levels.begin(), levels.end(), price,
+            [worse](const DepthLevel& level, uint32_t p) { return worse(level.price, p); });
+        bool found = it != levels.end() && it->price == price;
+
+        if (quantity == 0) {
+            if (found) {
+                levels.erase(it);
+            }
+        } else if (found) {
+            it->quantity = quantity;
+        } else {
+            levels.insert(it, {price, quantity});
+        }
+    }
+
+    vector<DepthLevel> bids;
+    vector<DepthLevel> asks;
+};
+
+// publishes in the matching thread, every level change lands in a DepthBook before the book call returns
+class DepthSink {
+public:
+    explicit DepthSink(DepthBook& depth) : depth(&depth) {}
+
+    inline void on_report(const ExecutionReport& report) { depth->apply(report); }
+
+private:
+    DepthBook* depth;
+};
+
+#endif // DEPTHBOOK_H
@@ -0,0 +1,64 @@
+#ifndef EXECUTIONREPORTS_H
+#define EXECUTIONREPORTS_H
+
+#include "OrderUtils.h"
+#include "SpscRing.h"
+
+using namespace std;
+
+enum class ReportType : uint8_t {
+    ACK,     // order accepted, quantity as submitted
+    REJECT,  // order or its unfilled remainder was not rested
+    FILL,    // order_id traded against resting contra_order_id
+    CANCEL,  // quantity is what was left when cancelled
+    MODIFY,  // quantity is the new resting quantity
+    LEVEL,   // book change, quantity is the level's new total (0 when it emptied)
+    TRIGGER  // armed stop entered the book, price is its trigger
+};
+
+// why a REJECT was sent, NONE on every other report
+enum class RejectReason : uint8_t {
+    NONE,
+    PRICE,           // not on a tick, or the reserved MAX_PRICE
+    CAPACITY,        // order store full
+    DUPLICATE,       // order id already resting
+    ACCOUNT,         // account outside the risk table
+    ORDER_QUANTITY,  // above the account's order size limit
+    NOTIONAL,        // above the account's notional limit
+    OPEN_QUANTITY,   // would take the account's resting quantity over its limit
+    PRICE_BAND,      // priced through the collar around the opposite touch
+    SELF_TRADE,      // would have traded with the account's own resting order
+    TRIGGER,         // stop whose trigger the last trade has already reached
+    LIQUIDITY        // what a triggered stop market could not fill, it never rests
+};
+
+// 40 bytes. sequence numbers are per book and gap-free, so a consumer can prove nothing was lost.
+struct ExecutionReport {
+    uint64_t sequence;
+    uint64_t order_id;
+    uint64_t contra_order_id;
+    uint32_t price;
+    uint32_t quantity;
+    uint32_t book;
+    ReportType type;
+    Side side;
+    RejectReason reason;
+};
+
+// sinks are compile-time book parameters, the default one compiles away
+struct NullSink {
+    inline void on_report(const ExecutionReport&) {}
+};
+
+// hands reports to another thread, backpressure instead of loss when the ring is full
+class RingSink {
+public:
+    explicit RingSink(SpscRing<ExecutionReport>& ring) : ring(&ring) {}
+
+    inline void on_report(const ExecutionReport& report) { ring->push(report); }
+
+private:
+    SpscRing<ExecutionReport>* ring;
+};
+
+#endif // EXECUTIONREPORTS_H
@@ -0,0 +1,356 @@
+#ifndef FEEDREPLAY_H
+#define FEEDREPLAY_H
+
+#include "OrderUtils.h"
+#include "SymbolRouter.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// compact binary capture format, loosely modelled on ITCH:
+//   FeedHeader
+//   symbol directory, symbol_count space padded 8 byte names, file symbol i is directory entry i
+//   message_count messages back to back, each starting with its one byte type
+// fields are little endian and unaligned, a reader decodes them straight out of the mapping.
+
+constexpr char FEED_MAGIC[8] = {'O', 'B', 'F', 'E', 'E', 'D', '1', '\0'};
+constexpr uint32_t FEED_VERSION = 1;
+constexpr uint32_t FEED_SYMBOL_LENGTH = 8;
+
+struct FeedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t symbol_count;
+    uint64_t message_count;
+};
+
+#pragma pack(push, 1)
+
+struct FeedAdd {
+    char type;  // 'A'
+    uint8_t side;  // 'B' or 'S'
+    uint16_t symbol;
+    uint64_t order_id;
+    uint32_t price;
+    uint32_t quantity;
+};
+
+struct FeedCancel {
+    char type;  // 'X'
+    uint8_t reserved;
+    uint16_t symbol;
+    uint64_t order_id;
+};
+
+struct FeedModify {
+    char type;  // 'U'
+    uint8_t reserved;
+    uint16_t symbol;
+    uint64_t order_id;
+    uint32_t quantity;  // new resting quantity
+};
+
+struct FeedExecute {
+    char type;  // 'E'
+    uint8_t reserved;
+    uint16_t symbol;
+    uint64_t order_id;
+    uint32_t quantity;  // executed quantity
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(FeedHeader) == 24, "FeedHeader layout");
+static_assert(sizeof(FeedAdd) == 20 && sizeof(FeedCancel) == 12 &&
+              sizeof(FeedModify) == 16 && sizeof(FeedExecute) == 16, "feed message layout");
+
+// buffered capture writer, the message count in the header is patched on close
+class FeedWriter {
+public:
+    FeedWriter() = default;
+    ~FeedWriter() { close(); }
+
+    FeedWriter(const FeedWriter&) = delete;
+    FeedWriter& operator=(const FeedWriter&) = delete;
+
+    // returns false if the file cannot be created or there are more symbols than the format holds
+    bool open(const char* path, const vector<string>& symbols) {
+        if (symbols.size() > UINT16_MAX + 1) {
+            return false;
+        }
+        file = fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+        FeedHeader header{};
+        memcpy(header.magic, FEED_MAGIC, sizeof(FEED_MAGIC));
+        header.version = FEED_VERSION;
+        header.symbol_count = symbols.size();
+        fwrite(&header, sizeof(header), 1, file);
+
+        for (const string& symbol : symbols) {
+            char name[FEED_SYMBOL_LENGTH];
+            memset(name, ' ', sizeof(name));
+            memcpy(name, symbol.data(), min<size_t>(symbol.size(), sizeof(name)));
+            fwrite(name, sizeof(name), 1, file);
+        }
+        directory_size = symbols.size();
+        messages = 0;
+        rejected = 0;
+        return true;
+    }
+
+    // messages take the symbol as Command and the router do, one outside the directory would wrap in the
+    // 16-bit field and land in another book, so it is dropped and close() reports it
+    void add(uint32_t symbol, uint64_t order_id, Side side, uint32_t price, uint32_t quantity) {
+        if (!in_directory(symbol)) {
+            return;
+        }
+        FeedAdd message{'A', uint8_t(side == Side::BUY ? 'B' : 'S'), uint16_t(symbol), order_id, price, quantity};
+        append(message);
+    }
+
+    void cancel(uint32_t symbol, uint64_t order_id) {
+        if (!in_directory(symbol)) {
+            return;
+        }
+        FeedCancel message{'X', 0, uint16_t(symbol), order_id};
+        append(message);
+    }
+
+    void modify(uint32_t symbol, uint64_t order_id, uint32_t new_quantity) {
+        if (!in_directory(symbol)) {
+            return;
+        }
+        FeedModify message{'U', 0, uint16_t(symbol), order_id, new_quantity};
+        append(message);
+    }
+
+    void execute(uint32_t symbol, uint64_t order_id, uint32_t quantity) {
+        if (!in_directory(symbol)) {
+            return;
+        }
+        FeedExecute message{'E', 0, uint16_t(symbol), order_id, quantity};
+        append(message);
+    }
+
+    void write(const Command& command) {
+        switch (command.type) {
+            case CommandType::ADD:
+                add(command.symbol, command.order_id, command.side, command.price, command.quantity);
+                break;
+            case CommandType::CANCEL:
+                cancel(command.symbol, command.order_id);
+                break;
+            case CommandType::MODIFY:
+                modify(command.symbol, command.order_id, command.quantity);
+                break;
+            case CommandType::EXECUTE:
+                execute(command.symbol, command.order_id, command.quantity);
+                break;
+            case CommandType::ADD_STOP:
+                // a venue feed shows a stop only once it has entered, as the add it became
+                break;
+        }
+    }
+
+    // returns false if any write failed or a message named a symbol outside the directory
+    bool close() {
+        if (!file) {
+            return true;
+        }
+        fseek(file, offsetof(FeedHeader, message_count), SEEK_SET);
+        fwrite(&messages, sizeof(messages), 1, file);
+        bool ok = !ferror(file) && rejected == 0;
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+
+    uint64_t message_count() const { return messages; }
+    uint64_t rejected_count() const { return rejected; }
+
+private:
+    inline bool in_directory(uint32_t symbol) {
+        if (symbol >= directory_size) {
+            ++rejected;
+            return false;
+        }
+        return true;
+    }
+
+    template <typename Message>
+    inline void append(const Message& message) {
+        fwrite(&message, sizeof(message), 1, file);
+        ++messages;
+    }
+
+    FILE* file = nullptr;
+    uint32_t directory_size = 0;
+    uint64_t messages = 0;
+    uint64_t rejected = 0;
+};
+
+// maps a capture read-only and decodes messages in place, nothing is copied out of the mapping
+class FeedReader {
+public:
+    FeedReader() = default;
+    ~FeedReader() { close(); }
+
+    FeedReader(const FeedReader&) = delete;
+    FeedReader& operator=(const FeedReader&) = delete;
+
+    // returns false if the file cannot be mapped or is not a capture of this version
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(FeedHeader)) {
+            ::close(fd);
+            return false;
+        }
+        length = st.st_size;
+
+        // populate up front so replay timing does not include page faults
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            length = 0;
+            return false;
+        }
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, length, MADV_SEQUENTIAL);
+
+        const FeedHeader& header = *reinterpret_cast<const FeedHeader*>(data);
+        if (memcmp(header.magic, FEED_MAGIC, sizeof(FEED_MAGIC)) != 0 || header.version != FEED_VERSION ||
+            length < sizeof(FeedHeader) + uint64_t(header.symbol_count) * FEED_SYMBOL_LENGTH) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+            data = nullptr;
+            length = 0;
+        }
+    }
+
+    uint32_t symbol_count() const { return header().symbol_count; }
+    uint64_t message_count() const { return header().message_count; }
+    size_t size_bytes() const { return length; }
+
+    // directory name with the padding stripped
+    string symbol(uint32_t i) const {
+        const char* name = data + sizeof(FeedHeader) + i * FEED_SYMBOL_LENGTH;
+        size_t n = FEED_SYMBOL_LENGTH;
+        while (n > 0 && (name[n - 1] == ' ' || name[n - 1] == '\0')) {
+            --n;
+        }
+        return string(name, n);
+    }
+
+    // visits every message as a Command, stops at the first unknown or truncated message, or one naming a symbol
+    // outside the directory.
+    // returns the number of messages visited.
+    template <typename Visit>
+    uint64_t for_each(Visit visit) const {
+        const char* p = messages_begin();
+        const char* end = data + length;
+        uint32_t symbols = symbol_count();
+        uint64_t visited = 0;
+
+        while (p < end) {
+            Command command{};
+            switch (*p) {
+                case 'A': {
+                    if (size_t(end - p) < sizeof(FeedAdd)) {
+                        return visited;
+                    }
+                    const FeedAdd& m = *reinterpret_cast<const FeedAdd*>(p);
+                    command = {m.order_id, m.symbol, m.price, m.quantity, CommandType::ADD,
+                               m.side == 'B' ? Side::BUY : Side::SELL};
+                    p += sizeof(FeedAdd);
+                    break;
+                }
+                case 'X': {
+                    if (size_t(end - p) < sizeof(FeedCancel)) {
+                        return visited;
+                    }
+                    const FeedCancel& m = *reinterpret_cast<const FeedCancel*>(p);
+                    command = {m.order_id, m.symbol, 0, 0, CommandType::CANCEL, Side::BUY};
+                    p += sizeof(FeedCancel);
+                    break;
+                }
+                case 'U': {
+                    if (size_t(end - p) < sizeof(FeedModify)) {
+                        return visited;
+                    }
+                    const FeedModify& m = *reinterpret_cast<const FeedModify*>(p);
+                    command = {m.order_id, m.symbol, 0, m.quantity, CommandType::MODIFY, Side::BUY};
+                    p += sizeof(FeedModify);
+                    break;
+                }
+                case 'E': {
+                    if (size_t(end - p) < sizeof(FeedExecute)) {
+                        return visited;
+                    }
+                    const FeedExecute& m = *reinterpret_cast<const FeedExecute*>(p);
+                    command = {m.order_id, m.symbol, 0, m.quantity, CommandType::EXECUTE, Side::BUY};
+                    p += sizeof(FeedExecute);
+                    break;
+                }
+                default:
+                    return visited;
+            }
+            if (command.symbol >= symbols) {
+                return visited;
+            }
+            visit(command);
+            ++visited;
+        }
+        return visited;
+    }
+
+    // drives a router whose symbol ids match the capture directory, see add_symbols
+    template <typename Sink, typename Spec>
+    uint64_t replay(BasicSymbolRouter<Sink, Spec>& router) const {
+        return for_each([&router](const Command& command) {
+            router.apply(command);
+        });
+    }
+
+    // lists the capture symbols on an empty router in directory order
+    template <typename Sink, typename Spec>
+    void add_symbols(BasicSymbolRouter<Sink, Spec>& router) const {
+        for (uint32_t i = 0; i < symbol_count(); i++) {
+            router.add_symbol(symbol(i));
+        }
+    }
+
+private:
+    const FeedHeader& header() const { return *reinterpret_cast<const FeedHeader*>(data); }
+
+    const char* messages_begin() const {
+        return data + sizeof(FeedHeader) + header().symbol_count * FEED_SYMBOL_LENGTH;
+    }
+
+    const char* data = nullptr;
+    size_t length = 0;
+};
+
+#endif // FEEDREPLAY_H
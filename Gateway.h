@@ -0,0 +1,899 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include "SymbolRouter.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/io_uring.h>
+
+using namespace std;
+
+// order entry over TCP or unix stream sockets, one thread running the event loop and the matching.
+// every message starts with its one byte type and has a fixed size per type, fields are little endian
+// and unaligned as in the feed captures. a client numbers nothing itself: its n-th message is request n,
+// and every report carries the request that caused it. each request is answered at least once, adds by
+// their ack or reject, cancels and modifies by the book's report or by a reject when the order is not
+// the client's or no longer rests.
+//
+// client order ids are per connection and must be below 2^GATEWAY_ORDER_BITS. the book sees
+// session << GATEWAY_ORDER_BITS | client id, so connections cannot collide or touch each other's
+// orders, and a report finds its connection from the order id alone. sessions are numbered from 1
+// and never reused, so a report for a connection that has gone is simply dropped.
+//
+// everything a receive holds is applied before anything is sent, and the reports for all of it leave in
+// one send per connection at the end of the loop iteration. two backends drive the same sessions:
+// epoll readiness with non-blocking recv/send, and io_uring with the receives, sends and accepts
+// submitted together in one system call per iteration.
+
+constexpr uint32_t GATEWAY_ORDER_BITS = 40;
+constexpr uint64_t GATEWAY_MAX_CLIENT_ID = (uint64_t(1) << GATEWAY_ORDER_BITS) - 1;
+constexpr uint32_t GATEWAY_MAX_SESSIONS = (1u << (64 - GATEWAY_ORDER_BITS)) - 1;
+
+#pragma pack(push, 1)
+
+struct EntryAdd {
+    char type;     // 'A'
+    uint8_t side;  // 'B' or 'S'
+    uint8_t tif;   // 'D' day or 'G' good till cancelled
+    uint8_t reserved;
+    uint32_t symbol;
+    uint64_t client_order_id;
+    uint32_t price;
+    uint32_t quantity;
+};
+
+struct EntryCancel {
+    char type;  // 'X'
+    uint8_t reserved[7];
+    uint64_t client_order_id;
+};
+
+struct EntryModify {
+    char type;  // 'U'
+    uint8_t reserved[3];
+    uint32_t quantity;  // new resting quantity, 0 cancels
+    uint64_t client_order_id;
+};
+
+// 'K' ack, 'J' reject, 'F' fill, 'C' cancelled, 'M' modified
+struct EntryReport {
+    char type;
+    uint8_t side;  // 'B' or 'S', of the order the report is for
+    uint16_t reserved;
+    uint32_t request;  // this connection's request that caused it, 0 for a fill caused by another connection
+    uint64_t client_order_id;
+    uint64_t sequence;  // book report sequence, 0 for a reject from the gateway itself
+    uint32_t symbol;
+    uint32_t price;
+    uint32_t quantity;  // as in the ExecutionReport of the same type
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(EntryAdd) == 24 && sizeof(EntryCancel) == 16 && sizeof(EntryModify) == 16 &&
+              sizeof(EntryReport) == 36, "order entry message layout");
+
+// 0 for an unknown type
+inline size_t entry_size(char type) {
+    switch (type) {
+        case 'A':
+            return sizeof(EntryAdd);
+        case 'X':
+            return sizeof(EntryCancel);
+        case 'U':
+            return sizeof(EntryModify);
+        default:
+            return 0;
+    }
+}
+
+struct GatewayConfig {
+    // bytes one receive can take, every message fits many times over
+    uint32_t receive_bytes = 64 << 10;
+    // reports waiting to be sent to one connection before it is dropped as too slow
+    uint32_t send_bytes = 4 << 20;
+    // cancel a connection's resting orders when it goes
+    bool cancel_on_disconnect = true;
+    // spin on the event source instead of sleeping in it, only for a core of its own
+    bool busy_poll = false;
+    uint32_t uring_entries = 4096;
+};
+
+class Gateway;
+
+struct GatewaySink {
+    Gateway* gateway;
+    inline void on_report(const ExecutionReport& report);
+};
+
+using GatewayRouter = BasicSymbolRouter<GatewaySink>;
+
+// listening sockets, -1 on failure. TCP listens on every address, a unix path is replaced if it exists
+inline int listen_tcp(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline int listen_unix(const char* path) {
+    sockaddr_un address{};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// blocking client connections, -1 on failure
+inline int connect_tcp(const char* host, uint16_t port) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host, to_string(port).c_str(), &hints, &found) != 0) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    if (fd >= 0) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+inline int connect_unix(const char* path) {
+    sockaddr_un address{};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one connection. input is parsed in place, output is appended behind whatever is still being sent
+struct GatewaySession {
+    int fd = -1;
+    uint32_t id = 0;
+    uint32_t requests = 0;
+    bool closed = false;    // to be closed at the next flush, nothing more is delivered to it
+    bool ended = false;     // its orders have been pulled
+    bool dirty = false;     // queued for the end-of-iteration flush
+    bool watching = false;  // epoll: waiting for the socket to take more output
+    uint32_t in_flight = 0; // io_uring: operations the kernel still holds this session's buffers for
+    bool sending = false;   // io_uring: a send of [out_begin, out_end) is in flight
+
+    vector<char> in;
+    size_t in_used = 0;
+    vector<char> out;
+    size_t out_begin = 0;
+    size_t out_end = 0;
+
+    // engine ids of every order added, trimmed to the live ones as it grows, cancelled on disconnect
+    vector<uint64_t> orders;
+    size_t trim_at = 1024;
+
+    size_t pending() const { return out_end - out_begin; }
+};
+
+// minimal io_uring over the raw system calls: one submission and one completion ring
+class Uring {
+public:
+    Uring() = default;
+    ~Uring() { close(); }
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    bool open(uint32_t entries) {
+        io_uring_params params{};
+        fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_bytes = cq_bytes = max(sq_bytes, cq_bytes);
+        }
+        sq_ring = map(sq_bytes, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : map(cq_bytes, IORING_OFF_CQ_RING);
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_bytes, IORING_OFF_SQES));
+        if (!sq_ring || !cq_ring || !sqes) {
+            close();
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ring);
+        char* cq = static_cast<char*>(cq_ring);
+        sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        tail = *sq_tail;
+        return true;
+    }
+
+    void close() {
+        if (sqes) {
+            munmap(sqes, sqes_bytes);
+        }
+        if (cq_ring && cq_ring != sq_ring) {
+            munmap(cq_ring, cq_bytes);
+        }
+        if (sq_ring) {
+            munmap(sq_ring, sq_bytes);
+        }
+        sqes = nullptr;
+        sq_ring = cq_ring = nullptr;
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // a zeroed entry, submitting what is queued first if the ring is full. null if that fails
+    io_uring_sqe* next() {
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries && submit(0) < 0) {
+            return nullptr;
+        }
+        uint32_t slot = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[slot] = slot;
+        ++tail;
+        return sqe;
+    }
+
+    // submits everything queued and waits for at least wait completions. -1 with errno on failure
+    int submit(uint32_t wait) {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        uint32_t queued = tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        return int(syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    }
+
+    // hands every completion so far to handle
+    template <typename Handle>
+    void complete(Handle&& handle) {
+        uint32_t head = *cq_head;
+        uint32_t end = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != end; head++) {
+            handle(cqes[head & cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void* map(size_t bytes, off_t offset) {
+        void* ring = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+
+    int fd = -1;
+    bool single_mmap = false;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sq_bytes = 0;
+    size_t cq_bytes = 0;
+    size_t sqes_bytes = 0;
+
+    uint32_t* sq_head = nullptr;
+    uint32_t* sq_tail = nullptr;
+    uint32_t* sq_array = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t sq_entries = 0;
+    uint32_t tail = 0;
+    uint32_t* cq_head = nullptr;
+    uint32_t* cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+class Gateway {
+public:
+    explicit Gateway(GatewayConfig gateway_config = GatewayConfig(), uint32_t max_orders = MAX_ORDERS)
+        : config(gateway_config), router(new GatewayRouter(max_orders, GatewaySink{this})), sessions(1) {}
+
+    Gateway(const Gateway&) = delete;
+    Gateway& operator=(const Gateway&) = delete;
+
+    ~Gateway() {
+        for (auto& session : sessions) {
+            if (session && session->fd >= 0) {
+                ::close(session->fd);
+            }
+        }
+    }
+
+    uint32_t add_symbol(const string& symbol) { return router->add_symbol(symbol); }
+    GatewayRouter& engine() { return *router; }
+
+    // runs until stop(), false if the backend cannot be set up. listener must be non-blocking
+    bool serve_epoll(int listener) {
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            return false;
+        }
+        epoll = epoll_fd;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = 0;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event) < 0) {
+            ::close(epoll);
+            return false;
+        }
+
+        epoll_event events[256];
+        while (!stopping.load(memory_order_relaxed)) {
+            int n = epoll_wait(epoll, events, 256, config.busy_poll ? 0 : -1);
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64;
+                if (id == 0) {
+                    accept_epoll(listener);
+                    continue;
+                }
+                GatewaySession* session = sessions[id].get();
+                if (!session || session->closed) {
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    send_epoll(*session);
+                    // a failed send may have closed and freed the session
+                    session = sessions[id].get();
+                    if (!session || session->closed) {
+                        continue;
+                    }
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive_epoll(*session);
+                }
+            }
+            flush_epoll();
+        }
+        ::close(epoll);
+        epoll = -1;
+        return true;
+    }
+
+    bool serve_uring(int listener) {
+        if (!ring.open(config.uring_entries)) {
+            return false;
+        }
+        if (!submit_accept(listener)) {
+            ring.close();
+            return false;
+        }
+
+        while (!stopping.load(memory_order_relaxed)) {
+            if (ring.submit(config.busy_poll ? 0 : 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                break;
+            }
+            ring.complete([&](const io_uring_cqe& cqe) { completed_uring(listener, cqe); });
+            flush_uring();
+        }
+        ring.close();
+        return true;
+    }
+
+    // from any thread or a signal handler, the loop returns after its current wait
+    void stop() { stopping.store(true, memory_order_relaxed); }
+
+    uint32_t open_sessions() const { return connected; }
+    uint64_t requests() const { return total_requests; }
+
+    // the sink's entry point. level reports are market data and not sent here
+    inline void on_report(const ExecutionReport& report) {
+        switch (report.type) {
+            case ReportType::LEVEL:
+                return;
+            case ReportType::FILL:
+                deliver(report.order_id, 'F', report.side, report);
+                deliver(report.contra_order_id, 'F', report.side == Side::BUY ? Side::SELL : Side::BUY, report);
+                return;
+            default:
+                deliver(report.order_id, report_code(report.type), report.side, report);
+        }
+    }
+
+private:
+    static char report_code(ReportType type) {
+        switch (type) {
+            case ReportType::ACK:
+                return 'K';
+            case ReportType::REJECT:
+                return 'J';
+            case ReportType::CANCEL:
+                return 'C';
+            default:
+                return 'M';
+        }
+    }
+
+    GatewaySession* open_session(int fd) {
+        if (sessions.size() > GATEWAY_MAX_SESSIONS) {
+            return nullptr;
+        }
+        unique_ptr<GatewaySession> session(new GatewaySession());
+        session->fd = fd;
+        session->id = sessions.size();
+        session->in.resize(config.receive_bytes);
+        session->out.resize(config.send_bytes);
+        sessions.push_back(move(session));
+        ++connected;
+        return sessions.back().get();
+    }
+
+    // stops delivering to the session and pulls its orders. the caller closes the socket
+    void end_session(GatewaySession& session) {
+        if (session.ended) {
+            return;
+        }
+        session.closed = true;
+        session.ended = true;
+        --connected;
+        if (config.cancel_on_disconnect) {
+            for (uint64_t order_id : session.orders) {
+                router->cancel_order(order_id);
+            }
+        }
+        session.orders.clear();
+        session.orders.shrink_to_fit();
+    }
+
+    // applies every whole message in the input, a partial one is kept for the next receive.
+    // false on a message type the protocol does not have
+    bool process(GatewaySession& session) {
+        const char* data = session.in.data();
+        size_t used = session.in_used;
+        size_t at = 0;
+        while (at < used && !session.closed) {
+            size_t size = entry_size(data[at]);
+            if (size == 0) {
+                return false;
+            }
+            if (used - at < size) {
+                break;
+            }
+            apply(session, data + at);
+            at += size;
+        }
+        if (at > 0) {
+            memmove(session.in.data(), data + at, used - at);
+            session.in_used = used - at;
+        }
+        return true;
+    }
+
+    void apply(GatewaySession& session, const char* message) {
+        current = &session;
+        current_request = ++session.requests;
+        answered = false;
+        ++total_requests;
+
+        uint64_t base = uint64_t(session.id) << GATEWAY_ORDER_BITS;
+        switch (message[0]) {
+            case 'A': {
+                EntryAdd add;
+                memcpy(&add, message, sizeof(add));
+                current_order = base | add.client_order_id;
+                bool valid = add.client_order_id != 0 && add.client_order_id <= GATEWAY_MAX_CLIENT_ID &&
+                             add.symbol < router->symbol_count() && (add.side == 'B' || add.side == 'S') &&
+                             (add.tif == 'D' || add.tif == 'G');
+                if (!valid) {
+                    reject(session, add.client_order_id, add.side, add.symbol, add.price, add.quantity);
+                    break;
+                }
+                track(session, current_order);
+                router->add_order(add.symbol, current_order, add.side == 'B' ? Side::BUY : Side::SELL, add.price,
+                                  add.quantity, add.tif == 'G' ? TimeInForce::GTC : TimeInForce::DAY);
+                break;
+            }
+            case 'X': {
+                EntryCancel cancel;
+                memcpy(&cancel, message, sizeof(cancel));
+                current_order = base | (cancel.client_order_id & GATEWAY_MAX_CLIENT_ID);
+                router->cancel_order(current_order);
+                if (!answered) {
+                    reject(session, cancel.client_order_id, 0, 0, 0, 0);
+                }
+                break;
+            }
+            case 'U': {
+                EntryModify modify;
+                memcpy(&modify, message, sizeof(modify));
+                current_order = base | (modify.client_order_id & GATEWAY_MAX_CLIENT_ID);
+                router->modify_order(current_order, modify.quantity);
+                if (!answered) {
+                    reject(session, modify.client_order_id, 0, 0, 0, modify.quantity);
+                }
+                break;
+            }
+        }
+        current = nullptr;
+        current_order = 0;
+    }
+
+    // remembers an order for cancel on disconnect. the list is trimmed to live orders whenever it doubles
+    void track(GatewaySession& session, uint64_t order_id) {
+        if (!config.cancel_on_disconnect) {
+            return;
+        }
+        session.orders.push_back(order_id);
+        if (session.orders.size() >= session.trim_at) {
+            size_t kept = 0;
+            for (uint64_t id : session.orders) {
+                if (router->has_order(id)) {
+                    session.orders[kept++] = id;
+                }
+            }
+            session.orders.resize(kept);
+            session.trim_at = max<size_t>(1024, kept * 2);
+        }
+    }
+
+    inline void deliver(uint64_t order_id, char type, Side side, const ExecutionReport& report) {
+        uint64_t id = order_id >> GATEWAY_ORDER_BITS;
+        GatewaySession* session = id < sessions.size() ? sessions[id].get() : nullptr;
+        if (!session || session->closed) {
+            return;
+        }
+        EntryReport message;
+        message.type = type;
+        message.side = side == Side::BUY ? 'B' : 'S';
+        message.reserved = 0;
+        message.request = session == current ? current_request : 0;
+        message.client_order_id = order_id & GATEWAY_MAX_CLIENT_ID;
+        message.sequence = report.sequence;
+        message.symbol = report.book;
+        message.price = report.price;
+        message.quantity = report.quantity;
+        answered |= order_id == current_order;
+        append(*session, message);
+    }
+
+    void reject(GatewaySession& session, uint64_t client_order_id, uint8_t side, uint32_t symbol, uint32_t price,
+                uint32_t quantity) {
+        EntryReport message{};
+        message.type = 'J';
+        message.side = side;
+        message.request = current_request;
+        message.client_order_id = client_order_id;
+        message.symbol = symbol;
+        message.price = price;
+        message.quantity = quantity;
+        answered = true;
+        append(session, message);
+    }
+
+    // a connection that lets its output back up past send_bytes is dropped at the next flush
+    inline void append(GatewaySession& session, const EntryReport& message) {
+        if (session.out.size() - session.out_end < sizeof(message)) {
+            // the bytes an io_uring send holds must stay where they are
+            if (session.sending || session.out_begin == 0) {
+                session.closed = true;
+                mark_dirty(session);
+                return;
+            }
+            memmove(session.out.data(), session.out.data() + session.out_begin, session.pending());
+            session.out_end -= session.out_begin;
+            session.out_begin = 0;
+        }
+        memcpy(session.out.data() + session.out_end, &message, sizeof(message));
+        session.out_end += sizeof(message);
+        mark_dirty(session);
+    }
+
+    inline void mark_dirty(GatewaySession& session) {
+        if (!session.dirty) {
+            session.dirty = true;
+            dirty.push_back(session.id);
+        }
+    }
+
+    // epoll backend
+
+    void accept_epoll(int listener) {
+        while (true) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            configure(fd);
+            GatewaySession* session = open_session(fd);
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = session ? session->id : 0;
+            if (!session || epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+                if (session) {
+                    end_session(*session);
+                    sessions[session->id].reset();
+                }
+                ::close(fd);
+            }
+        }
+    }
+
+    void receive_epoll(GatewaySession& session) {
+        while (true) {
+            size_t space = session.in.size() - session.in_used;
+            ssize_t got = recv(session.fd, session.in.data() + session.in_used, space, 0);
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                close_epoll(session);
+                return;
+            }
+            session.in_used += got;
+            if (!process(session)) {
+                close_epoll(session);
+                return;
+            }
+            if (size_t(got) < space) {
+                // a short read drained the socket
+                return;
+            }
+        }
+    }
+
+    void send_epoll(GatewaySession& session) {
+        while (session.pending() > 0) {
+            ssize_t sent = send(session.fd, session.out.data() + session.out_begin, session.pending(), MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent <= 0) {
+                close_epoll(session);
+                return;
+            }
+            session.out_begin += sent;
+        }
+        if (session.pending() == 0) {
+            session.out_begin = session.out_end = 0;
+        }
+        // only ask for writability while output is waiting on the socket
+        bool watch = session.pending() > 0;
+        if (watch != session.watching) {
+            epoll_event event{};
+            event.events = watch ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            event.data.u64 = session.id;
+            epoll_ctl(epoll, EPOLL_CTL_MOD, session.fd, &event);
+            session.watching = watch;
+        }
+    }
+
+    void flush_epoll() {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            GatewaySession* session = sessions[dirty[i]].get();
+            if (!session) {
+                continue;
+            }
+            session->dirty = false;
+            if (session->closed) {
+                close_epoll(*session);
+            } else {
+                send_epoll(*session);
+            }
+        }
+        dirty.clear();
+    }
+
+    void close_epoll(GatewaySession& session) {
+        uint32_t id = session.id;
+        end_session(session);
+        if (session.fd >= 0) {
+            ::close(session.fd);
+            session.fd = -1;
+        }
+        if (!session.dirty) {
+            sessions[id].reset();
+        }
+    }
+
+    static void configure(int fd) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    // io_uring backend. user_data is the session id shifted over the operation
+
+    enum UringOp : uint64_t { ACCEPT, RECEIVE, SEND };
+
+    bool submit_accept(int listener) {
+        io_uring_sqe* sqe = ring.next();
+        if (!sqe) {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listener;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = ACCEPT;
+        return true;
+    }
+
+    void submit_receive(GatewaySession& session) {
+        io_uring_sqe* sqe = ring.next();
+        if (!sqe) {
+            session.closed = true;
+            return;
+        }
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = session.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(session.in.data() + session.in_used);
+        sqe->len = uint32_t(session.in.size() - session.in_used);
+        sqe->user_data = uint64_t(session.id) << 8 | RECEIVE;
+        ++session.in_flight;
+    }
+
+    void submit_send(GatewaySession& session) {
+        io_uring_sqe* sqe = ring.next();
+        if (!sqe) {
+            session.closed = true;
+            return;
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = session.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(session.out.data() + session.out_begin);
+        sqe->len = uint32_t(session.pending());
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = uint64_t(session.id) << 8 | SEND;
+        session.sending = true;
+        ++session.in_flight;
+    }
+
+    void completed_uring(int listener, const io_uring_cqe& cqe) {
+        uint64_t op = cqe.user_data & 0xff;
+        if (op == ACCEPT) {
+            if (cqe.res >= 0) {
+                configure(cqe.res);
+                GatewaySession* session = open_session(cqe.res);
+                if (session) {
+                    submit_receive(*session);
+                } else {
+                    ::close(cqe.res);
+                }
+            }
+            if (!stopping.load(memory_order_relaxed)) {
+                submit_accept(listener);
+            }
+            return;
+        }
+
+        uint64_t id = cqe.user_data >> 8;
+        GatewaySession* session = sessions[id].get();
+        --session->in_flight;
+        if (op == RECEIVE) {
+            if (cqe.res <= 0 || session->closed) {
+                session->closed = true;
+            } else {
+                session->in_used += cqe.res;
+                if (!process(*session)) {
+                    session->closed = true;
+                } else {
+                    submit_receive(*session);
+                }
+            }
+        } else {
+            session->sending = false;
+            if (cqe.res < 0) {
+                session->closed = true;
+            } else {
+                session->out_begin += cqe.res;
+                if (session->pending() == 0) {
+                    session->out_begin = session->out_end = 0;
+                }
+            }
+        }
+        mark_dirty(*session);
+    }
+
+    // sends what is pending where no send is in flight, and retires closed sessions once the kernel
+    // holds none of their buffers
+    void flush_uring() {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            GatewaySession* session = sessions[dirty[i]].get();
+            if (!session) {
+                continue;
+            }
+            session->dirty = false;
+            if (session->closed) {
+                end_session(*session);
+                if (session->fd >= 0) {
+                    // ends a receive still waiting on the socket
+                    shutdown(session->fd, SHUT_RDWR);
+                }
+                if (session->in_flight == 0) {
+                    ::close(session->fd);
+                    sessions[session->id].reset();
+                }
+            } else if (!session->sending && session->pending() > 0) {
+                submit_send(*session);
+            }
+        }
+        dirty.clear();
+    }
+
+    GatewayConfig config;
+    unique_ptr<GatewayRouter> router;
+    vector<unique_ptr<GatewaySession>> sessions;  // by session id, slot 0 stands for the listener
+    vector<uint32_t> dirty;
+    uint32_t connected = 0;
+    uint64_t total_requests = 0;
+    atomic<bool> stopping{false};
+
+    // the request being applied, for tagging and answering what the book reports back
+    GatewaySession* current = nullptr;
+    uint32_t current_request = 0;
+    uint64_t current_order = 0;
+    bool answered = false;
+
+    int epoll = -1;
+    Uring ring;
+};
+
+inline void GatewaySink::on_report(const ExecutionReport& report) { gateway->on_report(report); }
+
+#endif // GATEWAY_H
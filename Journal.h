@@ -0,0 +1,373 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "OrderUtils.h"
+#include "SpscRing.h"
+#include "SymbolRouter.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// append-only journal of inbound commands:
+//   JournalHeader
+//   fixed size JournalRecords, sequence first_sequence, first_sequence + 1, ...
+// the matching thread only pushes each command into a ring. a writer thread numbers, encodes and writes them,
+// and fdatasyncs at most once per durability window so one sync commits every record written since the last.
+// a crash can leave a torn or zero-filled tail, a reader stops at the first record out of sequence or failing its checksum.
+// roll_session is not a command, a journal covers one session and a new one is opened at each rollover.
+// nor is configuration: symbols, a risk table and its limits, and price bands are set up on the book or router
+// before a replay as they were before the session, only the account each order was entered under is journaled.
+
+constexpr char JOURNAL_MAGIC[8] = {'O', 'B', 'J', 'R', 'N', 'L', '1', '\0'};
+// 2: time in force in the flags byte
+// 3: account, records grow to 40 bytes
+// 4: stops, with their trigger
+constexpr uint32_t JOURNAL_VERSION = 4;
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_bytes;
+    uint64_t first_sequence;
+    uint64_t reserved;
+};
+
+// 40 bytes
+struct JournalRecord {
+    uint64_t sequence;
+    uint64_t order_id;
+    uint32_t symbol;
+    uint32_t price;
+    uint32_t quantity;
+    uint16_t account;
+    uint8_t type;
+    uint8_t flags;  // side in bit 0, time in force in bit 1
+    uint16_t checksum;  // over every other field, sequence included
+    uint16_t reserved;  // zero
+    uint32_t trigger;  // stops only
+};
+
+static_assert(sizeof(JournalHeader) == 32 && sizeof(JournalRecord) == 40, "journal layout");
+
+inline uint16_t journal_checksum(const JournalRecord& record) {
+    uint64_t h = record.sequence * 0x9E3779B97F4A7C15ull;
+    h ^= record.order_id * 0xC2B2AE3D27D4EB4Full;
+    h ^= ((uint64_t(record.symbol) << 32) | record.price) * 0x165667B19E3779F9ull;
+    h ^= uint64_t(record.trigger) * 0x9FB21C651E98DF25ull;
+    h ^= ((uint64_t(record.quantity) << 32) | (uint64_t(record.account) << 16) | (record.type << 8) | record.flags) *
+         0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    h ^= h >> 16;
+    return uint16_t(h);
+}
+
+struct JournalConfig {
+    // fdatasync at most this often, 0 syncs after every write
+    uint32_t sync_interval_us = 1000;
+    // false leaves flushing to the page cache, records survive a process crash but not a machine one
+    bool sync = true;
+    // commands the matching thread can run ahead of the writer before record() waits
+    size_t ring_capacity = 1 << 20;
+    // records per write() call at most
+    uint32_t write_batch = 2048;
+    // an idle writer yields for a while, then sleeps this long between polls of the ring
+    uint32_t idle_sleep_us = 50;
+    // spin on an empty ring instead of sleeping, only for a writer with a core of its own
+    bool busy_poll = false;
+};
+
+// empty polls an idle writer yields through before it starts sleeping
+constexpr uint32_t JOURNAL_IDLE_SPINS = 64;
+
+class Journal {
+public:
+    Journal() = default;
+    ~Journal() { close(); }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // creates or truncates path and starts the writer. returns false if the file cannot be created, or for a
+    // first_sequence of 0, which leaves no sequence below it to report as written or durable before anything is
+    bool open(const char* path, JournalConfig journal_config = JournalConfig(), uint64_t first_sequence = 1) {
+        close();
+        if (first_sequence == 0) {
+            return false;
+        }
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        JournalHeader header{};
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        header.version = JOURNAL_VERSION;
+        header.record_bytes = sizeof(JournalRecord);
+        header.first_sequence = first_sequence;
+        if (!write_all(&header, sizeof(header))) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        config = journal_config;
+        ring.reset(new SpscRing<Command>(config.ring_capacity));
+        base_sequence = first_sequence;
+        next_sequence = first_sequence;
+        recorded = 0;
+        written.store(first_sequence - 1, memory_order_relaxed);
+        durable.store(first_sequence - 1, memory_order_relaxed);
+        failed.store(false, memory_order_relaxed);
+        syncs = 0;
+        running.store(true, memory_order_release);
+        writer = thread([this] { run(); });
+        return true;
+    }
+
+    // matching thread. waits while the writer is a full ring behind
+    inline void record(const Command& command) {
+        ring->push(command);
+        ++recorded;
+    }
+
+    // matching thread. sequence number of the last command recorded
+    uint64_t last_recorded() const { return base_sequence + recorded - 1; }
+
+    // written to the file, and synced to disk when config.sync is set
+    uint64_t written_sequence() const { return written.load(memory_order_acquire); }
+    uint64_t durable_sequence() const { return durable.load(memory_order_acquire); }
+
+    // matching thread. waits until sequence has been synced, e.g. before acknowledging an order externally
+    void wait_durable(uint64_t sequence) const {
+        while (durable.load(memory_order_acquire) < sequence && !failed.load(memory_order_acquire)) {
+            this_thread::yield();
+        }
+    }
+
+    // a write or sync failed, records from that point on are not durable
+    bool failed_write() const { return failed.load(memory_order_acquire); }
+    uint64_t sync_count() const { return syncs; }
+
+    // drains the ring, syncs and closes. returns false if any write or sync failed
+    bool close() {
+        if (fd < 0) {
+            return true;
+        }
+        running.store(false, memory_order_release);
+        writer.join();
+        bool ok = !failed.load(memory_order_acquire);
+        ok = ::close(fd) == 0 && ok;
+        fd = -1;
+        return ok;
+    }
+
+private:
+    void run() {
+        vector<Command> batch(config.write_batch);
+        vector<JournalRecord> encoded(config.write_batch);
+        auto last_sync = chrono::steady_clock::now();
+        bool unsynced = false;
+        uint32_t idle = 0;
+
+        while (true) {
+            size_t n = ring->pop_batch(batch.data(), batch.size());
+            if (n > 0) {
+                idle = 0;
+                for (size_t i = 0; i < n; i++) {
+                    const Command& command = batch[i];
+                    JournalRecord& record = encoded[i];
+                    record.sequence = next_sequence++;
+                    record.order_id = command.order_id;
+                    record.symbol = command.symbol;
+                    record.price = command.price;
+                    record.quantity = command.quantity;
+                    record.account = command.account;
+                    record.trigger = command.trigger;
+                    record.type = uint8_t(command.type);
+                    record.flags = uint8_t(command.side) | uint8_t(command.tif) << 1;
+                    record.checksum = 0;
+                    record.checksum = journal_checksum(record);
+                }
+                // after a failed write the file has a hole, so nothing behind it is written or counted
+                if (!failed.load(memory_order_relaxed) && write_all(encoded.data(), n * sizeof(JournalRecord))) {
+                    written.store(next_sequence - 1, memory_order_release);
+                    unsynced = true;
+                } else {
+                    failed.store(true, memory_order_release);
+                }
+            }
+
+            // group commit: one sync covers everything written since the last one
+            bool stopping = n == 0 && !running.load(memory_order_acquire) && ring->empty();
+            if (unsynced) {
+                auto now = chrono::steady_clock::now();
+                if (stopping || chrono::duration_cast<chrono::microseconds>(now - last_sync).count() >= config.sync_interval_us) {
+                    // only what reached the file, and only if the sync did
+                    uint64_t covered = written.load(memory_order_relaxed);
+                    if (config.sync && fdatasync(fd) != 0) {
+                        failed.store(true, memory_order_release);
+                    } else {
+                        durable.store(covered, memory_order_release);
+                    }
+                    ++syncs;
+                    last_sync = now;
+                    unsynced = false;
+                }
+            }
+            if (stopping) {
+                return;
+            }
+            if (n == 0) {
+                // back off rather than hold a core for a whole quiet session, but never past a pending sync
+                if (config.busy_poll || unsynced || ++idle < JOURNAL_IDLE_SPINS) {
+                    this_thread::yield();
+                } else {
+                    this_thread::sleep_for(chrono::microseconds(config.idle_sleep_us));
+                }
+            }
+        }
+    }
+
+    bool write_all(const void* data, size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = ::write(fd, p, bytes);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    JournalConfig config;
+    unique_ptr<SpscRing<Command>> ring;
+    thread writer;
+    int fd = -1;
+    uint64_t base_sequence = 1;
+    atomic<bool> running{false};
+
+    // matching thread
+    alignas(CACHE_LINE) uint64_t recorded = 0;
+
+    // writer thread, the atomics are read by the matching thread
+    alignas(CACHE_LINE) uint64_t next_sequence = 1;
+    uint64_t syncs = 0;
+    atomic<uint64_t> written{0};
+    atomic<uint64_t> durable{0};
+    atomic<bool> failed{false};
+};
+
+// maps a journal read-only and hands back the commands in sequence
+class JournalReader {
+public:
+    JournalReader() = default;
+    ~JournalReader() { close(); }
+
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+
+    // returns false if the file cannot be mapped or is not a journal of this version
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(JournalHeader)) {
+            ::close(fd);
+            return false;
+        }
+        length = st.st_size;
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            length = 0;
+            return false;
+        }
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, length, MADV_SEQUENTIAL);
+
+        const JournalHeader& header = *reinterpret_cast<const JournalHeader*>(data);
+        if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || header.version != JOURNAL_VERSION ||
+            header.record_bytes != sizeof(JournalRecord)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+            data = nullptr;
+            length = 0;
+        }
+    }
+
+    uint64_t first_sequence() const { return header().first_sequence; }
+
+    // records present in the file, a torn tail included
+    uint64_t stored_records() const { return (length - sizeof(JournalHeader)) / sizeof(JournalRecord); }
+
+    // visits records in sequence as (sequence, Command), stops at the first one out of sequence or failing
+    // its checksum. returns the number of records visited.
+    template <typename Visit>
+    uint64_t for_each(Visit visit) const {
+        const JournalRecord* records = reinterpret_cast<const JournalRecord*>(data + sizeof(JournalHeader));
+        uint64_t stored = stored_records();
+        uint64_t expected = first_sequence();
+
+        for (uint64_t i = 0; i < stored; i++, expected++) {
+            JournalRecord record = records[i];
+            uint16_t checksum = record.checksum;
+            record.checksum = 0;
+            if (record.sequence != expected || journal_checksum(record) != checksum) {
+                return i;
+            }
+            visit(record.sequence, Command{record.order_id, record.symbol, record.price, record.quantity,
+                                           CommandType(record.type), Side(record.flags & 1), TimeInForce(record.flags >> 1 & 1),
+                                           record.account, record.trigger});
+        }
+        return stored;
+    }
+
+    // command symbols are ignored, the journal belongs to this book
+    template <typename Sink, typename Spec>
+    uint64_t replay(BasicOrderbook<Sink, Spec>& book) const {
+        return for_each([&book](uint64_t, const Command& command) {
+            book.apply(command);
+        });
+    }
+
+    // symbol ids must match the router the journal was recorded from
+    template <typename Sink, typename Spec>
+    uint64_t replay(BasicSymbolRouter<Sink, Spec>& router) const {
+        return for_each([&router](uint64_t, const Command& command) {
+            router.apply(command);
+        });
+    }
+
+private:
+    const JournalHeader& header() const { return *reinterpret_cast<const JournalHeader*>(data); }
+
+    const char* data = nullptr;
+    size_t length = 0;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,237 @@
+#ifndef LADDERANALYTICS_H
+#define LADDERANALYTICS_H
+
+#include "OrderUtils.h"
+#include "PriceLadder.h"
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// range queries over a ladder's levels: quantity up to a price, the cost of filling a quantity, and the bid/ask
+// imbalance over the top k levels. they read the ladder's dense quantity mirror a block of 8 levels at a time,
+// so a block is summed or skipped without visiting its levels one by one, and empty levels are plain zeros.
+// the kernels are a template parameter so both versions can be compared in one binary.
+
+// taking liquidity, notional / quantity is the VWAP
+struct FillEstimate {
+    uint64_t quantity = 0;
+    uint64_t notional = 0;
+
+    double vwap() const { return quantity ? double(notional) / quantity : 0.0; }
+};
+
+// portable kernels, also the fallback where AVX2 is not available
+struct ScalarKernels {
+    static inline uint64_t sum(const uint32_t* quantities, uint32_t n) {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            total += quantities[i];
+        }
+        return total;
+    }
+
+    static inline uint64_t block_sum(const uint32_t* quantities) { return sum(quantities, 8); }
+
+    // sum of quantities[i] * (first_price + i) over a block
+    static inline uint64_t block_notional(const uint32_t* quantities, uint32_t first_price) {
+        uint64_t notional = 0;
+        for (uint32_t i = 0; i < 8; i++) {
+            notional += uint64_t(quantities[i]) * (first_price + i);
+        }
+        return notional;
+    }
+
+    // non-empty levels in a block
+    static inline uint32_t block_levels(const uint32_t* quantities) {
+        uint32_t levels = 0;
+        for (uint32_t i = 0; i < 8; i++) {
+            levels += quantities[i] != 0;
+        }
+        return levels;
+    }
+};
+
+#if defined(__AVX2__)
+// 8 quantities per load, widened to 64-bit lanes before adding so level totals cannot overflow a sum
+struct Avx2Kernels {
+    static inline uint64_t sum(const uint32_t* quantities, uint32_t n) {
+        __m256i total = _mm256_setzero_si256();
+        uint32_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities + i));
+            total = _mm256_add_epi64(total, widened_sum(q));
+        }
+        return horizontal_sum(total) + ScalarKernels::sum(quantities + i, n - i);
+    }
+
+    static inline uint64_t block_sum(const uint32_t* quantities) {
+        return horizontal_sum(widened_sum(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities))));
+    }
+
+    static inline uint64_t block_notional(const uint32_t* quantities, uint32_t first_price) {
+        __m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities));
+        __m256i price = _mm256_add_epi64(_mm256_set1_epi64x(first_price), _mm256_setr_epi64x(0, 1, 2, 3));
+        // mul_epu32 multiplies the low 32 bits of each 64-bit lane into a full 64-bit product
+        __m256i low = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(q)), price);
+        __m256i high = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(q, 1)),
+                                        _mm256_add_epi64(price, _mm256_set1_epi64x(4)));
+        return horizontal_sum(_mm256_add_epi64(low, high));
+    }
+
+    static inline uint32_t block_levels(const uint32_t* quantities) {
+        __m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities));
+        uint32_t empty = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(q, _mm256_setzero_si256())));
+        return 8 - __builtin_popcount(empty);
+    }
+
+private:
+    static inline __m256i widened_sum(__m256i q) {
+        return _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(q)),
+                                _mm256_cvtepu32_epi64(_mm256_extracti128_si256(q, 1)));
+    }
+
+    static inline uint64_t horizontal_sum(__m256i v) {
+        __m128i pair = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        return _mm_cvtsi128_si64(_mm_add_epi64(pair, _mm_unpackhi_epi64(pair, pair)));
+    }
+};
+
+using AnalyticsKernels = Avx2Kernels;
+#else
+using AnalyticsKernels = ScalarKernels;
+#endif
+
+// takes up to wanted from a span, best end first (the top for bids). whole blocks are taken while they do not
+// complete the fill, the block that does is walked level by level. returns true once wanted reaches 0
+template <typename Kernels>
+inline bool take_from_span(const QuantitySpan& span, bool from_top, uint64_t& wanted, FillEstimate& fill) {
+    uint32_t n = span.count;
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32_t offset = from_top ? n - i - 8 : i;
+        uint64_t block = Kernels::block_sum(span.quantities + offset);
+        if (block >= wanted) {
+            break;
+        }
+        wanted -= block;
+        fill.quantity += block;
+        fill.notional += Kernels::block_notional(span.quantities + offset, span.first_price + offset);
+    }
+    for (; i < n; i++) {
+        uint32_t offset = from_top ? n - 1 - i : i;
+        uint64_t taken = min<uint64_t>(span.quantities[offset], wanted);
+        wanted -= taken;
+        fill.quantity += taken;
+        fill.notional += taken * (span.first_price + offset);
+        if (wanted == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// adds the quantity of up to levels non-empty levels of a span, best end first. returns true once levels reaches 0
+template <typename Kernels>
+inline bool top_of_span(const QuantitySpan& span, bool from_top, uint32_t& levels, uint64_t& quantity) {
+    uint32_t n = span.count;
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32_t offset = from_top ? n - i - 8 : i;
+        uint32_t block_levels = Kernels::block_levels(span.quantities + offset);
+        if (block_levels >= levels) {
+            break;
+        }
+        levels -= block_levels;
+        quantity += Kernels::block_sum(span.quantities + offset);
+    }
+    for (; i < n; i++) {
+        uint32_t level_quantity = span.quantities[from_top ? n - 1 - i : i];
+        if (level_quantity > 0) {
+            quantity += level_quantity;
+            if (--levels == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// quantity resting on side at price or better
+template <typename Kernels = AnalyticsKernels, uint32_t Window>
+inline uint64_t quantity_to_price(const BasicPriceLadder<Window>& ladder, Side side, uint32_t price) {
+    uint64_t total = 0;
+    uint32_t best = side == Side::BUY ? ladder.best_bid() : ladder.best_ask();
+    if (side == Side::BUY ? best == 0 : best == MAX_PRICE) {
+        return 0;
+    }
+    ladder.for_each_span(side, best, price, [&total](const QuantitySpan& span) {
+        total += Kernels::sum(span.quantities, span.count);
+        return true;
+    });
+    return total;
+}
+
+// what an order of side for quantity would take from the other side if it swept without a limit.
+// the estimate's quantity falls short of quantity when the other side runs out
+template <typename Kernels = AnalyticsKernels, uint32_t Window>
+inline FillEstimate estimate_fill(const BasicPriceLadder<Window>& ladder, Side side, uint64_t quantity) {
+    FillEstimate fill;
+    uint64_t wanted = quantity;
+    if (wanted == 0) {
+        return fill;
+    }
+    if (side == Side::BUY) {
+        uint32_t best = ladder.best_ask();
+        if (best != MAX_PRICE) {
+            ladder.for_each_span(Side::SELL, best, MAX_PRICE - 1, [&](const QuantitySpan& span) {
+                return !take_from_span<Kernels>(span, false, wanted, fill);
+            });
+        }
+    } else {
+        uint32_t best = ladder.best_bid();
+        if (best != 0) {
+            ladder.for_each_span(Side::BUY, best, 0, [&](const QuantitySpan& span) {
+                return !take_from_span<Kernels>(span, true, wanted, fill);
+            });
+        }
+    }
+    return fill;
+}
+
+// quantity of the best levels non-empty levels of side
+template <typename Kernels = AnalyticsKernels, uint32_t Window>
+inline uint64_t top_quantity(const BasicPriceLadder<Window>& ladder, Side side, uint32_t levels) {
+    uint64_t quantity = 0;
+    if (levels == 0) {
+        return 0;
+    }
+    if (side == Side::BUY) {
+        uint32_t best = ladder.best_bid();
+        if (best != 0) {
+            ladder.for_each_span(Side::BUY, best, 0, [&](const QuantitySpan& span) {
+                return !top_of_span<Kernels>(span, true, levels, quantity);
+            });
+        }
+    } else {
+        uint32_t best = ladder.best_ask();
+        if (best != MAX_PRICE) {
+            ladder.for_each_span(Side::SELL, best, MAX_PRICE - 1, [&](const QuantitySpan& span) {
+                return !top_of_span<Kernels>(span, false, levels, quantity);
+            });
+        }
+    }
+    return quantity;
+}
+
+// (bid - ask) / (bid + ask) over the top levels non-empty levels of each side, from -1 to 1, 0 for an empty book
+template <typename Kernels = AnalyticsKernels, uint32_t Window>
+inline double level_imbalance(const BasicPriceLadder<Window>& ladder, uint32_t levels) {
+    uint64_t bid = top_quantity<Kernels>(ladder, Side::BUY, levels);
+    uint64_t ask = top_quantity<Kernels>(ladder, Side::SELL, levels);
+    return bid + ask ? (double(bid) - double(ask)) / double(bid + ask) : 0.0;
+}
+
+#endif // LADDERANALYTICS_H
@@ -0,0 +1,212 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// per-operation latency instrumentation for the benchmark harness.
+// probes are compiled in only when ORDERBOOK_LATENCY is non-zero, otherwise LATENCY_SCOPE expands to nothing.
+#ifndef ORDERBOOK_LATENCY
+#define ORDERBOOK_LATENCY 0
+#endif
+
+// cycle counter, the virtual counter on arm64 and steady_clock elsewhere
+inline uint64_t tsc_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#elif defined(__aarch64__)
+    uint64_t t;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// the same counter without the fences, for timestamps carried in messages where ordering against the
+// surrounding instructions does not matter
+inline uint64_t tsc_stamp() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return tsc_now();
+#endif
+}
+
+// measured once against steady_clock, ~20 ms on first use
+inline double tsc_ticks_per_ns() {
+    static const double ticks_per_ns = [] {
+        auto wall_start = chrono::steady_clock::now();
+        uint64_t tsc_start = tsc_now();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        uint64_t tsc_end = tsc_now();
+        auto wall_end = chrono::steady_clock::now();
+        return (tsc_end - tsc_start) / (double)chrono::duration_cast<chrono::nanoseconds>(wall_end - wall_start).count();
+    }();
+    return ticks_per_ns;
+}
+
+// HDR-style log-linear histogram of tick counts. values below 2^(SUB_BITS+1) are exact, above that every
+// power of two is split into 2^SUB_BITS buckets, so a recorded value is off by at most 1/2^SUB_BITS (~3%).
+// recording is a clz, a shift and an increment.
+class LatencyHistogram {
+public:
+    static constexpr uint32_t SUB_BITS = 5;
+    static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr uint32_t BUCKETS = (64 - SUB_BITS) * SUB_BUCKETS + SUB_BUCKETS;
+
+    inline void record(uint64_t ticks) {
+        ++counts[bucket(ticks)];
+        ++total;
+        if (ticks > largest) {
+            largest = ticks;
+        }
+    }
+
+    // upper bound of the bucket holding the p-th percentile (0-100), never above the largest value recorded
+    uint64_t percentile(double p) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = uint64_t(p / 100.0 * total + 0.5);
+        rank = rank == 0 ? 1 : (rank > total ? total : rank);
+
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                uint64_t upper = bucket_upper(i);
+                return upper < largest ? upper : largest;
+            }
+        }
+        return largest;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        largest = other.largest > largest ? other.largest : largest;
+    }
+
+    void reset() {
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            counts[i] = 0;
+        }
+        total = 0;
+        largest = 0;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return largest; }
+
+private:
+    static inline uint32_t bucket(uint64_t v) {
+        if (v < 2 * SUB_BUCKETS) {
+            return v;
+        }
+        uint32_t shift = (63 - __builtin_clzll(v)) - SUB_BITS;
+        return shift * SUB_BUCKETS + (v >> shift);
+    }
+
+    static inline uint64_t bucket_upper(uint32_t i) {
+        if (i < 2 * SUB_BUCKETS) {
+            return i;
+        }
+        uint32_t shift = i / SUB_BUCKETS - 1;
+        uint64_t mantissa = i % SUB_BUCKETS + SUB_BUCKETS;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    uint64_t counts[BUCKETS] = {0};
+    uint64_t total = 0;
+    uint64_t largest = 0;
+};
+
+// times the enclosing scope into a histogram
+class LatencyScope {
+public:
+    explicit LatencyScope(LatencyHistogram& histogram) : histogram(histogram), start(tsc_now()) {}
+    ~LatencyScope() { histogram.record(tsc_now() - start); }
+
+    LatencyScope(const LatencyScope&) = delete;
+    LatencyScope& operator=(const LatencyScope&) = delete;
+
+private:
+    LatencyHistogram& histogram;
+    uint64_t start;
+};
+
+#define LATENCY_CONCAT_(a, b) a##b
+#define LATENCY_CONCAT(a, b) LATENCY_CONCAT_(a, b)
+#if ORDERBOOK_LATENCY
+#define LATENCY_SCOPE(histogram) LatencyScope LATENCY_CONCAT(latency_scope_, __LINE__)(histogram)
+#else
+#define LATENCY_SCOPE(histogram) ((void)0)
+#endif
+
+// one summarized histogram, in nanoseconds
+struct LatencySummary {
+    string benchmark;
+    string operation;
+    uint64_t count;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+inline LatencySummary summarize(const string& benchmark, const string& operation, const LatencyHistogram& histogram) {
+    double scale = 1.0 / tsc_ticks_per_ns();
+    return LatencySummary{benchmark, operation, histogram.count(),
+                          histogram.percentile(50) * scale, histogram.percentile(90) * scale,
+                          histogram.percentile(99) * scale, histogram.percentile(99.9) * scale,
+                          histogram.max() * scale};
+}
+
+// returns false if the file cannot be written
+inline bool write_latency_csv(const char* path, const vector<LatencySummary>& rows) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "benchmark,operation,count,p50_ns,p90_ns,p99_ns,p99_9_ns,max_ns\n");
+    for (const LatencySummary& row : rows) {
+        fprintf(file, "%s,%s,%llu,%.1f,%.1f,%.1f,%.1f,%.1f\n", row.benchmark.c_str(), row.operation.c_str(),
+                (unsigned long long)row.count, row.p50, row.p90, row.p99, row.p999, row.max);
+    }
+    return fclose(file) == 0;
+}
+
+inline bool write_latency_json(const char* path, const vector<LatencySummary>& rows) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "[\n");
+    for (size_t i = 0; i < rows.size(); i++) {
+        const LatencySummary& row = rows[i];
+        fprintf(file, "  {\"benchmark\": \"%s\", \"operation\": \"%s\", \"count\": %llu, \"p50_ns\": %.1f, "
+                      "\"p90_ns\": %.1f, \"p99_ns\": %.1f, \"p99_9_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+                row.benchmark.c_str(), row.operation.c_str(), (unsigned long long)row.count,
+                row.p50, row.p90, row.p99, row.p999, row.max, i + 1 < rows.size() ? "," : "");
+    }
+    fprintf(file, "]\n");
+    return fclose(file) == 0;
+}
+
+#endif // LATENCY_H
@@ -0,0 +1,221 @@
+#ifndef LEVELBITMAP_H
+#define LEVELBITMAP_H
+
+#include <cstdint>
+
+using namespace std;
+
+// three-level bitmap over N price levels. each summary bit marks a non-empty word below it,
+// so highest/lowest and next-level queries take at most three clz/ctz steps whatever the gap.
+template <uint32_t N>
+class LevelBitmap {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    static constexpr uint32_t WORDS = (N + 63) / 64;
+    static constexpr uint32_t SUMMARY_WORDS = (WORDS + 63) / 64;
+    static_assert(SUMMARY_WORDS <= 64, "LevelBitmap covers at most 64^3 levels");
+
+    inline void set(uint32_t i) {
+        uint32_t w = i / 64;
+        words[w] |= 1ULL << (i % 64);
+        summary[w / 64] |= 1ULL << (w % 64);
+        top |= 1ULL << (w / 64);
+    }
+
+    inline void clear(uint32_t i) {
+        uint32_t w = i / 64;
+        words[w] &= ~(1ULL << (i % 64));
+        if (words[w] == 0) {
+            summary[w / 64] &= ~(1ULL << (w % 64));
+            if (summary[w / 64] == 0) {
+                top &= ~(1ULL << (w / 64));
+            }
+        }
+    }
+
+    inline bool test(uint32_t i) const {
+        return (words[i / 64] >> (i % 64)) & 1;
+    }
+
+    inline bool empty() const { return top == 0; }
+
+    inline uint32_t highest() const {
+        if (top == 0) {
+            return NONE;
+        }
+        return highest_in(63 - __builtin_clzll(top));
+    }
+
+    inline uint32_t lowest() const {
+        if (top == 0) {
+            return NONE;
+        }
+        return lowest_in(__builtin_ctzll(top));
+    }
+
+    // highest set level strictly below i
+    inline uint32_t next_below(uint32_t i) const {
+        if (i == 0) {
+            return NONE;
+        }
+        --i;
+
+        uint32_t w = i / 64;
+        uint64_t bits = words[w] & at_or_below(i % 64);
+        if (bits) {
+            return w * 64 + (63 - __builtin_clzll(bits));
+        }
+
+        uint32_t s = w / 64;
+        uint64_t summary_bits = summary[s] & below(w % 64);
+        if (summary_bits) {
+            uint32_t word = s * 64 + (63 - __builtin_clzll(summary_bits));
+            return word * 64 + (63 - __builtin_clzll(words[word]));
+        }
+
+        uint64_t top_bits = top & below(s);
+        if (top_bits) {
+            return highest_in(63 - __builtin_clzll(top_bits));
+        }
+        return NONE;
+    }
+
+    // lowest set level strictly above i
+    inline uint32_t next_above(uint32_t i) const {
+        if (i + 1 >= N) {
+            return NONE;
+        }
+        ++i;
+
+        uint32_t w = i / 64;
+        uint64_t bits = words[w] & at_or_above(i % 64);
+        if (bits) {
+            return w * 64 + __builtin_ctzll(bits);
+        }
+
+        uint32_t s = w / 64;
+        uint64_t summary_bits = summary[s] & above(w % 64);
+        if (summary_bits) {
+            uint32_t word = s * 64 + __builtin_ctzll(summary_bits);
+            return word * 64 + __builtin_ctzll(words[word]);
+        }
+
+        uint64_t top_bits = top & above(s);
+        if (top_bits) {
+            return lowest_in(__builtin_ctzll(top_bits));
+        }
+        return NONE;
+    }
+
+    // visits set levels from hi down to lo while visit returns true, bits are consumed a word at a time.
+    // returns false if visit stopped the walk
+    template <typename Visit>
+    inline bool walk_down(uint32_t hi, uint32_t lo, Visit& visit) const {
+        uint32_t w = hi / 64;
+        uint64_t bits = words[w] & at_or_below(hi % 64);
+        for (;;) {
+            while (bits) {
+                uint32_t b = 63 - __builtin_clzll(bits);
+                if (w * 64 + b < lo) {
+                    return true;
+                }
+                if (!visit(w * 64 + b)) {
+                    return false;
+                }
+                bits &= ~(1ULL << b);
+            }
+            w = word_below(w);
+            if (w == NONE || w < lo / 64) {
+                return true;
+            }
+            bits = words[w];
+        }
+    }
+
+    // visits set levels from lo up to hi while visit returns true
+    template <typename Visit>
+    inline bool walk_up(uint32_t lo, uint32_t hi, Visit& visit) const {
+        uint32_t w = lo / 64;
+        uint64_t bits = words[w] & at_or_above(lo % 64);
+        for (;;) {
+            while (bits) {
+                uint32_t b = __builtin_ctzll(bits);
+                if (w * 64 + b > hi) {
+                    return true;
+                }
+                if (!visit(w * 64 + b)) {
+                    return false;
+                }
+                bits &= bits - 1;
+            }
+            w = word_above(w);
+            if (w == NONE || w > hi / 64) {
+                return true;
+            }
+            bits = words[w];
+        }
+    }
+
+    void reset() {
+        for (uint32_t i = 0; i < WORDS; i++) {
+            words[i] = 0;
+        }
+        for (uint32_t i = 0; i < SUMMARY_WORDS; i++) {
+            summary[i] = 0;
+        }
+        top = 0;
+    }
+
+private:
+    static inline uint64_t below(uint32_t b) { return (1ULL << b) - 1; }
+    static inline uint64_t at_or_below(uint32_t b) { return (2ULL << b) - 1; }
+    static inline uint64_t above(uint32_t b) { return ~at_or_below(b); }
+    static inline uint64_t at_or_above(uint32_t b) { return ~below(b); }
+
+    // nearest non-empty word strictly below / above word w
+    inline uint32_t word_below(uint32_t w) const {
+        uint32_t s = w / 64;
+        uint64_t summary_bits = summary[s] & below(w % 64);
+        if (summary_bits) {
+            return s * 64 + (63 - __builtin_clzll(summary_bits));
+        }
+        uint64_t top_bits = top & below(s);
+        if (top_bits) {
+            uint32_t t = 63 - __builtin_clzll(top_bits);
+            return t * 64 + (63 - __builtin_clzll(summary[t]));
+        }
+        return NONE;
+    }
+
+    inline uint32_t word_above(uint32_t w) const {
+        uint32_t s = w / 64;
+        uint64_t summary_bits = summary[s] & above(w % 64);
+        if (summary_bits) {
+            return s * 64 + __builtin_ctzll(summary_bits);
+        }
+        uint64_t top_bits = top & above(s);
+        if (top_bits) {
+            uint32_t t = __builtin_ctzll(top_bits);
+            return t * 64 + __builtin_ctzll(summary[t]);
+        }
+        return NONE;
+    }
+
+    // highest / lowest level under a non-empty summary word
+    inline uint32_t highest_in(uint32_t s) const {
+        uint32_t word = s * 64 + (63 - __builtin_clzll(summary[s]));
+        return word * 64 + (63 - __builtin_clzll(words[word]));
+    }
+
+    inline uint32_t lowest_in(uint32_t s) const {
+        uint32_t word = s * 64 + __builtin_ctzll(summary[s]);
+        return word * 64 + __builtin_ctzll(words[word]);
+    }
+
+    uint64_t words[WORDS] = {0};
+    uint64_t summary[SUMMARY_WORDS] = {0};
+    uint64_t top = 0;
+};
+
+#endif // LEVELBITMAP_H
@@ -0,0 +1,345 @@
+#ifndef MARKETDATABUS_H
+#define MARKETDATABUS_H
+
+#include "SymbolRouter.h"
+#include "Latency.h"
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// one-writer, many-reader broadcast of trades, top of book and level changes through a shared memory file,
+// e.g. under /dev/shm. the writer never waits: it overwrites the oldest slot whatever the readers are doing.
+// a reader keeps its cursor in its own memory, maps the file read-only, and reads by polling the stamp of
+// the slot its cursor points at, so it makes no system calls and nothing it does reaches the writer's lines.
+// every slot is one cache line, a stamp and the message, written like a Seqlock: the stamp is cleared,
+// the message stored, and the stamp set to the message number + 1. a reader takes the message only if the
+// stamp was its cursor + 1 both before and after reading it. a stamp already past that means the writer
+// lapped the reader, which counts the gap, resumes at the live edge and rebuilds its state from later
+// messages (quotes are always complete, level changes carry the level's full quantity).
+
+constexpr char BUS_MAGIC[8] = {'O', 'B', 'M', 'D', 'B', 'U', 'S', '1'};
+constexpr uint32_t BUS_VERSION = 1;
+
+enum class MarketDataType : uint8_t {
+    TRADE,  // price and quantity traded, side is the aggressor's
+    QUOTE,  // new best bid and ask, after every command that changed either
+    LEVEL   // a level's new total on side, 0 once it emptied
+};
+
+// 56 bytes, with the stamp one slot per cache line
+struct MarketDataMessage {
+    uint64_t sequence;     // the book's report sequence, for quotes that of the last report of the command
+    uint64_t publish_tsc;  // writer's cycle counter when its command first published, 0 if not stamped
+    uint32_t symbol;
+    MarketDataType type;
+    Side side;
+    uint16_t reserved;
+    uint32_t price;
+    uint32_t quantity;
+    uint32_t bid_price;
+    uint32_t bid_quantity;
+    uint32_t ask_price;
+    uint32_t ask_quantity;
+    uint32_t padding;
+};
+
+static_assert(sizeof(MarketDataMessage) == 56, "MarketDataMessage fills a slot with its stamp");
+
+struct BusHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_bytes;
+    uint64_t capacity;
+    alignas(CACHE_LINE) atomic<uint64_t> published;  // messages written so far, read by readers only to start or resync
+    atomic<uint64_t> closed;                         // set once the writer is done
+};
+
+struct alignas(CACHE_LINE) BusSlot {
+    static constexpr size_t WORDS = sizeof(MarketDataMessage) / sizeof(uint64_t);
+
+    atomic<uint64_t> stamp;  // message number + 1 once written, 0 while being written
+    atomic<uint64_t> words[WORDS];
+};
+
+static_assert(sizeof(BusSlot) == CACHE_LINE, "one slot per cache line");
+
+inline size_t bus_bytes(uint64_t capacity) { return sizeof(BusHeader) + capacity * sizeof(BusSlot); }
+
+class BusWriter {
+public:
+    BusWriter() = default;
+    ~BusWriter() { close(); }
+
+    BusWriter(const BusWriter&) = delete;
+    BusWriter& operator=(const BusWriter&) = delete;
+
+    // creates or replaces the bus file with min_capacity slots rounded up to a power of two, faulted in
+    // up front. false if it cannot be created
+    bool create(const char* path, uint64_t min_capacity) {
+        close();
+        uint64_t slots = 2;
+        while (slots < min_capacity) {
+            slots <<= 1;
+        }
+        // a new file rather than a truncated one, readers still mapping an old bus keep it
+        unlink(path);
+        int fd = ::open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bytes = bus_bytes(slots);
+        void* mapping = ftruncate(fd, bytes) == 0
+                            ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0)
+                            : MAP_FAILED;
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            unlink(path);
+            return false;
+        }
+        header = static_cast<BusHeader*>(mapping);
+        ring = reinterpret_cast<BusSlot*>(static_cast<char*>(mapping) + sizeof(BusHeader));
+        mask = slots - 1;
+        next = 0;
+
+        // the file is zeroed, so every stamp reads as not yet written. the magic goes last
+        header->version = BUS_VERSION;
+        header->slot_bytes = sizeof(BusSlot);
+        header->capacity = slots;
+        atomic_thread_fence(memory_order_release);
+        memcpy(header->magic, BUS_MAGIC, sizeof(BUS_MAGIC));
+        return true;
+    }
+
+    // marks the bus finished for its readers and unmaps it, the file stays
+    void close() {
+        if (header) {
+            header->closed.store(1, memory_order_release);
+            munmap(header, bytes);
+            header = nullptr;
+        }
+    }
+
+    inline void publish(const MarketDataMessage& message) {
+        uint64_t source[BusSlot::WORDS];
+        memcpy(source, &message, sizeof(message));
+
+        BusSlot& slot = ring[next & mask];
+        slot.stamp.store(0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (size_t i = 0; i < BusSlot::WORDS; i++) {
+            slot.words[i].store(source[i], memory_order_relaxed);
+        }
+        slot.stamp.store(next + 1, memory_order_release);
+        header->published.store(++next, memory_order_relaxed);
+    }
+
+    uint64_t published() const { return next; }
+    uint64_t capacity() const { return mask + 1; }
+
+private:
+    BusHeader* header = nullptr;
+    BusSlot* ring = nullptr;
+    size_t bytes = 0;
+    uint64_t mask = 0;
+    uint64_t next = 0;
+};
+
+enum class BusRead {
+    NONE,     // nothing new yet
+    MESSAGE,  // message filled in
+    GAP       // the writer lapped this reader, which now resumes at the live edge
+};
+
+class BusReader {
+public:
+    BusReader() = default;
+    ~BusReader() { close(); }
+
+    BusReader(const BusReader&) = delete;
+    BusReader& operator=(const BusReader&) = delete;
+
+    // maps a bus read-only and starts at its live edge. false if the file is missing or not a bus
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        void* mapping = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(BusHeader)
+                            ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0)
+                            : MAP_FAILED;
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        header = static_cast<const BusHeader*>(mapping);
+        bytes = st.st_size;
+        if (memcmp(header->magic, BUS_MAGIC, sizeof(BUS_MAGIC)) != 0 || header->version != BUS_VERSION ||
+            header->slot_bytes != sizeof(BusSlot) || bus_bytes(header->capacity) > bytes) {
+            close();
+            return false;
+        }
+        ring = reinterpret_cast<const BusSlot*>(reinterpret_cast<const char*>(mapping) + sizeof(BusHeader));
+        mask = header->capacity - 1;
+        cursor = header->published.load(memory_order_acquire);
+        return true;
+    }
+
+    void close() {
+        if (header) {
+            munmap(const_cast<BusHeader*>(header), bytes);
+            header = nullptr;
+        }
+    }
+
+    inline BusRead read(MarketDataMessage& message) {
+        const BusSlot& slot = ring[cursor & mask];
+        uint64_t stamp = slot.stamp.load(memory_order_acquire);
+        if (stamp == cursor + 1) {
+            uint64_t copy[BusSlot::WORDS];
+            for (size_t i = 0; i < BusSlot::WORDS; i++) {
+                copy[i] = slot.words[i].load(memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (slot.stamp.load(memory_order_relaxed) == stamp) {
+                memcpy(&message, copy, sizeof(message));
+                ++cursor;
+                return BusRead::MESSAGE;
+            }
+        } else if (stamp <= cursor) {
+            // a slot of the previous lap, or one being written
+            return BusRead::NONE;
+        }
+        return resync();
+    }
+
+    // the writer has closed the bus, anything not yet read is still there unless it is lapped
+    bool writer_closed() const { return header->closed.load(memory_order_acquire) != 0; }
+
+    uint64_t position() const { return cursor; }
+    uint64_t gaps() const { return gap_count; }
+    uint64_t lost() const { return lost_count; }
+
+private:
+    [[gnu::noinline]] BusRead resync() {
+        uint64_t live = header->published.load(memory_order_acquire);
+        ++gap_count;
+        lost_count += live - cursor;
+        cursor = live;
+        return BusRead::GAP;
+    }
+
+    const BusHeader* header = nullptr;
+    const BusSlot* ring = nullptr;
+    size_t bytes = 0;
+    uint64_t mask = 0;
+    uint64_t cursor = 0;
+    uint64_t gap_count = 0;
+    uint64_t lost_count = 0;
+};
+
+template <typename Spec>
+class MarketDataPublisher;
+
+// hands the books' reports to their publisher
+template <typename Spec>
+struct BusSink {
+    MarketDataPublisher<Spec>* publisher;
+    inline void on_report(const ExecutionReport& report);
+};
+
+// a router whose books publish trades and level changes to a bus as they report them, and which publishes a
+// quote after each command that moved its book's best bid or ask. quotes are compared after the command
+// rather than from inside it, since a book reports a level before it has moved its best price.
+// messages are stamped with the cycle counter once per command, at its first message, since a counter read
+// costs as much as writing a slot. without timestamps publish_tsc is 0
+template <typename Spec = DefaultBookSpec>
+class MarketDataPublisher {
+public:
+    using Router = BasicSymbolRouter<BusSink<Spec>, Spec>;
+
+    explicit MarketDataPublisher(BusWriter& writer, bool timestamps = true, uint32_t max_orders = MAX_ORDERS)
+        : writer(&writer), timestamps(timestamps), router(new Router(max_orders, BusSink<Spec>{this})) {}
+
+    MarketDataPublisher(const MarketDataPublisher&) = delete;
+    MarketDataPublisher& operator=(const MarketDataPublisher&) = delete;
+
+    uint32_t add_symbol(const string& symbol) {
+        uint32_t id = router->add_symbol(symbol);
+        if (id >= quotes.size()) {
+            quotes.resize(id + 1, Quote(0, 0, 0, 0));
+        }
+        return id;
+    }
+
+    inline void apply(const Command& command) {
+        command_stamp = 0;
+        router->apply(command);
+        Quote quote = router->get_quote(command.symbol);
+        Quote& published = quotes[command.symbol];
+        if (quote.bid_price != published.bid_price || quote.bid_quantity != published.bid_quantity ||
+            quote.ask_price != published.ask_price || quote.ask_quantity != published.ask_quantity) {
+            publish_quote(command.symbol, quote);
+        }
+    }
+
+    inline void on_report(const ExecutionReport& report) {
+        last_sequence = report.sequence;
+        if (report.type != ReportType::FILL && report.type != ReportType::LEVEL) {
+            return;
+        }
+        MarketDataMessage message{};
+        message.sequence = report.sequence;
+        message.publish_tsc = stamp();
+        message.symbol = report.book;
+        message.type = report.type == ReportType::FILL ? MarketDataType::TRADE : MarketDataType::LEVEL;
+        message.side = report.side;
+        message.price = report.price;
+        message.quantity = report.quantity;
+        writer->publish(message);
+    }
+
+    Router& engine() { return *router; }
+
+private:
+    inline uint64_t stamp() {
+        if (timestamps && command_stamp == 0) {
+            command_stamp = tsc_stamp();
+        }
+        return command_stamp;
+    }
+
+    [[gnu::noinline]] void publish_quote(uint32_t symbol, const Quote& quote) {
+        quotes[symbol] = quote;
+        MarketDataMessage message{};
+        message.sequence = last_sequence;
+        message.publish_tsc = stamp();
+        message.symbol = symbol;
+        message.type = MarketDataType::QUOTE;
+        message.bid_price = quote.bid_price;
+        message.bid_quantity = quote.bid_quantity;
+        message.ask_price = quote.ask_price;
+        message.ask_quantity = quote.ask_quantity;
+        writer->publish(message);
+    }
+
+    BusWriter* writer;
+    bool timestamps;
+    uint64_t last_sequence = 0;  // of the book's last report
+    uint64_t command_stamp = 0;
+    unique_ptr<Router> router;
+    vector<Quote> quotes;  // last published per symbol
+};
+
+template <typename Spec>
+inline void BusSink<Spec>::on_report(const ExecutionReport& report) { publisher->on_report(report); }
+
+#endif // MARKETDATABUS_H
@@ -0,0 +1,244 @@
+#ifndef MEMORYARENA_H
+#define MEMORYARENA_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace std;
+
+// every large structure of a store lives in one anonymous mapping sized at construction. by default the
+// mapping is only reserved and pages fault in as orders first touch them, mid-session. provisioned memory
+// moves all of that to startup: huge pages where the system has them, every page faulted in, and locked so
+// it is never reclaimed, swapped or migrated while the book trades
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+struct MemoryOptions {
+    bool huge_pages = false;        // 1 GB then 2 MB pages from the hugetlb pool, transparent huge pages failing both
+    bool prefault = false;          // every page faulted in at construction
+    bool lock = false;              // mlock'd, a lock that fails (RLIMIT_MEMLOCK) leaves the arena unlocked
+    uint32_t reserved_levels = 0;   // per ladder side, overflow levels a book reserves so far prices do not allocate
+};
+
+// huge pages, prefaulted and locked, with room for 4096 overflow levels a side
+inline MemoryOptions provisioned_memory() {
+    return MemoryOptions{true, true, true, 4096};
+}
+
+enum class PageBacking : uint8_t {
+    SMALL,        // 4 KB pages
+    TRANSPARENT,  // 4 KB pages the kernel may fold into 2 MB ones, see huge_bytes()
+    HUGE_2MB,
+    HUGE_1GB
+};
+
+inline const char* backing_name(PageBacking backing) {
+    switch (backing) {
+        case PageBacking::SMALL: return "4 KB";
+        case PageBacking::TRANSPARENT: return "transparent 2 MB";
+        case PageBacking::HUGE_2MB: return "2 MB";
+        case PageBacking::HUGE_1GB: return "1 GB";
+    }
+    return "?";
+}
+
+constexpr size_t SMALL_PAGE = 4096;
+constexpr size_t HUGE_PAGE_2MB = 2 << 20;
+constexpr size_t HUGE_PAGE_1GB = 1 << 30;
+
+// an anonymous mapping, zeroed like calloc'd memory. aborts if not even small pages can be mapped, as a failed
+// new does in this -fno-exceptions build, rather than leave a store to fault on a null base mid-session
+class MemoryArena {
+public:
+    MemoryArena() = default;
+
+    MemoryArena(size_t requested, const MemoryOptions& options) : bytes(requested) {
+        if (requested == 0) {
+            return;
+        }
+        if (options.huge_pages) {
+            map_huge(requested);
+        }
+        if (!base) {
+            map_small(requested, options.huge_pages);
+        }
+        if (!base) {
+            fprintf(stderr, "MemoryArena: cannot map %zu bytes\n", requested);
+            abort();
+        }
+        if (options.prefault) {
+            prefault();
+        }
+        if (options.lock) {
+            locked = mlock(base, mapped) == 0;
+        }
+    }
+
+    ~MemoryArena() { unmap(); }
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    MemoryArena& operator=(MemoryArena&& other) {
+        if (this != &other) {
+            unmap();
+            base = other.base;
+            bytes = other.bytes;
+            mapped = other.mapped;
+            page_backing = other.page_backing;
+            locked = other.locked;
+            other.base = nullptr;
+        }
+        return *this;
+    }
+
+    void* data() const { return base; }
+    size_t size() const { return bytes; }
+    size_t mapped_bytes() const { return mapped; }
+    PageBacking backing() const { return page_backing; }
+    bool is_locked() const { return locked; }
+
+    size_t page_bytes() const {
+        switch (page_backing) {
+            case PageBacking::HUGE_2MB: return HUGE_PAGE_2MB;
+            case PageBacking::HUGE_1GB: return HUGE_PAGE_1GB;
+            default: return SMALL_PAGE;
+        }
+    }
+
+    // dTLB entries it takes to map the whole arena, transparent huge pages counted as the kernel has folded them
+    size_t tlb_entries() const {
+        if (page_backing == PageBacking::TRANSPARENT) {
+            size_t huge = huge_bytes();
+            return huge / HUGE_PAGE_2MB + (mapped - huge) / SMALL_PAGE;
+        }
+        return mapped / page_bytes();
+    }
+
+    // bytes of the arena backed by huge pages right now: all of it for hugetlb, for transparent huge pages
+    // what /proc/self/smaps reports for the mapping (0 if it cannot be read)
+    size_t huge_bytes() const {
+        if (page_backing == PageBacking::HUGE_2MB || page_backing == PageBacking::HUGE_1GB) {
+            return mapped;
+        }
+        if (!base) {
+            return 0;
+        }
+        FILE* smaps = fopen("/proc/self/smaps", "r");
+        if (!smaps) {
+            return 0;
+        }
+        // the arena may have been split into several VMAs by mlock or madvise, sum those inside it
+        uintptr_t lo = reinterpret_cast<uintptr_t>(base);
+        uintptr_t hi = lo + mapped;
+        bool inside = false;
+        size_t huge = 0;
+        char line[256];
+        while (fgets(line, sizeof(line), smaps)) {
+            unsigned long start, end;
+            size_t kb;
+            if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+                inside = start >= lo && end <= hi;
+            } else if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+                huge += kb * 1024;
+            }
+        }
+        fclose(smaps);
+        return huge;
+    }
+
+    // takes over a mapping made elsewhere, e.g. a snapshot file mapped back in, unmapped on destruction
+    void adopt(void* mapping, size_t mapping_bytes) {
+        unmap();
+        base = mapping;
+        bytes = mapping_bytes;
+        mapped = mapping_bytes;
+        page_backing = PageBacking::SMALL;
+        locked = false;
+    }
+
+private:
+    static size_t round_up(size_t n, size_t page) { return (n + page - 1) & ~(page - 1); }
+
+    // 1 GB pages only for arenas of a gigabyte or more, rounding a smaller one up would waste most of a page.
+    // either fails unless the hugetlb pool has pages of that size free
+    void map_huge(size_t requested) {
+        if (requested >= HUGE_PAGE_1GB) {
+            try_map(round_up(requested, HUGE_PAGE_1GB), MAP_HUGETLB | MAP_HUGE_1GB, PageBacking::HUGE_1GB);
+        }
+        if (!base) {
+            try_map(round_up(requested, HUGE_PAGE_2MB), MAP_HUGETLB, PageBacking::HUGE_2MB);
+        }
+    }
+
+    // with transparent huge pages asked for, the mapping is rounded to whole 2 MB pages and aligned to one,
+    // the kernel only folds aligned 2 MB runs
+    void map_small(size_t requested, bool transparent) {
+        if (!transparent) {
+            try_map(round_up(requested, SMALL_PAGE), 0, PageBacking::SMALL);
+            return;
+        }
+        size_t length = round_up(requested, HUGE_PAGE_2MB);
+        void* p = mmap(nullptr, length + HUGE_PAGE_2MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return;
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(p);
+        uintptr_t aligned = round_up(start, HUGE_PAGE_2MB);
+        if (aligned > start) {
+            munmap(p, aligned - start);
+        }
+        munmap(reinterpret_cast<void*>(aligned + length), start + HUGE_PAGE_2MB - aligned);
+        base = reinterpret_cast<void*>(aligned);
+        mapped = length;
+        page_backing = PageBacking::TRANSPARENT;
+        madvise(base, mapped, MADV_HUGEPAGE);
+    }
+
+    void try_map(size_t length, int flags, PageBacking page_size) {
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        if (p != MAP_FAILED) {
+            base = p;
+            mapped = length;
+            page_backing = page_size;
+        }
+    }
+
+    // a write fault per page, so the pages are private and writable and the first order's store does not
+    // fault again. MADV_POPULATE_WRITE (5.14) does it in one call, older kernels get a store per page
+    void prefault() {
+        if (madvise(base, mapped, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+        volatile char* p = static_cast<volatile char*>(base);
+        for (size_t offset = 0; offset < mapped; offset += SMALL_PAGE) {
+            p[offset] = 0;
+        }
+    }
+
+    void unmap() {
+        if (base) {
+            munmap(base, mapped);
+        }
+        base = nullptr;
+    }
+
+    void* base = nullptr;
+    size_t bytes = 0;
+    size_t mapped = 0;
+    PageBacking page_backing = PageBacking::SMALL;
+    bool locked = false;
+};
+
+#endif // MEMORYARENA_H
@@ -0,0 +1,153 @@
+#ifndef ORDERINDEX_H
+#define ORDERINDEX_H
+
+#include "OrderUtils.h"
+#include "Snapshot.h"
+#include "MemoryArena.h"
+
+using namespace std;
+
+// open-addressing order_id -> pool index table with linear probing.
+// sized once at startup to at least 2x the order capacity, so probes stay short and
+// a lookup normally resolves inside a single 64 byte line (4 slots per line).
+// erase uses backward-shift deletion, so there are no tombstones to degrade probes over a session.
+class OrderIndex {
+public:
+    explicit OrderIndex(uint32_t max_orders, const MemoryOptions& memory = MemoryOptions()) {
+        uint64_t want = 2ULL * max_orders;
+        capacity = 16;
+        shift = 60;
+        while (capacity < want) {
+            capacity <<= 1;
+            --shift;
+        }
+        mask = capacity - 1;
+
+        // an all-zero slot is empty, and the arena's pages are zeroed, faulted in on first touch unless provisioned
+        arena = MemoryArena(capacity * sizeof(Slot), memory);
+        slots = static_cast<Slot*>(arena.data());
+    }
+
+    OrderIndex(const OrderIndex&) = delete;
+    OrderIndex& operator=(const OrderIndex&) = delete;
+
+    // returns NULL_INDEX when the order is not resting
+    inline uint32_t find(uint64_t order_id) const {
+        for (uint64_t i = home(order_id);; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.handle == 0) {
+                return NULL_INDEX;
+            }
+            if (slot.order_id == order_id) {
+                return slot.handle - 1;
+            }
+        }
+    }
+
+    // returns false if the order_id is already present
+    inline bool insert(uint64_t order_id, uint32_t index) {
+        uint64_t i = home(order_id);
+        for (; slots[i].handle != 0; i = (i + 1) & mask) {
+            if (slots[i].order_id == order_id) {
+                return false;
+            }
+        }
+        guard_write(i);
+        slots[i].order_id = order_id;
+        slots[i].handle = index + 1;
+        ++count;
+        return true;
+    }
+
+    inline void erase(uint64_t order_id) {
+        uint64_t i = home(order_id);
+        for (;; i = (i + 1) & mask) {
+            if (slots[i].handle == 0) {
+                return;
+            }
+            if (slots[i].order_id == order_id) {
+                break;
+            }
+        }
+
+        // pull later entries of the probe run back into the hole
+        for (uint64_t j = (i + 1) & mask; slots[j].handle != 0; j = (j + 1) & mask) {
+            uint64_t h = home(slots[j].order_id);
+            if (((j - h) & mask) >= ((j - i) & mask)) {
+                guard_write(i);
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        guard_write(i);
+        slots[i].handle = 0;
+        --count;
+    }
+
+    // pulls in the line a lookup of order_id starts probing at. forced inline like every prefetch helper:
+    // gcc treats a function that only prefetches as free of side effects and drops calls to it
+    [[gnu::always_inline]] inline void prefetch(uint64_t order_id) const {
+        __builtin_prefetch(&slots[home(order_id)], 1);
+    }
+
+    uint32_t size() const { return count; }
+    uint64_t slot_count() const { return capacity; }
+    const MemoryArena& memory() const { return arena; }
+
+    // snapshot support: the table is position independent, so it is written and mapped back as raw bytes
+    const void* data() const { return slots; }
+    size_t data_bytes() const { return capacity * sizeof(Slot); }
+
+    // set while a background snapshot streams the table out, nullptr otherwise
+    void set_guard(SnapshotRegion* region) { guard = region; }
+
+    // a table of slot_count() slots mapped from a snapshot, before it is adopted: true if exactly count slots
+    // are in use and each names a pool index below high_water
+    bool valid_table(const void* mapped, uint32_t high_water, uint32_t expected_count) const {
+        const Slot* table = static_cast<const Slot*>(mapped);
+        uint64_t used = 0;
+        for (uint64_t i = 0; i < capacity; i++) {
+            if (table[i].handle != 0) {
+                if (table[i].handle - 1 >= high_water) {
+                    return false;
+                }
+                ++used;
+            }
+        }
+        return used == expected_count;
+    }
+
+    // takes over a table of slot_count() slots mapped from a snapshot, unmapped on destruction
+    void adopt(void* mapped, size_t mapped_bytes, uint32_t restored_count) {
+        arena.adopt(mapped, mapped_bytes);
+        slots = static_cast<Slot*>(mapped);
+        count = restored_count;
+    }
+
+private:
+    struct Slot {
+        uint64_t order_id;
+        uint32_t handle;  // pool index + 1, 0 marks an empty slot
+    };
+
+    inline void guard_write(uint64_t i) {
+        if (guard) {
+            guard->before_write(&slots[i]);
+        }
+    }
+
+    // fibonacci hashing spreads sequential ids across the table
+    inline uint64_t home(uint64_t order_id) const {
+        return (order_id * 0x9E3779B97F4A7C15ULL) >> shift;
+    }
+
+    MemoryArena arena;
+    Slot* slots;
+    SnapshotRegion* guard = nullptr;
+    uint64_t capacity;
+    uint64_t mask;
+    uint32_t shift;
+    uint32_t count = 0;
+};
+
+#endif // ORDERINDEX_H
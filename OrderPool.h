@@ -0,0 +1,111 @@
+#ifndef ORDERPOOL_H
+#define ORDERPOOL_H
+
+#include "OrderUtils.h"
+#include "Snapshot.h"
+#include "MemoryArena.h"
+
+using namespace std;
+
+// fixed-capacity slab of order nodes, mapped once up front.
+// slots are handed out from a free list first, then by bumping a high-water mark,
+// so pages are only touched once an order actually lands on them, unless the memory is provisioned.
+class OrderPool {
+public:
+    explicit OrderPool(uint32_t capacity, const MemoryOptions& memory = MemoryOptions())
+        : arena(sizeof(Order) * capacity, memory), nodes(static_cast<Order*>(arena.data())), capacity(capacity) {}
+
+    OrderPool(const OrderPool&) = delete;
+    OrderPool& operator=(const OrderPool&) = delete;
+
+    // returns NULL_INDEX when the pool is exhausted
+    inline uint32_t allocate() {
+        if (free_head != NULL_INDEX) {
+            uint32_t index = free_head;
+            free_head = nodes[index].next;
+            ++live;
+            return index;
+        }
+        if (high_water < capacity) {
+            ++live;
+            return high_water++;
+        }
+        return NULL_INDEX;
+    }
+
+    inline void release(uint32_t index) {
+        guard_write(index);
+        nodes[index].next = free_head;
+        free_head = index;
+        --live;
+    }
+
+    // handing out a mutable node counts as a write for a running background snapshot
+    inline Order& operator[](uint32_t index) {
+        guard_write(index);
+        return nodes[index];
+    }
+    inline const Order& operator[](uint32_t index) const { return nodes[index]; }
+
+    [[gnu::always_inline]] inline void prefetch(uint32_t index) const { __builtin_prefetch(&nodes[index], 1); }
+
+    // the node the next allocate() hands out
+    [[gnu::always_inline]] inline void prefetch_next() const {
+        if (free_head != NULL_INDEX) {
+            __builtin_prefetch(&nodes[free_head], 1);
+        } else if (high_water < capacity) {
+            __builtin_prefetch(&nodes[high_water], 1);
+        }
+    }
+
+    uint32_t size() const { return live; }
+    uint32_t max_size() const { return capacity; }
+    const MemoryArena& memory() const { return arena; }
+
+    // snapshot support: the raw node array and the allocator state. only nodes below high_water are meaningful
+    struct State {
+        uint32_t high_water;
+        uint32_t free_head;
+        uint32_t live;
+    };
+
+    State state() const { return State{high_water, free_head, live}; }
+    const Order* data() const { return nodes; }
+
+    // set while a background snapshot streams the nodes out, nullptr otherwise
+    void set_guard(SnapshotRegion* region) { guard = region; }
+
+    // takes over capacity nodes mapped from a snapshot, unmapped on destruction. the snapshot mapping replaces
+    // the provisioned one, with small pages and unlocked
+    void adopt(Order* mapped, size_t mapped_bytes, const State& restored) {
+        arena.adopt(mapped, mapped_bytes);
+        nodes = mapped;
+        high_water = restored.high_water;
+        free_head = restored.free_head;
+        live = restored.live;
+    }
+
+    // forget every slot without touching the nodes
+    void clear() {
+        free_head = NULL_INDEX;
+        high_water = 0;
+        live = 0;
+    }
+
+private:
+    inline void guard_write(uint32_t index) {
+        if (guard) {
+            guard->before_write(&nodes[index]);
+        }
+    }
+
+    MemoryArena arena;
+    Order* nodes;
+    SnapshotRegion* guard = nullptr;
+    uint32_t capacity;
+    uint32_t high_water = 0;
+    uint32_t free_head = NULL_INDEX;
+    uint32_t live = 0;
+};
+
+#endif // ORDERPOOL_H
@@ -1,44 +1,82 @@
+#ifndef ORDERUTILS_H
+#define ORDERUTILS_H
+
 #include <cstdint>
-#include <queue>
-#include <deque>
 #include <chrono>
+#include <vector>
 
 using namespace std;
 
-enum class Side {
+// sentinel for an unlinked intrusive queue pointer
+constexpr uint32_t NULL_INDEX = UINT32_MAX;
+
+// prices are unbounded, MAX_PRICE itself is reserved as the "no ask" sentinel
+constexpr uint32_t MAX_PRICE = UINT32_MAX;
+
+enum class Side : uint8_t {
     BUY,
     SELL
 };
 
+// day orders are purged at session rollover, GTC orders rest until cancelled or filled
+enum class TimeInForce : uint8_t {
+    DAY,
+    GTC
+};
+
+// head/tail index into the order pool, orders are linked FIFO through Order::prev/next
 struct PriceLevel {
     uint32_t price = 0;
-    deque<uint64_t> order_ids;
     uint32_t total_quantity = 0;
+    uint32_t head = NULL_INDEX;
+    uint32_t tail = NULL_INDEX;
+
+    bool empty() const { return head == NULL_INDEX; }
 };
 
-struct Trade {
-    uint64_t buy_order_id;
-    uint64_t sell_order_id;
-    uint32_t price;
+// 32 bytes, two orders per cache line
+struct Order {
+    uint64_t order_id;
+    uint32_t price;  // in ticks of the owning book
     uint32_t quantity;
+    uint32_t prev = NULL_INDEX;
+    uint32_t next = NULL_INDEX;
+    uint32_t book = 0;  // owning book when the order store is shared
+    Side side;
+    TimeInForce tif;
+    uint16_t account = 0;  // risk table entry, see RiskChecks.h
 
-    Trade() = default;
+    Order() = default;
 
-    Trade(uint64_t buy_order_id, uint64_t sell_order_id, uint32_t price, uint32_t quantity)
-        : buy_order_id(buy_order_id), sell_order_id(sell_order_id), price(price), quantity(quantity) {}
+    Order(uint64_t order_id, Side side, uint32_t price, uint32_t quantity, TimeInForce tif = TimeInForce::DAY,
+          uint16_t account = 0)
+        : order_id(order_id), price(price), quantity(quantity), side(side), tif(tif), account(account) {}
 };
 
-struct Order {
+enum class CommandType : uint8_t {
+    ADD,
+    CANCEL,
+    MODIFY,
+    EXECUTE,  // resting order traded away, e.g. replayed from a venue feed
+    ADD_STOP  // stop at trigger, price is its limit and 0 for a stop market
+};
+
+// one inbound instruction, 32 bytes. cancel/modify/execute use order_id and quantity only,
+// symbol is carried so a router can find the owning shard without an order lookup.
+struct Command {
     uint64_t order_id;
-    Side side;
+    uint32_t symbol;
     uint32_t price;
     uint32_t quantity;
-    bool deleted = false;
-
-    Order(uint64_t order_id, Side side, uint32_t price, uint32_t quantity)
-        : order_id(order_id), side(side), price(price), quantity(quantity), deleted(false) {}
+    CommandType type;
+    Side side;
+    TimeInForce tif = TimeInForce::DAY;  // adds only
+    uint16_t account = 0;                // adds only, see RiskChecks.h
+    uint32_t trigger = 0;                // stops only
 };
 
+static_assert(sizeof(Command) == 32, "two commands per cache line");
+
 struct Quote {
     uint32_t bid_price;
     uint32_t bid_quantity;
@@ -53,3 +91,16 @@ struct Quote {
         this->ask_quantity = ask_quantity;
     }
 };
+
+struct DepthLevel {
+    uint32_t price;
+    uint32_t quantity;
+};
+
+// up to n levels per side, best first. the vectors keep their capacity, so refreshing a snapshot does not allocate
+struct Depth {
+    vector<DepthLevel> bids;
+    vector<DepthLevel> asks;
+};
+
+#endif // ORDERUTILS_H
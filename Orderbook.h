@@ -2,326 +2,1589 @@
 #define ORDERBOOK_H
 
 #include "OrderUtils.h"
+#include "OrderPool.h"
+#include "OrderIndex.h"
+#include "PriceLadder.h"
+#include "ExecutionReports.h"
+#include "Snapshot.h"
+#include "TopOfBook.h"
+#include "LadderAnalytics.h"
+#include "RiskChecks.h"
+#include "StopOrders.h"
 #include <iostream>
-#include <unordered_map>
+#include <cstdio>
 #include <algorithm>
+#include <memory>
+#include <span>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <utility>
 
 using namespace std;
 
-// array-based price levels for O(1) access
-constexpr uint32_t MAX_PRICE = 100000;
+// default order capacity of a standalone book
+constexpr uint32_t MAX_ORDERS = 1 << 20;
+
+// order nodes live in a preallocated pool, the index only holds pool indices.
+// a SymbolRouter shares one store between all of its books so one lookup finds any order.
+// armed stops are indexed beside the resting orders, and capping them at half the order capacity keeps
+// the index, sized for twice that, at most three quarters full.
+// memory says how the three arenas are provisioned, and the books on the store reserve to match
+struct OrderStore {
+    MemoryOptions memory;
+    OrderPool pool;
+    OrderIndex index;
+    StopPool stops;
+
+    explicit OrderStore(uint32_t max_orders, const MemoryOptions& memory = MemoryOptions())
+        : memory(memory), pool(max_orders, memory), index(max_orders, memory), stops(max_orders / 2 + 1, memory) {}
+};
+
+// how far apply_batch looks ahead: the index slot of a command is prefetched this many commands early,
+// its order node once that slot has arrived, and its level once the node has
+constexpr size_t BATCH_INDEX_AHEAD = 12;
+constexpr size_t BATCH_NODE_AHEAD = 6;
+constexpr size_t BATCH_LEVEL_AHEAD = 2;
+
+// compile-time shape of a book. prices on the book's interface are in price units and must be multiples of
+// TickSize, inside the book they are tick counts, so the ladder window spans LadderLevels ticks however
+// coarse the tick. every conversion is a multiply or a division by a constant, and none at all for tick 1
+template <uint32_t TickSize = 1, uint32_t LadderLevels = LADDER_WINDOW>
+struct BookSpec {
+    static_assert(TickSize > 0, "tick size must be positive");
+
+    static constexpr uint32_t TICK_SIZE = TickSize;
+    using Ladder = BasicPriceLadder<LadderLevels>;
+
+    static constexpr bool on_tick(uint32_t price) { return price % TickSize == 0; }
+    static constexpr uint32_t to_ticks(uint32_t price) { return price / TickSize; }
+    static constexpr uint32_t to_ticks_up(uint32_t price) { return price / TickSize + (price % TickSize != 0); }
+    static constexpr uint32_t to_price(uint32_t ticks) { return ticks * TickSize; }
+};
+
+using DefaultBookSpec = BookSpec<>;
+
+// every accepted order, fill, cancel, modify and level change is reported to Sink in sequence
+template <typename Sink = NullSink, typename Spec = DefaultBookSpec>
+class BasicOrderbook {
+public:
+    using Ladder = typename Spec::Ladder;
+
+    // standalone book with its own order store, see MemoryArena.h for memory
+    explicit BasicOrderbook(uint32_t max_orders = MAX_ORDERS, Sink sink = Sink(),
+                            const MemoryOptions& memory = MemoryOptions())
+        : owned_store(new OrderStore(max_orders, memory)), order_pool(owned_store->pool),
+          orders(owned_store->index), stop_pool(owned_store->stops), book_id(0), sink(sink) {
+        provision(memory);
+    }
+
+    // book sharing an order store, resting orders are tagged with book_id
+    BasicOrderbook(OrderStore& store, uint32_t book_id, Sink sink = Sink())
+        : order_pool(store.pool), orders(store.index), stop_pool(store.stops), book_id(book_id), sink(sink) {
+        provision(store.memory);
+    }
+
+    ~BasicOrderbook() {
+        if (locked) {
+            munlock(this, sizeof(*this));
+        }
+    }
+
+    BasicOrderbook(const BasicOrderbook&) = delete;
+    BasicOrderbook& operator=(const BasicOrderbook&) = delete;
+
+    Quote get_quote() const
+    {
+        uint32_t bid_price = 0;
+        uint32_t bid_quantity = 0;
+        uint32_t ask_price = 0;
+        uint32_t ask_quantity = 0;
+
+        if (best_bid > 0) {
+            const PriceLevel* level = ladder.find(Side::BUY, best_bid);
+            if (level->total_quantity > 0) {
+                bid_price = Spec::to_price(best_bid);
+                bid_quantity = level->total_quantity;
+            }
+        }
+
+        if (best_ask < MAX_PRICE) {
+            const PriceLevel* level = ladder.find(Side::SELL, best_ask);
+            if (level->total_quantity > 0) {
+                ask_price = Spec::to_price(best_ask);
+                ask_quantity = level->total_quantity;
+            }
+        }
+
+        return Quote(bid_price, bid_quantity, ask_price, ask_quantity);
+    }
+
+    // n best levels per side. walks active levels only, so the cost is O(n) whatever the gaps
+    void get_depth(uint32_t n, Depth& depth) const
+    {
+        depth.bids.clear();
+        depth.asks.clear();
+
+        // a level with nothing left is not shown, as in get_quote
+        auto collect = [n](vector<DepthLevel>& out) {
+            return [n, &out](const PriceLevel& level) {
+                if (level.total_quantity > 0) {
+                    out.push_back({Spec::to_price(level.price), level.total_quantity});
+                }
+                return out.size() < n;
+            };
+        };
+        if (n > 0) {
+            ladder.walk_bids(collect(depth.bids));
+            ladder.walk_asks(collect(depth.asks));
+        }
+    }
 
-unordered_map<uint64_t, Order> orders;
+    // range analytics over the levels, vectorized where AVX2 is available. see LadderAnalytics.h.
+    // like get_quote they read the book itself and belong to the matching thread
 
-PriceLevel buy_side[MAX_PRICE];
-PriceLevel sell_side[MAX_PRICE];
+    // quantity resting on side at price or better
+    uint64_t quantity_to_price(Side side, uint32_t price) const
+    {
+        return ::quantity_to_price(ladder, side, side == Side::BUY ? Spec::to_ticks_up(price) : Spec::to_ticks(price));
+    }
 
-// track best prices for speed
-uint32_t best_bid = 0;
-uint32_t best_ask = MAX_PRICE;
+    // what an order of side would take from the other side to fill quantity, vwap() is its average price
+    FillEstimate estimate_fill(Side side, uint64_t quantity) const
+    {
+        FillEstimate fill = ::estimate_fill(ladder, side, quantity);
+        fill.notional *= Spec::TICK_SIZE;
+        return fill;
+    }
 
-// static trade buffer to avoid allocations in hot path
-constexpr uint32_t MAX_TRADES = 256;
-Trade trade_buffer[MAX_TRADES];
-uint32_t trade_count = 0;
+    // (bid - ask) / (bid + ask) over the top levels non-empty levels of each side
+    double level_imbalance(uint32_t levels) const { return ::level_imbalance(ladder, levels); }
 
-// bitmaps for O(1) best bid/ask lookup
-constexpr uint32_t BITMAP_SIZE = (MAX_PRICE + 63) / 64;
-uint64_t bid_bitmap[BITMAP_SIZE] = {0};
-uint64_t ask_bitmap[BITMAP_SIZE] = {0};
+    // account picks the order's limits and self-trade mode in an attached risk table, see set_risk
+    void add_order(uint64_t order_id, Side side, uint32_t price, uint32_t quantity, TimeInForce tif = TimeInForce::DAY,
+                   uint16_t account = 0)
+    {
+        place_order(order_id, side, price, quantity, tif, account);
+        check_stops();
+        refresh_top();
+    }
 
-inline void set_level_active(uint32_t price, bool is_bid) {
-    uint64_t* bmp = is_bid ? bid_bitmap : ask_bitmap;
-    bmp[price / 64] |= (1ULL << (price % 64));
-}
+    // arms a stop, prices in price units. once a trade prints at trigger or through it, the order enters the
+    // book as a limit order at limit, or with limit 0 as a market order: priced at the price band around the
+    // opposite touch when one is set and unbounded otherwise, with whatever it cannot fill rejected rather than
+    // rested. a stop is acknowledged when armed and reported as TRIGGER when it enters, then fills and rests as
+    // any add. risk limits are checked when it is armed, at its limit or for a stop market at its trigger, and
+    // its quantity counts as open for its account while it stays armed. a trigger the last trade has already
+    // reached is rejected
+    void add_stop(uint64_t order_id, Side side, uint32_t trigger, uint32_t limit, uint32_t quantity,
+                  TimeInForce tif = TimeInForce::DAY, uint16_t account = 0)
+    {
+        if (trigger == 0 || trigger >= MAX_PRICE || limit >= MAX_PRICE || !Spec::on_tick(trigger) ||
+            !Spec::on_tick(limit)) {
+            reject(order_id, side, trigger, quantity, RejectReason::PRICE);
+            return;
+        }
+        uint32_t trigger_ticks = Spec::to_ticks(trigger);
+        if (last_trade != 0 && (side == Side::BUY ? trigger_ticks <= last_trade : trigger_ticks >= last_trade)) {
+            reject(order_id, side, trigger, quantity, RejectReason::TRIGGER);
+            return;
+        }
+        if (risk) {
+            RejectReason reason = risk->check(account, limit ? limit : trigger, quantity);
+            if (reason != RejectReason::NONE) {
+                reject(order_id, side, trigger, quantity, reason);
+                return;
+            }
+        }
 
-inline void set_level_inactive(uint32_t price, bool is_bid) {
-    uint64_t* bmp = is_bid ? bid_bitmap : ask_bitmap;
-    bmp[price / 64] &= ~(1ULL << (price % 64));
-}
+        uint32_t slot = stop_pool.allocate();
+        if (slot == NULL_INDEX) {
+            reject(order_id, side, trigger, quantity, RejectReason::CAPACITY);
+            return;
+        }
+        if (!orders.insert(order_id, STOP_HANDLE | slot)) {
+            stop_pool.release(slot);
+            reject(order_id, side, trigger, quantity, RejectReason::DUPLICATE);
+            return;
+        }
+
+        StopOrder& stop = stop_pool[slot];
+        stop = StopOrder{order_id, trigger_ticks, Spec::to_ticks(limit), quantity, NULL_INDEX, NULL_INDEX, book_id,
+                         side, tif, account};
+        rest_open(stop, quantity);
+        report(ReportType::ACK, order_id, 0, side, trigger_ticks, quantity);
 
-inline uint32_t find_best_bid() {
-    for (int i = BITMAP_SIZE - 1; i >= 0; --i) {
-        if (bid_bitmap[i]) {
-            // count leading zeros
-            return i * 64 + (63 - __builtin_clzll(bid_bitmap[i]));
+        // allocated with the first stop, books that never arm one carry a pointer
+        if (!stop_levels) {
+            stop_levels.reset(new Ladder());
         }
+        stop_levels->track(last_trade ? last_trade : trigger_ticks);
+        Side half = trigger_half(side);
+        PriceLevel& level = stop_levels->level(half, trigger_ticks);
+        bool was_empty = level.empty();
+        level.price = trigger_ticks;
+        link_stop(level, slot);
+        level.total_quantity += quantity;
+        if (was_empty) {
+            stop_levels->set_active(half, trigger_ticks);
+        }
+        ++armed;
     }
-    return 0;
-}
 
-inline uint32_t find_best_ask() {
-    for (uint32_t i = 0; i < BITMAP_SIZE; ++i) {
-        if (ask_bitmap[i]) {
-            // count trailing zeroes
-            return i * 64 + __builtin_ctzll(ask_bitmap[i]);
+    void cancel_order(uint64_t order_id)
+    {
+        uint32_t index = orders.find(order_id);
+        if (index >= STOP_HANDLE) {
+            if (index != NULL_INDEX) {
+                cancel_stop(index & ~STOP_HANDLE);
+            }
+            return;
         }
+        cancel_resting(index);
     }
-    return MAX_PRICE;
-}
 
-Quote get_quote()
-{
-    uint32_t bid_price = 0;
-    uint32_t bid_quantity = 0;
-    uint32_t ask_price = 0;
-    uint32_t ask_quantity = 0;
+    void modify_order(uint64_t order_id, uint32_t new_quantity)
+    {
+        uint32_t index = orders.find(order_id);
+        if (index >= STOP_HANDLE) {
+            if (index != NULL_INDEX) {
+                modify_stop(index & ~STOP_HANDLE, new_quantity);
+            }
+            return;
+        }
+        modify_resting(index, new_quantity);
+    }
 
-    if (best_bid > 0 && buy_side[best_bid].total_quantity > 0) {
-        bid_price = best_bid;
-        bid_quantity = buy_side[best_bid].total_quantity;
+    // resting order traded away outside this book, e.g. an execution replayed from a venue feed.
+    // an armed stop has nothing to trade yet and is left alone
+    void execute_order(uint64_t order_id, uint32_t quantity)
+    {
+        uint32_t index = orders.find(order_id);
+        if (index >= STOP_HANDLE) {
+            return;
+        }
+        execute_resting(index, quantity);
     }
 
-    if (best_ask < MAX_PRICE && sell_side[best_ask].total_quantity > 0) {
-        ask_price = best_ask;
-        ask_quantity = sell_side[best_ask].total_quantity;
+    // cancel/modify/execute by pool index, for routers that already resolved the order
+    void cancel_resting(uint32_t index)
+    {
+        Order& order = order_pool[index];
+        uint64_t order_id = order.order_id;
+        Side side = order.side;
+        uint32_t price = order.price;
+        uint32_t quantity = order.quantity;
+
+        release_open(order, quantity);
+        uint32_t level_quantity = remove_order(ladder.level(side, price), index);
+        report(ReportType::CANCEL, order_id, 0, side, price, quantity);
+        report_level(side, price, level_quantity);
+        refresh_top();
     }
 
-    return Quote(bid_price, bid_quantity, ask_price, ask_quantity);
-}
+    // a modify down to zero is a cancel, an order with nothing left never keeps its slot.
+    // an increase goes through the risk stage, and a rejected one leaves the order as it was
+    void modify_resting(uint32_t index, uint32_t new_quantity)
+    {
+        if (new_quantity == 0) {
+            cancel_resting(index);
+            return;
+        }
+        Order& order = order_pool[index];
+        uint32_t old_quantity = order.quantity;
+        uint32_t price = order.price;
+
+        if (risk && new_quantity > old_quantity) [[unlikely]] {
+            RejectReason reason = risk->check(order.account, Spec::to_price(price), new_quantity,
+                                              new_quantity - old_quantity);
+            if (reason != RejectReason::NONE) {
+                reject(order.order_id, order.side, Spec::to_price(price), new_quantity, reason);
+                return;
+            }
+        }
+
+        PriceLevel& level = ladder.level(order.side, price);
 
+        level.total_quantity = level.total_quantity - old_quantity + new_quantity;
+        order.quantity = new_quantity;
+        release_open(order, old_quantity);
+        rest_open(order, new_quantity);
 
-void fill_order(uint64_t order_id, Side side, uint32_t price, uint32_t quantity, uint32_t& filled_quantity)
-{
-    uint32_t remaining = quantity;
-    filled_quantity = 0;
-    trade_count = 0;
+        report(ReportType::MODIFY, order.order_id, 0, order.side, price, new_quantity);
+        report_level(order.side, price, level.total_quantity);
+        refresh_top();
+    }
 
-    if (side == Side::BUY)
+    // reported as a fill against an unknown aggressor (order_id 0)
+    void execute_resting(uint32_t index, uint32_t quantity)
     {
-        // match against sells
-        while (remaining > 0 && best_ask < MAX_PRICE && best_ask <= price)
-        {
-            PriceLevel& level = sell_side[best_ask];
-            if (level.order_ids.empty()) {
-                set_level_inactive(best_ask, false);
-                best_ask = find_best_ask();
-                continue;
-            }
-
-            uint64_t resting_order_id = level.order_ids.front();
-            auto order_iter = orders.find(resting_order_id);
-
-            // skip deleted/stale orders
-            if (order_iter == orders.end() || order_iter->second.deleted) {
-                level.order_ids.pop_front();
-                if (level.order_ids.empty()) {
-                    set_level_inactive(best_ask, false);
-                    best_ask = find_best_ask();
-                }
-                continue;
+        Order& order = order_pool[index];
+        uint64_t order_id = order.order_id;
+        Side side = order.side;
+        uint32_t price = order.price;
+        uint32_t executed = min(quantity, order.quantity);
+
+        PriceLevel& level = ladder.level(side, price);
+        order.quantity -= executed;
+        level.total_quantity -= executed;
+        release_open(order, executed);
+
+        uint32_t level_quantity = order.quantity == 0 ? remove_order(level, index) : level.total_quantity;
+        report(ReportType::FILL, 0, order_id, side == Side::BUY ? Side::SELL : Side::BUY, price, executed);
+        report_level(side, price, level_quantity);
+        last_trade = price;
+        check_stops();
+        refresh_top();
+    }
+
+    // cancel/modify an armed stop by its slot in the store's stop pool
+    void cancel_stop(uint32_t slot)
+    {
+        const StopOrder& stop = stop_pool[slot];
+        report(ReportType::CANCEL, stop.order_id, 0, stop.side, stop.trigger, stop.quantity);
+        remove_stop(slot);
+    }
+
+    void modify_stop(uint32_t slot, uint32_t new_quantity)
+    {
+        if (new_quantity == 0) {
+            cancel_stop(slot);
+            return;
+        }
+        StopOrder& stop = stop_pool[slot];
+        uint32_t check_price = Spec::to_price(stop.limit ? stop.limit : stop.trigger);
+        if (risk && new_quantity > stop.quantity) [[unlikely]] {
+            RejectReason reason = risk->check(stop.account, check_price, new_quantity, new_quantity - stop.quantity);
+            if (reason != RejectReason::NONE) {
+                reject(stop.order_id, stop.side, Spec::to_price(stop.trigger), new_quantity, reason);
+                return;
             }
+        }
+        PriceLevel& level = stop_levels->level(trigger_half(stop.side), stop.trigger);
+        level.total_quantity = level.total_quantity - stop.quantity + new_quantity;
+        release_open(stop, stop.quantity);
+        rest_open(stop, new_quantity);
+        stop.quantity = new_quantity;
+        report(ReportType::MODIFY, stop.order_id, 0, stop.side, stop.trigger, new_quantity);
+    }
 
-            Order& resting_order = order_iter->second;
+    // applies commands strictly in order, exactly as the single-order calls would. while one command runs,
+    // the cache lines the next few will touch are prefetched in stages, so their misses overlap instead of
+    // each call stalling on its own. symbols are ignored
+    void apply_batch(span<const Command> commands)
+    {
+        // pool index each lookahead command resolved to, so the later stage does not look it up again
+        uint32_t resolved[BATCH_INDEX_AHEAD];
+        size_t n = commands.size();
 
-            uint32_t match_quantity = min(remaining, resting_order.quantity);
-            if (trade_count < MAX_TRADES) {
-                trade_buffer[trade_count++] = Trade(order_id, resting_order_id, best_ask, match_quantity);
+        // prime the pipeline so the head of the batch is covered too
+        for (size_t i = 0; i < min(n, BATCH_INDEX_AHEAD); i++) {
+            prefetch_index(commands[i]);
+        }
+        for (size_t i = 0; i < min(n, BATCH_NODE_AHEAD); i++) {
+            resolved[i] = prefetch_node(commands[i]);
+        }
+        for (size_t i = 0; i < min(n, BATCH_LEVEL_AHEAD); i++) {
+            prefetch_level(commands[i], resolved[i]);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (i + BATCH_INDEX_AHEAD < n) {
+                prefetch_index(commands[i + BATCH_INDEX_AHEAD]);
+            }
+            if (i + BATCH_NODE_AHEAD < n) {
+                resolved[(i + BATCH_NODE_AHEAD) % BATCH_INDEX_AHEAD] = prefetch_node(commands[i + BATCH_NODE_AHEAD]);
             }
-            remaining -= match_quantity;
-            filled_quantity += match_quantity;
+            if (i + BATCH_LEVEL_AHEAD < n) {
+                prefetch_level(commands[i + BATCH_LEVEL_AHEAD], resolved[(i + BATCH_LEVEL_AHEAD) % BATCH_INDEX_AHEAD]);
+            }
+            apply(commands[i]);
+        }
+    }
 
-            resting_order.quantity -= match_quantity;
-            level.total_quantity -= match_quantity;
+    inline void apply(const Command& command)
+    {
+        switch (command.type) {
+            case CommandType::ADD:
+                add_order(command.order_id, command.side, command.price, command.quantity, command.tif, command.account);
+                break;
+            case CommandType::CANCEL:
+                cancel_order(command.order_id);
+                break;
+            case CommandType::MODIFY:
+                modify_order(command.order_id, command.quantity);
+                break;
+            case CommandType::EXECUTE:
+                execute_order(command.order_id, command.quantity);
+                break;
+            case CommandType::ADD_STOP:
+                add_stop(command.order_id, command.side, command.trigger, command.price, command.quantity, command.tif,
+                         command.account);
+                break;
+        }
+    }
 
-            if (resting_order.quantity == 0)
-            {
-                resting_order.deleted = true;  // tombstone
-                level.order_ids.pop_front();
+    // level lines for a router prefetching on the book's behalf, for an order about to be added at price
+    [[gnu::always_inline]] inline void prefetch_level(Side side, uint32_t price) const
+    {
+        ladder.prefetch(side, Spec::to_ticks(price));
+    }
 
-                if (level.order_ids.empty()) {
-                    set_level_inactive(best_ask, false);
-                    best_ask = find_best_ask();
+    // and for an order of this book already resting, whose price is in ticks
+    [[gnu::always_inline]] inline void prefetch_level(const Order& order) const { ladder.prefetch(order.side, order.price); }
+
+    // empties the book without reporting. only active levels and their orders are touched, so an idle book
+    // resets in well under a microsecond whatever its capacity
+    void clear() {
+        // return resting orders to the store, then reset the levels
+        ladder.for_each_level([this](Side, PriceLevel& level) { release_level(level); });
+        ladder.clear();
+
+        // and the armed stops. with nothing left to trade there is no last trade either
+        if (armed) {
+            stop_levels->for_each_level([this](Side, PriceLevel& level) {
+                for (uint32_t i = level.head; i != NULL_INDEX;) {
+                    uint32_t next = stop_pool[i].next;
+                    release_open(stop_pool[i], stop_pool[i].quantity);
+                    orders.erase(stop_pool[i].order_id);
+                    stop_pool.release(i);
+                    i = next;
                 }
-            }
+            });
+            stop_levels->clear();
+            armed = 0;
         }
+        last_trade = 0;
+        checked_trade = 0;
+
+        // reset best prices
+        best_bid = 0;
+        best_ask = MAX_PRICE;
+        refresh_top();
     }
-    else // SELL
+
+    // session rollover: cancels every DAY order and leaves GTC orders where they are, queue priority included.
+    // each purged order is reported as a CANCEL and each level it left once as a LEVEL. armed DAY stops are
+    // cancelled too. walks active levels and their orders only. returns the number of orders and stops purged
+    uint32_t roll_session()
     {
-        // match against buys
-        while (remaining > 0 && best_bid > 0 && best_bid >= price)
-        {
-            PriceLevel& level = buy_side[best_bid];
-            if (level.order_ids.empty()) {
-                set_level_inactive(best_bid, true);
-                best_bid = find_best_bid();
-                continue;
-            }
-
-            uint64_t resting_order_id = level.order_ids.front();
-            auto order_iter = orders.find(resting_order_id);
-
-            // skip deleted/stale orders
-            if (order_iter == orders.end() || order_iter->second.deleted) {
-                level.order_ids.pop_front();
-                if (level.order_ids.empty()) {
-                    set_level_inactive(best_bid, true);
-                    best_bid = find_best_bid();
+        const OrderPool& pool = order_pool;  // reads must not trip a running snapshot's guard
+        uint32_t purged = 0;
+        emptied_levels.clear();
+
+        ladder.for_each_level([&](Side side, PriceLevel& level) {
+            uint32_t level_purged = 0;
+            for (uint32_t i = level.head; i != NULL_INDEX; ) {
+                const Order& order = pool[i];
+                uint32_t next = order.next;
+                if (order.tif == TimeInForce::DAY) {
+                    report(ReportType::CANCEL, order.order_id, 0, side, level.price, order.quantity);
+                    release_open(order, order.quantity);
+                    unlink_order(level, i);
+                    level.total_quantity -= order.quantity;
+                    orders.erase(order.order_id);
+                    order_pool.release(i);
+                    ++level_purged;
+                }
+                i = next;
+            }
+            if (level_purged > 0) {
+                report_level(side, level.price, level.total_quantity);
+                if (level.empty()) {
+                    emptied_levels.push_back({side, level.price});
                 }
-                continue;
+                purged += level_purged;
             }
+        });
 
-            Order& resting_order = order_iter->second;
+        // retired after the walk, the ladder cannot change under it
+        if (!emptied_levels.empty()) {
+            for (const auto& [side, price] : emptied_levels) {
+                ladder.set_inactive(side, price);
+            }
+            best_bid = ladder.best_bid();
+            best_ask = ladder.best_ask();
+            track_touch();
+        }
+        if (armed) {
+            purged += purge_day_stops();
+        }
+        refresh_top();
+        return purged;
+    }
+
+    // from now on the best levels are published to slot after every change that reaches them, for strategy or
+    // risk threads that must not read the book itself. levels (1 to TOP_LEVELS) sets how deep a change must be
+    // to republish, a change further out costs the writer a comparison and readers nothing. nullptr stops it
+    void publish_top(TopOfBookSlot* slot, uint32_t levels = 1)
+    {
+        top_slot = slot;
+        top_levels = max(1u, min(levels, TOP_LEVELS));
+        if (top_slot) {
+            published_top = current_top();
+            top_slot->store(published_top);
+        }
+    }
+
+    // from now on every add is checked against table's limits for its account before it is acknowledged, and
+    // an add meeting a resting order of its own account follows the account's self-trade mode. the open
+    // quantity of the resting orders and armed stops moves from the previous table to this one. a router shares one table between its
+    // books, so the limits hold across instruments. nullptr stops the checks
+    void set_risk(RiskTable* table)
+    {
+        move_open_quantity(risk, table);
+        risk = table;
+    }
+
+    // collar around the opposite touch in basis points: a buy priced more than the band above the best ask,
+    // or a sell more than the band below the best bid, is rejected. no check while that side is empty, 0 stops it
+    void set_price_band(uint32_t basis_points) { price_band = basis_points; }
+
+    // next active bid below price for depth walks, 0 when there is none
+    inline uint32_t next_bid_level(uint32_t price) const {
+        return Spec::to_price(ladder.next_bid_level(Spec::to_ticks_up(price)));
+    }
+
+    // next active ask above price for depth walks, MAX_PRICE when there is none
+    inline uint32_t next_ask_level(uint32_t price) const {
+        uint32_t next = ladder.next_ask_level(Spec::to_ticks(price));
+        return next == MAX_PRICE ? MAX_PRICE : Spec::to_price(next);
+    }
+
+    // the levels themselves, their prices are in ticks
+    const Ladder& levels() const { return ladder; }
+
+    // resting orders in the book's store, across every book of a router when the store is shared
+    uint32_t live_orders() const { return orders.size() - stop_pool.size(); }
+
+    // stops armed on this book
+    uint32_t armed_stops() const { return armed; }
+
+    // price of the last trade on this book, 0 before the first
+    uint32_t last_trade_price() const { return Spec::to_price(last_trade); }
+
+    // sequence number of the last report
+    uint64_t last_sequence() const { return sequence; }
 
-            uint32_t match_quantity = min(remaining, resting_order.quantity);
-            if (trade_count < MAX_TRADES) {
-                trade_buffer[trade_count++] = Trade(order_id, resting_order_id, best_bid, match_quantity);
+    uint32_t id() const { return book_id; }
+
+    // writes the whole book to path (through path.tmp, then renamed) and syncs it, matching waits until done.
+    // only standalone books snapshot, a book sharing a router's store does not own its orders.
+    // armed stops are not part of the format, a book holding any does not snapshot
+    bool save_snapshot(const char* path) const
+    {
+        char tmp_path[4096];
+        if (!owned_store || snapshot_active || armed || snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+            return false;
+        }
+        int fd = ::open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        SnapshotHeader header = snapshot_header();
+        bool ok = write_snapshot_head(fd, header, ladder) &&
+                  snapshot_pwrite(fd, order_pool.data(), uint64_t(header.high_water) * sizeof(Order), header.pool_offset) &&
+                  snapshot_pwrite(fd, orders.data(), header.index_bytes, header.index_offset);
+        return seal_snapshot(fd, tmp_path, path, ok);
+    }
+
+    // starts writing a snapshot of the book as it is now from a writer thread and returns, matching carries on.
+    // the ladder is copied here, the pool and index are streamed out behind a chunk-level copy-on-write guard,
+    // so the pause is the ladder copy plus a 4 KB copy whenever matching is first to touch a chunk.
+    // returns false if a snapshot is already running or the path is too long. the writer thread is started
+    // by the first call and then sleeps between snapshots
+    bool begin_snapshot(const char* path)
+    {
+        if (!owned_store || snapshot_active || armed) {
+            return false;
+        }
+        if (!background) {
+            background.reset(new BackgroundSnapshot());
+        }
+        BackgroundSnapshot& snapshot = *background;
+        if (snprintf(snapshot.path, sizeof(snapshot.path), "%s", path) >= (int)sizeof(snapshot.path) ||
+            snprintf(snapshot.tmp_path, sizeof(snapshot.tmp_path), "%s.tmp", path) >= (int)sizeof(snapshot.tmp_path)) {
+            return false;
+        }
+
+        snapshot.header = snapshot_header();
+        snapshot.ladder = ladder;
+        if (!snapshot.pool_region.begin(order_pool.data(), uint64_t(snapshot.header.high_water) * sizeof(Order)) ||
+            !snapshot.index_region.begin(orders.data(), snapshot.header.index_bytes)) {
+            return false;
+        }
+        order_pool.set_guard(&snapshot.pool_region);
+        orders.set_guard(&snapshot.index_region);
+        snapshot_active = true;
+        snapshot.done.store(false, memory_order_relaxed);
+
+        if (!snapshot.writer.joinable()) {
+            snapshot.writer = thread([&snapshot] { snapshot.run(); });
+        }
+        snapshot.generation.fetch_add(1, memory_order_release);
+        snapshot.generation.notify_one();
+        return true;
+    }
+
+    // true until the writer of the last begin_snapshot has finished
+    bool snapshot_running() const
+    {
+        return snapshot_active && !background->done.load(memory_order_acquire);
+    }
+
+    // waits for the writer of the last begin_snapshot and drops the guard, true if the file was written
+    bool finish_snapshot()
+    {
+        if (!snapshot_active) {
+            return false;
+        }
+        while (!background->done.load(memory_order_acquire)) {
+            this_thread::yield();
+        }
+        order_pool.set_guard(nullptr);
+        orders.set_guard(nullptr);
+        snapshot_active = false;
+        return background->ok;
+    }
+
+    // replaces the book with a snapshot taken with the same capacity. the pool and index are mapped
+    // copy-on-write from the file and fault in as they are touched, only the ladder is read.
+    // returns false, leaving the book unchanged, if the file is not a valid snapshot for this book or stops are
+    // armed. the last trade is not kept, stops armed afterwards are only checked against trades from then on
+    bool restore_snapshot(const char* path)
+    {
+        if (!owned_store || snapshot_active || armed) {
+            return false;
+        }
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        SnapshotHeader header;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && snapshot_pread(fd, &header, sizeof(header), 0) &&
+                  memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                  header.version == SNAPSHOT_VERSION && header.tick_size == Spec::TICK_SIZE &&
+                  header.pool_capacity == order_pool.max_size() && header.index_slots == orders.slot_count() &&
+                  header.high_water <= header.pool_capacity && header.live <= header.high_water &&
+                  header.index_count == header.live &&
+                  (header.free_head == NULL_INDEX || header.free_head < header.high_water) &&
+                  header.ladder_offset == SNAPSHOT_ALIGN &&
+                  header.pool_offset == snapshot_align(header.ladder_offset + header.ladder_bytes) &&
+                  header.pool_bytes == uint64_t(header.pool_capacity) * sizeof(Order) &&
+                  header.index_offset == snapshot_align(header.pool_offset + header.pool_bytes) &&
+                  header.index_bytes == orders.data_bytes() &&
+                  header.file_bytes == header.index_offset + header.index_bytes &&
+                  uint64_t(st.st_size) >= header.index_offset + header.index_bytes;
+
+        // the ladder is small, rebuild it aside and check it agrees with the header before touching the book
+        unique_ptr<Ladder> restored(new Ladder());
+        if (ok) {
+            uint64_t offset = header.ladder_offset;
+            ok = restored->read_raw([&](void* data, size_t bytes) {
+                bool read = snapshot_pread(fd, data, bytes, offset);
+                offset += bytes;
+                return read;
+            }, header.ladder_bytes);
+            ok = ok && restored->best_bid() == header.best_bid && restored->best_ask() == header.best_ask;
+        }
+
+        void* pool_mapping = MAP_FAILED;
+        void* index_mapping = MAP_FAILED;
+        if (ok) {
+            pool_mapping = mmap(nullptr, header.pool_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, header.pool_offset);
+            index_mapping = mmap(nullptr, header.index_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, header.index_offset);
+            ok = pool_mapping != MAP_FAILED && index_mapping != MAP_FAILED;
+        }
+        ::close(fd);
+
+        // a truncated or corrupt file must not hand the book a link out of the pool
+        ok = ok && restored->inactive_levels_empty() &&
+             valid_links(*restored, static_cast<const Order*>(pool_mapping), header) &&
+             orders.valid_table(index_mapping, header.high_water, header.index_count);
+
+        if (!ok) {
+            if (pool_mapping != MAP_FAILED) {
+                munmap(pool_mapping, header.pool_bytes);
+            }
+            if (index_mapping != MAP_FAILED) {
+                munmap(index_mapping, header.index_bytes);
             }
-            remaining -= match_quantity;
-            filled_quantity += match_quantity;
+            return false;
+        }
 
-            resting_order.quantity -= match_quantity;
-            level.total_quantity -= match_quantity;
+        // the attached risk table trades the book's resting orders for the restored ones
+        move_open_quantity(risk, nullptr);
+        order_pool.adopt(static_cast<Order*>(pool_mapping), header.pool_bytes,
+                         OrderPool::State{header.high_water, header.free_head, header.live});
+        orders.adopt(index_mapping, header.index_bytes, header.index_count);
+        ladder = *restored;
+        best_bid = header.best_bid;
+        best_ask = header.best_ask;
+        sequence = header.sequence;
+        last_trade = 0;
+        checked_trade = 0;
+        move_open_quantity(nullptr, risk);
+        refresh_top();
+        return true;
+    }
 
-            if (resting_order.quantity == 0)
-            {
-                resting_order.deleted = true;  // tombstone
-                level.order_ids.pop_front();
+private:
+    // restore_snapshot's check of the restored nodes: every level's queue walks forward through nodes below
+    // high_water whose back links, sides and prices match and whose quantities add up to the level's total,
+    // the free list stays below high_water too, and together they account for every node below it.
+    // the counts bound every walk, so a cycle fails instead of looping
+    static bool valid_links(Ladder& restored, const Order* nodes, const SnapshotHeader& header) {
+        uint32_t high_water = header.high_water;
+        uint64_t resting = 0;
+        bool ok = true;
+        restored.for_each_level([&](Side side, PriceLevel& level) {
+            uint64_t quantity = 0;
+            uint32_t prev = NULL_INDEX;
+            ok = ok && level.head != NULL_INDEX;
+            for (uint32_t i = level.head; ok && i != NULL_INDEX; i = nodes[i].next) {
+                ok = i < high_water && ++resting <= header.live && nodes[i].prev == prev &&
+                     nodes[i].side == side && nodes[i].price == level.price;
+                if (ok) {
+                    quantity += nodes[i].quantity;
+                    prev = i;
+                }
+            }
+            ok = ok && level.tail == prev && quantity == level.total_quantity;
+        });
+        uint64_t free_nodes = 0;
+        for (uint32_t i = header.free_head; ok && i != NULL_INDEX; i = nodes[i].next) {
+            ok = i < high_water && ++free_nodes <= high_water - header.live;
+        }
+        return ok && resting == header.live && free_nodes == high_water - header.live;
+    }
+
+    // apply_batch stages. an add needs its level and a fresh node, everything else resolves its order
+    // through the index first. a command earlier in the batch may still change what a lookup finds,
+    // which only makes a prefetch useless, never wrong. all of them are forced inline, see OrderIndex::prefetch
+    [[gnu::always_inline]] inline void prefetch_index(const Command& command) const
+    {
+        orders.prefetch(command.order_id);
+        if (command.type == CommandType::ADD) {
+            ladder.prefetch(command.side, Spec::to_ticks(command.price));
+        }
+    }
+
+    // returns the pool index the order resolved to, NULL_INDEX for adds
+    [[gnu::always_inline]] inline uint32_t prefetch_node(const Command& command) const
+    {
+        if (command.type == CommandType::ADD) {
+            order_pool.prefetch_next();
+            return NULL_INDEX;
+        }
+        uint32_t index = orders.find(command.order_id);
+        if (index < STOP_HANDLE) {
+            order_pool.prefetch(index);
+        }
+        return index;
+    }
+
+    // the level, and the neighbours the queue update will write: the tail an add links behind,
+    // the prev and next a cancel unlinks from
+    [[gnu::always_inline]] inline void prefetch_level(const Command& command, uint32_t index) const
+    {
+        const OrderPool& pool = order_pool;
+        if (command.type == CommandType::ADD) {
+            const PriceLevel* level = ladder.find_window(command.side, Spec::to_ticks(command.price));
+            if (level && level->tail != NULL_INDEX) {
+                pool.prefetch(level->tail);
+            }
+            return;
+        }
+        if (index >= STOP_HANDLE) {
+            return;
+        }
+        const Order& order = pool[index];
+        ladder.prefetch(order.side, order.price);
+        if (command.type != CommandType::MODIFY) {
+            if (order.prev != NULL_INDEX) {
+                pool.prefetch(order.prev);
+            }
+            if (order.next != NULL_INDEX) {
+                pool.prefetch(order.next);
+            }
+        }
+    }
+
+    // writer side of begin_snapshot, kept once allocated so later snapshots reuse the thread and chunk tables
+    struct BackgroundSnapshot {
+        SnapshotRegion pool_region;
+        SnapshotRegion index_region;
+        Ladder ladder;
+        SnapshotHeader header;
+        char path[4096];
+        char tmp_path[4096];
+        thread writer;
+        atomic<uint32_t> generation{0};  // bumped once per snapshot, and once more to stop
+        atomic<bool> stopping{false};
+        atomic<bool> done{true};
+        bool ok = false;
+
+        void run() {
+            for (uint32_t seen = 0;;) {
+                generation.wait(seen, memory_order_acquire);
+                seen = generation.load(memory_order_acquire);
+                if (stopping.load(memory_order_acquire)) {
+                    return;
+                }
 
-                if (level.order_ids.empty()) {
-                    set_level_inactive(best_bid, true);
-                    best_bid = find_best_bid();
+                int fd = ::open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                bool written = fd >= 0;
+                written = pool_region.write_all(fd, header.pool_offset) && written;
+                written = index_region.write_all(fd, header.index_offset) && written;
+                if (fd >= 0) {
+                    ok = seal_snapshot(fd, tmp_path, path, written && write_snapshot_head(fd, header, ladder));
+                } else {
+                    ok = false;
                 }
+                done.store(true, memory_order_release);
             }
         }
+
+        ~BackgroundSnapshot() {
+            if (writer.joinable()) {
+                stopping.store(true, memory_order_release);
+                generation.fetch_add(1, memory_order_release);
+                generation.notify_one();
+                writer.join();
+            }
+        }
+    };
+
+    SnapshotHeader snapshot_header() const
+    {
+        OrderPool::State pool_state = order_pool.state();
+        SnapshotHeader header{};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.book_id = book_id;
+        header.pool_capacity = order_pool.max_size();
+        header.high_water = pool_state.high_water;
+        header.free_head = pool_state.free_head;
+        header.live = pool_state.live;
+        header.index_slots = orders.slot_count();
+        header.index_count = orders.size();
+        header.best_bid = best_bid;
+        header.best_ask = best_ask;
+        header.tick_size = Spec::TICK_SIZE;
+        header.sequence = sequence;
+        header.ladder_offset = SNAPSHOT_ALIGN;
+        header.ladder_bytes = ladder.raw_bytes();
+        header.pool_offset = snapshot_align(header.ladder_offset + header.ladder_bytes);
+        header.pool_bytes = uint64_t(header.pool_capacity) * sizeof(Order);
+        header.index_offset = snapshot_align(header.pool_offset + header.pool_bytes);
+        header.index_bytes = orders.data_bytes();
+        header.file_bytes = header.index_offset + header.index_bytes;
+        return header;
     }
-}
 
-// batch cleanup of tombstoned orders
-void cleanup_deleted_orders() {
-    for (auto it = orders.begin(); it != orders.end(); ) {
-        if (it->second.deleted) {
-            it = orders.erase(it);
-        } else {
-            ++it;
+    static bool write_snapshot_head(int fd, const SnapshotHeader& header, const Ladder& levels)
+    {
+        bool ok = snapshot_pwrite(fd, &header, sizeof(header), 0);
+        uint64_t offset = header.ladder_offset;
+        levels.write_raw([&](const void* data, size_t bytes) {
+            ok = ok && snapshot_pwrite(fd, data, bytes, offset);
+            offset += bytes;
+        });
+        // the pool tail is never written, size the file so the index lands where the header says
+        return ok && ftruncate(fd, header.file_bytes) == 0;
+    }
+
+    // syncs and publishes tmp_path as path, or removes it if anything failed
+    static bool seal_snapshot(int fd, const char* tmp_path, const char* path, bool ok)
+    {
+        ok = ok && fsync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+        ok = ok && rename(tmp_path, path) == 0;
+        if (!ok) {
+            unlink(tmp_path);
         }
+        return ok;
     }
-}
 
-void add_order(uint64_t order_id, Side side, uint32_t price, uint32_t quantity)
-{
-    // bounds check for price
-    if (price >= MAX_PRICE) {
-        return;
+    // price in ticks, reports carry price units
+    inline void report(ReportType type, uint64_t order_id, uint64_t contra_order_id, Side side,
+                       uint32_t price, uint32_t quantity) {
+        emit(type, order_id, contra_order_id, side, Spec::to_price(price), quantity);
     }
 
-    uint32_t filled_quantity = 0;
+    // a reject carries the price as submitted, which need not be on a tick
+    inline void reject(uint64_t order_id, Side side, uint32_t price, uint32_t quantity, RejectReason reason) {
+        emit(ReportType::REJECT, order_id, 0, side, price, quantity, reason);
+    }
 
-    // try to fill first
-    fill_order(order_id, side, price, quantity, filled_quantity);
+    inline void emit(ReportType type, uint64_t order_id, uint64_t contra_order_id, Side side,
+                     uint32_t price, uint32_t quantity, RejectReason reason = RejectReason::NONE) {
+        ExecutionReport r;
+        r.sequence = ++sequence;
+        r.order_id = order_id;
+        r.contra_order_id = contra_order_id;
+        r.price = price;
+        r.quantity = quantity;
+        r.book = book_id;
+        r.type = type;
+        r.side = side;
+        r.reason = reason;
+        sink.on_report(r);
+    }
+
+    // every change to a level's total is reported through here, which also keeps the ladder's dense
+    // quantity mirror current for the analytics queries
+    inline void report_level(Side side, uint32_t price, uint32_t quantity) {
+        ladder.set_quantity(side, price, quantity);
+        report(ReportType::LEVEL, 0, 0, side, price, quantity);
+    }
+
+    inline void refresh_top()
+    {
+        if (top_slot) [[unlikely]] {
+            republish_top();
+        }
+    }
 
-    if (filled_quantity >= quantity)
+    // kept out of line so books that do not publish carry no extra code on the hot path
+    [[gnu::noinline]] void republish_top()
     {
-        return; // fully filled
+        TopOfBook top = current_top();
+        if (memcmp(top.bids, published_top.bids, sizeof(top.bids)) != 0 ||
+            memcmp(top.asks, published_top.asks, sizeof(top.asks)) != 0) {
+            top_slot->store(top);
+            published_top = top;
+        }
     }
 
-    uint32_t remaining_quantity = quantity - filled_quantity;
+    TopOfBook current_top() const
+    {
+        TopOfBook top{};
+        top.sequence = sequence;
+        if (top_levels == 1) {
+            Quote q = get_quote();
+            top.bids[0] = {q.bid_price, q.bid_quantity};
+            top.asks[0] = {q.ask_price, q.ask_quantity};
+            return top;
+        }
+        auto collect = [this](DepthLevel* out) {
+            return [this, out, n = 0u](const PriceLevel& level) mutable {
+                if (level.total_quantity > 0) {
+                    out[n++] = {Spec::to_price(level.price), level.total_quantity};
+                }
+                return n < top_levels;
+            };
+        };
+        ladder.walk_bids(collect(top.bids));
+        ladder.walk_asks(collect(top.asks));
+        return top;
+    }
 
-    PriceLevel& level = (side == Side::BUY) ? buy_side[price] : sell_side[price];
+    // slide the dense window along with the market, anchored on the mid when both sides are quoted
+    inline void track_touch() {
+        if (best_bid > 0 && best_ask < MAX_PRICE) {
+            ladder.track(best_bid + (best_ask - best_bid) / 2);
+        } else if (best_bid > 0) {
+            ladder.track(best_bid);
+        } else if (best_ask < MAX_PRICE) {
+            ladder.track(best_ask);
+        }
+    }
 
-    bool was_empty = level.order_ids.empty();
+    // append to the tail of the level's FIFO
+    inline void enqueue_order(PriceLevel& level, uint32_t index) {
+        Order& order = order_pool[index];
+        order.prev = level.tail;
+        order.next = NULL_INDEX;
 
-    if (level.price == 0) {
-        level.price = price;
+        if (level.tail != NULL_INDEX) {
+            order_pool[level.tail].next = index;
+        } else {
+            level.head = index;
+        }
+        level.tail = index;
     }
 
-    level.order_ids.push_back(order_id);
-    level.total_quantity += remaining_quantity;
+    // O(1) unlink from anywhere in the level's FIFO
+    inline void unlink_order(PriceLevel& level, uint32_t index) {
+        Order& order = order_pool[index];
 
-    orders.emplace(order_id, Order(order_id, side, price, remaining_quantity));
+        if (order.prev != NULL_INDEX) {
+            order_pool[order.prev].next = order.next;
+        } else {
+            level.head = order.next;
+        }
 
-    // update bitmap and best bid/ask if this level just became active
-    if (was_empty) {
-        set_level_active(price, side == Side::BUY);
+        if (order.next != NULL_INDEX) {
+            order_pool[order.next].prev = order.prev;
+        } else {
+            level.tail = order.prev;
+        }
     }
 
-    if (side == Side::BUY) {
-        if (price > best_bid) {
-            best_bid = price;
+    // unlink a resting order, return its slot to the pool and retire the level if it emptied.
+    // returns the quantity left at the level
+    inline uint32_t remove_order(PriceLevel& level, uint32_t index) {
+        Order& order = order_pool[index];
+        uint32_t price = order.price;
+        Side side = order.side;
+
+        unlink_order(level, index);
+        level.total_quantity -= order.quantity;
+        orders.erase(order.order_id);
+        order_pool.release(index);
+
+        if (!level.empty()) {
+            return level.total_quantity;
         }
-    } else {
-        if (price < best_ask) {
-            best_ask = price;
+
+        ladder.set_inactive(side, price);
+
+        if (side == Side::BUY && price == best_bid) {
+            best_bid = ladder.best_bid();
+            track_touch();
+        } else if (side == Side::SELL && price == best_ask) {
+            best_ask = ladder.best_ask();
+            track_touch();
         }
+        return 0;
     }
-}
 
-void cancel_order(uint64_t order_id)
-{
-    auto it = orders.find(order_id);
-    if (it == orders.end() || it->second.deleted) {
-        return;
+    // the store's arenas are provisioned by the store. the book's own levels are written in full by its
+    // constructor, what it would still allocate while trading is its ladders' overflow, the trigger ladder
+    // and the trigger queue, reserved here and faulted in by filling them once. a locked book locks itself too
+    void provision(const MemoryOptions& memory) {
+        if (memory.reserved_levels > 0) {
+            ladder.reserve_overflow(memory.reserved_levels);
+            stop_levels.reset(new Ladder());
+            stop_levels->reserve_overflow(memory.reserved_levels);
+            triggered.resize(memory.reserved_levels);
+            triggered.clear();
+        }
+        if (memory.lock) {
+            locked = mlock(this, sizeof(*this)) == 0;
+        }
     }
 
-    Order& order = it->second;
-    order.deleted = true;  // tombstone
-    uint32_t price = order.price;
+    // sell stops fire highest trigger first and buy stops lowest first, as bids and asks are matched, so they
+    // are kept on the bid and ask halves of the trigger ladder and its best prices are the next to fire
+    static inline Side trigger_half(Side side) { return side == Side::BUY ? Side::SELL : Side::BUY; }
 
-    PriceLevel& level = (order.side == Side::BUY) ? buy_side[price] : sell_side[price];
+    inline void link_stop(PriceLevel& level, uint32_t slot) {
+        StopOrder& stop = stop_pool[slot];
+        stop.prev = level.tail;
+        stop.next = NULL_INDEX;
+        if (level.tail != NULL_INDEX) {
+            stop_pool[level.tail].next = slot;
+        } else {
+            level.head = slot;
+        }
+        level.tail = slot;
+    }
 
-    // find and remove order_id
-    for (auto deque_it = level.order_ids.begin(); deque_it != level.order_ids.end(); ++deque_it) {
-        if (*deque_it == order_id) {
-            level.order_ids.erase(deque_it);
-            break;
+    inline void unlink_stop(PriceLevel& level, uint32_t slot) {
+        StopOrder& stop = stop_pool[slot];
+        if (stop.prev != NULL_INDEX) {
+            stop_pool[stop.prev].next = stop.next;
+        } else {
+            level.head = stop.next;
+        }
+        if (stop.next != NULL_INDEX) {
+            stop_pool[stop.next].prev = stop.prev;
+        } else {
+            level.tail = stop.prev;
         }
     }
 
-    level.total_quantity -= order.quantity;
+    // disarms a stop without reporting
+    void remove_stop(uint32_t slot) {
+        StopOrder& stop = stop_pool[slot];
+        Side half = trigger_half(stop.side);
+        PriceLevel& level = stop_levels->level(half, stop.trigger);
+        unlink_stop(level, slot);
+        level.total_quantity -= stop.quantity;
+        if (level.empty()) {
+            stop_levels->set_inactive(half, stop.trigger);
+        }
+        release_open(stop, stop.quantity);
+        orders.erase(stop.order_id);
+        stop_pool.release(slot);
+        --armed;
+    }
 
-    // update bitmap and best bid/ask if this level is now empty
-    if (level.order_ids.empty()) {
-        level.price = 0;
-        level.total_quantity = 0;
+    // a trade has moved the last trade since the stops were last looked at
+    inline void check_stops() {
+        if (armed && last_trade != checked_trade) [[unlikely]] {
+            run_stops();
+        }
+    }
 
-        bool is_bid = (order.side == Side::BUY);
-        set_level_inactive(price, is_bid);
+    // enters the stops the last trade has reached one at a time. the trades of each may reach more, which
+    // queue behind those already set off, so a cascade runs in a fixed order: stops set off by the same move
+    // enter nearest trigger first and FIFO within a trigger, those set off by a later move after them
+    [[gnu::noinline]] void run_stops() {
+        for (size_t next = 0;;) {
+            if (last_trade != checked_trade) {
+                collect_stops();
+            }
+            if (next == triggered.size()) {
+                break;
+            }
+            enter_stop(triggered[next++]);
+        }
+        triggered.clear();
+    }
 
-        if (is_bid && price == best_bid) {
-            best_bid = find_best_bid();
-        } else if (!is_bid && price == best_ask) {
-            best_ask = find_best_ask();
+    // every untriggered buy stop is above the last trade and every sell stop below it, so a move up can only
+    // reach buy stops and a move down sell stops, and the levels it crossed are the best ones of that half.
+    // each is found with the ladder's bitmap scans and taken whole
+    void collect_stops() {
+        checked_trade = last_trade;
+        for (uint32_t trigger = stop_levels->best_ask(); trigger != MAX_PRICE && trigger <= last_trade;
+             trigger = stop_levels->best_ask()) {
+            take_stop_level(Side::SELL, trigger);
+        }
+        for (uint32_t trigger = stop_levels->best_bid(); trigger != 0 && trigger >= last_trade;
+             trigger = stop_levels->best_bid()) {
+            take_stop_level(Side::BUY, trigger);
         }
+        stop_levels->track(last_trade);
     }
 
-    orders.erase(it);
-}
+    void take_stop_level(Side half, uint32_t trigger) {
+        const PriceLevel& level = stop_levels->level(half, trigger);
+        for (uint32_t i = level.head; i != NULL_INDEX; i = stop_pool[i].next) {
+            triggered.push_back(i);
+        }
+        stop_levels->set_inactive(half, trigger);
+    }
 
-void modify_order(uint64_t order_id, uint32_t new_quantity)
-{
-    auto it = orders.find(order_id);
-    if (it == orders.end()) {
-        return;
+    // the stop leaves the stop pool and the index before it enters, a remainder it rests is indexed again.
+    // what it held open while armed is released, and a remainder that rests counts again as any order's.
+    // a stop limit meets the price band as it stands when it enters
+    void enter_stop(uint32_t slot) {
+        StopOrder stop = stop_pool[slot];
+        release_open(stop, stop.quantity);
+        orders.erase(stop.order_id);
+        stop_pool.release(slot);
+        --armed;
+        report(ReportType::TRIGGER, stop.order_id, 0, stop.side, stop.trigger, stop.quantity);
+        if (price_band && stop.limit != 0 && outside_band(stop.side, stop.limit)) {
+            reject(stop.order_id, stop.side, Spec::to_price(stop.limit), stop.quantity, RejectReason::PRICE_BAND);
+            return;
+        }
+        SelfTradePrevention self_trade = risk ? risk->self_trade(stop.account) : SelfTradePrevention::NONE;
+        enter_order(stop.order_id, stop.side, stop.limit, Spec::to_price(stop.limit), stop.quantity, stop.tif,
+                    stop.account, self_trade, stop.limit == 0);
     }
 
-    Order& order = it->second;
-    uint32_t old_quantity = order.quantity;
-    uint32_t price = order.price;
+    // a market order sweeps as far as the price band allows, all the way without one
+    inline uint32_t market_price(Side side) const {
+        if (side == Side::BUY) {
+            if (price_band == 0 || best_ask == MAX_PRICE) {
+                return MAX_PRICE - 1;
+            }
+            return uint32_t(min<uint64_t>(uint64_t(best_ask) * (10000 + uint64_t(price_band)) / 10000, MAX_PRICE - 1));
+        }
+        if (price_band == 0 || best_bid == 0) {
+            return 0;
+        }
+        uint64_t scaled = uint64_t(best_bid) * (10000 - min(price_band, 10000u));
+        return uint32_t((scaled + 9999) / 10000);
+    }
 
-    PriceLevel& level = (order.side == Side::BUY) ? buy_side[price] : sell_side[price];
+    // roll_session's share for the stops, cancels every DAY stop and returns how many
+    uint32_t purge_day_stops() {
+        uint32_t purged = 0;
+        emptied_levels.clear();
+        stop_levels->for_each_level([&](Side half, PriceLevel& level) {
+            for (uint32_t i = level.head; i != NULL_INDEX;) {
+                StopOrder& stop = stop_pool[i];
+                uint32_t next = stop.next;
+                if (stop.tif == TimeInForce::DAY) {
+                    report(ReportType::CANCEL, stop.order_id, 0, stop.side, stop.trigger, stop.quantity);
+                    unlink_stop(level, i);
+                    level.total_quantity -= stop.quantity;
+                    release_open(stop, stop.quantity);
+                    orders.erase(stop.order_id);
+                    stop_pool.release(i);
+                    --armed;
+                    ++purged;
+                }
+                i = next;
+            }
+            if (level.empty()) {
+                emptied_levels.push_back({half, level.price});
+            }
+        });
+        for (const auto& [half, trigger] : emptied_levels) {
+            stop_levels->set_inactive(half, trigger);
+        }
+        return purged;
+    }
+
+    // open quantity of resting orders and armed stops, kept in the attached risk table only
+    template <typename Node>
+    inline void rest_open(const Node& node, uint32_t quantity) {
+        if (risk) {
+            risk->rest(node.account, quantity);
+        }
+    }
 
-    level.total_quantity = level.total_quantity - old_quantity + new_quantity;
-    order.quantity = new_quantity;
-}
+    template <typename Node>
+    inline void release_open(const Node& node, uint32_t quantity) {
+        if (risk) {
+            risk->release(node.account, quantity);
+        }
+    }
 
-void clear_orderbook() {
-    orders.clear();
+    // every resting order's and armed stop's quantity out of one table and into the other, either may be nullptr
+    void move_open_quantity(RiskTable* from, RiskTable* to) {
+        if (from == to) {
+            return;
+        }
+        auto move = [&](const auto& pool, Ladder& levels) {
+            levels.for_each_level([&](Side, PriceLevel& level) {
+                for (uint32_t i = level.head; i != NULL_INDEX; i = pool[i].next) {
+                    if (from) {
+                        from->release(pool[i].account, pool[i].quantity);
+                    }
+                    if (to) {
+                        to->rest(pool[i].account, pool[i].quantity);
+                    }
+                }
+            });
+        };
+        move(order_pool, ladder);
+        if (armed) {
+            move(stop_pool, *stop_levels);
+        }
+    }
 
-    // reset arrays
-    for (uint32_t i = 0; i < MAX_PRICE; i++) {
-        buy_side[i] = PriceLevel{};
-        sell_side[i] = PriceLevel{};
+    // buy priced above the best ask, or sell below the best bid, by more than the band
+    inline bool outside_band(Side side, uint32_t price) const {
+        if (side == Side::BUY) {
+            return best_ask < MAX_PRICE && uint64_t(price) * 10000 > uint64_t(best_ask) * (10000 + uint64_t(price_band));
+        }
+        return best_bid > 0 && uint64_t(price) * 10000 < uint64_t(best_bid) * (10000 - min(price_band, 10000u));
     }
 
-    // reset bitmaps
-    for (uint32_t i = 0; i < BITMAP_SIZE; i++) {
-        bid_bitmap[i] = 0;
-        ask_bitmap[i] = 0;
+    // drop every order queued at a level from the store
+    void release_level(PriceLevel& level) {
+        for (uint32_t i = level.head; i != NULL_INDEX; ) {
+            uint32_t next = order_pool[i].next;
+            release_open(order_pool[i], order_pool[i].quantity);
+            orders.erase(order_pool[i].order_id);
+            order_pool.release(i);
+            i = next;
+        }
     }
 
-    // reset best prices
-    best_bid = 0;
-    best_ask = MAX_PRICE;
-}
+    // price in price units, everything from the ack on works in ticks
+    void place_order(uint64_t order_id, Side side, uint32_t submitted_price, uint32_t quantity, TimeInForce tif,
+                     uint16_t account)
+    {
+        // bounds and tick check for price
+        if (submitted_price >= MAX_PRICE || !Spec::on_tick(submitted_price)) {
+            reject(order_id, side, submitted_price, quantity, RejectReason::PRICE);
+            return;
+        }
+        uint32_t price = Spec::to_ticks(submitted_price);
+
+        // an id already resting or armed is refused whole, before anything is acknowledged or matched
+        if (orders.find(order_id) != NULL_INDEX) {
+            reject(order_id, side, submitted_price, quantity, RejectReason::DUPLICATE);
+            return;
+        }
+
+        // risk stage, a rejected order is never acknowledged
+        SelfTradePrevention self_trade = SelfTradePrevention::NONE;
+        if (risk) {
+            RejectReason reason = risk->check(account, submitted_price, quantity);
+            if (reason != RejectReason::NONE) {
+                reject(order_id, side, submitted_price, quantity, reason);
+                return;
+            }
+            self_trade = risk->self_trade(account);
+        }
+        if (price_band && outside_band(side, price)) {
+            reject(order_id, side, submitted_price, quantity, RejectReason::PRICE_BAND);
+            return;
+        }
+
+        report(ReportType::ACK, order_id, 0, side, price, quantity);
+        enter_order(order_id, side, price, submitted_price, quantity, tif, account, self_trade, false);
+    }
+
+    // matching and resting for an order past its checks, price in ticks. a market order is priced here and
+    // whatever it does not fill is rejected
+    void enter_order(uint64_t order_id, Side side, uint32_t price, uint32_t submitted_price, uint32_t quantity,
+                     TimeInForce tif, uint16_t account, SelfTradePrevention self_trade, bool market)
+    {
+        if (market) [[unlikely]] {
+            price = market_price(side);
+        }
+
+        uint32_t filled_quantity = 0;
+        uint32_t prevented_quantity = 0;
+
+        // try to fill first
+        fill_order(order_id, side, price, quantity, account, self_trade, filled_quantity, prevented_quantity);
+
+        // what self-trade prevention took off the order is not rested
+        if (prevented_quantity > 0) [[unlikely]] {
+            reject(order_id, side, submitted_price, prevented_quantity, RejectReason::SELF_TRADE);
+        }
+
+        if (filled_quantity + prevented_quantity >= quantity)
+        {
+            return; // fully filled
+        }
+
+        uint32_t remaining_quantity = quantity - filled_quantity - prevented_quantity;
+
+        if (market) [[unlikely]] {
+            reject(order_id, side, submitted_price, remaining_quantity, RejectReason::LIQUIDITY);
+            return;
+        }
+
+        uint32_t index = order_pool.allocate();
+        if (index == NULL_INDEX) {
+            // pool exhausted, remainder is not rested
+            reject(order_id, side, submitted_price, remaining_quantity, RejectReason::CAPACITY);
+            return;
+        }
+
+        // place_order and add_stop refuse taken ids, so this only keeps the index whole if a caller slips past them
+        if (!orders.insert(order_id, index)) {
+            order_pool.release(index);
+            reject(order_id, side, submitted_price, remaining_quantity, RejectReason::DUPLICATE);
+            return;
+        }
+
+        order_pool[index] = Order(order_id, side, price, remaining_quantity, tif, account);
+        order_pool[index].book = book_id;
+        rest_open(order_pool[index], remaining_quantity);
+
+        PriceLevel& level = ladder.level(side, price);
+
+        bool was_empty = level.empty();
+
+        level.price = price;
+        enqueue_order(level, index);
+        level.total_quantity += remaining_quantity;
+        report_level(side, price, level.total_quantity);
+
+        // update bitmap and best bid/ask if this level just became active
+        if (was_empty) {
+            ladder.set_active(side, price);
+        }
+
+        if (side == Side::BUY) {
+            if (price > best_bid) {
+                best_bid = price;
+                track_touch();
+            }
+        } else {
+            if (price < best_ask) {
+                best_ask = price;
+                track_touch();
+            }
+        }
+    }
+
+    // the resting order at index, head of level, belongs to the incoming order's own account. returns false when
+    // the incoming order is to stop matching. kept out of line, the matching loops only pay for the account compare
+    [[gnu::noinline]] bool prevent_self_trade(SelfTradePrevention mode, PriceLevel& level, uint32_t index,
+                                              uint32_t& remaining, uint32_t& prevented_quantity, uint32_t& touched_price)
+    {
+        if (mode == SelfTradePrevention::CANCEL_NEWEST) {
+            prevented_quantity += remaining;
+            remaining = 0;
+            return false;
+        }
+        Order& resting_order = order_pool[index];
+        uint64_t resting_id = resting_order.order_id;
+        Side resting_side = resting_order.side;
+        uint32_t level_price = resting_order.price;
+        uint32_t cut = resting_order.quantity;
+        if (mode == SelfTradePrevention::DECREMENT) {
+            cut = min(cut, remaining);
+            prevented_quantity += cut;
+            remaining -= cut;
+        }
+
+        release_open(resting_order, cut);
+        if (cut < resting_order.quantity) {
+            resting_order.quantity -= cut;
+            level.total_quantity -= cut;
+            report(ReportType::MODIFY, resting_id, 0, resting_side, level_price, resting_order.quantity);
+            touched_price = level_price;
+            return true;
+        }
+
+        report(ReportType::CANCEL, resting_id, 0, resting_side, level_price, cut);
+        if (remove_order(level, index) == 0) {
+            report_level(resting_side, level_price, 0);
+            touched_price = NULL_INDEX;
+        } else {
+            touched_price = level_price;
+        }
+        return true;
+    }
+
+    // prevented_quantity is what self-trade prevention took off the incoming order without a fill
+    void fill_order(uint64_t order_id, Side side, uint32_t price, uint32_t quantity, uint16_t account,
+                    SelfTradePrevention self_trade, uint32_t& filled_quantity, uint32_t& prevented_quantity)
+    {
+        uint32_t remaining = quantity;
+        filled_quantity = 0;
+        prevented_quantity = 0;
+
+        // level updates are coalesced to one per level crossed
+        uint32_t touched_price = NULL_INDEX;
+
+        if (side == Side::BUY)
+        {
+            // match against sells
+            while (remaining > 0 && best_ask < MAX_PRICE && best_ask <= price)
+            {
+                PriceLevel& level = ladder.level(Side::SELL, best_ask);
+                if (level.empty()) {
+                    ladder.set_inactive(Side::SELL, best_ask);
+                    best_ask = ladder.best_ask();
+                    continue;
+                }
+
+                uint32_t resting_index = level.head;
+                Order& resting_order = order_pool[resting_index];
+
+                if (self_trade != SelfTradePrevention::NONE && resting_order.account == account) [[unlikely]] {
+                    if (!prevent_self_trade(self_trade, level, resting_index, remaining, prevented_quantity, touched_price)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                uint32_t match_quantity = min(remaining, resting_order.quantity);
+                report(ReportType::FILL, order_id, resting_order.order_id, side, best_ask, match_quantity);
+                remaining -= match_quantity;
+                filled_quantity += match_quantity;
+
+                resting_order.quantity -= match_quantity;
+                level.total_quantity -= match_quantity;
+                release_open(resting_order, match_quantity);
+                touched_price = best_ask;
+                last_trade = best_ask;
+
+                if (resting_order.quantity == 0) {
+                    uint32_t level_price = best_ask;
+                    if (remove_order(level, resting_index) == 0) {
+                        report_level(Side::SELL, level_price, 0);
+                        touched_price = NULL_INDEX;
+                    }
+                }
+            }
+
+            // one update for the level the sweep stopped inside
+            if (touched_price != NULL_INDEX) {
+                report_level(Side::SELL, touched_price, ladder.find(Side::SELL, touched_price)->total_quantity);
+            }
+        }
+        else // SELL
+        {
+            // match against buys
+            while (remaining > 0 && best_bid > 0 && best_bid >= price)
+            {
+                PriceLevel& level = ladder.level(Side::BUY, best_bid);
+                if (level.empty()) {
+                    ladder.set_inactive(Side::BUY, best_bid);
+                    best_bid = ladder.best_bid();
+                    continue;
+                }
+
+                uint32_t resting_index = level.head;
+                Order& resting_order = order_pool[resting_index];
+
+                if (self_trade != SelfTradePrevention::NONE && resting_order.account == account) [[unlikely]] {
+                    if (!prevent_self_trade(self_trade, level, resting_index, remaining, prevented_quantity, touched_price)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                uint32_t match_quantity = min(remaining, resting_order.quantity);
+                report(ReportType::FILL, order_id, resting_order.order_id, side, best_bid, match_quantity);
+                remaining -= match_quantity;
+                filled_quantity += match_quantity;
+
+                resting_order.quantity -= match_quantity;
+                level.total_quantity -= match_quantity;
+                release_open(resting_order, match_quantity);
+                touched_price = best_bid;
+                last_trade = best_bid;
+
+                if (resting_order.quantity == 0) {
+                    uint32_t level_price = best_bid;
+                    if (remove_order(level, resting_index) == 0) {
+                        report_level(Side::BUY, level_price, 0);
+                        touched_price = NULL_INDEX;
+                    }
+                }
+            }
+
+            // one update for the level the sweep stopped inside
+            if (touched_price != NULL_INDEX) {
+                report_level(Side::BUY, touched_price, ladder.find(Side::BUY, touched_price)->total_quantity);
+            }
+        }
+    }
+
+    unique_ptr<OrderStore> owned_store;
+    OrderPool& order_pool;
+    OrderIndex& orders;
+    StopPool& stop_pool;
+    uint32_t book_id;
+
+    Ladder ladder;
+
+    // track best prices for speed, in ticks
+    uint32_t best_bid = 0;
+    uint32_t best_ask = MAX_PRICE;
+
+    Sink sink;
+    uint64_t sequence = 0;
+
+    // publish_top target and the last record stored there, compared so unchanged tops are not republished
+    TopOfBookSlot* top_slot = nullptr;
+    uint32_t top_levels = 1;
+    TopOfBook published_top{};
+
+    // set_risk table and set_price_band collar, neither is checked until set
+    RiskTable* risk = nullptr;
+    uint32_t price_band = 0;
+
+    // trigger levels of the armed stops, created with the first. last_trade is in ticks, 0 before any trade,
+    // and checked_trade is what it was when the stops were last collected
+    unique_ptr<Ladder> stop_levels;
+    uint32_t armed = 0;
+    uint32_t last_trade = 0;
+    uint32_t checked_trade = 0;
+    vector<uint32_t> triggered;  // run_stops queue, keeps its capacity
+    bool locked = false;
+
+    // roll_session scratch, keeps its capacity between sessions
+    vector<pair<Side, uint32_t>> emptied_levels;
+
+    // declared after the store so a running writer is joined before the pool and index go away
+    unique_ptr<BackgroundSnapshot> background;
+    bool snapshot_active = false;
+};
+
+using Orderbook = BasicOrderbook<>;
 
 #endif // ORDERBOOK_H
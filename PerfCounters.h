@@ -0,0 +1,277 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// hardware event counts of the calling thread, read around single operations by the benchmark harness.
+// the events are opened as one perf_event_open group, so they are scheduled onto the PMU together and a
+// delta between two samples covers the same instructions for every counter. only user space is counted.
+// where the kernel allows it the counters are read with rdpmc from their mmapped pages, tens of cycles a
+// sample, otherwise with one read() of the group. events the cpu or the kernel does not offer are left out,
+// and when none can be opened open() returns false and error() says why, so callers print that and go on.
+
+enum CounterId : uint32_t { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES, COUNTERS };
+
+inline const char* counter_name(uint32_t counter) {
+    static const char* names[COUNTERS] = {"cycles", "instructions", "L1D miss", "LLC miss", "dTLB miss", "branch miss"};
+    return names[counter];
+}
+
+struct CounterSample {
+    uint64_t values[COUNTERS] = {};
+};
+
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    ~PerfCounters() { close(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // opens and starts every counter it can for the calling thread. false if none could be opened
+    bool open() {
+        close();
+#if defined(__linux__)
+        for (uint32_t c = 0; c < COUNTERS; c++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = c == L1D_MISSES || c == LLC_MISSES || c == DTLB_MISSES ? PERF_TYPE_HW_CACHE : PERF_TYPE_HARDWARE;
+            attr.config = event_config(c);
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0) {
+                if (reason.empty()) {
+                    reason = string(counter_name(c)) + ": " + describe(errno);
+                }
+                continue;
+            }
+            fds[c] = fd;
+            if (leader < 0) {
+                leader = fd;
+            }
+            // position of this counter in a group read
+            slot[c] = opened++;
+        }
+        if (opened == 0) {
+            return false;
+        }
+
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+        // a group the PMU cannot hold at once never runs, and its counts stay 0
+        GroupRead group;
+        if (::read(leader, &group, sizeof(group)) <= 0 || group.time_running == 0) {
+            close();
+            reason = "the events could not be scheduled together on the PMU";
+            return false;
+        }
+
+        user_reads = map_pages();
+        return true;
+#else
+        reason = "perf_event_open is linux only";
+        return false;
+#endif
+    }
+
+    void close() {
+#if defined(__linux__)
+        for (uint32_t c = 0; c < COUNTERS; c++) {
+            if (pages[c]) {
+                munmap(pages[c], page_bytes());
+                pages[c] = nullptr;
+            }
+            if (fds[c] >= 0) {
+                ::close(fds[c]);
+                fds[c] = -1;
+            }
+        }
+#endif
+        leader = -1;
+        opened = 0;
+        user_reads = false;
+        reason.clear();
+    }
+
+    bool available() const { return opened > 0; }
+    bool has(uint32_t counter) const { return fds[counter] >= 0; }
+    // read with rdpmc rather than a system call
+    bool user_space_reads() const { return user_reads; }
+    // why the first counter that failed could not be opened, empty if all of them were
+    const string& error() const { return reason; }
+
+    // counts so far, counters that are not open read 0
+    inline void read(CounterSample& sample) const {
+#if defined(__linux__)
+#if defined(__x86_64__) || defined(__i386__)
+        if (user_reads) {
+            _mm_lfence();
+            for (uint32_t c = 0; c < COUNTERS; c++) {
+                sample.values[c] = pages[c] ? read_page(pages[c]) : 0;
+            }
+            _mm_lfence();
+            return;
+        }
+#endif
+        GroupRead group;
+        if (opened == 0 || ::read(leader, &group, sizeof(group)) <= 0) {
+            sample = CounterSample();
+            return;
+        }
+        for (uint32_t c = 0; c < COUNTERS; c++) {
+            sample.values[c] = fds[c] >= 0 ? group.values[slot[c]] : 0;
+        }
+#else
+        sample = CounterSample();
+#endif
+    }
+
+private:
+#if defined(__linux__)
+    struct GroupRead {
+        uint64_t count;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[COUNTERS];
+    };
+
+    static uint64_t event_config(uint32_t counter) {
+        auto cache = [](uint64_t cache, uint64_t op, uint64_t result) { return cache | (op << 8) | (result << 16); };
+        switch (counter) {
+            case CYCLES:
+                return PERF_COUNT_HW_CPU_CYCLES;
+            case INSTRUCTIONS:
+                return PERF_COUNT_HW_INSTRUCTIONS;
+            case L1D_MISSES:
+                return cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+            case LLC_MISSES:
+                return cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+            case DTLB_MISSES:
+                return cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+            default:
+                return PERF_COUNT_HW_BRANCH_MISSES;
+        }
+    }
+
+    static string describe(int error) {
+        string text = strerror(error);
+        if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV) {
+            text += " (no hardware PMU event, common under virtualization)";
+        } else if (error == EACCES || error == EPERM) {
+            FILE* file = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+            int paranoid = 0;
+            if (file && fscanf(file, "%d", &paranoid) == 1) {
+                text += " (perf_event_paranoid is " + to_string(paranoid) + ")";
+            }
+            if (file) {
+                fclose(file);
+            }
+        }
+        return text;
+    }
+
+    static size_t page_bytes() { return size_t(sysconf(_SC_PAGESIZE)); }
+
+    // rdpmc needs every open counter's page to allow it and the counter to be live on the PMU
+    bool map_pages() {
+#if defined(__x86_64__) || defined(__i386__)
+        for (uint32_t c = 0; c < COUNTERS; c++) {
+            if (fds[c] < 0) {
+                continue;
+            }
+            void* page = mmap(nullptr, page_bytes(), PROT_READ, MAP_SHARED, fds[c], 0);
+            if (page == MAP_FAILED) {
+                return false;
+            }
+            pages[c] = static_cast<perf_event_mmap_page*>(page);
+            if (!pages[c]->cap_user_rdpmc || pages[c]->index == 0) {
+                return false;
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // the kernel's offset plus the live hardware count, retried if the kernel updated the page meanwhile
+    static inline uint64_t read_page(const perf_event_mmap_page* page) {
+        uint32_t sequence;
+        uint64_t count;
+        do {
+            sequence = page->lock;
+            asm volatile("" ::: "memory");
+            uint32_t index = page->index;
+            count = page->offset;
+            if (index) {
+                uint32_t width = page->pmc_width;
+                int64_t pmc = int64_t(__rdpmc(int(index - 1)));
+                count += uint64_t((pmc << (64 - width)) >> (64 - width));
+            }
+            asm volatile("" ::: "memory");
+        } while (page->lock != sequence);
+        return count;
+    }
+#endif
+
+    perf_event_mmap_page* pages[COUNTERS] = {};
+#endif
+
+    int fds[COUNTERS] = {-1, -1, -1, -1, -1, -1};
+    uint32_t slot[COUNTERS] = {};
+    int leader = -1;
+    uint32_t opened = 0;
+    bool user_reads = false;
+    string reason;
+};
+
+// per-operation totals of counter deltas, turned into averages per operation when reported
+struct CounterTotals {
+    uint64_t operations = 0;
+    uint64_t values[COUNTERS] = {};
+
+    inline void add(const CounterSample& before, const CounterSample& after) {
+        ++operations;
+        for (uint32_t c = 0; c < COUNTERS; c++) {
+            values[c] += after.values[c] - before.values[c];
+        }
+    }
+
+    void reset() { *this = CounterTotals(); }
+
+    // mean per operation, less the mean of overhead (an empty read pair, or nothing), never below 0
+    double mean(uint32_t counter, const CounterTotals& overhead) const {
+        if (operations == 0) {
+            return 0;
+        }
+        double value = double(values[counter]) / operations;
+        if (overhead.operations) {
+            value -= double(overhead.values[counter]) / overhead.operations;
+        }
+        return value > 0 ? value : 0;
+    }
+};
+
+#endif // PERFCOUNTERS_H
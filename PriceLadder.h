@@ -0,0 +1,522 @@
+#ifndef PRICELADDER_H
+#define PRICELADDER_H
+
+#include "OrderUtils.h"
+#include "LevelBitmap.h"
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// quantities of consecutive prices, quantities[i] rests at first_price + i and is 0 where no level rests
+struct QuantitySpan {
+    const uint32_t* quantities;
+    uint32_t count;
+    uint32_t first_price;
+};
+
+// dense levels kept around the touch by default
+constexpr uint32_t LADDER_WINDOW = 2048;
+
+// price levels for both sides of one book. a window of Window prices around the touch is held
+// as a ring of dense levels indexed by price & (Window - 1), so sliding the window only moves
+// the levels that cross its edges. levels outside the window live in small sorted overflow vectors.
+// when the window moves, levels leaving it are evicted to overflow and overflow levels it now covers are
+// pulled in, so overflow never holds a price inside the window.
+// the window is a book parameter, a narrower one shrinks the book for instruments that trade near the touch
+template <uint32_t Window>
+class BasicPriceLadder {
+public:
+    static_assert((Window & (Window - 1)) == 0 && Window >= 64, "the ladder window must be a power of two, 64 or more");
+
+    static constexpr uint32_t WINDOW = Window;
+    static constexpr uint32_t MASK = Window - 1;
+    static constexpr uint32_t NONE = LevelBitmap<Window>::NONE;
+
+    inline bool in_window(uint32_t price) const {
+        return price - base < WINDOW;
+    }
+
+    // level at price, an overflow level is created if it does not exist yet
+    inline PriceLevel& level(Side side, uint32_t price) {
+        if (in_window(price)) {
+            return (side == Side::BUY ? bid_window : ask_window)[price & MASK];
+        }
+        return overflow_level(side == Side::BUY ? bid_overflow : ask_overflow, price);
+    }
+
+    // nullptr if no level exists at price
+    inline const PriceLevel* find(Side side, uint32_t price) const {
+        if (in_window(price)) {
+            return &(side == Side::BUY ? bid_window : ask_window)[price & MASK];
+        }
+        const vector<PriceLevel>& overflow = side == Side::BUY ? bid_overflow : ask_overflow;
+        auto it = lower_bound_price(overflow, price);
+        return (it != overflow.end() && it->price == price) ? &*it : nullptr;
+    }
+
+    // nullptr outside the window, never searches overflow
+    inline const PriceLevel* find_window(Side side, uint32_t price) const {
+        return in_window(price) ? &(side == Side::BUY ? bid_window : ask_window)[price & MASK] : nullptr;
+    }
+
+    // window levels only, an overflow lookup is a search anyway
+    [[gnu::always_inline]] inline void prefetch(Side side, uint32_t price) const {
+        if (in_window(price)) {
+            __builtin_prefetch(&(side == Side::BUY ? bid_window : ask_window)[price & MASK], 1);
+        }
+    }
+
+    // overflow levels are active while they exist, so only window levels carry a bit
+    inline void set_active(Side side, uint32_t price) {
+        if (in_window(price)) {
+            (side == Side::BUY ? bid_bitmap : ask_bitmap).set(price & MASK);
+        }
+    }
+
+    // mirrors a level's new total into the dense quantity array, window prices only
+    inline void set_quantity(Side side, uint32_t price, uint32_t quantity) {
+        if (in_window(price)) {
+            (side == Side::BUY ? bid_quantity : ask_quantity)[price & MASK] = quantity;
+        }
+    }
+
+    // resets the level, the caller must not use it afterwards
+    inline void set_inactive(Side side, uint32_t price) {
+        if (in_window(price)) {
+            (side == Side::BUY ? bid_window : ask_window)[price & MASK] = PriceLevel{};
+            (side == Side::BUY ? bid_quantity : ask_quantity)[price & MASK] = 0;
+            (side == Side::BUY ? bid_bitmap : ask_bitmap).clear(price & MASK);
+            return;
+        }
+        vector<PriceLevel>& overflow = side == Side::BUY ? bid_overflow : ask_overflow;
+        auto it = lower_bound_price(overflow, price);
+        if (it != overflow.end() && it->price == price) {
+            overflow.erase(it);
+        }
+    }
+
+    // highest active bid, 0 when there is none
+    inline uint32_t best_bid() const {
+        uint32_t best = highest_at_or_below(bid_bitmap, base + MASK);
+        if (!bid_overflow.empty() && (best == NONE || bid_overflow.back().price > best)) {
+            best = bid_overflow.back().price;
+        }
+        return best == NONE ? 0 : best;
+    }
+
+    // lowest active ask, MAX_PRICE when there is none
+    inline uint32_t best_ask() const {
+        uint32_t best = lowest_at_or_above(ask_bitmap, base);
+        if (!ask_overflow.empty() && (best == NONE || ask_overflow.front().price < best)) {
+            best = ask_overflow.front().price;
+        }
+        return best == NONE ? MAX_PRICE : best;
+    }
+
+    // next active bid below price, 0 when there is none
+    inline uint32_t next_bid_level(uint32_t price) const {
+        uint32_t next = NONE;
+        if (price > base) {
+            next = highest_at_or_below(bid_bitmap, min(price - 1, base + MASK));
+        }
+        auto it = lower_bound_price(bid_overflow, price);
+        if (it != bid_overflow.begin() && (next == NONE || prev(it)->price > next)) {
+            next = prev(it)->price;
+        }
+        return next == NONE ? 0 : next;
+    }
+
+    // next active ask above price, MAX_PRICE when there is none
+    inline uint32_t next_ask_level(uint32_t price) const {
+        uint32_t next = NONE;
+        if (price < base + MASK) {
+            next = lowest_at_or_above(ask_bitmap, max(price + 1, base));
+        }
+        auto it = upper_bound_price(ask_overflow, price);
+        if (it != ask_overflow.end() && (next == NONE || it->price < next)) {
+            next = it->price;
+        }
+        return next == NONE ? MAX_PRICE : next;
+    }
+
+    // visits active bid levels best first while visit returns true
+    template <typename Visit>
+    void walk_bids(Visit visit) const {
+        // overflow above the window, then the window from the top down, then overflow below it
+        auto split = lower_bound_price(bid_overflow, base + WINDOW);
+        for (auto it = bid_overflow.end(); it != split;) {
+            if (!visit(*--it)) {
+                return;
+            }
+        }
+        uint32_t start = base & MASK;
+        if (start > 0 && !walk_down(bid_bitmap, bid_window, start - 1, 0, visit)) {
+            return;
+        }
+        if (!walk_down(bid_bitmap, bid_window, MASK, start, visit)) {
+            return;
+        }
+        for (auto it = lower_bound_price(bid_overflow, base); it != bid_overflow.begin();) {
+            if (!visit(*--it)) {
+                return;
+            }
+        }
+    }
+
+    // visits active ask levels best first while visit returns true
+    template <typename Visit>
+    void walk_asks(Visit visit) const {
+        auto split = lower_bound_price(ask_overflow, base);
+        for (auto it = ask_overflow.begin(); it != split; ++it) {
+            if (!visit(*it)) {
+                return;
+            }
+        }
+        uint32_t start = base & MASK;
+        if (!walk_up(ask_bitmap, ask_window, start, MASK, visit)) {
+            return;
+        }
+        if (start > 0 && !walk_up(ask_bitmap, ask_window, 0, start - 1, visit)) {
+            return;
+        }
+        for (auto it = lower_bound_price(ask_overflow, base + WINDOW); it != ask_overflow.end(); ++it) {
+            if (!visit(*it)) {
+                return;
+            }
+        }
+    }
+
+    // keeps the anchor (normally the mid) inside the middle half of the window
+    inline void track(uint32_t anchor) {
+        if (anchor - base >= WINDOW / 4 && anchor - base < WINDOW - WINDOW / 4) {
+            return;
+        }
+        recenter(anchor);
+    }
+
+    void recenter(uint32_t anchor) {
+        uint32_t new_base = anchor > WINDOW / 2 ? anchor - WINDOW / 2 : 0;
+        new_base = min(new_base, MAX_PRICE - WINDOW);
+        if (new_base == base) {
+            return;
+        }
+
+        // evict the prices the window slides off
+        uint32_t evict_lo = base;
+        uint32_t evict_hi = base + WINDOW;
+        if (new_base > base && new_base - base < WINDOW) {
+            evict_hi = new_base;
+        } else if (new_base < base && base - new_base < WINDOW) {
+            evict_lo = new_base + WINDOW;
+        }
+        evict(bid_window, bid_quantity, bid_bitmap, bid_overflow, evict_lo, evict_hi);
+        evict(ask_window, ask_quantity, ask_bitmap, ask_overflow, evict_lo, evict_hi);
+
+        base = new_base;
+
+        admit(bid_window, bid_quantity, bid_bitmap, bid_overflow);
+        admit(ask_window, ask_quantity, ask_bitmap, ask_overflow);
+        ++recenters;
+    }
+
+    // visits every active level as (side, level), window levels in slot order. only set bits are visited,
+    // so the cost follows the levels in use rather than the window size. visit must not activate or retire levels
+    template <typename Visit>
+    void for_each_level(Visit visit) {
+        auto bid_visit = [this, &visit](uint32_t slot) { visit(Side::BUY, bid_window[slot]); return true; };
+        auto ask_visit = [this, &visit](uint32_t slot) { visit(Side::SELL, ask_window[slot]); return true; };
+        bid_bitmap.walk_up(0, MASK, bid_visit);
+        ask_bitmap.walk_up(0, MASK, ask_visit);
+        for (PriceLevel& level : bid_overflow) {
+            visit(Side::BUY, level);
+        }
+        for (PriceLevel& level : ask_overflow) {
+            visit(Side::SELL, level);
+        }
+    }
+
+    // reserves room for levels overflow levels per side, prefaulted, so prices away from the window do not
+    // allocate until more than that many rest out there
+    void reserve_overflow(uint32_t levels) {
+        for (vector<PriceLevel>* overflow : {&bid_overflow, &ask_overflow}) {
+            if (overflow->empty()) {
+                overflow->resize(levels);
+                overflow->clear();
+            }
+        }
+    }
+
+    // inactive window levels are already reset, so only the active ones are written back
+    void clear() {
+        auto bid_reset = [this](uint32_t slot) { bid_window[slot] = PriceLevel{}; bid_quantity[slot] = 0; return true; };
+        auto ask_reset = [this](uint32_t slot) { ask_window[slot] = PriceLevel{}; ask_quantity[slot] = 0; return true; };
+        bid_bitmap.walk_up(0, MASK, bid_reset);
+        ask_bitmap.walk_up(0, MASK, ask_reset);
+        bid_bitmap.reset();
+        ask_bitmap.reset();
+        bid_overflow.clear();
+        ask_overflow.clear();
+    }
+
+    // visits the quantities of side from price first to price last, both inclusive and first the better one,
+    // as QuantitySpans in book order while visit returns true. each window stretch that does not wrap the ring
+    // is one span, every overflow level a span of one. quantities are only current between book operations
+    template <typename Visit>
+    void for_each_span(Side side, uint32_t first, uint32_t last, Visit visit) const {
+        bool bids = side == Side::BUY;
+        uint32_t lo = bids ? last : first;
+        uint32_t hi = bids ? first : last;
+        if (lo > hi) {
+            return;
+        }
+        const vector<PriceLevel>& overflow = bids ? bid_overflow : ask_overflow;
+        auto overflow_span = [](const PriceLevel& level) { return QuantitySpan{&level.total_quantity, 1, level.price}; };
+
+        // overflow on the better side of the window, the window, then overflow on the far side
+        uint32_t window_lo = max(lo, base);
+        uint32_t window_hi = min(hi, base + MASK);
+        auto below = lower_bound_price(overflow, base);
+        auto above = lower_bound_price(overflow, base + WINDOW);
+
+        if (bids) {
+            for (auto it = upper_bound_price(overflow, hi); it > above;) {
+                if (--it; it->price < lo || !visit(overflow_span(*it))) {
+                    return;
+                }
+            }
+        } else {
+            for (auto it = lower_bound_price(overflow, lo); it < below; ++it) {
+                if (it->price > hi || !visit(overflow_span(*it))) {
+                    return;
+                }
+            }
+        }
+
+        if (window_lo <= window_hi) {
+            const uint32_t* quantity = bids ? bid_quantity : ask_quantity;
+            uint32_t slot_lo = window_lo & MASK;
+            uint32_t slot_hi = window_hi & MASK;
+            if (slot_lo <= slot_hi) {
+                if (!visit(QuantitySpan{quantity + slot_lo, window_hi - window_lo + 1, window_lo})) {
+                    return;
+                }
+            } else {
+                // wraps the ring: the low prices run to the end of the array, the high ones start at slot 0
+                QuantitySpan low{quantity + slot_lo, WINDOW - slot_lo, window_lo};
+                QuantitySpan high{quantity, slot_hi + 1, window_hi - slot_hi};
+                if (!visit(bids ? high : low) || !visit(bids ? low : high)) {
+                    return;
+                }
+            }
+        }
+
+        if (bids) {
+            for (auto it = min(below, upper_bound_price(overflow, hi)); it != overflow.begin();) {
+                if (--it; it->price < lo || !visit(overflow_span(*it))) {
+                    return;
+                }
+            }
+        } else {
+            for (auto it = max(above, lower_bound_price(overflow, lo)); it != overflow.end(); ++it) {
+                if (it->price > hi || !visit(overflow_span(*it))) {
+                    return;
+                }
+            }
+        }
+    }
+
+    // snapshot support. the window, bitmaps and base are written raw and the overflow levels follow them.
+    // write(const void*, size_t) is called in order and nothing here allocates, so it is safe in a forked child
+    template <typename Write>
+    void write_raw(Write write) const {
+        uint64_t header[4] = {base, recenters, bid_overflow.size(), ask_overflow.size()};
+        write(header, sizeof(header));
+        write(bid_window, sizeof(bid_window));
+        write(ask_window, sizeof(ask_window));
+        write(&bid_bitmap, sizeof(bid_bitmap));
+        write(&ask_bitmap, sizeof(ask_bitmap));
+        write(bid_overflow.data(), bid_overflow.size() * sizeof(PriceLevel));
+        write(ask_overflow.data(), ask_overflow.size() * sizeof(PriceLevel));
+    }
+
+    // reads length bytes of write_raw output, read(void*, size_t) returns false when the data runs short
+    template <typename Read>
+    bool read_raw(Read read, size_t length) {
+        uint64_t header[4];
+        if (!read(header, sizeof(header)) || header[0] > MAX_PRICE - WINDOW ||
+            header[2] > length || header[3] > length ||
+            length != fixed_raw_bytes() + (header[2] + header[3]) * sizeof(PriceLevel)) {
+            return false;
+        }
+        base = header[0];
+        recenters = header[1];
+        bid_overflow.resize(header[2]);
+        ask_overflow.resize(header[3]);
+        bool ok = read(bid_window, sizeof(bid_window)) && read(ask_window, sizeof(ask_window)) &&
+                  read(&bid_bitmap, sizeof(bid_bitmap)) && read(&ask_bitmap, sizeof(ask_bitmap)) &&
+                  read(bid_overflow.data(), bid_overflow.size() * sizeof(PriceLevel)) &&
+                  read(ask_overflow.data(), ask_overflow.size() * sizeof(PriceLevel));
+        // the quantity mirror is derived, so it is rebuilt rather than stored
+        for (uint32_t i = 0; i < WINDOW; i++) {
+            bid_quantity[i] = bid_window[i].total_quantity;
+            ask_quantity[i] = ask_window[i].total_quantity;
+        }
+        return ok;
+    }
+
+    // after read_raw: true if every window level without its bit set is empty, so nothing outside the
+    // bitmap carries links into the pool
+    bool inactive_levels_empty() const {
+        for (uint32_t slot = 0; slot < WINDOW; slot++) {
+            if ((!bid_bitmap.test(slot) && !bid_window[slot].empty()) ||
+                (!ask_bitmap.test(slot) && !ask_window[slot].empty())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // bytes write_raw produces
+    size_t raw_bytes() const {
+        return fixed_raw_bytes() + (bid_overflow.size() + ask_overflow.size()) * sizeof(PriceLevel);
+    }
+
+    uint32_t window_base() const { return base; }
+    uint32_t overflow_levels() const { return bid_overflow.size() + ask_overflow.size(); }
+    uint64_t recenter_count() const { return recenters; }
+
+private:
+    using Bitmap = LevelBitmap<WINDOW>;
+
+    static constexpr size_t fixed_raw_bytes() {
+        return 4 * sizeof(uint64_t) + 2 * WINDOW * sizeof(PriceLevel) + 2 * sizeof(Bitmap);
+    }
+
+    static inline vector<PriceLevel>::const_iterator lower_bound_price(const vector<PriceLevel>& overflow, uint32_t price) {
+        return lower_bound(overflow.begin(), overflow.end(), price,
+            [](const PriceLevel& level, uint32_t p) { return level.price < p; });
+    }
+
+    static inline vector<PriceLevel>::const_iterator upper_bound_price(const vector<PriceLevel>& overflow, uint32_t price) {
+        return upper_bound(overflow.begin(), overflow.end(), price,
+            [](uint32_t p, const PriceLevel& level) { return p < level.price; });
+    }
+
+    static inline PriceLevel& overflow_level(vector<PriceLevel>& overflow, uint32_t price) {
+        auto it = overflow.begin() + (lower_bound_price(overflow, price) - overflow.begin());
+        if (it == overflow.end() || it->price != price) {
+            PriceLevel level;
+            level.price = price;
+            it = overflow.insert(it, level);
+        }
+        return *it;
+    }
+
+    // ring slot -> price, offsets from base increase from slot (base & MASK) and wrap
+    inline uint32_t slot_price(uint32_t slot) const {
+        return base + ((slot - base) & MASK);
+    }
+
+    // lowest active window price at or above price, which must be inside the window
+    inline uint32_t lowest_at_or_above(const Bitmap& bitmap, uint32_t price) const {
+        uint32_t start = base & MASK;
+        uint32_t slot = price & MASK;
+        uint32_t found = bitmap.test(slot) ? slot : bitmap.next_above(slot);
+
+        if (slot >= start) {
+            // search to the top of the ring, then wrap below start
+            if (found == NONE) {
+                found = bitmap.lowest();
+                if (found >= start) {
+                    found = NONE;
+                }
+            }
+        } else if (found >= start) {
+            found = NONE;
+        }
+        return found == NONE ? NONE : slot_price(found);
+    }
+
+    // highest active window price at or below price, which must be inside the window
+    inline uint32_t highest_at_or_below(const Bitmap& bitmap, uint32_t price) const {
+        uint32_t start = base & MASK;
+        uint32_t slot = price & MASK;
+        uint32_t found = bitmap.test(slot) ? slot : bitmap.next_below(slot);
+
+        if (slot >= start) {
+            if (found != NONE && found < start) {
+                found = NONE;
+            }
+        } else if (found == NONE) {
+            // wrapped, continue down from the top of the ring
+            found = bitmap.highest();
+            if (found != NONE && found < start) {
+                found = NONE;
+            }
+        }
+        return found == NONE ? NONE : slot_price(found);
+    }
+
+    // active window slots from hi down to lo, false once visit asked to stop
+    template <typename Visit>
+    static inline bool walk_down(const Bitmap& bitmap, const PriceLevel* window, uint32_t hi, uint32_t lo, Visit& visit) {
+        auto slot_visit = [window, &visit](uint32_t slot) { return visit(window[slot]); };
+        return bitmap.walk_down(hi, lo, slot_visit);
+    }
+
+    template <typename Visit>
+    static inline bool walk_up(const Bitmap& bitmap, const PriceLevel* window, uint32_t lo, uint32_t hi, Visit& visit) {
+        auto slot_visit = [window, &visit](uint32_t slot) { return visit(window[slot]); };
+        return bitmap.walk_up(lo, hi, slot_visit);
+    }
+
+    void evict(PriceLevel* window, uint32_t* quantity, Bitmap& bitmap, vector<PriceLevel>& overflow, uint32_t lo, uint32_t hi) {
+        // evicted prices sit below or above the whole window, so they form one run in overflow
+        size_t pos = lower_bound_price(overflow, lo) - overflow.begin();
+        for (uint32_t price = lowest_at_or_above(bitmap, lo); price != NONE && price - lo < hi - lo;
+             price = price - base < MASK ? lowest_at_or_above(bitmap, price + 1) : NONE) {
+            uint32_t slot = price & MASK;
+            overflow.insert(overflow.begin() + pos++, window[slot]);
+            window[slot] = PriceLevel{};
+            quantity[slot] = 0;
+            bitmap.clear(slot);
+        }
+    }
+
+    void admit(PriceLevel* window, uint32_t* quantity, Bitmap& bitmap, vector<PriceLevel>& overflow) {
+        auto first = lower_bound_price(overflow, base);
+        auto last = first;
+        while (last != overflow.end() && in_window(last->price)) {
+            uint32_t slot = last->price & MASK;
+            window[slot] = *last;
+            quantity[slot] = last->total_quantity;
+            bitmap.set(slot);
+            ++last;
+        }
+        overflow.erase(first, last);
+    }
+
+    uint32_t base = 0;
+    uint64_t recenters = 0;
+
+    PriceLevel bid_window[WINDOW];
+    PriceLevel ask_window[WINDOW];
+
+    // window level totals side by side, indexed by ring slot and 0 where no level rests, so range queries
+    // read contiguous memory that vectorizes instead of striding through the levels. see LadderAnalytics.h
+    alignas(32) uint32_t bid_quantity[WINDOW] = {0};
+    alignas(32) uint32_t ask_quantity[WINDOW] = {0};
+
+    // window occupancy, indexed by ring slot
+    Bitmap bid_bitmap;
+    Bitmap ask_bitmap;
+
+    // sorted by price, every entry is an active level
+    vector<PriceLevel> bid_overflow;
+    vector<PriceLevel> ask_overflow;
+};
+
+using PriceLadder = BasicPriceLadder<LADDER_WINDOW>;
+
+#endif // PRICELADDER_H
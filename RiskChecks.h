@@ -0,0 +1,108 @@
+#ifndef RISKCHECKS_H
+#define RISKCHECKS_H
+
+#include "OrderUtils.h"
+#include "ExecutionReports.h"
+#include <memory>
+
+using namespace std;
+
+// pre-trade limits and self-trade prevention, checked by the book itself before an add reaches matching.
+// every account is one 32-byte entry of a flat table allocated up front, so a check is one cache line read
+// and a few compares, and keeping the open quantity current is one add where an order rests, fills or leaves.
+// a table is attached with set_risk and may be shared by every book of a router, limits then span the books
+
+// what an account's order does to a resting order of the same account it would trade with
+enum class SelfTradePrevention : uint8_t {
+    NONE,           // the orders trade
+    CANCEL_NEWEST,  // the incoming order's remainder is rejected, the resting order stays
+    CANCEL_OLDEST,  // the resting order is cancelled and matching carries on
+    DECREMENT       // both lose the smaller quantity without a fill, the one left with nothing goes
+};
+
+// per account, unlimited by default
+struct AccountLimits {
+    uint64_t max_notional = UINT64_MAX;       // price units times quantity, per order
+    uint64_t max_open_quantity = UINT64_MAX;  // resting across every book sharing the table, incoming order included
+    uint32_t max_order_quantity = UINT32_MAX;
+    SelfTradePrevention self_trade = SelfTradePrevention::NONE;
+};
+
+struct alignas(32) AccountRisk {
+    AccountLimits limits;
+    uint64_t open_quantity = 0;
+};
+
+static_assert(sizeof(AccountRisk) == 32, "one account per half cache line");
+
+// accounts are dense ids from 0, the id an order carries indexes the table directly.
+// used by the matching thread only, like the books it is attached to
+class RiskTable {
+public:
+    explicit RiskTable(uint32_t accounts = 1024) : table(new AccountRisk[accounts]), count(accounts) {}
+
+    RiskTable(const RiskTable&) = delete;
+    RiskTable& operator=(const RiskTable&) = delete;
+
+    // false for an account outside the table
+    bool set_limits(uint16_t account, const AccountLimits& limits) {
+        if (account >= count) {
+            return false;
+        }
+        table[account].limits = limits;
+        return true;
+    }
+
+    const AccountLimits& limits(uint16_t account) const { return table[account].limits; }
+    uint64_t open_quantity(uint16_t account) const { return table[account].open_quantity; }
+    uint32_t accounts() const { return count; }
+
+    // the first limit an order of quantity at price (in price units) would break, NONE if it may go ahead
+    inline RejectReason check(uint16_t account, uint32_t price, uint32_t quantity) const {
+        return check(account, price, quantity, quantity);
+    }
+
+    // the same for an order adding only added to the account's open quantity, e.g. a modify from
+    // quantity - added up to quantity
+    inline RejectReason check(uint16_t account, uint32_t price, uint32_t quantity, uint32_t added) const {
+        if (account >= count) [[unlikely]] {
+            return RejectReason::ACCOUNT;
+        }
+        const AccountRisk& entry = table[account];
+        if (quantity > entry.limits.max_order_quantity) {
+            return RejectReason::ORDER_QUANTITY;
+        }
+        if (uint64_t(price) * quantity > entry.limits.max_notional) {
+            return RejectReason::NOTIONAL;
+        }
+        if (entry.open_quantity + added > entry.limits.max_open_quantity) {
+            return RejectReason::OPEN_QUANTITY;
+        }
+        return RejectReason::NONE;
+    }
+
+    // the account's mode, NONE outside the table
+    inline SelfTradePrevention self_trade(uint16_t account) const {
+        return account < count ? table[account].limits.self_trade : SelfTradePrevention::NONE;
+    }
+
+    // quantity coming to rest, and leaving by fill, cancel, modify or purge. accounts outside the table
+    // never pass check, so only books that rested orders before the table was attached can name one
+    inline void rest(uint16_t account, uint32_t quantity) {
+        if (account < count) {
+            table[account].open_quantity += quantity;
+        }
+    }
+
+    inline void release(uint16_t account, uint32_t quantity) {
+        if (account < count) {
+            table[account].open_quantity -= quantity;
+        }
+    }
+
+private:
+    unique_ptr<AccountRisk[]> table;
+    uint32_t count;
+};
+
+#endif // RISKCHECKS_H
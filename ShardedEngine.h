@@ -0,0 +1,149 @@
+#ifndef SHARDEDENGINE_H
+#define SHARDEDENGINE_H
+
+#include "SymbolRouter.h"
+#include "SpscRing.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+// instruments are partitioned across worker threads, each pinned to its own core and owning its books
+// outright. a single gateway thread routes commands by symbol into per-shard SPSC queues, so nothing on
+// the match path takes a lock or shares a cache line with another shard.
+template <typename Sink = NullSink, typename Spec = DefaultBookSpec>
+class BasicShardedEngine {
+public:
+    using Router = BasicSymbolRouter<Sink, Spec>;
+
+    // make_sink(shard) supplies each shard's sink, e.g. a RingSink over a ring owned by that shard's consumer
+    template <typename MakeSink>
+    BasicShardedEngine(uint32_t num_shards, uint32_t max_orders_per_shard, size_t queue_capacity, MakeSink make_sink) {
+        for (uint32_t i = 0; i < num_shards; i++) {
+            shards.emplace_back(new Shard(max_orders_per_shard, queue_capacity, make_sink(i)));
+        }
+    }
+
+    explicit BasicShardedEngine(uint32_t num_shards, uint32_t max_orders_per_shard = MAX_ORDERS,
+                                size_t queue_capacity = 1 << 16)
+        : BasicShardedEngine(num_shards, max_orders_per_shard, queue_capacity, [](uint32_t) { return Sink(); }) {}
+
+    ~BasicShardedEngine() { stop(); }
+
+    BasicShardedEngine(const BasicShardedEngine&) = delete;
+    BasicShardedEngine& operator=(const BasicShardedEngine&) = delete;
+
+    // setup only, before start(). symbols are dealt round-robin across shards
+    uint32_t add_symbol(const string& symbol) {
+        uint32_t shard = routes.size() % shards.size();
+        routes.push_back(Route{shard, shards[shard]->router->add_symbol(symbol)});
+        return routes.size() - 1;
+    }
+
+    // launches one worker per shard, pinned to first_core + shard where the platform allows it
+    void start(uint32_t first_core = 0) {
+        uint32_t num_cores = max(1u, thread::hardware_concurrency());
+        for (uint32_t i = 0; i < shards.size(); i++) {
+            Shard& shard = *shards[i];
+            shard.running.store(true, memory_order_release);
+            shard.worker = thread([&shard] { shard.run(); });
+            pin(shard.worker, (first_core + i) % num_cores);
+        }
+    }
+
+    // gateway thread only. blocks while the shard's queue is full
+    inline void submit(Command command) {
+        const Route& route = routes[command.symbol];
+        Shard& shard = *shards[route.shard];
+        command.symbol = route.local_symbol;
+        shard.inbox.push(command);
+        shard.submitted++;
+    }
+
+    // gateway thread only. waits until every submitted command has been applied
+    void flush() {
+        for (auto& shard : shards) {
+            while (shard->processed.load(memory_order_acquire) != shard->submitted) {
+                this_thread::yield();
+            }
+        }
+    }
+
+    void stop() {
+        for (auto& shard : shards) {
+            if (shard->worker.joinable()) {
+                shard->running.store(false, memory_order_release);
+                shard->worker.join();
+            }
+        }
+    }
+
+    // only safe while the engine is stopped or flushed
+    Quote get_quote(uint32_t symbol) const {
+        const Route& route = routes[symbol];
+        return shards[route.shard]->router->get_quote(route.local_symbol);
+    }
+
+    uint32_t shard_count() const { return shards.size(); }
+    uint32_t symbol_count() const { return routes.size(); }
+
+private:
+    struct Route {
+        uint32_t shard;
+        uint32_t local_symbol;
+    };
+
+    struct Shard {
+        Shard(uint32_t max_orders, size_t queue_capacity, Sink sink)
+            : inbox(queue_capacity), router(new Router(max_orders, sink)) {}
+
+        void run() {
+            Command batch[64];
+            while (true) {
+                size_t n = inbox.pop_batch(batch, 64);
+                if (n == 0) {
+                    if (!running.load(memory_order_acquire) && inbox.empty()) {
+                        return;
+                    }
+                    this_thread::yield();
+                    continue;
+                }
+                router->apply_batch(span<const Command>(batch, n));
+                processed.store(processed.load(memory_order_relaxed) + n, memory_order_release);
+            }
+        }
+
+        SpscRing<Command> inbox;
+        unique_ptr<Router> router;
+        thread worker;
+        atomic<bool> running{false};
+
+        // written by the worker, read by the gateway
+        alignas(CACHE_LINE) atomic<uint64_t> processed{0};
+
+        // gateway-private
+        alignas(CACHE_LINE) uint64_t submitted = 0;
+    };
+
+    static void pin(thread& worker, uint32_t core) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        pthread_setaffinity_np(worker.native_handle(), sizeof(cpu_set_t), &cpus);
+#endif
+    }
+
+    vector<unique_ptr<Shard>> shards;
+    vector<Route> routes;
+};
+
+using ShardedEngine = BasicShardedEngine<>;
+
+#endif // SHARDEDENGINE_H
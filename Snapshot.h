@@ -0,0 +1,225 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// book snapshot file. everything in the book is addressed by pool index, so the sections are written raw
+// and the pool and index sections are mapped straight back on restore:
+//   SnapshotHeader, padded to SNAPSHOT_ALIGN
+//   ladder section, PriceLadder::write_raw output
+//   pool section at pool_offset, pool_capacity nodes of which only those below high_water are written
+//   index section at index_offset, the whole open-addressing table
+// sections start on SNAPSHOT_ALIGN boundaries so they can be mapped, and the unwritten tail of the pool is a hole.
+
+constexpr char SNAPSHOT_MAGIC[8] = {'O', 'B', 'S', 'N', 'A', 'P', '1', '\0'};
+// 2: orders carry their time in force
+// 3: the book's tick size, ladder and order prices are in ticks
+// 4: orders carry their account
+constexpr uint32_t SNAPSHOT_VERSION = 4;
+constexpr uint64_t SNAPSHOT_ALIGN = 4096;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t book_id;
+
+    uint32_t pool_capacity;
+    uint32_t high_water;
+    uint32_t free_head;
+    uint32_t live;
+    uint64_t index_slots;
+    uint32_t index_count;
+
+    uint32_t best_bid;
+    uint32_t best_ask;
+    uint32_t tick_size;
+    uint64_t sequence;
+
+    uint64_t ladder_offset;
+    uint64_t ladder_bytes;
+    uint64_t pool_offset;
+    uint64_t pool_bytes;
+    uint64_t index_offset;
+    uint64_t index_bytes;
+    uint64_t file_bytes;
+};
+
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_ALIGN, "SnapshotHeader must fit its page");
+
+constexpr uint64_t snapshot_align(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1);
+}
+
+// pwrite until done, false on error
+inline bool snapshot_pwrite(int fd, const void* data, size_t bytes, uint64_t offset) {
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t n = pwrite(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+inline bool snapshot_pread(int fd, void* data, size_t bytes, uint64_t offset) {
+    char* p = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t n = pread(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// granularity of the background snapshot's copy-on-write
+constexpr uint64_t SNAPSHOT_CHUNK = 4096;
+
+// copy-on-write guard over one region while a writer thread streams it to a file.
+// the owner calls before_write ahead of every store into the region. the first store into a chunk the writer has
+// not reached yet copies the chunk aside into a shadow mapping, so the file ends up holding the region exactly
+// as it was at begin. the owner never makes a syscall here, and only waits when the writer is in the middle of
+// writing that very chunk.
+class SnapshotRegion {
+public:
+    SnapshotRegion() = default;
+    ~SnapshotRegion() {
+        release_shadow();
+        free(states);
+    }
+
+    SnapshotRegion(const SnapshotRegion&) = delete;
+    SnapshotRegion& operator=(const SnapshotRegion&) = delete;
+
+    // owner side, no writer may be running. the shadow is only reserved here, pages fault in as chunks are copied.
+    // returns false if the shadow or the chunk table cannot be allocated
+    bool begin(const void* region, uint64_t region_bytes) {
+        uint64_t needed = (region_bytes + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+        if (needed > capacity) {
+            // zeroed states belong to no epoch, so a fresh table needs no initialisation pass
+            free(states);
+            states = static_cast<atomic<uint32_t>*>(calloc(needed, sizeof(atomic<uint32_t>)));
+            capacity = states ? needed : 0;
+            if (!states) {
+                return false;
+            }
+        }
+        release_shadow();
+        if (region_bytes > 0) {
+            void* mapped = mmap(nullptr, region_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mapped == MAP_FAILED) {
+                return false;
+            }
+            shadow = static_cast<char*>(mapped);
+        }
+        base = static_cast<const char*>(region);
+        bytes = region_bytes;
+        chunks = needed;
+        epoch += 4;
+        return true;
+    }
+
+    inline void before_write(const void* p) {
+        uint64_t offset = static_cast<const char*>(p) - base;
+        if (offset >= bytes) {
+            return;
+        }
+        uint64_t chunk = offset / SNAPSHOT_CHUNK;
+        if (states[chunk].load(memory_order_acquire) < epoch + COPIED) {
+            preserve(chunk);
+        }
+    }
+
+    // writer side. writes every chunk as it was at begin to fd at file_offset, then drops the shadow.
+    // returns false on a write error
+    bool write_all(int fd, uint64_t file_offset) {
+        bool ok = true;
+        for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+            uint64_t offset = chunk * SNAPSHOT_CHUNK;
+            uint64_t length = min(SNAPSHOT_CHUNK, bytes - offset);
+            uint32_t state = states[chunk].load(memory_order_acquire);
+            for (;;) {
+                if (state == epoch + COPYING) {
+                    this_thread::yield();
+                    state = states[chunk].load(memory_order_acquire);
+                } else if (state == epoch + COPIED) {
+                    ok = snapshot_pwrite(fd, shadow + offset, length, file_offset + offset) && ok;
+                    break;
+                } else if (states[chunk].compare_exchange_weak(state, epoch + CLAIMED, memory_order_acquire)) {
+                    ok = snapshot_pwrite(fd, base + offset, length, file_offset + offset) && ok;
+                    states[chunk].store(epoch + SAVED, memory_order_release);
+                    break;
+                }
+            }
+        }
+        release_shadow();
+        return ok;
+    }
+
+private:
+    // per-chunk state, offset by the epoch of the current snapshot. anything below epoch is still to be saved
+    enum : uint32_t {
+        CLAIMED,  // the writer is writing it from the region
+        COPYING,  // the owner is copying it into the shadow
+        COPIED,   // the shadow holds it, the owner may write
+        SAVED     // on disk, the owner may write
+    };
+
+    void preserve(uint64_t chunk) {
+        uint32_t state = states[chunk].load(memory_order_acquire);
+        while (state < epoch + COPIED) {
+            if (state == epoch + CLAIMED) {
+                // one chunk write at most
+                this_thread::yield();
+                state = states[chunk].load(memory_order_acquire);
+            } else if (states[chunk].compare_exchange_weak(state, epoch + COPYING, memory_order_acquire)) {
+                uint64_t offset = chunk * SNAPSHOT_CHUNK;
+                memcpy(shadow + offset, base + offset, min(SNAPSHOT_CHUNK, bytes - offset));
+                states[chunk].store(epoch + COPIED, memory_order_release);
+                return;
+            }
+        }
+    }
+
+    void release_shadow() {
+        if (shadow) {
+            munmap(shadow, bytes);
+            shadow = nullptr;
+        }
+    }
+
+    const char* base = nullptr;
+    char* shadow = nullptr;
+    uint64_t bytes = 0;
+    uint64_t chunks = 0;
+    uint64_t capacity = 0;
+    atomic<uint32_t>* states = nullptr;
+    uint32_t epoch = 0;
+};
+
+#endif // SNAPSHOT_H
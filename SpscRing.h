@@ -0,0 +1,103 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+constexpr size_t CACHE_LINE = 64;
+
+// bounded single-producer/single-consumer ring. head and tail sit on their own cache lines and
+// each side keeps a cached copy of the other's index, so the shared lines are only read when the
+// cached view says the ring looks full (producer) or empty (consumer).
+template <typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t min_capacity) {
+        capacity = 2;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        mask = capacity - 1;
+        slots = static_cast<T*>(aligned_alloc(CACHE_LINE, ((sizeof(T) * capacity + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE));
+    }
+
+    ~SpscRing() { free(slots); }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer side, false when full
+    inline bool try_push(const T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - cached_head == capacity) {
+            cached_head = head.load(memory_order_acquire);
+            if (t - cached_head == capacity) {
+                return false;
+            }
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    // producer side, waits for the consumer instead of dropping when full
+    inline void push(const T& item) {
+        while (!try_push(item)) {
+            this_thread::yield();
+        }
+    }
+
+    // consumer side, false when empty
+    inline bool try_pop(T& item) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == cached_tail) {
+            cached_tail = tail.load(memory_order_acquire);
+            if (h == cached_tail) {
+                return false;
+            }
+        }
+        item = slots[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    // consumer side, drains up to max_items with a single index publish
+    inline size_t pop_batch(T* out, size_t max_items) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == cached_tail) {
+            cached_tail = tail.load(memory_order_acquire);
+        }
+        size_t n = min(max_items, cached_tail - h);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = slots[(h + i) & mask];
+        }
+        if (n > 0) {
+            head.store(h + n, memory_order_release);
+        }
+        return n;
+    }
+
+    // approximate when called concurrently
+    size_t size() const { return tail.load(memory_order_acquire) - head.load(memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    size_t max_size() const { return capacity; }
+
+private:
+    alignas(CACHE_LINE) atomic<size_t> head{0};
+    size_t cached_tail = 0;
+
+    alignas(CACHE_LINE) atomic<size_t> tail{0};
+    size_t cached_head = 0;
+
+    alignas(CACHE_LINE) T* slots;
+    size_t capacity;
+    size_t mask;
+};
+
+#endif // SPSCRING_H
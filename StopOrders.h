@@ -0,0 +1,83 @@
+#ifndef STOPORDERS_H
+#define STOPORDERS_H
+
+#include "OrderUtils.h"
+#include "MemoryArena.h"
+
+using namespace std;
+
+// armed stop orders wait outside the book until a trade prints at their trigger price or through it, at or
+// above it for a buy and at or below it for a sell. a book queues them FIFO on a trigger ladder of their own,
+// so a move of the last trade finds the crossed triggers level by level with the same bitmap scans the book
+// uses for its best prices, whatever the number of stops armed elsewhere.
+// stops share the order index with resting orders under STOP_HANDLE | slot, so cancel and modify find either
+// in one lookup, and order ids stay unique across both
+
+// set on the index handle of an armed stop. NULL_INDEX carries it as well, so index >= STOP_HANDLE is
+// "not a resting order" in one compare
+constexpr uint32_t STOP_HANDLE = 1u << 31;
+
+// 40 bytes. trigger and limit in ticks of the owning book, limit 0 for a stop market
+struct StopOrder {
+    uint64_t order_id;
+    uint32_t trigger;
+    uint32_t limit;
+    uint32_t quantity;
+    uint32_t prev = NULL_INDEX;
+    uint32_t next = NULL_INDEX;
+    uint32_t book = 0;
+    Side side;
+    TimeInForce tif;
+    uint16_t account;
+};
+
+// fixed-capacity slab of stop nodes like OrderPool, shared by the books of a store. unless the memory is
+// provisioned, pages are only touched once a stop lands on them, so a store that never arms one pays
+// address space only
+class StopPool {
+public:
+    explicit StopPool(uint32_t capacity, const MemoryOptions& memory = MemoryOptions())
+        : arena(sizeof(StopOrder) * capacity, memory), nodes(static_cast<StopOrder*>(arena.data())),
+          capacity(capacity) {}
+
+    StopPool(const StopPool&) = delete;
+    StopPool& operator=(const StopPool&) = delete;
+
+    // returns NULL_INDEX when the pool is exhausted
+    inline uint32_t allocate() {
+        if (free_head != NULL_INDEX) {
+            uint32_t index = free_head;
+            free_head = nodes[index].next;
+            ++live;
+            return index;
+        }
+        if (high_water < capacity) {
+            ++live;
+            return high_water++;
+        }
+        return NULL_INDEX;
+    }
+
+    inline void release(uint32_t index) {
+        nodes[index].next = free_head;
+        free_head = index;
+        --live;
+    }
+
+    inline StopOrder& operator[](uint32_t index) { return nodes[index]; }
+    inline const StopOrder& operator[](uint32_t index) const { return nodes[index]; }
+
+    uint32_t size() const { return live; }
+    uint32_t max_size() const { return capacity; }
+    const MemoryArena& memory() const { return arena; }
+
+private:
+    MemoryArena arena;
+    StopOrder* nodes;
+    uint32_t capacity;
+    uint32_t high_water = 0;
+    uint32_t free_head = NULL_INDEX;
+    uint32_t live = 0;
+};
+
+#endif // STOPORDERS_H
@@ -0,0 +1,229 @@
+#ifndef SYMBOLROUTER_H
+#define SYMBOLROUTER_H
+
+#include "Orderbook.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+// hosts many instruments in one process. every book shares one order store, so
+// cancel/modify/execute by order id resolve the owning book from the order node itself in one lookup.
+// symbols are resolved to dense ids once at setup, the hot path only takes ids.
+// every book reports to its own copy of sink, tagged with the symbol id.
+// every book shares Spec, routers for instruments of different tick sizes are separate routers
+template <typename Sink = NullSink, typename Spec = DefaultBookSpec>
+class BasicSymbolRouter {
+public:
+    using Book = BasicOrderbook<Sink, Spec>;
+
+    // every book provisions itself as the store is, see MemoryArena.h
+    explicit BasicSymbolRouter(uint32_t max_orders = MAX_ORDERS, Sink sink = Sink(),
+                               const MemoryOptions& memory = MemoryOptions())
+        : store(max_orders, memory), sink(sink) {}
+
+    BasicSymbolRouter(const BasicSymbolRouter&) = delete;
+    BasicSymbolRouter& operator=(const BasicSymbolRouter&) = delete;
+
+    // returns the existing id if the symbol is already listed
+    uint32_t add_symbol(const string& symbol) {
+        auto it = directory.find(symbol);
+        if (it != directory.end()) {
+            return it->second;
+        }
+
+        uint32_t symbol_id = books.size();
+        books.emplace_back(new Book(store, symbol_id, sink));
+        books.back()->set_risk(risk);
+        directory.emplace(symbol, symbol_id);
+        return symbol_id;
+    }
+
+    // returns NULL_INDEX for an unknown symbol
+    uint32_t symbol_id(const string& symbol) const {
+        auto it = directory.find(symbol);
+        return it == directory.end() ? NULL_INDEX : it->second;
+    }
+
+    inline void add_order(uint32_t symbol_id, uint64_t order_id, Side side, uint32_t price, uint32_t quantity,
+                          TimeInForce tif = TimeInForce::DAY, uint16_t account = 0) {
+        books[symbol_id]->add_order(order_id, side, price, quantity, tif, account);
+    }
+
+    // see BasicOrderbook::add_stop, stops are armed and triggered per book
+    void add_stop(uint32_t symbol_id, uint64_t order_id, Side side, uint32_t trigger, uint32_t limit, uint32_t quantity,
+                  TimeInForce tif = TimeInForce::DAY, uint16_t account = 0) {
+        books[symbol_id]->add_stop(order_id, side, trigger, limit, quantity, tif, account);
+    }
+
+    inline void cancel_order(uint64_t order_id) {
+        uint32_t index = store.index.find(order_id);
+        if (index >= STOP_HANDLE) {
+            if (index != NULL_INDEX) {
+                books[store.stops[index & ~STOP_HANDLE].book]->cancel_stop(index & ~STOP_HANDLE);
+            }
+            return;
+        }
+        books[store.pool[index].book]->cancel_resting(index);
+    }
+
+    inline void modify_order(uint64_t order_id, uint32_t new_quantity) {
+        uint32_t index = store.index.find(order_id);
+        if (index >= STOP_HANDLE) {
+            if (index != NULL_INDEX) {
+                books[store.stops[index & ~STOP_HANDLE].book]->modify_stop(index & ~STOP_HANDLE, new_quantity);
+            }
+            return;
+        }
+        books[store.pool[index].book]->modify_resting(index, new_quantity);
+    }
+
+    inline void execute_order(uint64_t order_id, uint32_t quantity) {
+        uint32_t index = store.index.find(order_id);
+        if (index >= STOP_HANDLE) {
+            return;
+        }
+        books[store.pool[index].book]->execute_resting(index, quantity);
+    }
+
+    inline void apply(const Command& command) {
+        switch (command.type) {
+            case CommandType::ADD:
+                add_order(command.symbol, command.order_id, command.side, command.price, command.quantity, command.tif,
+                          command.account);
+                break;
+            case CommandType::CANCEL:
+                cancel_order(command.order_id);
+                break;
+            case CommandType::MODIFY:
+                modify_order(command.order_id, command.quantity);
+                break;
+            case CommandType::EXECUTE:
+                execute_order(command.order_id, command.quantity);
+                break;
+            case CommandType::ADD_STOP:
+                add_stop(command.symbol, command.order_id, command.side, command.trigger, command.price,
+                         command.quantity, command.tif, command.account);
+                break;
+        }
+    }
+
+    // strictly in order, with the same staged prefetching as BasicOrderbook::apply_batch. an order's book is
+    // only known once its node has arrived, so its level is prefetched in the last stage
+    void apply_batch(span<const Command> commands) {
+        uint32_t resolved[BATCH_INDEX_AHEAD];
+        size_t n = commands.size();
+
+        for (size_t i = 0; i < min(n, BATCH_INDEX_AHEAD); i++) {
+            prefetch_index(commands[i]);
+        }
+        for (size_t i = 0; i < min(n, BATCH_NODE_AHEAD); i++) {
+            resolved[i] = prefetch_node(commands[i]);
+        }
+        for (size_t i = 0; i < min(n, BATCH_LEVEL_AHEAD); i++) {
+            prefetch_level(commands[i], resolved[i]);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (i + BATCH_INDEX_AHEAD < n) {
+                prefetch_index(commands[i + BATCH_INDEX_AHEAD]);
+            }
+            if (i + BATCH_NODE_AHEAD < n) {
+                resolved[(i + BATCH_NODE_AHEAD) % BATCH_INDEX_AHEAD] = prefetch_node(commands[i + BATCH_NODE_AHEAD]);
+            }
+            if (i + BATCH_LEVEL_AHEAD < n) {
+                prefetch_level(commands[i + BATCH_LEVEL_AHEAD], resolved[(i + BATCH_LEVEL_AHEAD) % BATCH_INDEX_AHEAD]);
+            }
+            apply(commands[i]);
+        }
+    }
+
+    inline Quote get_quote(uint32_t symbol_id) const {
+        return books[symbol_id]->get_quote();
+    }
+
+    inline void get_depth(uint32_t symbol_id, uint32_t n, Depth& depth) const {
+        books[symbol_id]->get_depth(n, depth);
+    }
+
+    Book& book(uint32_t symbol_id) { return *books[symbol_id]; }
+
+    // every book in turn, each pays for its own active levels only
+    void clear() {
+        for (auto& book : books) {
+            book->clear();
+        }
+    }
+
+    // purges DAY orders from every book at a session boundary, returns the number purged
+    uint32_t roll_session() {
+        uint32_t purged = 0;
+        for (auto& book : books) {
+            purged += book->roll_session();
+        }
+        return purged;
+    }
+
+    // one risk table for every book, present and future, so an account's open quantity spans instruments.
+    // price bands are per instrument, set through book(symbol_id)
+    void set_risk(RiskTable* table) {
+        risk = table;
+        for (auto& book : books) {
+            book->set_risk(table);
+        }
+    }
+
+    uint32_t symbol_count() const { return books.size(); }
+
+    // order ids are unique across every book in the router, armed stops included
+    uint32_t live_orders() const { return store.index.size() - store.stops.size(); }
+
+    bool has_order(uint64_t order_id) const { return store.index.find(order_id) != NULL_INDEX; }
+
+private:
+    [[gnu::always_inline]] inline void prefetch_index(const Command& command) const {
+        store.index.prefetch(command.order_id);
+        if (command.type == CommandType::ADD) {
+            books[command.symbol]->prefetch_level(command.side, command.price);
+        }
+    }
+
+    [[gnu::always_inline]] inline uint32_t prefetch_node(const Command& command) const {
+        if (command.type == CommandType::ADD) {
+            store.pool.prefetch_next();
+            return NULL_INDEX;
+        }
+        uint32_t index = store.index.find(command.order_id);
+        if (index < STOP_HANDLE) {
+            store.pool.prefetch(index);
+        }
+        return index;
+    }
+
+    [[gnu::always_inline]] inline void prefetch_level(const Command& command, uint32_t index) const {
+        if (index >= STOP_HANDLE) {
+            return;
+        }
+        const Order& order = store.pool[index];
+        books[order.book]->prefetch_level(order);
+        if (command.type != CommandType::MODIFY) {
+            if (order.prev != NULL_INDEX) {
+                store.pool.prefetch(order.prev);
+            }
+            if (order.next != NULL_INDEX) {
+                store.pool.prefetch(order.next);
+            }
+        }
+    }
+
+    OrderStore store;
+    Sink sink;
+    RiskTable* risk = nullptr;
+    vector<unique_ptr<Book>> books;
+    unordered_map<string, uint32_t> directory;
+};
+
+using SymbolRouter = BasicSymbolRouter<>;
+
+#endif // SYMBOLROUTER_H
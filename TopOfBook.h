@@ -0,0 +1,91 @@
+#ifndef TOPOFBOOK_H
+#define TOPOFBOOK_H
+
+#include "OrderUtils.h"
+#include "SpscRing.h"
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+using namespace std;
+
+// single-writer sequence lock over a small trivially copyable value. the writer never waits for readers,
+// a store is two version bumps around plain stores. a reader copies the value between two reads of the version
+// and keeps the copy only if the version was even and unchanged, so it never sees a torn value.
+// the payload is held as relaxed atomic words, which compile to ordinary moves but keep the race defined.
+template <typename T>
+class Seqlock {
+public:
+    static_assert(is_trivially_copyable_v<T> && sizeof(T) % sizeof(uint64_t) == 0,
+                  "Seqlock holds trivially copyable values of whole words");
+
+    // writer thread only
+    inline void store(const T& value) {
+        uint64_t source[WORDS];
+        memcpy(source, &value, sizeof(T));
+
+        uint64_t v = version.load(memory_order_relaxed);
+        version.store(v + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i].store(source[i], memory_order_relaxed);
+        }
+        version.store(v + 2, memory_order_release);
+    }
+
+    // any thread, wait-free. false if the read overlapped a store, value is then left unchanged
+    inline bool try_load(T& value) const {
+        uint64_t before = version.load(memory_order_acquire);
+        if (before & 1) {
+            return false;
+        }
+        uint64_t copy[WORDS];
+        for (size_t i = 0; i < WORDS; i++) {
+            copy[i] = words[i].load(memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (version.load(memory_order_relaxed) != before) {
+            return false;
+        }
+        memcpy(&value, copy, sizeof(T));
+        return true;
+    }
+
+    // retries until a read lands between two stores
+    inline T load() const {
+        T value;
+        while (!try_load(value)) {
+            this_thread::yield();
+        }
+        return value;
+    }
+
+    // stores so far, any thread
+    uint64_t stores() const { return version.load(memory_order_acquire) / 2; }
+
+private:
+    static constexpr size_t WORDS = sizeof(T) / sizeof(uint64_t);
+
+    alignas(CACHE_LINE) atomic<uint64_t> version{0};
+    atomic<uint64_t> words[WORDS] = {};
+};
+
+// levels per side in a published TopOfBook
+constexpr uint32_t TOP_LEVELS = 3;
+
+// 56 bytes, so with the seqlock version a record fills one cache line
+struct TopOfBook {
+    uint64_t sequence;            // book report sequence of the last change it reflects
+    DepthLevel bids[TOP_LEVELS];  // best first, price and quantity 0 past the last level
+    DepthLevel asks[TOP_LEVELS];
+
+    // same values as the book's get_quote
+    Quote quote() const { return Quote(bids[0].price, bids[0].quantity, asks[0].price, asks[0].quantity); }
+};
+
+static_assert(sizeof(TopOfBook) + sizeof(uint64_t) <= CACHE_LINE, "TopOfBook must share a line with its version");
+
+using TopOfBookSlot = Seqlock<TopOfBook>;
+
+#endif // TOPOFBOOK_H
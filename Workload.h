@@ -0,0 +1,296 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "OrderUtils.h"
+#include "SymbolRouter.h"
+#include <cmath>
+#include <random>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+// order flow shaped like a venue's rather than uniform noise: arrivals are Poisson with bursts, passive
+// orders land a few ticks behind the touch, most orders are cancelled rather than traded, trades hit the
+// touch and now and then sweep several levels, and the book can start with deep queues.
+// the generator drives its own shadow router as it goes, so every cancel and modify names an order that
+// is still resting, and trades are priced against the real touch. prices are in ticks
+struct WorkloadConfig {
+    uint64_t operations = 1000000;
+    uint32_t symbols = 1;
+    uint32_t seed = 42;
+
+    // mean arrival rate. a burst starts with burst_probability per event and runs burst_events events at
+    // burst_multiplier times the rate
+    double rate_per_sec = 1e6;
+    double burst_probability = 0.0001;
+    uint32_t burst_events = 200;
+    double burst_multiplier = 10;
+
+    // passive orders rest this many ticks behind the touch, geometric with mean mean_touch_offset and 0
+    // meaning at the touch, so most of them join the first few levels
+    double mean_touch_offset = 2.0;
+    uint32_t max_touch_offset = 1000;
+
+    // cancels per trade, e.g. 30 for a 30:1 cancel-to-trade ratio. modifies take modify_share of the flow
+    // and adds balance cancels and trades so the book neither drains nor grows
+    double cancels_per_trade = 30;
+    double modify_share = 0.05;
+
+    // a trade is a marketable order at the touch, sweep_share of them take sweep_levels levels at once
+    double sweep_share = 0.02;
+    uint32_t sweep_levels = 10;
+
+    // book built before the measured flow: levels per side from the touch out, orders queued at each
+    uint32_t initial_levels = 20;
+    uint32_t orders_per_level = 5;
+
+    uint32_t mid = 100000;
+    uint32_t max_quantity = 100;
+};
+
+struct Workload {
+    vector<Command> setup;        // builds the initial book, applied before anything is measured
+    vector<Command> commands;     // the measured flow
+    vector<uint64_t> arrival_ns;  // scheduled arrival of each command, the first at 0
+
+    uint64_t adds = 0;  // passive adds, trades and sweeps not included
+    uint64_t cancels = 0;
+    uint64_t modifies = 0;
+    uint64_t trades = 0;
+    uint64_t sweeps = 0;
+};
+
+class WorkloadGenerator {
+public:
+    explicit WorkloadGenerator(const WorkloadConfig& config)
+        : config(config), gen(config.seed), router(new Router(MAX_ORDERS, ShadowSink{this})),
+          touch_offset(1.0 / (1.0 + max(config.mean_touch_offset, 0.0))) {
+        for (uint32_t s = 0; s < config.symbols; s++) {
+            router->add_symbol("SYM" + to_string(s));
+        }
+    }
+
+    WorkloadGenerator(const WorkloadGenerator&) = delete;
+    WorkloadGenerator& operator=(const WorkloadGenerator&) = delete;
+
+    Workload generate() {
+        Workload workload;
+        build_book(workload.setup);
+
+        // shares of the flow: adds = cancels + trades keeps the book level, and cancels = ratio * trades
+        double trade_share = (1.0 - config.modify_share) / (2.0 * (config.cancels_per_trade + 1.0));
+        double cancel_share = config.cancels_per_trade * trade_share;
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        exponential_distribution<double> gap(config.rate_per_sec / 1e9);
+
+        workload.commands.reserve(config.operations);
+        workload.arrival_ns.reserve(config.operations);
+        double now_ns = 0;
+        uint32_t burst_left = 0;
+
+        for (uint64_t i = 0; i < config.operations; i++) {
+            if (burst_left == 0 && unit(gen) < config.burst_probability) {
+                burst_left = config.burst_events;
+            }
+            double interval = gap(gen);
+            if (burst_left > 0) {
+                interval /= config.burst_multiplier;
+                --burst_left;
+            }
+            now_ns += i == 0 ? 0 : interval;
+
+            double pick = unit(gen);
+            Command command;
+            if (resting.empty() || pick >= cancel_share + trade_share + config.modify_share) {
+                command = passive_add(symbol_dist());
+                ++workload.adds;
+            } else if (pick < cancel_share) {
+                command = cancel();
+                ++workload.cancels;
+            } else if (pick < cancel_share + config.modify_share) {
+                command = modify();
+                ++workload.modifies;
+            } else {
+                // a trade needs something resting on the other side, otherwise the order simply rests
+                uint32_t symbol = symbol_dist();
+                Side side = gen() % 2 ? Side::BUY : Side::SELL;
+                Quote quote = router->get_quote(symbol);
+                if (side == Side::BUY ? quote.ask_quantity > 0 : quote.bid_quantity > 0) {
+                    bool sweep = unit(gen) < config.sweep_share;
+                    command = trade(symbol, side, side == Side::BUY ? quote.ask_price : quote.bid_price, sweep);
+                    ++workload.trades;
+                    workload.sweeps += sweep;
+                } else {
+                    command = passive_add(symbol);
+                    ++workload.adds;
+                }
+            }
+            apply(command);
+            workload.commands.push_back(command);
+            workload.arrival_ns.push_back(uint64_t(now_ns));
+        }
+        return workload;
+    }
+
+private:
+    // keeps the resting set in step with the shadow router: fills shrink or remove resting orders, and the
+    // order being added learns how much of it traded
+    struct ShadowSink {
+        WorkloadGenerator* generator;
+        void on_report(const ExecutionReport& report) { generator->on_report(report); }
+    };
+
+    using Router = BasicSymbolRouter<ShadowSink>;
+
+    struct Resting {
+        uint32_t slot;  // position in resting_ids
+        uint32_t symbol;
+        uint32_t quantity;
+    };
+
+    void on_report(const ExecutionReport& report) {
+        if (report.type != ReportType::FILL) {
+            return;
+        }
+        if (report.order_id == pending_id) {
+            pending_filled += report.quantity;
+        }
+        auto it = resting.find(report.contra_order_id);
+        if (it != resting.end()) {
+            it->second.quantity -= report.quantity;
+            if (it->second.quantity == 0) {
+                remove_resting(it);
+            }
+        }
+    }
+
+    void apply(const Command& command) {
+        if (command.type != CommandType::ADD) {
+            auto it = resting.find(command.order_id);
+            if (command.type == CommandType::CANCEL) {
+                remove_resting(it);
+            } else {
+                it->second.quantity = command.quantity;
+            }
+            router->apply(command);
+            return;
+        }
+        pending_id = command.order_id;
+        pending_filled = 0;
+        router->apply(command);
+        if (pending_filled < command.quantity) {
+            resting_ids.push_back(command.order_id);
+            resting.emplace(command.order_id, Resting{uint32_t(resting_ids.size() - 1), command.symbol,
+                                                      command.quantity - pending_filled});
+        }
+        pending_id = 0;
+    }
+
+    void remove_resting(unordered_map<uint64_t, Resting>::iterator it) {
+        uint32_t slot = it->second.slot;
+        resting_ids[slot] = resting_ids.back();
+        resting.find(resting_ids[slot])->second.slot = slot;
+        resting_ids.pop_back();
+        resting.erase(it);
+    }
+
+    void build_book(vector<Command>& setup) {
+        for (uint32_t s = 0; s < config.symbols; s++) {
+            for (uint32_t level = 0; level < config.initial_levels; level++) {
+                for (uint32_t k = 0; k < config.orders_per_level; k++) {
+                    for (Side side : {Side::BUY, Side::SELL}) {
+                        Command command = add(s, side, side == Side::BUY ? config.mid - 1 - level : config.mid + 1 + level,
+                                              quantity());
+                        apply(command);
+                        setup.push_back(command);
+                    }
+                }
+            }
+        }
+    }
+
+    Command add(uint32_t symbol, Side side, uint32_t price, uint32_t quantity) {
+        Command command{};
+        command.type = CommandType::ADD;
+        command.order_id = next_order_id++;
+        command.symbol = symbol;
+        command.side = side;
+        command.price = price;
+        command.quantity = quantity;
+        return command;
+    }
+
+    // behind the touch of its own side, or around the last mid when that side is empty
+    Command passive_add(uint32_t symbol) {
+        Side side = gen() % 2 ? Side::BUY : Side::SELL;
+        Quote quote = router->get_quote(symbol);
+        uint32_t offset = min<uint32_t>(touch_offset(gen), config.max_touch_offset);
+        uint32_t price;
+        if (side == Side::BUY) {
+            uint32_t touch = quote.bid_quantity > 0 ? quote.bid_price : (quote.ask_quantity > 0 ? quote.ask_price - 1 : config.mid - 1);
+            price = touch > offset ? touch - offset : 1;
+        } else {
+            uint32_t touch = quote.ask_quantity > 0 ? quote.ask_price : (quote.bid_quantity > 0 ? quote.bid_price + 1 : config.mid + 1);
+            price = touch + offset;
+        }
+        return add(symbol, side, price, quantity());
+    }
+
+    // marketable at the far touch. a sweep is priced sweep_levels ticks through and sized to take what rests
+    // up to there, so it clears those levels and rests little if anything
+    Command trade(uint32_t symbol, Side side, uint32_t touch, bool sweep) {
+        if (!sweep) {
+            return add(symbol, side, touch, quantity());
+        }
+        Side contra = side == Side::BUY ? Side::SELL : Side::BUY;
+        uint32_t limit = side == Side::BUY ? touch + config.sweep_levels - 1 : touch - min(touch - 1, config.sweep_levels - 1);
+        uint64_t available = router->book(symbol).quantity_to_price(contra, limit);
+        return add(symbol, side, limit, uint32_t(min<uint64_t>(available, UINT32_MAX)));
+    }
+
+    Command cancel() {
+        uint64_t order_id = resting_ids[gen() % resting_ids.size()];
+        Command command{};
+        command.type = CommandType::CANCEL;
+        command.order_id = order_id;
+        command.symbol = resting.find(order_id)->second.symbol;
+        return command;
+    }
+
+    // size changes are mostly reductions, as when a resting order is partly pulled
+    Command modify() {
+        uint64_t order_id = resting_ids[gen() % resting_ids.size()];
+        const Resting& order = resting.find(order_id)->second;
+        Command command{};
+        command.type = CommandType::MODIFY;
+        command.order_id = order_id;
+        command.symbol = order.symbol;
+        command.quantity = gen() % 4 == 0 ? quantity() : 1 + gen() % order.quantity;
+        return command;
+    }
+
+    uint32_t quantity() { return 1 + gen() % config.max_quantity; }
+    uint32_t symbol_dist() { return config.symbols == 1 ? 0 : gen() % config.symbols; }
+
+    WorkloadConfig config;
+    mt19937_64 gen;
+    unique_ptr<Router> router;
+    geometric_distribution<uint32_t> touch_offset;
+
+    unordered_map<uint64_t, Resting> resting;
+    vector<uint64_t> resting_ids;
+    uint64_t next_order_id = 1;
+
+    // the add being applied to the shadow router and what of it has traded so far
+    uint64_t pending_id = 0;
+    uint32_t pending_filled = 0;
+};
+
+inline Workload generate_workload(const WorkloadConfig& config) {
+    unique_ptr<WorkloadGenerator> generator(new WorkloadGenerator(config));
+    return generator->generate();
+}
+
+#endif // WORKLOAD_H
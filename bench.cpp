@@ -0,0 +1,448 @@
+#include "Workload.h"
+#include "Latency.h"
+#include "PerfCounters.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <sched.h>
+
+using namespace std;
+
+// runs generated workloads (Workload.h) through a router and reports what they cost:
+//   bench [workload ...] [--cpu N] [--runs N] [--ops N] [--counters 0] [--json results.json] [--baseline earlier.json]
+// with no workload named every one runs. the thread is pinned to one cpu, the current one unless --cpu
+// says otherwise. commands are generated before anything is timed, and each run applies the setup
+// commands untimed and then makes three passes over the same flow:
+//   throughput  the whole flow back to back, timed at its ends only
+//   service     each command timed on its own, less the cost of an empty probe
+//   response    commands applied at their scheduled Poisson arrival times, timed from when each was due,
+//               so the queueing behind a burst is counted (open loop)
+// and, where hardware counters can be opened (PerfCounters.h), a fourth pass reads them around each command
+// and around a get_quote after it, reported as averages per command kind less the cost of an empty read.
+// --counters 0 skips that pass
+// the first run warms caches and the branch predictors and is not reported. --json writes every figure
+// as one flat row and --baseline prints the change against such a file
+
+struct NamedWorkload {
+    const char* name;
+    const char* description;
+    WorkloadConfig config;
+};
+
+vector<NamedWorkload> workloads(uint64_t operations) {
+    WorkloadConfig touch;
+    touch.operations = operations;
+
+    WorkloadConfig deep = touch;
+    deep.initial_levels = 50;
+    deep.orders_per_level = 200;
+    deep.mean_touch_offset = 5;
+
+    WorkloadConfig sweeps = touch;
+    sweeps.sweep_share = 0.25;
+    sweeps.sweep_levels = 20;
+    sweeps.burst_probability = 0.0004;
+
+    WorkloadConfig symbols = touch;
+    symbols.symbols = 256;
+    symbols.initial_levels = 10;
+    symbols.orders_per_level = 4;
+
+    return {
+        {"touch", "30:1 cancels to trades, orders a geometric 2 ticks behind the touch", touch},
+        {"deep_queues", "200 orders a level over 50 levels a side, cancels anywhere in the queues", deep},
+        {"sweeps", "a quarter of trades sweep 20 levels, bursts four times as often", sweeps},
+        {"symbols", "the touch flow spread over 256 books", symbols},
+    };
+}
+
+struct Row {
+    string workload;
+    string metric;
+    double value;
+};
+
+bool selected(int argc, char** argv, const char* workload) {
+    bool any = false;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            ++i;
+            continue;
+        }
+        any = true;
+        if (strcmp(argv[i], workload) == 0) {
+            return true;
+        }
+    }
+    return !any;
+}
+
+const char* option(int argc, char** argv, const char* name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+// pins the calling thread, -1 for the cpu it is on now. returns the cpu, or -1 if pinning failed
+int pin_to_cpu(int cpu) {
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? cpu : -1;
+}
+
+string cpu_model() {
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    char line[512];
+    string model = "unknown";
+    while (file && fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "model name", 10) == 0 && strchr(line, ':')) {
+            model = strchr(line, ':') + 2;
+            model.erase(model.find_last_not_of("\n ") + 1);
+            break;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+    return model;
+}
+
+// median cost of two back to back probes, removed from every service time
+uint64_t probe_overhead() {
+    LatencyHistogram probes;
+    for (int i = 0; i < 1000000; i++) {
+        uint64_t start = tsc_now();
+        probes.record(tsc_now() - start);
+    }
+    return probes.percentile(50);
+}
+
+// mean counts of two back to back reads, removed from every counter average
+CounterTotals counter_overhead(const PerfCounters& counters) {
+    CounterTotals overhead;
+    CounterSample before;
+    CounterSample after;
+    for (int i = 0; i < 100000; i++) {
+        counters.read(before);
+        counters.read(after);
+        overhead.add(before, after);
+    }
+    return overhead;
+}
+
+const char* counter_key(uint32_t counter) {
+    static const char* keys[COUNTERS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses",
+                                         "branch_misses"};
+    return keys[counter];
+}
+
+void print_row(const LatencySummary& row) {
+    cout << "    " << left << setw(10) << row.operation << right << fixed << setprecision(1)
+         << " p50 " << setw(7) << row.p50 << "  p90 " << setw(7) << row.p90
+         << "  p99 " << setw(7) << row.p99 << "  p99.9 " << setw(8) << row.p999
+         << "  max " << setw(10) << row.max << " ns  (" << row.count << ")" << endl;
+}
+
+void add_rows(vector<Row>& rows, const string& workload, const string& prefix, const LatencySummary& summary) {
+    rows.push_back({workload, prefix + "_p50_ns", summary.p50});
+    rows.push_back({workload, prefix + "_p99_ns", summary.p99});
+    rows.push_back({workload, prefix + "_p99_9_ns", summary.p999});
+}
+
+void print_counters(const char* operation, const CounterTotals& totals, const PerfCounters& counters,
+                    const CounterTotals& overhead) {
+    cout << "    " << left << setw(10) << operation << right << fixed << setprecision(1);
+    for (uint32_t c = 0; c < COUNTERS; c++) {
+        if (counters.has(c)) {
+            cout << "  " << counter_name(c) << " " << setw(c == CYCLES || c == INSTRUCTIONS ? 6 : 5)
+                 << totals.mean(c, overhead);
+        }
+    }
+    if (counters.has(CYCLES) && counters.has(INSTRUCTIONS) && totals.mean(CYCLES, overhead) > 0) {
+        cout << "  IPC " << setprecision(2) << totals.mean(INSTRUCTIONS, overhead) / totals.mean(CYCLES, overhead);
+    }
+    cout << endl;
+}
+
+void add_counter_rows(vector<Row>& rows, const string& workload, const char* operation, const CounterTotals& totals,
+                      const PerfCounters& counters, const CounterTotals& overhead) {
+    for (uint32_t c = 0; c < COUNTERS; c++) {
+        if (counters.has(c)) {
+            rows.push_back({workload, string("counters_") + operation + "_" + counter_key(c), totals.mean(c, overhead)});
+        }
+    }
+}
+
+// counters is null when the counter pass is off or no counter could be opened
+void run_workload(const NamedWorkload& named, int num_runs, uint64_t overhead, const PerfCounters* counters,
+                  const CounterTotals& read_overhead, vector<Row>& rows) {
+    enum { ADD, TRADE, CANCEL, MODIFY, ALL, KINDS };
+    const char* kinds[KINDS] = {"add", "trade", "cancel", "modify", "all"};
+
+    Workload workload = generate_workload(named.config);
+    const vector<Command>& commands = workload.commands;
+    size_t n = commands.size();
+
+    // per-command kind and due time, worked out before anything is timed
+    vector<uint8_t> kind(n);
+    vector<uint64_t> due(n);
+    {
+        unique_ptr<SymbolRouter> shadow(new SymbolRouter());
+        for (uint32_t s = 0; s < named.config.symbols; s++) {
+            shadow->add_symbol("SYM" + to_string(s));
+        }
+        for (const Command& command : workload.setup) {
+            shadow->apply(command);
+        }
+        double ticks_per_ns = tsc_ticks_per_ns();
+        for (size_t i = 0; i < n; i++) {
+            const Command& command = commands[i];
+            if (command.type == CommandType::ADD) {
+                Quote q = shadow->get_quote(command.symbol);
+                bool crossing = command.side == Side::BUY ? (q.ask_quantity > 0 && command.price >= q.ask_price)
+                                                          : (q.bid_quantity > 0 && command.price <= q.bid_price);
+                kind[i] = crossing ? TRADE : ADD;
+            } else {
+                kind[i] = command.type == CommandType::CANCEL ? CANCEL : MODIFY;
+            }
+            due[i] = uint64_t(workload.arrival_ns[i] * ticks_per_ns);
+            shadow->apply(command);
+        }
+    }
+
+    unique_ptr<SymbolRouter> router(new SymbolRouter());
+    for (uint32_t s = 0; s < named.config.symbols; s++) {
+        router->add_symbol("SYM" + to_string(s));
+    }
+    auto reset = [&] {
+        router->clear();
+        for (const Command& command : workload.setup) {
+            router->apply(command);
+        }
+    };
+
+    vector<double> ns_per_op;
+    unique_ptr<LatencyHistogram[]> service(new LatencyHistogram[KINDS]);
+    LatencyHistogram response;
+    CounterTotals counted[KINDS];
+    CounterTotals quotes;
+    double ticks_per_ns = tsc_ticks_per_ns();
+
+    for (int run = 0; run <= num_runs; run++) {
+        reset();
+        uint64_t start = tsc_now();
+        for (size_t i = 0; i < n; i++) {
+            router->apply(commands[i]);
+        }
+        uint64_t elapsed = tsc_now() - start;
+
+        reset();
+        if (run == 1) {
+            for (int k = 0; k < KINDS; k++) {
+                service[k].reset();
+            }
+            response.reset();
+        }
+        for (size_t i = 0; i < n; i++) {
+            uint64_t before = tsc_now();
+            router->apply(commands[i]);
+            uint64_t took = tsc_now() - before;
+            took = took > overhead ? took - overhead : 0;
+            service[kind[i]].record(took);
+            service[ALL].record(took);
+        }
+
+        reset();
+        uint64_t base = tsc_now();
+        for (size_t i = 0; i < n; i++) {
+            uint64_t due_at = base + due[i];
+            while (tsc_now() < due_at) {
+            }
+            router->apply(commands[i]);
+            response.record(tsc_now() - due_at);
+        }
+
+        if (counters && run > 0) {
+            reset();
+            CounterSample before;
+            CounterSample after;
+            for (size_t i = 0; i < n; i++) {
+                counters->read(before);
+                router->apply(commands[i]);
+                counters->read(after);
+                counted[kind[i]].add(before, after);
+                counted[ALL].add(before, after);
+
+                counters->read(before);
+                Quote quote = router->get_quote(commands[i].symbol);
+                counters->read(after);
+                quotes.add(before, after);
+                asm volatile("" : : "r"(quote.bid_price) : "memory");
+            }
+        }
+
+        if (run > 0) {
+            ns_per_op.push_back(elapsed / ticks_per_ns / n);
+        }
+    }
+
+    double mean = accumulate(ns_per_op.begin(), ns_per_op.end(), 0.0) / ns_per_op.size();
+    double sq_sum = 0;
+    for (double v : ns_per_op) {
+        sq_sum += (v - mean) * (v - mean);
+    }
+    double seconds = workload.arrival_ns.back() / 1e9;
+
+    cout << named.name << ": " << named.description << endl;
+    cout << "  " << n << " commands: " << workload.adds << " adds, " << workload.cancels << " cancels, "
+         << workload.modifies << " modifies, " << workload.trades << " trades of which " << workload.sweeps
+         << " sweeps; " << workload.setup.size() << " orders resting at the start" << endl;
+    cout << "  Throughput: " << fixed << setprecision(2) << mean << " ns/op (std: " << sqrt(sq_sum / ns_per_op.size())
+         << ")" << endl;
+    cout << "  Service time, less " << setprecision(1) << overhead / ticks_per_ns << " ns of probe:" << endl;
+    rows.push_back({named.name, "ns_per_op", mean});
+    for (int k = 0; k < KINDS; k++) {
+        LatencySummary summary = summarize(named.name, kinds[k], service[k]);
+        print_row(summary);
+        add_rows(rows, named.name, string("service_") + kinds[k], summary);
+    }
+    cout << "  Response time, arriving at " << setprecision(2) << n / seconds / 1e6
+         << "M commands/s with bursts:" << endl;
+    LatencySummary summary = summarize(named.name, "all", response);
+    print_row(summary);
+    add_rows(rows, named.name, "response", summary);
+    if (counters) {
+        cout << "  Counters per command, less an empty read (" << (counters->user_space_reads() ? "rdpmc" : "read()")
+             << "):" << endl;
+        for (int k = 0; k < KINDS; k++) {
+            print_counters(kinds[k], counted[k], *counters, read_overhead);
+            add_counter_rows(rows, named.name, kinds[k], counted[k], *counters, read_overhead);
+        }
+        print_counters("quote", quotes, *counters, read_overhead);
+        add_counter_rows(rows, named.name, "quote", quotes, *counters, read_overhead);
+    }
+    cout << endl;
+}
+
+bool write_json(const char* path, const vector<Row>& rows, int cpu, const char* counter_reads, int num_runs,
+                uint64_t operations) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "{\n  \"machine\": {\"cpu\": \"%s\", \"pinned_cpu\": %d, \"compiler\": \"%s\", \"tsc_ticks_per_ns\": %.3f, \"counters\": \"%s\"},\n",
+            cpu_model().c_str(), cpu, __VERSION__, tsc_ticks_per_ns(), counter_reads);
+    fprintf(file, "  \"config\": {\"runs\": %d, \"operations\": %llu},\n", num_runs, (unsigned long long)operations);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < rows.size(); i++) {
+        fprintf(file, "    {\"workload\": \"%s\", \"metric\": \"%s\", \"value\": %.2f}%s\n", rows[i].workload.c_str(),
+                rows[i].metric.c_str(), rows[i].value, i + 1 < rows.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+// reads the result rows of a file write_json produced, one per line
+bool read_json(const char* path, vector<Row>& rows) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[512];
+    char workload[128];
+    char metric[128];
+    double value;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, " {\"workload\": \"%127[^\"]\", \"metric\": \"%127[^\"]\", \"value\": %lf", workload, metric,
+                   &value) == 3) {
+            rows.push_back({workload, metric, value});
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// every figure is a time or an event count, so a positive change is a slowdown
+void compare(const vector<Row>& baseline, const vector<Row>& rows) {
+    cout << "Against the baseline, + is slower:" << endl;
+    for (const Row& row : rows) {
+        for (const Row& old : baseline) {
+            if (old.workload == row.workload && old.metric == row.metric) {
+                double change = old.value > 0 ? (row.value - old.value) / old.value * 100 : 0;
+                cout << "  " << left << setw(12) << row.workload << setw(22) << row.metric << right << fixed
+                     << setprecision(1) << setw(10) << old.value << " -> " << setw(10) << row.value << "  "
+                     << showpos << change << noshowpos << "%" << endl;
+            }
+        }
+    }
+    cout << endl;
+}
+
+int main(int argc, char** argv) {
+    const char* cpu_option = option(argc, argv, "--cpu");
+    const char* runs_option = option(argc, argv, "--runs");
+    const char* ops_option = option(argc, argv, "--ops");
+    const char* json_path = option(argc, argv, "--json");
+    const char* baseline_path = option(argc, argv, "--baseline");
+    const char* counters_option = option(argc, argv, "--counters");
+    int num_runs = runs_option ? atoi(runs_option) : 5;
+    uint64_t operations = ops_option ? strtoull(ops_option, nullptr, 10) : 1000000;
+
+    vector<Row> baseline;
+    if (baseline_path && !read_json(baseline_path, baseline)) {
+        cerr << "cannot read " << baseline_path << endl;
+        return 1;
+    }
+
+    int cpu = pin_to_cpu(cpu_option ? atoi(cpu_option) : -1);
+    if (cpu < 0) {
+        cout << "could not pin to a cpu, running unpinned" << endl;
+    }
+    uint64_t overhead = probe_overhead();
+
+    // opened after pinning, the counters follow this thread
+    PerfCounters counters;
+    CounterTotals read_overhead;
+    bool counting = !(counters_option && atoi(counters_option) == 0);
+    if (counting && counters.open()) {
+        read_overhead = counter_overhead(counters);
+        if (!counters.error().empty()) {
+            cout << "some hardware counters unavailable, " << counters.error() << endl;
+        }
+    } else if (counting) {
+        cout << "hardware counters unavailable, " << counters.error() << endl;
+    }
+    cout << "=== Workload Benchmarks (" << cpu_model() << ", cpu " << cpu << ", " << num_runs << " runs after a warm-up, "
+         << fixed << setprecision(2) << tsc_ticks_per_ns() << " ticks/ns) ===" << endl << endl;
+
+    const char* counter_reads = !counters.available() ? "none" : (counters.user_space_reads() ? "rdpmc" : "read");
+
+    vector<Row> rows;
+    for (const NamedWorkload& named : workloads(operations)) {
+        if (selected(argc, argv, named.name)) {
+            run_workload(named, num_runs, overhead, counters.available() ? &counters : nullptr, read_overhead, rows);
+        }
+    }
+
+    if (!baseline.empty()) {
+        compare(baseline, rows);
+    }
+    if (json_path && !write_json(json_path, rows, cpu, counter_reads, num_runs, operations)) {
+        cerr << "cannot write " << json_path << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,315 @@
+#include "Gateway.h"
+#include "Latency.h"
+#include "Workload.h"
+#include <iostream>
+#include <iomanip>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+
+using namespace std;
+
+// order entry gateway (Gateway.h) and a load generator for it:
+//   gateway serve [--port N | --unix PATH] [--symbols N] [--uring] [--busy-poll]
+//   gateway load  [--port N | --unix PATH] [--host H] [--connections N] [--window N] [--ops N] [--symbols N]
+// serve lists SYM0.. and matches until interrupted, on io_uring with --uring if the kernel allows it.
+// load plays a generated workload (Workload.h) on each connection, on its own range of --symbols symbols,
+// keeping up to --window requests outstanding. a request's round trip runs from its send to the first
+// report tagged with it, and the orders/sec is what the whole run sustained
+
+const char* option(int argc, char** argv, const char* name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+bool flag(int argc, char** argv, const char* name) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Gateway* serving = nullptr;
+
+void on_signal(int) {
+    if (serving) {
+        serving->stop();
+    }
+}
+
+int serve(int argc, char** argv) {
+    const char* port = option(argc, argv, "--port");
+    const char* path = option(argc, argv, "--unix");
+    const char* symbols = option(argc, argv, "--symbols");
+
+    GatewayConfig config;
+    config.busy_poll = flag(argc, argv, "--busy-poll");
+    unique_ptr<Gateway> gateway(new Gateway(config));
+    uint32_t symbol_count = symbols ? atoi(symbols) : 256;
+    for (uint32_t s = 0; s < symbol_count; s++) {
+        gateway->add_symbol("SYM" + to_string(s));
+    }
+
+    int listener = path ? listen_unix(path) : listen_tcp(port ? atoi(port) : 9000);
+    if (listener < 0) {
+        cerr << "cannot listen on " << (path ? path : (port ? port : "9000")) << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    serving = gateway.get();
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    bool uring = flag(argc, argv, "--uring");
+    cout << "serving " << symbol_count << " symbols on " << (path ? path : "port ") << (path ? "" : (port ? port : "9000"))
+         << " with " << (uring ? "io_uring" : "epoll") << endl;
+    if (uring && !gateway->serve_uring(listener)) {
+        cout << "io_uring unavailable (" << strerror(errno) << "), falling back to epoll" << endl;
+        uring = false;
+    }
+    if (!uring && !gateway->serve_epoll(listener)) {
+        cerr << "cannot set up epoll: " << strerror(errno) << endl;
+        return 1;
+    }
+    close(listener);
+    if (path) {
+        unlink(path);
+    }
+    cout << "served " << gateway->requests() << " requests, " << gateway->engine().live_orders()
+         << " orders resting" << endl;
+    return 0;
+}
+
+struct LoadConnection {
+    int fd = -1;
+    uint32_t symbol_base = 0;
+    vector<Command> commands;  // setup then the measured flow
+    size_t measured_from = 0;  // first request of the measured flow, numbered from 0
+
+    vector<char> out;
+    size_t out_begin = 0;
+    vector<char> in;
+    size_t in_used = 0;
+
+    size_t sent = 0;
+    size_t completed = 0;
+    vector<uint64_t> sent_at;
+
+    uint64_t acks = 0;
+    uint64_t fills = 0;
+    uint64_t rejects = 0;
+};
+
+void encode(LoadConnection& connection, const Command& command) {
+    char message[sizeof(EntryAdd)];
+    size_t size = 0;
+    if (command.type == CommandType::ADD) {
+        EntryAdd add{};
+        add.type = 'A';
+        add.side = command.side == Side::BUY ? 'B' : 'S';
+        add.tif = command.tif == TimeInForce::GTC ? 'G' : 'D';
+        add.symbol = connection.symbol_base + command.symbol;
+        add.client_order_id = command.order_id;
+        add.price = command.price;
+        add.quantity = command.quantity;
+        memcpy(message, &add, size = sizeof(add));
+    } else if (command.type == CommandType::CANCEL) {
+        EntryCancel cancel{};
+        cancel.type = 'X';
+        cancel.client_order_id = command.order_id;
+        memcpy(message, &cancel, size = sizeof(cancel));
+    } else {
+        EntryModify modify{};
+        modify.type = 'U';
+        modify.quantity = command.quantity;
+        modify.client_order_id = command.order_id;
+        memcpy(message, &modify, size = sizeof(modify));
+    }
+    connection.out.insert(connection.out.end(), message, message + size);
+}
+
+// false once the connection fails
+bool send_pending(LoadConnection& connection) {
+    while (connection.out_begin < connection.out.size()) {
+        ssize_t sent = send(connection.fd, connection.out.data() + connection.out_begin,
+                            connection.out.size() - connection.out_begin, MSG_NOSIGNAL);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        connection.out_begin += sent;
+    }
+    connection.out.clear();
+    connection.out_begin = 0;
+    return true;
+}
+
+bool receive(LoadConnection& connection, LatencyHistogram& round_trip, uint64_t& last_completion) {
+    ssize_t got = recv(connection.fd, connection.in.data() + connection.in_used,
+                       connection.in.size() - connection.in_used, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return true;
+    }
+    if (got <= 0) {
+        return false;
+    }
+    uint64_t now = tsc_now();
+    connection.in_used += got;
+    size_t at = 0;
+    for (; at + sizeof(EntryReport) <= connection.in_used; at += sizeof(EntryReport)) {
+        EntryReport report;
+        memcpy(&report, connection.in.data() + at, sizeof(report));
+        connection.acks += report.type == 'K';
+        connection.fills += report.type == 'F';
+        connection.rejects += report.type == 'J';
+        // requests are answered in order and each at least once, so a new request number completes it
+        if (report.request > connection.completed) {
+            connection.completed = report.request;
+            if (report.request > connection.measured_from) {
+                round_trip.record(now - connection.sent_at[report.request - 1]);
+            }
+            last_completion = now;
+        }
+    }
+    memmove(connection.in.data(), connection.in.data() + at, connection.in_used - at);
+    connection.in_used -= at;
+    return true;
+}
+
+int load(int argc, char** argv) {
+    const char* port = option(argc, argv, "--port");
+    const char* path = option(argc, argv, "--unix");
+    const char* host = option(argc, argv, "--host");
+    const char* connections_option = option(argc, argv, "--connections");
+    const char* window_option = option(argc, argv, "--window");
+    const char* ops_option = option(argc, argv, "--ops");
+    const char* symbols_option = option(argc, argv, "--symbols");
+    uint32_t connection_count = connections_option ? atoi(connections_option) : 1;
+    size_t window = window_option ? strtoull(window_option, nullptr, 10) : 1;
+    uint64_t operations = ops_option ? strtoull(ops_option, nullptr, 10) : 200000;
+    uint32_t symbols = symbols_option ? atoi(symbols_option) : 1;
+
+    vector<LoadConnection> connections(connection_count);
+    for (uint32_t c = 0; c < connection_count; c++) {
+        LoadConnection& connection = connections[c];
+        WorkloadConfig config;
+        config.operations = operations;
+        config.symbols = symbols;
+        config.seed = 42 + c;
+        Workload workload = generate_workload(config);
+        connection.commands = workload.setup;
+        connection.measured_from = workload.setup.size();
+        connection.commands.insert(connection.commands.end(), workload.commands.begin(), workload.commands.end());
+        connection.sent_at.resize(connection.commands.size());
+        connection.symbol_base = c * symbols;
+        connection.in.resize(1 << 20);
+
+        connection.fd = path ? connect_unix(path) : connect_tcp(host ? host : "127.0.0.1", port ? atoi(port) : 9000);
+        if (connection.fd < 0) {
+            cerr << "cannot connect: " << strerror(errno) << endl;
+            return 1;
+        }
+        fcntl(connection.fd, F_SETFL, fcntl(connection.fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    LatencyHistogram round_trip;
+    vector<pollfd> polls(connection_count);
+    uint64_t first_measured = 0;
+    uint64_t last_completion = 0;
+    uint32_t finished = 0;
+
+    while (finished < connection_count) {
+        finished = 0;
+        for (uint32_t c = 0; c < connection_count; c++) {
+            LoadConnection& connection = connections[c];
+            if (connection.completed == connection.commands.size()) {
+                ++finished;
+            }
+            if (connection.sent - connection.completed < window && connection.sent < connection.commands.size()) {
+                uint64_t now = tsc_now();
+                while (connection.sent - connection.completed < window && connection.sent < connection.commands.size()) {
+                    if (connection.sent == connection.measured_from && (first_measured == 0 || now < first_measured)) {
+                        first_measured = now;
+                    }
+                    encode(connection, connection.commands[connection.sent]);
+                    connection.sent_at[connection.sent++] = now;
+                }
+                if (!send_pending(connection)) {
+                    cerr << "connection " << c << " lost" << endl;
+                    return 1;
+                }
+            }
+            polls[c].fd = connection.fd;
+            polls[c].events = POLLIN | (connection.out.empty() ? 0 : POLLOUT);
+            polls[c].revents = 0;
+        }
+        if (finished == connection_count) {
+            break;
+        }
+        if (poll(polls.data(), connection_count, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        for (uint32_t c = 0; c < connection_count; c++) {
+            bool ok = true;
+            if (polls[c].revents & POLLOUT) {
+                ok = send_pending(connections[c]);
+            }
+            if (ok && polls[c].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ok = receive(connections[c], round_trip, last_completion);
+            }
+            if (!ok) {
+                cerr << "connection " << c << " lost" << endl;
+                return 1;
+            }
+        }
+    }
+
+    uint64_t requests = 0;
+    uint64_t acks = 0;
+    uint64_t fills = 0;
+    uint64_t rejects = 0;
+    for (LoadConnection& connection : connections) {
+        requests += connection.commands.size() - connection.measured_from;
+        acks += connection.acks;
+        fills += connection.fills;
+        rejects += connection.rejects;
+        close(connection.fd);
+    }
+    double seconds = (last_completion - first_measured) / tsc_ticks_per_ns() / 1e9;
+    LatencySummary summary = summarize("gateway", "round trip", round_trip);
+
+    cout << "Gateway load (" << (path ? path : "tcp") << ", " << connection_count << " connection"
+         << (connection_count == 1 ? "" : "s") << ", window " << window << "):" << endl;
+    cout << "  " << requests << " requests in " << fixed << setprecision(3) << seconds << " s, " << setprecision(0)
+         << requests / seconds << " orders/sec sustained" << endl;
+    cout << "  round trip  p50 " << setprecision(1) << summary.p50 / 1000 << "  p90 " << summary.p90 / 1000
+         << "  p99 " << summary.p99 / 1000 << "  p99.9 " << summary.p999 / 1000 << "  max " << summary.max / 1000
+         << " us" << endl;
+    cout << "  reports: " << acks << " acks, " << fills << " fills, " << rejects << " rejects" << endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        return serve(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "load") == 0) {
+        return load(argc, argv);
+    }
+    cerr << "usage: gateway serve [--port N | --unix PATH] [--symbols N] [--uring] [--busy-poll]" << endl
+         << "       gateway load [--port N | --unix PATH] [--host H] [--connections N] [--window N] [--ops N]"
+         << " [--symbols N]" << endl;
+    return 1;
+}
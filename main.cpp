@@ -1,19 +1,143 @@
 #include "testing.h"
 #include <iostream>
+#include <cstring>
 #include <type_traits>
 
 using namespace std;
 
-int main()
+// with no arguments the core suite runs, the larger suites are selected by name
+bool selected(int argc, char** argv, const char* suite) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], suite) == 0 || strcmp(argv[i], "all") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// value following a "--name value" option, nullptr when absent
+const char* option(int argc, char** argv, const char* name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+int main(int argc, char** argv)
 {
     cout << "=== Orderbook Performance Benchmarks ===" << endl << endl;
 
-    benchmark_add_orders(100000);
-    benchmark_get_quote(1000000);
-    benchmark_cancel_orders(10000);
-    benchmark_modify_orders(10000);
-    benchmark_order_matching(5000);
-    benchmark_mixed_workload(50000);
+    // options alone still run the core suite
+    bool only_options = argc < 2 || argv[1][0] == '-';
+    if (only_options || selected(argc, argv, "core")) {
+        benchmark_add_orders(100000);
+        benchmark_get_quote(1000000);
+        benchmark_cancel_orders(10000);
+        benchmark_modify_orders(10000);
+        benchmark_order_matching(5000);
+        benchmark_mixed_workload(50000);
+    }
+
+    if (selected(argc, argv, "index")) {
+        benchmark_order_index(1000000);
+        benchmark_order_index(10000000);
+    }
+
+    if (selected(argc, argv, "sparse")) {
+        benchmark_sparse_book(50);
+    }
+
+    if (selected(argc, argv, "instruments")) {
+        for (int num_books : {1, 16, 128, 1024, 5000}) {
+            benchmark_multi_instrument(num_books, 1000000);
+        }
+    }
+
+    if (selected(argc, argv, "trend")) {
+        benchmark_trending_market(1000000);
+    }
+
+    if (selected(argc, argv, "reports")) {
+        benchmark_execution_reports(10000);
+    }
+
+    if (selected(argc, argv, "shards")) {
+        for (int num_shards : {1, 2, 4, 8, 16}) {
+            benchmark_sharded_engine(num_shards, 256, 2000000);
+        }
+    }
+
+    if (selected(argc, argv, "feed")) {
+        benchmark_feed_replay(1, 10000000);
+        benchmark_feed_replay(256, 10000000);
+    }
+
+    if (selected(argc, argv, "depth")) {
+        benchmark_depth(1000000);
+    }
+
+    if (selected(argc, argv, "snapshot")) {
+        benchmark_snapshot(1000000);
+        benchmark_snapshot(10000000);
+    }
+
+    if (selected(argc, argv, "journal")) {
+        benchmark_journal(1000000);
+    }
+
+    if (selected(argc, argv, "batch")) {
+        benchmark_batch(200, 1000000);
+        benchmark_batch(1000000, 1000000);
+        benchmark_batch(4000000, 1000000);
+    }
+
+    if (selected(argc, argv, "soak")) {
+        benchmark_soak(100000000);
+    }
+
+    if (selected(argc, argv, "reset")) {
+        benchmark_reset(500);
+    }
+
+    if (selected(argc, argv, "top")) {
+        benchmark_top_of_book(1000000);
+    }
+
+    if (selected(argc, argv, "analytics")) {
+        benchmark_analytics();
+    }
+
+    if (selected(argc, argv, "configs")) {
+        benchmark_book_configs(2000000);
+    }
+
+    if (selected(argc, argv, "risk")) {
+        benchmark_risk(2000000);
+    }
+
+    if (selected(argc, argv, "stops")) {
+        benchmark_stops(10000, 2000000);
+    }
+
+    if (selected(argc, argv, "memory")) {
+        benchmark_memory(1000000);
+    }
+
+    if (selected(argc, argv, "latency")) {
+        benchmark_latency(1000000);
+    }
+
+    // machine-readable percentiles for regression tracking
+    const char* csv_path = option(argc, argv, "--csv");
+    const char* json_path = option(argc, argv, "--json");
+    if (csv_path && !write_latency_csv(csv_path, latency_results)) {
+        cout << "cannot write " << csv_path << endl;
+    }
+    if (json_path && !write_latency_json(json_path, latency_results)) {
+        cout << "cannot write " << json_path << endl;
+    }
 
     cout << "=== Benchmarks Complete ===" << endl;
 
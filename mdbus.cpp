@@ -0,0 +1,326 @@
+#include "MarketDataBus.h"
+#include "Workload.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sched.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// shared memory market data bus (MarketDataBus.h):
+//   mdbus bench [--readers 0,1,2,4,8,16] [--ops N] [--slots N] [--path /dev/shm/orderbook.bus]
+//   mdbus listen [--path /dev/shm/orderbook.bus] [--count N]
+// bench applies a generated workload (Workload.h) through a publishing router once per reader count, every
+// reader a forked process with its own read-only mapping and cursor. it reports the writer's cost per command
+// and per message against a router that publishes nothing, and the readers' latency from publish to read.
+// readers spin on their next slot, yielding when idle only if there are more processes than cpus.
+// listen prints what a running writer publishes
+
+const char* DEFAULT_PATH = "/dev/shm/orderbook.bus";
+
+const char* option(int argc, char** argv, const char* name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+// what a reader process sends back through its pipe
+struct ReaderResult {
+    uint64_t messages = 0;
+    uint64_t gaps = 0;
+    uint64_t lost = 0;
+    LatencyHistogram latency;
+};
+
+bool write_all(int fd, const void* data, size_t bytes) {
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t n = write(fd, p, bytes);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t bytes) {
+    char* p = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t n = read(fd, p, bytes);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+// the forked reader: reads until the writer has closed the bus and nothing is left
+[[noreturn]] void run_reader(const char* path, int ready_fd, int result_fd, bool yield) {
+    unique_ptr<ReaderResult> result(new ReaderResult());
+    BusReader reader;
+    char opened = reader.open(path) ? 1 : 0;
+    write_all(ready_fd, &opened, 1);
+    if (!opened) {
+        _exit(1);
+    }
+
+    MarketDataMessage message{};
+    while (true) {
+        BusRead status = reader.read(message);
+        if (status == BusRead::NONE) {
+            if (!reader.writer_closed()) {
+                if (yield) {
+                    sched_yield();
+                }
+                continue;
+            }
+            // closed is checked before the last read, so nothing published before it is missed
+            status = reader.read(message);
+            if (status == BusRead::NONE) {
+                break;
+            }
+        }
+        if (status == BusRead::MESSAGE) {
+            result->latency.record(tsc_stamp() - message.publish_tsc);
+            ++result->messages;
+        }
+    }
+    result->gaps = reader.gaps();
+    result->lost = reader.lost();
+    write_all(result_fd, result.get(), sizeof(ReaderResult));
+    _exit(0);
+}
+
+// ns per measured command, the setup is the caller's
+template <typename Apply>
+double time_commands(const Workload& workload, Apply&& apply) {
+    uint64_t start = tsc_now();
+    for (const Command& command : workload.commands) {
+        apply(command);
+    }
+    return (tsc_now() - start) / tsc_ticks_per_ns() / workload.commands.size();
+}
+
+struct PublishResult {
+    double ns_per_command;
+    uint64_t messages;  // per run
+};
+
+// best of three runs through a publishing router on writer
+PublishResult publish_runs(BusWriter& writer, bool timestamps, const Workload& workload, uint32_t symbols) {
+    unique_ptr<MarketDataPublisher<>> publisher(new MarketDataPublisher<>(writer, timestamps));
+    for (uint32_t s = 0; s < symbols; s++) {
+        publisher->add_symbol("SYM" + to_string(s));
+    }
+    PublishResult result{1e30, 0};
+    for (int run = 0; run < 3; run++) {
+        publisher->engine().clear();
+        for (const Command& command : workload.setup) {
+            publisher->apply(command);
+        }
+        uint64_t before = writer.published();
+        result.ns_per_command = min(result.ns_per_command, time_commands(workload, [&](const Command& command) {
+                                        publisher->apply(command);
+                                    }));
+        result.messages = writer.published() - before;
+    }
+    return result;
+}
+
+int bench(int argc, char** argv) {
+    const char* path = option(argc, argv, "--path") ? option(argc, argv, "--path") : DEFAULT_PATH;
+    const char* readers_option = option(argc, argv, "--readers");
+    const char* ops_option = option(argc, argv, "--ops");
+    const char* slots_option = option(argc, argv, "--slots");
+    uint64_t slots = slots_option ? strtoull(slots_option, nullptr, 10) : 1 << 18;
+
+    vector<uint32_t> reader_counts;
+    for (const char* p = readers_option ? readers_option : "0,1,2,4,8,16"; *p;) {
+        reader_counts.push_back(strtoul(p, const_cast<char**>(&p), 10));
+        p += *p == ',';
+    }
+
+    WorkloadConfig config;
+    config.operations = ops_option ? strtoull(ops_option, nullptr, 10) : 1000000;
+    config.symbols = 16;
+    config.initial_levels = 10;
+    Workload workload = generate_workload(config);
+    uint32_t cpus = thread::hardware_concurrency();
+
+    // the same flow through a router that publishes nothing. every figure is the best of three runs over a
+    // cleared router, so none of them pays for first touching the order store
+    double bare = 1e30;
+    unique_ptr<SymbolRouter> router(new SymbolRouter());
+    for (uint32_t s = 0; s < config.symbols; s++) {
+        router->add_symbol("SYM" + to_string(s));
+    }
+    for (int run = 0; run < 3; run++) {
+        router->clear();
+        for (const Command& command : workload.setup) {
+            router->apply(command);
+        }
+        bare = min(bare, time_commands(workload, [&](const Command& command) { router->apply(command); }));
+    }
+
+    cout << "Market data bus (" << workload.commands.size() << " commands over " << config.symbols << " symbols, "
+         << slots << " slots at " << path << ", " << cpus << " cpus):" << endl;
+    cout << "  no bus: " << fixed << setprecision(1) << bare << " ns/command" << endl;
+
+    // the writer alone without timestamps, what the readers' latency figures cost
+    {
+        BusWriter writer;
+        if (!writer.create(path, slots)) {
+            cerr << "cannot create " << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        PublishResult unstamped = publish_runs(writer, false, workload, config.symbols);
+        cout << "  no readers, no timestamps: " << unstamped.ns_per_command << " ns/command, "
+             << (unstamped.ns_per_command - bare) * workload.commands.size() / unstamped.messages << " ns/message"
+             << endl;
+    }
+
+    cout << "  readers  ns/command  ns/message  msgs/command   latency p50      p99    p99.9        max    gaps      lost"
+         << endl;
+
+    for (uint32_t count : reader_counts) {
+        BusWriter writer;
+        if (!writer.create(path, slots)) {
+            cerr << "cannot create " << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+
+        int ready[2];
+        if (pipe(ready) < 0) {
+            return 1;
+        }
+        vector<pid_t> children;
+        vector<int> results;
+        bool yield = count + 1 > cpus;
+        for (uint32_t r = 0; r < count; r++) {
+            int result[2];
+            if (pipe(result) < 0) {
+                return 1;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(ready[0]);
+                close(result[0]);
+                run_reader(path, ready[1], result[1], yield);
+            }
+            close(result[1]);
+            children.push_back(pid);
+            results.push_back(result[0]);
+        }
+        close(ready[1]);
+        bool all_ready = true;
+        for (uint32_t r = 0; r < count; r++) {
+            char opened = 0;
+            all_ready = read_all(ready[0], &opened, 1) && opened && all_ready;
+        }
+        close(ready[0]);
+        if (!all_ready) {
+            cerr << "a reader could not open " << path << endl;
+        }
+
+        PublishResult published = publish_runs(writer, true, workload, config.symbols);
+        double ns_per_command = published.ns_per_command;
+        uint64_t messages = published.messages;
+        writer.close();
+
+        ReaderResult total;
+        unique_ptr<ReaderResult> result(new ReaderResult());
+        for (uint32_t r = 0; r < count; r++) {
+            if (read_all(results[r], result.get(), sizeof(ReaderResult))) {
+                total.messages += result->messages;
+                total.gaps += result->gaps;
+                total.lost += result->lost;
+                total.latency.merge(result->latency);
+            }
+            close(results[r]);
+            waitpid(children[r], nullptr, 0);
+        }
+
+        double ns_per_message = (ns_per_command - bare) * workload.commands.size() / messages;
+        cout << "  " << setw(7) << count << "  " << setw(10) << setprecision(1) << ns_per_command << "  " << setw(10)
+             << ns_per_message << "  " << setw(12) << setprecision(2) << double(messages) / workload.commands.size();
+        if (count > 0) {
+            LatencySummary latency = summarize("bus", "read", total.latency);
+            cout << "  " << setprecision(1) << setw(11) << latency.p50 << "  " << setw(7) << latency.p99 << "  "
+                 << setw(7) << latency.p999 << "  " << setw(9) << latency.max << " ns  " << setw(6) << total.gaps
+                 << "  " << setw(8) << total.lost;
+        }
+        cout << endl;
+    }
+    unlink(path);
+    cout << endl;
+    return 0;
+}
+
+int listen_bus(int argc, char** argv) {
+    const char* path = option(argc, argv, "--path") ? option(argc, argv, "--path") : DEFAULT_PATH;
+    const char* count_option = option(argc, argv, "--count");
+    uint64_t count = count_option ? strtoull(count_option, nullptr, 10) : UINT64_MAX;
+
+    BusReader reader;
+    if (!reader.open(path)) {
+        cerr << "no bus at " << path << endl;
+        return 1;
+    }
+    MarketDataMessage message{};
+    for (uint64_t seen = 0; seen < count;) {
+        BusRead status = reader.read(message);
+        if (status == BusRead::NONE) {
+            if (!reader.writer_closed()) {
+                sched_yield();
+                continue;
+            }
+            status = reader.read(message);
+            if (status == BusRead::NONE) {
+                break;
+            }
+        }
+        if (status == BusRead::GAP) {
+            cout << "gap, resuming at " << reader.position() << " (" << reader.lost() << " lost so far)" << endl;
+            continue;
+        }
+        ++seen;
+        cout << "SYM" << message.symbol << " #" << message.sequence << " ";
+        const char* side = message.side == Side::BUY ? "bid" : "ask";
+        switch (message.type) {
+            case MarketDataType::TRADE:
+                cout << "trade " << message.quantity << " @ " << message.price
+                     << (message.side == Side::BUY ? " (buyer)" : " (seller)") << endl;
+                break;
+            case MarketDataType::QUOTE:
+                cout << "quote " << message.bid_quantity << " @ " << message.bid_price << " / " << message.ask_quantity
+                     << " @ " << message.ask_price << endl;
+                break;
+            case MarketDataType::LEVEL:
+                cout << side << " level " << message.price << " now " << message.quantity << endl;
+                break;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "listen") == 0) {
+        return listen_bus(argc, argv);
+    }
+    cerr << "usage: mdbus bench [--readers 0,1,2,4,8,16] [--ops N] [--slots N] [--path FILE]" << endl
+         << "       mdbus listen [--path FILE] [--count N]" << endl;
+    return 1;
+}
@@ -0,0 +1,140 @@
+#include "FeedReplay.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <unordered_map>
+
+using namespace std;
+using namespace std::chrono;
+
+// replays a capture into a router and reports throughput:
+//   replay <capture.bin>
+// converts one LOBSTER message file (time,type,order_id,size,price,direction) to a capture:
+//   replay --convert-lobster <messages.csv> <symbol> <capture.bin>
+
+int replay_capture(const char* path) {
+    FeedReader reader;
+    if (!reader.open(path)) {
+        cerr << "cannot open capture " << path << endl;
+        return 1;
+    }
+
+    SymbolRouter router;
+    reader.add_symbols(router);
+
+    auto start = high_resolution_clock::now();
+    uint64_t replayed = reader.replay(router);
+    auto end = high_resolution_clock::now();
+
+    double seconds = duration_cast<nanoseconds>(end - start).count() / 1e9;
+    cout << path << ": " << replayed << " of " << reader.message_count() << " messages, "
+         << reader.symbol_count() << " symbols, " << reader.size_bytes() / (1 << 20) << " MB" << endl;
+    cout << fixed << setprecision(3) << "  replay: " << seconds << " s, "
+         << setprecision(2) << replayed / seconds / 1e6 << "M msgs/sec" << endl;
+    cout << "  live orders: " << router.live_orders() << endl;
+
+    for (uint32_t i = 0; i < min<uint32_t>(router.symbol_count(), 10); i++) {
+        Quote q = router.get_quote(i);
+        cout << "  " << reader.symbol(i) << ": Bid=" << q.bid_price << "(" << q.bid_quantity << ") "
+             << "Ask=" << q.ask_price << "(" << q.ask_quantity << ")" << endl;
+    }
+    return replayed == reader.message_count() ? 0 : 1;
+}
+
+// LOBSTER types: 1 add, 2 partial cancel, 3 delete, 4 visible execution.
+// hidden executions (5), cross trades (6) and halts (7) do not touch the visible book and are skipped.
+// a partial cancel carries the cancelled size, the capture carries the remaining size, so resting sizes are tracked.
+int convert_lobster(const char* input, const char* symbol, const char* output) {
+    FILE* in = fopen(input, "r");
+    if (!in) {
+        cerr << "cannot open " << input << endl;
+        return 1;
+    }
+    FeedWriter writer;
+    if (!writer.open(output, {symbol})) {
+        cerr << "cannot create " << output << endl;
+        fclose(in);
+        return 1;
+    }
+
+    unordered_map<uint64_t, uint32_t> resting;
+    uint64_t lines = 0;
+    uint64_t skipped = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), in)) {
+        ++lines;
+        char* p = line;
+        strtod(p, &p);  // time, unused
+        int type = strtol(p + 1, &p, 10);
+        uint64_t order_id = strtoull(p + 1, &p, 10);
+        uint32_t size = strtoul(p + 1, &p, 10);
+        uint32_t price = strtoul(p + 1, &p, 10);
+        int direction = strtol(p + 1, &p, 10);
+
+        switch (type) {
+            case 1:
+                writer.add(0, order_id, direction == 1 ? Side::BUY : Side::SELL, price, size);
+                resting[order_id] = size;
+                break;
+            case 2: {
+                auto it = resting.find(order_id);
+                if (it == resting.end()) {
+                    // placed before the file starts, the remaining size is unknown
+                    ++skipped;
+                    break;
+                }
+                it->second -= min(size, it->second);
+                if (it->second == 0) {
+                    writer.cancel(0, order_id);
+                    resting.erase(it);
+                } else {
+                    writer.modify(0, order_id, it->second);
+                }
+                break;
+            }
+            case 3:
+                writer.cancel(0, order_id);
+                resting.erase(order_id);
+                break;
+            case 4: {
+                writer.execute(0, order_id, size);
+                auto it = resting.find(order_id);
+                if (it != resting.end()) {
+                    it->second -= min(size, it->second);
+                    if (it->second == 0) {
+                        resting.erase(it);
+                    }
+                }
+                break;
+            }
+            default:
+                ++skipped;
+                break;
+        }
+    }
+    fclose(in);
+
+    uint64_t written = writer.message_count();
+    if (!writer.close()) {
+        cerr << "write to " << output << " failed" << endl;
+        return 1;
+    }
+    cout << input << ": " << lines << " lines, " << written << " messages written, " << skipped << " skipped" << endl;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 2) {
+        return replay_capture(argv[1]);
+    }
+    if (argc == 5 && strcmp(argv[1], "--convert-lobster") == 0) {
+        return convert_lobster(argv[2], argv[3], argv[4]);
+    }
+
+    cerr << "usage: " << argv[0] << " <capture.bin>" << endl
+         << "       " << argv[0] << " --convert-lobster <messages.csv> <symbol> <capture.bin>" << endl;
+    return 1;
+}
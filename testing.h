@@ -9,7 +9,21 @@
 #include <algorithm>
 #include <numeric>
 #include <cmath>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <csignal>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include "Orderbook.h"
+#include "SymbolRouter.h"
+#include "ShardedEngine.h"
+#include "FeedReplay.h"
+#include "DepthBook.h"
+#include "Latency.h"
+#include "Journal.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -38,6 +52,29 @@ void print_stats(const string& metric_name, const BenchmarkStats& stats, const s
          << stats.mean << " " << unit << " (std: " << stats.std_dev << ")" << endl;
 }
 
+// median and quartiles, for differences smaller than the spread of a mean over a few runs
+struct MedianStats {
+    double median;
+    double p25;
+    double p75;
+};
+
+MedianStats calculate_median(vector<double> values) {
+    sort(values.begin(), values.end());
+    auto at = [&](double q) {
+        double rank = q * (values.size() - 1);
+        size_t below = size_t(rank);
+        size_t above = min(below + 1, values.size() - 1);
+        return values[below] + (values[above] - values[below]) * (rank - below);
+    };
+    return MedianStats{at(0.5), at(0.25), at(0.75)};
+}
+
+void print_median(const string& metric_name, const MedianStats& stats, const string& unit) {
+    cout << "  " << metric_name << ": " << fixed << setprecision(2) << stats.median << " " << unit
+         << " (IQR: " << stats.p25 << " to " << stats.p75 << ")" << endl;
+}
+
 bool check_quote(const Quote& q, uint32_t exp_bid_price, uint32_t exp_bid_qty,
                  uint32_t exp_ask_price, uint32_t exp_ask_qty, const string& test_name) {
     bool passed = (q.bid_price == exp_bid_price && q.bid_quantity == exp_bid_qty &&
@@ -57,12 +94,13 @@ bool check_quote(const Quote& q, uint32_t exp_bid_price, uint32_t exp_bid_qty,
 }
 
 void benchmark_add_orders(int num_orders, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
     vector<double> total_times;
     vector<double> avg_per_add;
     vector<double> adds_per_sec;
 
     for (int run = 0; run < num_runs; run++) {
-        clear_orderbook();
+        book->clear();
         mt19937 gen(42);
         uniform_int_distribution<> price_dist(9000, 11000);
         uniform_int_distribution<> qty_dist(1, 100);
@@ -75,7 +113,7 @@ void benchmark_add_orders(int num_orders, int num_runs = 10) {
             Side side = side_dist(gen) == 0 ? Side::BUY : Side::SELL;
             uint32_t price = price_dist(gen);
             uint32_t quantity = qty_dist(gen);
-            add_order(order_id, side, price, quantity);
+            book->add_order(order_id, side, price, quantity);
         }
 
         auto end = high_resolution_clock::now();
@@ -94,24 +132,25 @@ void benchmark_add_orders(int num_orders, int num_runs = 10) {
 }
 
 void benchmark_get_quote(int num_iterations, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
     vector<double> total_times;
     vector<double> avg_per_quote;
     vector<double> quotes_per_sec;
 
     for (int run = 0; run < num_runs; run++) {
-        clear_orderbook();
+        book->clear();
 
         // Setup orderbook with some orders
         for (int i = 0; i < 1000; i++) {
-            add_order(i + 1, Side::BUY, 10000 - i, 100);
-            add_order(i + 1001, Side::SELL, 10001 + i, 100);
+            book->add_order(i + 1, Side::BUY, 10000 - i, 100);
+            book->add_order(i + 1001, Side::SELL, 10001 + i, 100);
         }
 
         auto start = high_resolution_clock::now();
 
         Quote q(0, 0, 0, 0);
         for (int i = 0; i < num_iterations; i++) {
-            q = get_quote();
+            q = book->get_quote();
             volatile uint32_t prevent_opt = q.bid_price;
         }
 
@@ -130,23 +169,49 @@ void benchmark_get_quote(int num_iterations, int num_runs = 10) {
     cout << endl;
 }
 
-void benchmark_cancel_orders(int num_orders, int num_runs = 10) {
+enum class CancelPattern {
+    FIFO,
+    REVERSE,
+    RANDOM
+};
+
+const char* cancel_pattern_name(CancelPattern pattern) {
+    switch (pattern) {
+        case CancelPattern::FIFO: return "FIFO";
+        case CancelPattern::REVERSE: return "reverse";
+        case CancelPattern::RANDOM: return "random";
+    }
+    return "";
+}
+
+void benchmark_cancel_orders(int num_orders, CancelPattern pattern, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
     vector<double> total_times;
     vector<double> avg_per_cancel;
     vector<double> cancels_per_sec;
 
+    // cancel sequence is built outside the timed region
+    vector<uint64_t> cancel_ids(num_orders);
+    iota(cancel_ids.begin(), cancel_ids.end(), 1);
+    if (pattern == CancelPattern::REVERSE) {
+        reverse(cancel_ids.begin(), cancel_ids.end());
+    } else if (pattern == CancelPattern::RANDOM) {
+        mt19937 gen(42);
+        shuffle(cancel_ids.begin(), cancel_ids.end(), gen);
+    }
+
     for (int run = 0; run < num_runs; run++) {
-        clear_orderbook();
+        book->clear();
 
-        // Add orders first
+        // Add orders first, all queued at one price
         for (int i = 0; i < num_orders; i++) {
-            add_order(i + 1, Side::BUY, 10000, 100);
+            book->add_order(i + 1, Side::BUY, 10000, 100);
         }
 
         auto start = high_resolution_clock::now();
 
         for (int i = 0; i < num_orders; i++) {
-            cancel_order(i + 1);
+            book->cancel_order(cancel_ids[i]);
         }
 
         auto end = high_resolution_clock::now();
@@ -157,32 +222,40 @@ void benchmark_cancel_orders(int num_orders, int num_runs = 10) {
         cancels_per_sec.push_back((num_orders * 1000000.0) / duration.count());
     }
 
-    cout << "Cancel Orders Benchmark (" << num_orders << " orders, " << num_runs << " runs):" << endl;
+    cout << "Cancel Orders Benchmark (" << num_orders << " orders, " << cancel_pattern_name(pattern)
+         << " order, " << num_runs << " runs):" << endl;
     print_stats("Total time", calculate_stats(total_times), "μs");
     print_stats("Avg per cancel", calculate_stats(avg_per_cancel), "μs");
     print_stats("Cancels/sec", calculate_stats(cancels_per_sec), "ops");
     cout << endl;
 }
 
+void benchmark_cancel_orders(int num_orders, int num_runs = 10) {
+    benchmark_cancel_orders(num_orders, CancelPattern::FIFO, num_runs);
+    benchmark_cancel_orders(num_orders, CancelPattern::REVERSE, num_runs);
+    benchmark_cancel_orders(num_orders, CancelPattern::RANDOM, num_runs);
+}
+
 void benchmark_modify_orders(int num_orders, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
     vector<double> total_times;
     vector<double> avg_per_modify;
     vector<double> modifies_per_sec;
 
     for (int run = 0; run < num_runs; run++) {
-        clear_orderbook();
+        book->clear();
         mt19937 gen(42 + run);
         uniform_int_distribution<> qty_dist(1, 100);
 
         // Add orders first
         for (int i = 0; i < num_orders; i++) {
-            add_order(i + 1, Side::BUY, 10000, 100);
+            book->add_order(i + 1, Side::BUY, 10000, 100);
         }
 
         auto start = high_resolution_clock::now();
 
         for (int i = 0; i < num_orders; i++) {
-            modify_order(i + 1, qty_dist(gen));
+            book->modify_order(i + 1, qty_dist(gen));
         }
 
         auto end = high_resolution_clock::now();
@@ -201,23 +274,24 @@ void benchmark_modify_orders(int num_orders, int num_runs = 10) {
 }
 
 void benchmark_order_matching(int num_orders, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
     vector<double> total_times;
     vector<double> avg_per_match;
     vector<double> matches_per_sec;
 
     for (int run = 0; run < num_runs; run++) {
-        clear_orderbook();
+        book->clear();
 
         // Add resting sell orders
         for (int i = 0; i < num_orders; i++) {
-            add_order(i + 1, Side::SELL, 10000 + i, 100);
+            book->add_order(i + 1, Side::SELL, 10000 + i, 100);
         }
 
         auto start = high_resolution_clock::now();
 
         // Add aggressive buy orders that will match
         for (int i = 0; i < num_orders; i++) {
-            add_order(i + num_orders + 1, Side::BUY, 10000 + i, 100);
+            book->add_order(i + num_orders + 1, Side::BUY, 10000 + i, 100);
         }
 
         auto end = high_resolution_clock::now();
@@ -236,12 +310,13 @@ void benchmark_order_matching(int num_orders, int num_runs = 10) {
 }
 
 void benchmark_mixed_workload(int num_operations, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
     vector<double> total_times;
     vector<double> avg_per_op;
     vector<double> ops_per_sec;
 
     for (int run = 0; run < num_runs; run++) {
-        clear_orderbook();
+        book->clear();
         mt19937 gen(42 + run);
         uniform_int_distribution<> op_dist(0, 3);  // 0=add, 1=cancel, 2=modify, 3=quote
         uniform_int_distribution<> price_dist(9900, 10100);
@@ -253,9 +328,9 @@ void benchmark_mixed_workload(int num_operations, int num_runs = 10) {
 
         // Pre-populate with some orders
         for (int i = 0; i < 100; i++) {
-            add_order(next_order_id, Side::BUY, 9950 - i, 100);
+            book->add_order(next_order_id, Side::BUY, 9950 - i, 100);
             active_orders.push_back(next_order_id++);
-            add_order(next_order_id, Side::SELL, 10050 + i, 100);
+            book->add_order(next_order_id, Side::SELL, 10050 + i, 100);
             active_orders.push_back(next_order_id++);
         }
 
@@ -268,19 +343,21 @@ void benchmark_mixed_workload(int num_operations, int num_runs = 10) {
                 Side side = side_dist(gen) == 0 ? Side::BUY : Side::SELL;
                 uint32_t price = price_dist(gen);
                 uint32_t quantity = qty_dist(gen);
-                add_order(next_order_id, side, price, quantity);
+                book->add_order(next_order_id, side, price, quantity);
                 active_orders.push_back(next_order_id++);
             } else if (op == 1 && !active_orders.empty()) {  // Cancel order
                 uniform_int_distribution<> order_dist(0, active_orders.size() - 1);
                 int idx = order_dist(gen);
-                cancel_order(active_orders[idx]);
-                active_orders.erase(active_orders.begin() + idx);
+                book->cancel_order(active_orders[idx]);
+                // swap-remove, an erase would shift the whole vector inside the timed loop
+                active_orders[idx] = active_orders.back();
+                active_orders.pop_back();
             } else if (op == 2 && !active_orders.empty()) {  // Modify order
                 uniform_int_distribution<> order_dist(0, active_orders.size() - 1);
                 int idx = order_dist(gen);
-                modify_order(active_orders[idx], qty_dist(gen));
+                book->modify_order(active_orders[idx], qty_dist(gen));
             } else {  // Get quote
-                Quote q = get_quote();
+                Quote q = book->get_quote();
                 volatile uint32_t prevent_opt = q.bid_price;
             }
         }
@@ -300,4 +377,2632 @@ void benchmark_mixed_workload(int num_operations, int num_runs = 10) {
     cout << endl;
 }
 
+// times random lookups and erase+insert churn against one index implementation
+template <typename Find, typename Replace>
+void run_index_benchmark(const string& name, vector<uint64_t> live_ids, const vector<uint32_t>& picks,
+                         const vector<uint32_t>& victims, int num_runs, Find find, Replace replace) {
+    vector<double> avg_per_lookup;
+    vector<double> avg_per_replace;
+    uint64_t next_id = live_ids.size() + 1;
+    size_t num_replaces = victims.size() / num_runs;
+
+    for (int run = 0; run < num_runs; run++) {
+        // resolve ids outside the timed region so the harness adds no cache misses of its own
+        vector<uint64_t> keys(picks.size());
+        for (size_t i = 0; i < picks.size(); i++) {
+            keys[i] = live_ids[picks[(i + run * 7919) % picks.size()]];
+        }
+        vector<uint64_t> old_ids(num_replaces);
+        for (size_t i = 0; i < num_replaces; i++) {
+            old_ids[i] = live_ids[victims[run * num_replaces + i]];
+        }
+
+        uint64_t checksum = 0;
+        auto start = high_resolution_clock::now();
+        for (uint64_t key : keys) {
+            checksum += find(key);
+        }
+        auto end = high_resolution_clock::now();
+        volatile uint64_t prevent_opt = checksum;
+        avg_per_lookup.push_back((double)duration_cast<nanoseconds>(end - start).count() / keys.size());
+
+        // swap live orders for fresh ids, keeping the live count constant
+        uint64_t first_new_id = next_id;
+        start = high_resolution_clock::now();
+        for (size_t i = 0; i < num_replaces; i++) {
+            replace(old_ids[i], next_id++, victims[run * num_replaces + i]);
+        }
+        end = high_resolution_clock::now();
+        avg_per_replace.push_back((double)duration_cast<nanoseconds>(end - start).count() / num_replaces);
+
+        for (size_t i = 0; i < num_replaces; i++) {
+            live_ids[victims[run * num_replaces + i]] = first_new_id + i;
+        }
+    }
+
+    print_stats(name + " avg per lookup", calculate_stats(avg_per_lookup), "ns");
+    print_stats(name + " avg per erase+insert", calculate_stats(avg_per_replace), "ns");
+}
+
+// order index lookup cost at a given number of live orders, against std::unordered_map.
+// keys are drawn at random from the live set, so once the table outgrows the cache every probe is a cold line.
+void benchmark_order_index(uint32_t num_orders, int num_ops = 1000000, int num_runs = 5) {
+    vector<uint64_t> live_ids(num_orders);
+    iota(live_ids.begin(), live_ids.end(), 1);
+
+    mt19937 gen(42);
+    uniform_int_distribution<uint32_t> pick_dist(0, num_orders - 1);
+    vector<uint32_t> picks(num_ops);
+    for (uint32_t& pick : picks) {
+        pick = pick_dist(gen);
+    }
+
+    // each live order is replaced at most once across all runs
+    vector<uint32_t> victims(num_orders);
+    iota(victims.begin(), victims.end(), 0);
+    shuffle(victims.begin(), victims.end(), gen);
+    victims.resize(min<size_t>(num_orders, num_ops / 4));
+
+    cout << "Order Index Benchmark (" << num_orders << " live orders, " << num_ops << " lookups, "
+         << num_runs << " runs):" << endl;
+
+    {
+        OrderIndex index(num_orders);
+        for (uint32_t i = 0; i < num_orders; i++) {
+            index.insert(live_ids[i], i);
+        }
+        run_index_benchmark("OrderIndex", live_ids, picks, victims, num_runs,
+            [&](uint64_t id) { return index.find(id); },
+            [&](uint64_t old_id, uint64_t new_id, uint32_t value) {
+                index.erase(old_id);
+                index.insert(new_id, value);
+            });
+    }
+
+    {
+        unordered_map<uint64_t, uint32_t> index;
+        index.reserve(num_orders);
+        for (uint32_t i = 0; i < num_orders; i++) {
+            index.emplace(live_ids[i], i);
+        }
+        run_index_benchmark("unordered_map", live_ids, picks, victims, num_runs,
+            [&](uint64_t id) { return index.find(id)->second; },
+            [&](uint64_t old_id, uint64_t new_id, uint32_t value) {
+                index.erase(old_id);
+                index.emplace(new_id, value);
+            });
+    }
+    cout << endl;
+}
+
+// worst case for best bid/ask recomputation: a handful of levels spread across the whole price range,
+// so every emptied level has to search a long gap to find the next one
+void benchmark_sparse_book(int num_levels, int num_sweeps = 1000, int num_runs = 10) {
+    unique_ptr<Orderbook> book(new Orderbook());
+    vector<double> avg_per_level;
+    vector<double> avg_per_cancel;
+
+    uint32_t spacing = (MAX_PRICE - 2) / num_levels;
+
+    for (int run = 0; run < num_runs; run++) {
+        book->clear();
+        uint64_t next_order_id = 1;
+        int64_t sweep_ns = 0;
+
+        // one aggressive buy sweeps every ask level, each emptied level triggers a recompute
+        for (int sweep = 0; sweep < num_sweeps; sweep++) {
+            for (int i = 0; i < num_levels; i++) {
+                book->add_order(next_order_id++, Side::SELL, 1 + i * spacing, 100);
+            }
+
+            auto start = high_resolution_clock::now();
+            book->add_order(next_order_id++, Side::BUY, MAX_PRICE - 1, 100 * num_levels);
+            auto end = high_resolution_clock::now();
+            sweep_ns += duration_cast<nanoseconds>(end - start).count();
+        }
+        avg_per_level.push_back((double)sweep_ns / ((int64_t)num_sweeps * num_levels));
+
+        // cancelling the touch with the next bid at the far end of the book
+        book->clear();
+        book->add_order(next_order_id++, Side::BUY, 1, 100);
+
+        auto start = high_resolution_clock::now();
+        for (int i = 0; i < num_sweeps; i++) {
+            book->add_order(next_order_id, Side::BUY, MAX_PRICE - 1, 100);
+            book->cancel_order(next_order_id++);
+        }
+        auto end = high_resolution_clock::now();
+        avg_per_cancel.push_back((double)duration_cast<nanoseconds>(end - start).count() / num_sweeps);
+    }
+
+    cout << "Sparse Book Benchmark (" << num_levels << " levels " << spacing << " ticks apart, "
+         << num_runs << " runs):" << endl;
+    print_stats("Avg per swept level", calculate_stats(avg_per_level), "ns");
+    print_stats("Avg per touch add+cancel", calculate_stats(avg_per_cancel), "ns");
+    cout << endl;
+}
+
+// mixed flow interleaved across many books in one process. with more instruments each op is
+// more likely to land on levels and orders evicted since that book was last touched.
+void benchmark_multi_instrument(int num_books, int num_operations, int num_runs = 5) {
+    vector<double> avg_per_op;
+    vector<double> ops_per_sec;
+
+    unique_ptr<SymbolRouter> router(new SymbolRouter());
+    for (int b = 0; b < num_books; b++) {
+        router->add_symbol("SYM" + to_string(b));
+    }
+
+    for (int run = 0; run < num_runs; run++) {
+        for (int b = 0; b < num_books; b++) {
+            router->book(b).clear();
+        }
+        mt19937 gen(42 + run);
+        uniform_int_distribution<> book_dist(0, num_books - 1);
+        uniform_int_distribution<> op_dist(0, 3);  // 0=add, 1=cancel, 2=modify, 3=quote
+        uniform_int_distribution<> price_dist(9900, 10100);
+        uniform_int_distribution<> qty_dist(1, 100);
+        uniform_int_distribution<> side_dist(0, 1);
+
+        uint64_t next_order_id = 1;
+        vector<uint64_t> active_orders;
+
+        // Pre-populate every book with some depth
+        for (int b = 0; b < num_books; b++) {
+            for (int i = 0; i < 10; i++) {
+                router->add_order(b, next_order_id, Side::BUY, 9950 - i, 100);
+                active_orders.push_back(next_order_id++);
+                router->add_order(b, next_order_id, Side::SELL, 10050 + i, 100);
+                active_orders.push_back(next_order_id++);
+            }
+        }
+
+        auto start = high_resolution_clock::now();
+
+        for (int i = 0; i < num_operations; i++) {
+            int op = op_dist(gen);
+            uint32_t symbol = book_dist(gen);
+
+            if (op == 0) {  // Add order
+                Side side = side_dist(gen) == 0 ? Side::BUY : Side::SELL;
+                router->add_order(symbol, next_order_id, side, price_dist(gen), qty_dist(gen));
+                active_orders.push_back(next_order_id++);
+            } else if (op == 1 && !active_orders.empty()) {  // Cancel order
+                uniform_int_distribution<size_t> order_dist(0, active_orders.size() - 1);
+                size_t idx = order_dist(gen);
+                router->cancel_order(active_orders[idx]);
+                active_orders[idx] = active_orders.back();
+                active_orders.pop_back();
+            } else if (op == 2 && !active_orders.empty()) {  // Modify order
+                uniform_int_distribution<size_t> order_dist(0, active_orders.size() - 1);
+                router->modify_order(active_orders[order_dist(gen)], qty_dist(gen));
+            } else {  // Get quote
+                Quote q = router->get_quote(symbol);
+                volatile uint32_t prevent_opt = q.bid_price;
+            }
+        }
+
+        auto end = high_resolution_clock::now();
+        auto duration = duration_cast<nanoseconds>(end - start);
+
+        avg_per_op.push_back((double)duration.count() / num_operations);
+        ops_per_sec.push_back((num_operations * 1000000000.0) / duration.count());
+    }
+
+    cout << "Multi-Instrument Benchmark (" << num_books << " books, " << num_operations << " operations, "
+         << num_runs << " runs):" << endl;
+    print_stats("Avg per op", calculate_stats(avg_per_op), "ns");
+    print_stats("Operations/sec", calculate_stats(ops_per_sec), "ops");
+    cout << endl;
+}
+
+// a market that trends steadily, so the dense ladder window keeps sliding under live flow.
+// per-segment averages should stay flat across the run if re-centering is amortized away.
+void benchmark_trending_market(int num_operations, int ticks_per_1000_ops = 250, int num_runs = 5) {
+    unique_ptr<Orderbook> book(new Orderbook());
+    const int segment = 10000;
+    vector<double> segment_avgs;
+    vector<double> worst_segment;
+    uint64_t recenters = 0;
+    uint32_t start_mid = 10000;
+    uint32_t end_mid = start_mid;
+
+    for (int run = 0; run < num_runs; run++) {
+        book->clear();
+        uint64_t recenters_before = book->levels().recenter_count();
+        mt19937 gen(42 + run);
+        uniform_int_distribution<> op_dist(0, 9);  // 0-3=add, 4-7=cancel, 8=cross, 9=quote
+        uniform_int_distribution<> offset_dist(1, 20);
+        uniform_int_distribution<> qty_dist(1, 100);
+        uniform_int_distribution<> side_dist(0, 1);
+
+        uint64_t next_order_id = 1;
+        vector<uint64_t> active_orders;
+        uint32_t mid = start_mid;
+
+        for (int i = 0; i < 200; i++) {
+            book->add_order(next_order_id, Side::BUY, mid - offset_dist(gen), 100);
+            active_orders.push_back(next_order_id++);
+            book->add_order(next_order_id, Side::SELL, mid + offset_dist(gen), 100);
+            active_orders.push_back(next_order_id++);
+        }
+
+        double worst = 0;
+        for (int seg = 0; seg < num_operations / segment; seg++) {
+            auto start = high_resolution_clock::now();
+
+            for (int i = 0; i < segment; i++) {
+                int op = op_dist(gen);
+                int64_t step = (int64_t)(seg * segment + i) * ticks_per_1000_ops / 1000;
+                mid = start_mid + step;
+
+                if (op < 4) {  // passive order around the drifting mid
+                    Side side = side_dist(gen) == 0 ? Side::BUY : Side::SELL;
+                    uint32_t price = side == Side::BUY ? mid - offset_dist(gen) : mid + offset_dist(gen);
+                    book->add_order(next_order_id, side, price, qty_dist(gen));
+                    active_orders.push_back(next_order_id++);
+                } else if (op < 8 && !active_orders.empty()) {  // cancel
+                    uniform_int_distribution<size_t> order_dist(0, active_orders.size() - 1);
+                    size_t idx = order_dist(gen);
+                    book->cancel_order(active_orders[idx]);
+                    active_orders[idx] = active_orders.back();
+                    active_orders.pop_back();
+                } else if (op == 8) {  // aggressive order through the touch
+                    Side side = side_dist(gen) == 0 ? Side::BUY : Side::SELL;
+                    uint32_t price = side == Side::BUY ? mid + 25 : mid - 25;
+                    book->add_order(next_order_id++, side, price, qty_dist(gen));
+                } else {
+                    Quote q = book->get_quote();
+                    volatile uint32_t prevent_opt = q.bid_price;
+                }
+            }
+
+            auto end = high_resolution_clock::now();
+            double avg = (double)duration_cast<nanoseconds>(end - start).count() / segment;
+            segment_avgs.push_back(avg);
+            worst = max(worst, avg);
+        }
+        worst_segment.push_back(worst);
+        recenters += book->levels().recenter_count() - recenters_before;
+        end_mid = mid;
+    }
+
+    cout << "Trending Market Benchmark (" << num_operations << " operations, mid " << start_mid << " -> " << end_mid
+         << ", " << recenters / num_runs << " re-centers per run, " << num_runs << " runs):" << endl;
+    print_stats("Avg per op, per " + to_string(segment) + "-op segment", calculate_stats(segment_avgs), "ns");
+    print_stats("Worst segment avg per op", calculate_stats(worst_segment), "ns");
+    cout << endl;
+}
+
+// one aggressive order sweeping num_resting resting orders while a consumer thread drains the report ring.
+// checks every fill arrives gap-free and times the sweep on the matching thread against the moment
+// the consumer has drained the last fill.
+void benchmark_execution_reports(int num_resting, int num_runs = 10) {
+    const int num_levels = 100;
+    const uint32_t per_order = 10;
+    uint32_t total_quantity = num_resting * per_order;
+
+    vector<double> null_sweep;
+    vector<double> ring_sweep;
+    vector<double> end_to_end;
+    uint64_t fills_delivered = 0;
+    uint64_t fills_expected = 0;
+
+    auto place_resting = [&](auto& book) {
+        for (int i = 0; i < num_resting; i++) {
+            book.add_order(i + 1, Side::SELL, 10000 + i % num_levels, per_order);
+        }
+    };
+
+    unique_ptr<Orderbook> null_book(new Orderbook());
+    for (int run = 0; run < num_runs; run++) {
+        null_book->clear();
+        place_resting(*null_book);
+
+        auto start = steady_clock::now();
+        null_book->add_order(num_resting + 1, Side::BUY, 10000 + num_levels, total_quantity);
+        auto end = steady_clock::now();
+        null_sweep.push_back(duration_cast<nanoseconds>(end - start).count());
+    }
+
+    SpscRing<ExecutionReport> ring(1 << 16);
+    unique_ptr<BasicOrderbook<RingSink>> book(new BasicOrderbook<RingSink>(MAX_ORDERS, RingSink(ring)));
+
+    atomic<bool> stop{false};
+    atomic<uint64_t> consumed{0};
+    atomic<uint64_t> fills{0};
+    atomic<uint64_t> filled_quantity{0};
+    atomic<uint64_t> gaps{0};
+    atomic<int64_t> last_fill_ns{0};
+
+    thread consumer([&] {
+        ExecutionReport batch[256];
+        uint64_t expected = 1;
+        while (!stop.load(memory_order_acquire)) {
+            size_t n = ring.pop_batch(batch, 256);
+            if (n == 0) {
+                this_thread::yield();
+                continue;
+            }
+
+            uint64_t batch_fills = 0;
+            uint64_t batch_quantity = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (batch[i].sequence != expected) {
+                    gaps.fetch_add(1, memory_order_relaxed);
+                }
+                expected = batch[i].sequence + 1;
+                if (batch[i].type == ReportType::FILL) {
+                    batch_fills++;
+                    batch_quantity += batch[i].quantity;
+                }
+            }
+            if (batch_fills > 0) {
+                fills.fetch_add(batch_fills, memory_order_relaxed);
+                filled_quantity.fetch_add(batch_quantity, memory_order_relaxed);
+                last_fill_ns.store(steady_clock::now().time_since_epoch().count(), memory_order_relaxed);
+            }
+            consumed.store(expected - 1, memory_order_release);
+        }
+    });
+
+    auto drain = [&] {
+        while (consumed.load(memory_order_acquire) != book->last_sequence()) {
+            this_thread::yield();
+        }
+    };
+
+    for (int run = 0; run < num_runs; run++) {
+        book->clear();
+        place_resting(*book);
+        drain();
+        fills.store(0);
+        filled_quantity.store(0);
+
+        auto start = steady_clock::now();
+        book->add_order(num_resting + 1, Side::BUY, 10000 + num_levels, total_quantity);
+        auto end = steady_clock::now();
+        drain();
+
+        ring_sweep.push_back(duration_cast<nanoseconds>(end - start).count());
+        end_to_end.push_back(last_fill_ns.load() - start.time_since_epoch().count());
+        fills_delivered += fills.load();
+        fills_expected += num_resting;
+        if (filled_quantity.load() != total_quantity) {
+            cout << "  ✗ FAIL: run " << run << " delivered " << filled_quantity.load() << " of "
+                 << total_quantity << " filled quantity" << endl;
+        }
+    }
+
+    stop.store(true, memory_order_release);
+    consumer.join();
+
+    cout << "Execution Reports Benchmark (1 order sweeping " << num_resting << " resting orders, "
+         << num_runs << " runs):" << endl;
+    print_stats("Sweep, no sink", calculate_stats(null_sweep), "ns");
+    print_stats("Sweep, ring sink", calculate_stats(ring_sweep), "ns");
+    print_stats("Sweep start to last fill drained", calculate_stats(end_to_end), "ns");
+    cout << "  Fills delivered: " << fills_delivered << "/" << fills_expected
+         << ", sequence gaps: " << gaps.load() << endl;
+    cout << endl;
+}
+
+// multi-symbol mixed flow, generated up front so the gateway loop only routes and enqueues
+vector<Command> generate_multi_symbol_flow(int num_symbols, int num_operations, uint32_t seed = 42) {
+    mt19937 gen(seed);
+    uniform_int_distribution<> symbol_dist(0, num_symbols - 1);
+    uniform_int_distribution<> op_dist(0, 2);  // 0=add, 1=cancel, 2=modify
+    uniform_int_distribution<> price_dist(9900, 10100);
+    uniform_int_distribution<> qty_dist(1, 100);
+    uniform_int_distribution<> side_dist(0, 1);
+
+    vector<Command> commands;
+    commands.reserve(num_operations);
+    vector<pair<uint64_t, uint32_t>> active_orders;
+    uint64_t next_order_id = 1;
+
+    for (int i = 0; i < num_operations; i++) {
+        int op = active_orders.empty() ? 0 : op_dist(gen);
+        Command command{};
+        if (op == 0) {
+            command.type = CommandType::ADD;
+            command.order_id = next_order_id++;
+            command.symbol = symbol_dist(gen);
+            command.side = side_dist(gen) == 0 ? Side::BUY : Side::SELL;
+            command.price = price_dist(gen);
+            command.quantity = qty_dist(gen);
+            active_orders.push_back({command.order_id, command.symbol});
+        } else {
+            uniform_int_distribution<size_t> order_dist(0, active_orders.size() - 1);
+            size_t idx = order_dist(gen);
+            command.order_id = active_orders[idx].first;
+            command.symbol = active_orders[idx].second;
+            if (op == 1) {
+                command.type = CommandType::CANCEL;
+                active_orders[idx] = active_orders.back();
+                active_orders.pop_back();
+            } else {
+                command.type = CommandType::MODIFY;
+                command.quantity = qty_dist(gen);
+            }
+        }
+        commands.push_back(command);
+    }
+    return commands;
+}
+
+// gateway thread feeding num_shards pinned workers, throughput measured from first submit to final flush
+void benchmark_sharded_engine(int num_shards, int num_symbols, int num_operations, int num_runs = 5) {
+    vector<double> ops_per_sec;
+    vector<Command> commands = generate_multi_symbol_flow(num_symbols, num_operations);
+
+    for (int run = 0; run < num_runs; run++) {
+        unique_ptr<ShardedEngine> engine(new ShardedEngine(num_shards, MAX_ORDERS / num_shards));
+        for (int i = 0; i < num_symbols; i++) {
+            engine->add_symbol("SYM" + to_string(i));
+        }
+        engine->start(1);
+
+        auto start = high_resolution_clock::now();
+        for (const Command& command : commands) {
+            engine->submit(command);
+        }
+        engine->flush();
+        auto end = high_resolution_clock::now();
+
+        engine->stop();
+        ops_per_sec.push_back((num_operations * 1000000000.0) / duration_cast<nanoseconds>(end - start).count());
+    }
+
+    cout << "Sharded Engine Benchmark (" << num_shards << " shards, " << num_symbols << " symbols, "
+         << num_operations << " operations, " << thread::hardware_concurrency() << " cores, " << num_runs << " runs):" << endl;
+    print_stats("Operations/sec", calculate_stats(ops_per_sec), "ops");
+    cout << endl;
+}
+
+// writes a multi-symbol flow to a capture, then times decoding it alone, replaying it into a router,
+// and applying the same commands straight from memory. every other modify is turned into an execution.
+void benchmark_feed_replay(int num_symbols, int num_messages, int num_runs = 5) {
+    const char* path = "/tmp/orderbook_feed_benchmark.bin";
+    vector<Command> commands = generate_multi_symbol_flow(num_symbols, num_messages);
+    bool execute = false;
+    for (Command& command : commands) {
+        if (command.type == CommandType::MODIFY && (execute = !execute)) {
+            command.type = CommandType::EXECUTE;
+        }
+    }
+
+    vector<string> symbols;
+    for (int i = 0; i < num_symbols; i++) {
+        symbols.push_back("SYM" + to_string(i));
+    }
+    FeedWriter writer;
+    if (!writer.open(path, symbols)) {
+        cout << "Feed Replay Benchmark: cannot create " << path << endl << endl;
+        return;
+    }
+    for (const Command& command : commands) {
+        writer.write(command);
+    }
+    writer.close();
+
+    // a symbol id past the directory must not wrap into the 16-bit field and land on another book
+    bool rejected = false;
+    {
+        const char* narrow_path = "/tmp/orderbook_feed_narrow.bin";
+        FeedWriter narrow;
+        if (narrow.open(narrow_path, {"ONLY"})) {
+            narrow.add(0, 1, Side::BUY, 10000, 10);
+            narrow.add(UINT16_MAX + 1, 2, Side::BUY, 10000, 10);
+            rejected = narrow.message_count() == 1 && narrow.rejected_count() == 1 && !narrow.close();
+        }
+        remove(narrow_path);
+    }
+
+    FeedReader reader;
+    if (!reader.open(path)) {
+        cout << "Feed Replay Benchmark: cannot map " << path << endl << endl;
+        return;
+    }
+
+    vector<double> decode_rates;
+    vector<double> replay_rates;
+    vector<double> direct_rates;
+    bool matched = true;
+
+    for (int run = 0; run < num_runs; run++) {
+        uint64_t checksum = 0;
+        auto start = high_resolution_clock::now();
+        uint64_t decoded = reader.for_each([&checksum](const Command& command) {
+            checksum += command.order_id + command.quantity;
+        });
+        auto end = high_resolution_clock::now();
+        decode_rates.push_back(decoded * 1000.0 / duration_cast<nanoseconds>(end - start).count());
+        if (checksum == 0) {
+            matched = false;
+        }
+
+        unique_ptr<SymbolRouter> replayed(new SymbolRouter());
+        reader.add_symbols(*replayed);
+        start = high_resolution_clock::now();
+        uint64_t count = reader.replay(*replayed);
+        end = high_resolution_clock::now();
+        replay_rates.push_back(count * 1000.0 / duration_cast<nanoseconds>(end - start).count());
+
+        unique_ptr<SymbolRouter> direct(new SymbolRouter());
+        for (const string& symbol : symbols) {
+            direct->add_symbol(symbol);
+        }
+        start = high_resolution_clock::now();
+        for (const Command& command : commands) {
+            switch (command.type) {
+                case CommandType::ADD:
+                    direct->add_order(command.symbol, command.order_id, command.side, command.price, command.quantity);
+                    break;
+                case CommandType::CANCEL:
+                    direct->cancel_order(command.order_id);
+                    break;
+                case CommandType::MODIFY:
+                    direct->modify_order(command.order_id, command.quantity);
+                    break;
+                case CommandType::EXECUTE:
+                    direct->execute_order(command.order_id, command.quantity);
+                    break;
+                case CommandType::ADD_STOP:  // captures hold none
+                    break;
+            }
+        }
+        end = high_resolution_clock::now();
+        direct_rates.push_back(commands.size() * 1000.0 / duration_cast<nanoseconds>(end - start).count());
+
+        matched = matched && count == commands.size() && replayed->live_orders() == direct->live_orders();
+        for (int i = 0; i < num_symbols; i++) {
+            Quote a = replayed->get_quote(i);
+            Quote b = direct->get_quote(i);
+            matched = matched && a.bid_price == b.bid_price && a.bid_quantity == b.bid_quantity &&
+                      a.ask_price == b.ask_price && a.ask_quantity == b.ask_quantity;
+        }
+    }
+
+    cout << "Feed Replay Benchmark (" << num_symbols << " symbols, " << num_messages << " messages, "
+         << reader.size_bytes() / (1 << 20) << " MB capture, " << num_runs << " runs):" << endl;
+    print_stats("Decode only", calculate_stats(decode_rates), "M msgs/sec");
+    print_stats("Replay into router", calculate_stats(replay_rates), "M msgs/sec");
+    print_stats("Apply from memory", calculate_stats(direct_rates), "M msgs/sec");
+    if (!matched) {
+        cout << "  ✗ FAIL: replayed book differs from the directly applied book" << endl;
+    }
+    if (!rejected) {
+        cout << "  ✗ FAIL: a message for a symbol outside the directory was written" << endl;
+    }
+    cout << endl;
+
+    reader.close();
+    remove(path);
+}
+
+template <typename Book>
+inline void apply_command(Book& book, const Command& command) {
+    switch (command.type) {
+        case CommandType::ADD:
+            book.add_order(command.order_id, command.side, command.price, command.quantity);
+            break;
+        case CommandType::CANCEL:
+            book.cancel_order(command.order_id);
+            break;
+        case CommandType::MODIFY:
+            book.modify_order(command.order_id, command.quantity);
+            break;
+        case CommandType::EXECUTE:
+            book.execute_order(command.order_id, command.quantity);
+            break;
+        case CommandType::ADD_STOP:
+            book.add_stop(command.order_id, command.side, command.trigger, command.price, command.quantity);
+            break;
+    }
+}
+
+bool same_depth(const Depth& a, const Depth& b) {
+    auto same = [](const vector<DepthLevel>& x, const vector<DepthLevel>& y) {
+        return x.size() == y.size() && equal(x.begin(), x.end(), y.begin(),
+            [](const DepthLevel& l, const DepthLevel& r) { return l.price == r.price && l.quantity == r.quantity; });
+    };
+    return same(a.bids, b.bids) && same(a.asks, b.asks);
+}
+
+// mixed flow on a book that stays deep: passive orders spread over 200 ticks either side of the mid,
+// 1 in 20 adds crosses the spread
+vector<Command> generate_deep_book_flow(int num_operations, uint32_t seed = 42) {
+    mt19937 gen(seed);
+    uniform_int_distribution<> op_dist(0, 2);
+    uniform_int_distribution<> offset_dist(1, 200);
+    uniform_int_distribution<> qty_dist(1, 100);
+    uniform_int_distribution<> side_dist(0, 1);
+    uniform_int_distribution<> cross_dist(0, 19);
+
+    vector<Command> commands;
+    commands.reserve(num_operations);
+    vector<uint64_t> active_orders;
+    uint64_t next_order_id = 1;
+
+    for (int i = 0; i < num_operations; i++) {
+        int op = active_orders.size() < 1000 ? 0 : op_dist(gen);
+        Command command{};
+        if (op == 0) {
+            bool buy = side_dist(gen) == 0;
+            int offset = cross_dist(gen) == 0 ? -5 : offset_dist(gen);
+            command.type = CommandType::ADD;
+            command.order_id = next_order_id++;
+            command.side = buy ? Side::BUY : Side::SELL;
+            command.price = buy ? 10000 - offset : 10000 + offset;
+            command.quantity = qty_dist(gen);
+            active_orders.push_back(command.order_id);
+        } else {
+            uniform_int_distribution<size_t> order_dist(0, active_orders.size() - 1);
+            size_t idx = order_dist(gen);
+            command.order_id = active_orders[idx];
+            if (op == 1) {
+                command.type = CommandType::CANCEL;
+                active_orders[idx] = active_orders.back();
+                active_orders.pop_back();
+            } else {
+                command.type = CommandType::MODIFY;
+                command.quantity = qty_dist(gen);
+            }
+        }
+        commands.push_back(command);
+    }
+    return commands;
+}
+
+// snapshot cost of get_depth on a populated book, then the per-op cost of keeping depth published
+// while mixed flow runs: rebuilding a snapshot after every op versus folding LEVEL deltas into a DepthBook
+void benchmark_depth(int num_operations, int num_runs = 10) {
+    const int num_snapshots = 1000000;
+    vector<Command> commands = generate_deep_book_flow(num_operations);
+    Depth depth;
+
+    unique_ptr<Orderbook> book(new Orderbook());
+    for (const Command& command : commands) {
+        apply_command(*book, command);
+    }
+    book->get_depth(UINT32_MAX, depth);
+    size_t bid_levels = depth.bids.size();
+    size_t ask_levels = depth.asks.size();
+
+    cout << "Depth Benchmark (" << num_operations << " mixed operations, " << bid_levels << " bid / "
+         << ask_levels << " ask levels at the end, " << num_runs << " runs):" << endl;
+
+    for (uint32_t n : {10u, 50u}) {
+        vector<double> snapshot_ns;
+        for (int run = 0; run < num_runs; run++) {
+            uint64_t checksum = 0;
+            auto start = high_resolution_clock::now();
+            for (int i = 0; i < num_snapshots; i++) {
+                book->get_depth(n, depth);
+                checksum += depth.bids.size() + depth.asks.size();
+            }
+            auto end = high_resolution_clock::now();
+            snapshot_ns.push_back(duration_cast<nanoseconds>(end - start).count() / (double)num_snapshots);
+            if (checksum != uint64_t(num_snapshots) * (min<size_t>(n, bid_levels) + min<size_t>(n, ask_levels))) {
+                cout << "  ✗ FAIL: short snapshot" << endl;
+            }
+        }
+        print_stats("get_depth(" + to_string(n) + ")", calculate_stats(snapshot_ns), "ns");
+    }
+
+    vector<double> plain_ns;
+    vector<double> rebuild10_ns;
+    vector<double> rebuild50_ns;
+    vector<double> incremental_ns;
+    bool matched = true;
+
+    DepthBook published;
+    unique_ptr<BasicOrderbook<DepthSink>> publishing(new BasicOrderbook<DepthSink>(MAX_ORDERS, DepthSink(published)));
+
+    auto time_ops = [&](auto& target, auto after_op) {
+        target.clear();
+        auto start = high_resolution_clock::now();
+        for (const Command& command : commands) {
+            apply_command(target, command);
+            after_op();
+        }
+        auto end = high_resolution_clock::now();
+        return duration_cast<nanoseconds>(end - start).count() / (double)commands.size();
+    };
+
+    for (int run = 0; run < num_runs; run++) {
+        plain_ns.push_back(time_ops(*book, [] {}));
+        rebuild10_ns.push_back(time_ops(*book, [&] { book->get_depth(10, depth); }));
+        rebuild50_ns.push_back(time_ops(*book, [&] { book->get_depth(50, depth); }));
+
+        published.clear();
+        incremental_ns.push_back(time_ops(*publishing, [] {}));
+
+        Depth expected;
+        book->get_depth(UINT32_MAX, expected);
+        published.get_depth(UINT32_MAX, depth);
+        matched = matched && same_depth(expected, depth);
+    }
+
+    print_stats("Ops, no depth", calculate_stats(plain_ns), "ns/op");
+    print_stats("Ops + get_depth(10) rebuild", calculate_stats(rebuild10_ns), "ns/op");
+    print_stats("Ops + get_depth(50) rebuild", calculate_stats(rebuild50_ns), "ns/op");
+    print_stats("Ops + incremental DepthBook", calculate_stats(incremental_ns), "ns/op");
+    if (!matched) {
+        cout << "  ✗ FAIL: incremental depth differs from the book" << endl;
+    }
+    cout << endl;
+}
+
+// num_orders resting orders over 1000 levels a side. times a synchronous snapshot, a background one (the pause
+// in begin_snapshot, the writer's total, and modify latency while the writer streams the book out) and a restore
+// into a fresh book. orders keep being modified while the background snapshot runs, and the restored book must
+// match the book as it was at begin_snapshot.
+void benchmark_snapshot(uint32_t num_orders, int num_runs = 3) {
+    const char* path = "/tmp/orderbook_snapshot_benchmark.bin";
+
+    unique_ptr<Orderbook> book(new Orderbook(num_orders));
+    auto populate_start = high_resolution_clock::now();
+    for (uint32_t i = 0; i < num_orders; i++) {
+        bool buy = i % 2 == 0;
+        uint32_t offset = 1 + (i / 2) % 1000;
+        book->add_order(i + 1, buy ? Side::BUY : Side::SELL, buy ? 10000 - offset : 10000 + offset, 1 + i % 100);
+    }
+    auto populate_end = high_resolution_clock::now();
+
+    vector<double> save_ms;
+    vector<double> begin_us;
+    vector<double> begin_cpu_us;
+    vector<double> background_ms;
+    vector<double> restore_ms;
+    vector<double> first_touch_ms;
+    LatencyHistogram during;
+    LatencyHistogram baseline;
+    uint64_t modifies_during = 0;
+    bool restored_ok = true;
+    uint64_t file_bytes = 0;
+
+    mt19937 gen(42);
+    uniform_int_distribution<uint32_t> order_dist(1, num_orders);
+    uniform_int_distribution<uint32_t> qty_dist(1, 100);
+    auto modify = [&](LatencyHistogram& histogram) {
+        uint64_t order_id = order_dist(gen);
+        uint32_t quantity = qty_dist(gen);
+        uint64_t start = tsc_now();
+        book->modify_order(order_id, quantity);
+        histogram.record(tsc_now() - start);
+    };
+
+    // starts the writer thread outside the timed runs
+    if (book->begin_snapshot(path)) {
+        book->finish_snapshot();
+    }
+
+    for (int run = 0; run < num_runs; run++) {
+        auto start = high_resolution_clock::now();
+        bool saved = book->save_snapshot(path);
+        auto end = high_resolution_clock::now();
+        save_ms.push_back(duration_cast<microseconds>(end - start).count() / 1000.0);
+        if (!saved) {
+            cout << "  ✗ FAIL: cannot write " << path << endl;
+            return;
+        }
+
+        for (int i = 0; i < 100000; i++) {
+            modify(baseline);
+        }
+
+        Depth expected;
+        book->get_depth(UINT32_MAX, expected);
+        // wall time includes any time the writer thread holds this core, thread cpu time is the pause itself
+        timespec cpu_start;
+        timespec cpu_end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        start = high_resolution_clock::now();
+        bool begun = book->begin_snapshot(path);
+        auto begun_at = high_resolution_clock::now();
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        begin_cpu_us.push_back((cpu_end.tv_sec - cpu_start.tv_sec) * 1e6 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e3);
+        while (book->snapshot_running()) {
+            modify(during);
+            modifies_during++;
+        }
+        bool background_saved = begun && book->finish_snapshot();
+        end = high_resolution_clock::now();
+        begin_us.push_back(duration_cast<nanoseconds>(begun_at - start).count() / 1000.0);
+        background_ms.push_back(duration_cast<microseconds>(end - start).count() / 1000.0);
+        restored_ok = restored_ok && background_saved;
+
+        unique_ptr<Orderbook> restored(new Orderbook(num_orders));
+        start = high_resolution_clock::now();
+        bool loaded = restored->restore_snapshot(path);
+        end = high_resolution_clock::now();
+        restore_ms.push_back(duration_cast<microseconds>(end - start).count() / 1000.0);
+
+        Depth depth;
+        restored->get_depth(UINT32_MAX, depth);
+        restored_ok = restored_ok && loaded && same_depth(depth, expected);
+
+        // the pool and index fault in lazily, one pass over every order pays for that
+        start = high_resolution_clock::now();
+        for (uint32_t id = 1; id <= num_orders; id++) {
+            restored->modify_order(id, 1 + (id - 1) % 100);
+        }
+        end = high_resolution_clock::now();
+        first_touch_ms.push_back(duration_cast<microseconds>(end - start).count() / 1000.0);
+
+        // the restored book must keep working: cancelling a spread of orders must take exactly their quantity out
+        uint64_t cancelled = 0;
+        for (uint32_t id = 1; id <= num_orders; id += 997) {
+            cancelled += 1 + (id - 1) % 100;
+            restored->cancel_order(id);
+        }
+        restored->get_depth(UINT32_MAX, depth);
+        uint64_t remaining = 0;
+        for (const DepthLevel& level : depth.bids) remaining += level.quantity;
+        for (const DepthLevel& level : depth.asks) remaining += level.quantity;
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < num_orders; i++) total += 1 + i % 100;
+        restored_ok = restored_ok && total - remaining == cancelled;
+
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            file_bytes = st.st_blocks * 512;
+        }
+    }
+
+    // a link out of the pool must be refused rather than followed: point the first order past the high-water mark
+    bool corrupt_rejected = false;
+    if (FILE* file = fopen(path, "r+b")) {
+        SnapshotHeader header;
+        if (fread(&header, sizeof(header), 1, file) == 1) {
+            uint32_t out_of_pool = header.high_water + 5;
+            fseek(file, header.pool_offset + offsetof(Order, next), SEEK_SET);
+            fwrite(&out_of_pool, sizeof(out_of_pool), 1, file);
+        }
+        fclose(file);
+        unique_ptr<Orderbook> corrupt(new Orderbook(num_orders));
+        corrupt_rejected = !corrupt->restore_snapshot(path) && corrupt->get_quote().bid_price == 0;
+    }
+    remove(path);
+
+    double scale = 1.0 / tsc_ticks_per_ns();
+    cout << "Snapshot Benchmark (" << num_orders << " resting orders, " << file_bytes / (1 << 20)
+         << " MB on disk, " << num_runs << " runs):" << endl;
+    cout << fixed << setprecision(2) << "  Rebuild by replaying adds: "
+         << duration_cast<microseconds>(populate_end - populate_start).count() / 1000.0 << " ms" << endl;
+    print_stats("save_snapshot, synchronous", calculate_stats(save_ms), "ms");
+    print_stats("begin_snapshot pause, wall", calculate_stats(begin_us), "μs");
+    print_stats("begin_snapshot pause, thread cpu", calculate_stats(begin_cpu_us), "μs");
+    print_stats("Background snapshot, until written", calculate_stats(background_ms), "ms");
+    print_stats("restore_snapshot", calculate_stats(restore_ms), "ms");
+    print_stats("First pass over every restored order", calculate_stats(first_touch_ms), "ms");
+    cout << fixed << setprecision(1)
+         << "  Modify p50/p99.9/max, idle: " << baseline.percentile(50) * scale << " / "
+         << baseline.percentile(99.9) * scale << " / " << baseline.max() * scale << " ns" << endl
+         << "  Modify p50/p99.9/max, during background snapshot: " << during.percentile(50) * scale << " / "
+         << during.percentile(99.9) * scale << " / " << during.max() * scale << " ns ("
+         << modifies_during << " modifies)" << endl;
+    if (!restored_ok) {
+        cout << "  ✗ FAIL: restored book differs from the book at begin_snapshot" << endl;
+    }
+    if (!corrupt_rejected) {
+        cout << "  ✗ FAIL: snapshot with a link out of the pool was restored" << endl;
+    }
+    cout << endl;
+}
+
+// mixed add/cancel/modify flow over num_resting random resting orders, the shape of benchmark_mixed_workload
+// scaled up until the index and pool no longer fit in cache. the first num_resting commands build the book
+vector<Command> generate_resting_flow(uint32_t num_resting, int num_operations, uint32_t seed = 42) {
+    mt19937 gen(seed);
+    uniform_int_distribution<> op_dist(0, 2);
+    uniform_int_distribution<> price_dist(9000, 11000);
+    uniform_int_distribution<> qty_dist(1, 100);
+
+    vector<Command> commands;
+    commands.reserve(num_resting + num_operations);
+    vector<uint64_t> active_orders;
+    uint64_t next_order_id = 1;
+
+    // passive both sides of a 10000 mid so the flow itself never trades through
+    auto add = [&] {
+        uint32_t price = price_dist(gen);
+        Side side = price < 10000 ? Side::BUY : Side::SELL;
+        price = price == 10000 ? 10001 : price;
+        commands.push_back(Command{next_order_id, 0, price, uint32_t(qty_dist(gen)), CommandType::ADD, side});
+        active_orders.push_back(next_order_id++);
+    };
+    for (uint32_t i = 0; i < num_resting; i++) {
+        add();
+    }
+    for (int i = 0; i < num_operations; i++) {
+        int op = op_dist(gen);
+        if (op == 0 || active_orders.empty()) {
+            add();
+            continue;
+        }
+        uniform_int_distribution<size_t> order_dist(0, active_orders.size() - 1);
+        size_t idx = order_dist(gen);
+        Command command{active_orders[idx], 0, 0, 0, CommandType::CANCEL, Side::BUY};
+        if (op == 1) {
+            active_orders[idx] = active_orders.back();
+            active_orders.pop_back();
+        } else {
+            command.type = CommandType::MODIFY;
+            command.quantity = qty_dist(gen);
+        }
+        commands.push_back(command);
+    }
+    return commands;
+}
+
+// the same flow applied one call per command and through apply_batch in batches of 16-256.
+// every batched run must leave the book exactly as the one-by-one run does
+void benchmark_batch(uint32_t num_resting, int num_operations, int num_runs = 5) {
+    vector<Command> commands = generate_resting_flow(num_resting, num_operations);
+    span<const Command> setup(commands.data(), num_resting);
+    span<const Command> flow(commands.data() + num_resting, num_operations);
+    unique_ptr<Orderbook> book(new Orderbook(max<uint32_t>(MAX_ORDERS, 2 * num_resting)));
+
+    cout << "Batch Benchmark (" << num_resting << " resting orders, " << num_operations << " mixed operations, "
+         << num_runs << " runs):" << endl;
+
+    Depth expected;
+    Depth depth;
+    auto time_flow = [&](size_t batch) {
+        book->clear();
+        book->apply_batch(setup);
+        auto start = high_resolution_clock::now();
+        if (batch == 1) {
+            for (const Command& command : flow) {
+                book->apply(command);
+            }
+        } else {
+            for (size_t i = 0; i < flow.size(); i += batch) {
+                book->apply_batch(flow.subspan(i, min(batch, flow.size() - i)));
+            }
+        }
+        auto end = high_resolution_clock::now();
+        return duration_cast<nanoseconds>(end - start).count() / (double)flow.size();
+    };
+
+    double single = 0;
+    bool matched = true;
+    for (size_t batch : {1, 16, 64, 256}) {
+        vector<double> ns_per_op;
+        for (int run = 0; run < num_runs; run++) {
+            ns_per_op.push_back(time_flow(batch));
+        }
+        if (batch == 1) {
+            book->get_depth(UINT32_MAX, expected);
+        } else {
+            book->get_depth(UINT32_MAX, depth);
+            matched = matched && same_depth(depth, expected);
+        }
+        BenchmarkStats stats = calculate_stats(ns_per_op);
+        if (batch == 1) {
+            single = stats.mean;
+            print_stats("One call per command", stats, "ns/op");
+        } else {
+            print_stats("apply_batch, batches of " + to_string(batch), stats, "ns/op");
+            cout << fixed << setprecision(2) << "    " << single / stats.mean << "x" << endl;
+        }
+    }
+    if (!matched) {
+        cout << "  ✗ FAIL: batched book differs from the one-by-one book" << endl;
+    }
+    cout << endl;
+}
+
+// resident set size, 0 where /proc is not available
+uint64_t resident_bytes() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+    unsigned long long pages = 0;
+    unsigned long long resident = 0;
+    int fields = fscanf(file, "%llu %llu", &pages, &resident);
+    fclose(file);
+    return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+struct FillCountSink {
+    uint64_t* fills;
+
+    inline void on_report(const ExecutionReport& report) {
+        if (report.type == ReportType::FILL) {
+            ++*fills;
+        }
+    }
+};
+
+// a trading day and then some on one book: passive adds either side of a fixed mid, marketable orders that
+// sweep a few levels, and cancels, until num_fills fills have printed. the book hovers around 100k orders. every report_every fills it prints
+// the live order count, resident memory and the latency percentiles of the operations since the last line,
+// so growth in memory or in the tail would show up as a trend down the table
+void benchmark_soak(uint64_t num_fills, uint64_t report_every = 10000000) {
+    uint64_t fills = 0;
+    unique_ptr<BasicOrderbook<FillCountSink>> book(new BasicOrderbook<FillCountSink>(MAX_ORDERS, FillCountSink{&fills}));
+
+    mt19937 gen(42);
+    uniform_int_distribution<> op_dist(0, 9);  // 0-5 passive add, 6-7 marketable, 8-9 cancel
+    // passive adds turn into cancels while the book holds more than this, so it settles at a working depth
+    const uint32_t target_live = 100000;
+    uniform_int_distribution<> offset_dist(1, 40);
+    uniform_int_distribution<> qty_dist(1, 100);
+    uniform_int_distribution<> sweep_dist(50, 150);
+    uniform_int_distribution<> side_dist(0, 1);
+    // recently added ids to cancel from, a slot whose order already traded makes the cancel a miss
+    vector<uint64_t> recent(1 << 16, 0);
+    uniform_int_distribution<size_t> recent_dist(0, recent.size() - 1);
+
+    LatencyHistogram histogram;
+    double scale = 1.0 / tsc_ticks_per_ns();
+    uint64_t next_order_id = 1;
+    uint64_t operations = 0;
+    uint64_t next_report = report_every;
+
+    cout << "Soak Benchmark (" << num_fills / 1000000 << "M fills, one line per " << report_every / 1000000
+         << "M):" << endl;
+    cout << "  " << setw(9) << "fills" << setw(10) << "ops" << setw(10) << "seconds" << setw(8) << "live"
+         << setw(9) << "RSS MB" << setw(8) << "p50" << setw(9) << "p99.9" << setw(11) << "max ns" << endl;
+    auto start = high_resolution_clock::now();
+
+    while (fills < num_fills) {
+        int op = op_dist(gen);
+        bool buy = side_dist(gen) == 0;
+        uint64_t begin = tsc_now();
+        if (op <= 5 && book->live_orders() < target_live) {
+            uint32_t offset = offset_dist(gen);
+            book->add_order(next_order_id, buy ? Side::BUY : Side::SELL, buy ? 10000 - offset : 10000 + offset, qty_dist(gen));
+            recent[next_order_id % recent.size()] = next_order_id;
+            next_order_id++;
+        } else if (op == 6 || op == 7) {
+            book->add_order(next_order_id++, buy ? Side::BUY : Side::SELL, buy ? 10040 : 9960, sweep_dist(gen));
+        } else {
+            book->cancel_order(recent[recent_dist(gen)]);
+        }
+        histogram.record(tsc_now() - begin);
+        operations++;
+
+        if (fills >= next_report) {
+            double seconds = duration_cast<milliseconds>(high_resolution_clock::now() - start).count() / 1000.0;
+            cout << "  " << setw(8) << fills / 1000000 << "M" << setw(9) << operations / 1000000 << "M"
+                 << fixed << setprecision(1) << setw(10) << seconds << setw(8) << book->live_orders()
+                 << setw(9) << resident_bytes() / double(1 << 20)
+                 << setw(8) << histogram.percentile(50) * scale << setw(9) << histogram.percentile(99.9) * scale
+                 << setw(11) << histogram.max() * scale << endl;
+            histogram.reset();
+            next_report += report_every;
+        }
+    }
+    cout << endl;
+}
+
+// folds every report into a running hash, two books that emitted the same reports in the same order agree on it
+struct ReportHashSink {
+    uint64_t* hash;
+    uint64_t* count;
+
+    inline void on_report(const ExecutionReport& report) {
+        uint64_t h = *hash;
+        for (uint64_t field : {report.sequence, report.order_id, report.contra_order_id,
+                               (uint64_t(report.price) << 32) | report.quantity,
+                               (uint64_t(report.type) << 8) | uint64_t(report.side)}) {
+            h = (h ^ field) * 0x100000001B3ull;
+        }
+        *hash = h;
+        ++*count;
+    }
+};
+
+bool same_file(const char* a, const char* b) {
+    FILE* x = fopen(a, "rb");
+    FILE* y = fopen(b, "rb");
+    bool same = x && y;
+    char bx[1 << 16];
+    char by[1 << 16];
+    while (same) {
+        size_t nx = fread(bx, 1, sizeof(bx), x);
+        size_t ny = fread(by, 1, sizeof(by), y);
+        same = nx == ny && memcmp(bx, by, nx) == 0;
+        if (nx == 0) {
+            break;
+        }
+    }
+    if (x) fclose(x);
+    if (y) fclose(y);
+    return same;
+}
+
+// cost of journaling on the matching thread: the deep-book flow applied bare, with each command pushed into a
+// ring nobody drains (the floor when the writer has its own core), and through a Journal at several group-commit
+// windows. then a journaled session is replayed into a fresh book, which must emit the same reports and end up
+// byte-identical to the original.
+void benchmark_journal(int num_operations, int num_runs = 5) {
+    const char* path = "/tmp/orderbook_journal_benchmark.bin";
+    vector<Command> commands = generate_deep_book_flow(num_operations);
+    unique_ptr<Orderbook> book(new Orderbook());
+
+    // wall time, and the matching thread's own cpu time, which leaves out a writer sharing its core
+    vector<double> cpu_ns;
+    auto time_ops = [&](auto record) {
+        book->clear();
+        timespec cpu_start;
+        timespec cpu_end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        auto start = high_resolution_clock::now();
+        for (const Command& command : commands) {
+            record(command);
+            apply_command(*book, command);
+        }
+        auto end = high_resolution_clock::now();
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        cpu_ns.push_back(((cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec)) / commands.size());
+        return duration_cast<nanoseconds>(end - start).count() / (double)commands.size();
+    };
+
+    cout << "Journal Benchmark (" << num_operations << " mixed operations, " << num_runs << " runs):" << endl;
+
+    vector<double> bare_ns;
+    vector<double> bare_cpu_ns;
+    vector<double> ring_ns;
+    SpscRing<Command> undrained(commands.size());
+    for (int run = 0; run < num_runs; run++) {
+        bare_ns.push_back(time_ops([](const Command&) {}));
+        bare_cpu_ns.push_back(cpu_ns.back());
+        ring_ns.push_back(time_ops([&](const Command& command) { undrained.push(command); }));
+        Command discard;
+        while (undrained.try_pop(discard)) {}
+    }
+    BenchmarkStats bare = calculate_stats(bare_ns);
+    BenchmarkStats bare_cpu = calculate_stats(bare_cpu_ns);
+    print_stats("No journal", bare, "ns/op");
+    print_stats("Ring push only", calculate_stats(ring_ns), "ns/op");
+
+    struct Window {
+        const char* name;
+        bool sync;
+        uint32_t interval_us;
+    };
+    for (const Window& window : {Window{"no fsync", false, 1000}, Window{"fsync every 10 ms", true, 10000},
+                                 Window{"fsync every 1 ms", true, 1000}, Window{"fsync every 100 μs", true, 100},
+                                 Window{"fsync every write", true, 0}}) {
+        vector<double> journaled_ns;
+        vector<double> journaled_cpu_ns;
+        vector<double> drain_ms;
+        uint64_t syncs = 0;
+        bool ok = true;
+        for (int run = 0; run < num_runs; run++) {
+            Journal journal;
+            JournalConfig config;
+            config.sync = window.sync;
+            config.sync_interval_us = window.interval_us;
+            if (!journal.open(path, config)) {
+                cout << "  ✗ FAIL: cannot create " << path << endl;
+                return;
+            }
+            journaled_ns.push_back(time_ops([&](const Command& command) { journal.record(command); }));
+            journaled_cpu_ns.push_back(cpu_ns.back());
+            // the tail still in flight when the session ends
+            auto start = high_resolution_clock::now();
+            ok = journal.close() && ok;
+            auto end = high_resolution_clock::now();
+            drain_ms.push_back(duration_cast<microseconds>(end - start).count() / 1000.0);
+            syncs += journal.sync_count();
+        }
+        BenchmarkStats stats = calculate_stats(journaled_ns);
+        print_stats(string("Journal, ") + window.name, stats, "ns/op");
+        cout << fixed << setprecision(2) << "    +" << stats.mean - bare.mean << " ns/op wall, +"
+             << calculate_stats(journaled_cpu_ns).mean - bare_cpu.mean << " ns/op matching thread cpu, "
+             << syncs / num_runs << " group commits per run, " << calculate_stats(drain_ms).mean
+             << " ms to drain at close" << endl;
+        if (!ok) {
+            cout << "  ✗ FAIL: journal write failed" << endl;
+        }
+    }
+
+    // a quiet session: an idle writer backs off instead of holding a core, and still syncs what arrives after.
+    // the matching thread sleeps too, so the process cpu time is the writer's
+    {
+        Journal journal;
+        bool rejected = !journal.open(path, JournalConfig(), 0);
+        bool opened = journal.open(path);
+        timespec cpu_start;
+        timespec cpu_end;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+        this_thread::sleep_for(milliseconds(100));
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+        double idle_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e3 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e6;
+        journal.record(commands[0]);
+        journal.wait_durable(journal.last_recorded());
+        bool synced = journal.durable_sequence() == 1 && journal.close();
+        cout << fixed << setprecision(2) << "  Idle writer: " << idle_ms << " ms cpu over 100 ms" << endl;
+        if (!rejected) {
+            cout << "  ✗ FAIL: a journal starting at sequence 0 was opened" << endl;
+        } else if (!opened || !synced) {
+            cout << "  ✗ FAIL: a record after an idle stretch was not synced" << endl;
+        } else if (idle_ms > 20) {
+            cout << "  ✗ FAIL: idle writer kept spinning" << endl;
+        } else {
+            cout << "  ✓ idle writer backs off and wakes for the next record" << endl;
+        }
+        remove(path);
+    }
+
+    // deterministic replay. adds are spread over 16 accounts and the odd ones may not enter more than 50 an
+    // order, so the replay only matches if each order comes back under its own account. every 500th command
+    // arms a stop a few ticks off the middle, alternately a buy stop limit and a sell stop market, and the
+    // stops still armed at the end are cancelled so the books can be snapshotted
+    vector<Command> session;
+    session.reserve(commands.size() + commands.size() / 250);
+    vector<uint64_t> stop_ids;
+    for (const Command& command : commands) {
+        session.push_back(command);
+        if (command.type == CommandType::ADD) {
+            session.back().account = uint16_t(command.order_id % 16);
+        }
+        if (session.size() % 500 == 0) {
+            bool buy = stop_ids.size() % 2 == 0;
+            Command stop{};
+            stop.type = CommandType::ADD_STOP;
+            stop.order_id = (1ull << 40) + stop_ids.size();
+            stop.side = buy ? Side::BUY : Side::SELL;
+            stop.trigger = buy ? 10003 : 9997;
+            stop.price = buy ? 10010 : 0;
+            stop.quantity = 5;
+            stop.account = uint16_t(stop_ids.size() % 16);
+            session.push_back(stop);
+            stop_ids.push_back(stop.order_id);
+        }
+    }
+    for (uint64_t id : stop_ids) {
+        Command cancel{};
+        cancel.type = CommandType::CANCEL;
+        cancel.order_id = id;
+        session.push_back(cancel);
+    }
+    RiskTable live_risk(16);
+    RiskTable replay_risk(16);
+    AccountLimits limited;
+    limited.max_order_quantity = 50;
+    for (uint16_t account = 1; account < 16; account += 2) {
+        live_risk.set_limits(account, limited);
+        replay_risk.set_limits(account, limited);
+    }
+
+    const char* live_snapshot = "/tmp/orderbook_journal_live.snap";
+    const char* replay_snapshot = "/tmp/orderbook_journal_replay.snap";
+    uint64_t live_hash = 0xCBF29CE484222325ull;
+    uint64_t live_reports = 0;
+    uint64_t replay_hash = 0xCBF29CE484222325ull;
+    uint64_t replay_reports = 0;
+
+    Journal journal;
+    unique_ptr<BasicOrderbook<ReportHashSink>> live(
+        new BasicOrderbook<ReportHashSink>(MAX_ORDERS, ReportHashSink{&live_hash, &live_reports}));
+    live->set_risk(&live_risk);
+    journal.open(path);
+    for (const Command& command : session) {
+        journal.record(command);
+        live->apply(command);
+    }
+    bool ok = journal.close() && live->save_snapshot(live_snapshot);
+
+    JournalReader reader;
+    unique_ptr<BasicOrderbook<ReportHashSink>> replayed(
+        new BasicOrderbook<ReportHashSink>(MAX_ORDERS, ReportHashSink{&replay_hash, &replay_reports}));
+    replayed->set_risk(&replay_risk);
+    auto start = high_resolution_clock::now();
+    uint64_t replayed_commands = reader.open(path) ? reader.replay(*replayed) : 0;
+    auto end = high_resolution_clock::now();
+    ok = ok && replayed->save_snapshot(replay_snapshot);
+
+    cout << fixed << setprecision(2) << "  Replay: " << replayed_commands << " commands in "
+         << duration_cast<microseconds>(end - start).count() / 1000.0 << " ms, " << replay_reports
+         << " reports" << endl;
+    if (!ok || replayed_commands != session.size()) {
+        cout << "  ✗ FAIL: journal incomplete" << endl;
+    } else if (replay_hash != live_hash || replay_reports != live_reports) {
+        cout << "  ✗ FAIL: replay emitted different reports" << endl;
+    } else if (!same_file(live_snapshot, replay_snapshot)) {
+        cout << "  ✗ FAIL: replayed book differs from the live book" << endl;
+    } else {
+        cout << "  ✓ identical reports and byte-identical final book" << endl;
+    }
+    reader.close();
+    remove(path);
+    remove(live_snapshot);
+    remove(replay_snapshot);
+    cout << endl;
+}
+
+// clear and session rollover. a clear pays for the active levels and resting orders only, so it is timed
+// against the number of levels in use. the rollover runs over num_books books sharing one router store,
+// 200 orders each over 40 levels with every third order GTC, and checks what is left against the GTC orders
+void benchmark_reset(int num_books, int num_runs = 5) {
+    cout << "Reset Benchmark:" << endl;
+    double scale = 1.0 / tsc_ticks_per_ns();
+
+    unique_ptr<Orderbook> book(new Orderbook());
+    const uint32_t per_level = 4;
+    for (uint32_t num_levels : {0u, 1u, 16u, 256u, 2048u}) {
+        vector<double> clear_ns;
+        for (int run = 0; run < num_runs * 20; run++) {
+            uint64_t order_id = 1;
+            for (uint32_t level = 0; level < num_levels; level++) {
+                bool buy = level % 2 == 0;
+                uint32_t price = buy ? 10000 - level / 2 : 10001 + level / 2;
+                for (uint32_t k = 0; k < per_level; k++) {
+                    book->add_order(order_id++, buy ? Side::BUY : Side::SELL, price, 10);
+                }
+            }
+            uint64_t begin = tsc_now();
+            book->clear();
+            clear_ns.push_back((tsc_now() - begin) * scale);
+        }
+        print_stats("clear, " + to_string(num_levels) + " levels x " + to_string(per_level) + " orders",
+                    calculate_stats(clear_ns), "ns");
+    }
+
+    unique_ptr<SymbolRouter> router(new SymbolRouter());
+    for (int b = 0; b < num_books; b++) {
+        router->add_symbol("SYM" + to_string(b));
+    }
+    const uint32_t orders_per_book = 200;
+    const uint32_t levels_per_book = 40;
+    uint32_t gtc_per_book = (orders_per_book + 2) / 3;
+
+    vector<double> roll_ms;
+    vector<double> clear_ms;
+    bool ok = true;
+    for (int run = 0; run < num_runs; run++) {
+        uint64_t order_id = 1;
+        for (int b = 0; b < num_books; b++) {
+            for (uint32_t k = 0; k < orders_per_book; k++) {
+                uint32_t level = k % levels_per_book;
+                bool buy = level < levels_per_book / 2;
+                uint32_t price = buy ? 10000 - level : 10001 + level - levels_per_book / 2;
+                router->add_order(b, order_id++, buy ? Side::BUY : Side::SELL, price, 10,
+                                  k % 3 == 0 ? TimeInForce::GTC : TimeInForce::DAY);
+            }
+        }
+
+        auto start = high_resolution_clock::now();
+        uint32_t purged = router->roll_session();
+        auto end = high_resolution_clock::now();
+        roll_ms.push_back(duration_cast<nanoseconds>(end - start).count() / 1e6);
+
+        // two of the five orders at each touch are GTC
+        ok = ok && purged == num_books * (orders_per_book - gtc_per_book) &&
+             router->live_orders() == num_books * gtc_per_book;
+        for (int b = 0; b < num_books && ok; b++) {
+            Quote q = router->get_quote(b);
+            ok = q.bid_price == 10000 && q.bid_quantity == 20 && q.ask_price == 10001 && q.ask_quantity == 20;
+        }
+
+        start = high_resolution_clock::now();
+        router->clear();
+        end = high_resolution_clock::now();
+        clear_ms.push_back(duration_cast<nanoseconds>(end - start).count() / 1e6);
+        ok = ok && router->live_orders() == 0;
+    }
+
+    BenchmarkStats roll = calculate_stats(roll_ms);
+    cout << "  " << num_books << " books x " << orders_per_book << " orders, " << gtc_per_book << " GTC each:" << endl;
+    print_stats("roll_session, all books", roll, "ms");
+    cout << fixed << setprecision(2) << "    " << roll.mean * 1e3 / num_books << " μs per book, "
+         << roll.mean * 1e6 / (num_books * (orders_per_book - gtc_per_book)) << " ns per purged order" << endl;
+    print_stats("clear, all books (GTC left)", calculate_stats(clear_ms), "ms");
+    if (ok) {
+        cout << "  ✓ only GTC orders survive, touch quantities as expected" << endl;
+    } else {
+        cout << "  ✗ FAIL: rollover left the wrong orders" << endl;
+    }
+    cout << endl;
+}
+
+// the matching thread publishes its top of book through a seqlock while 0 to 8 reader threads poll it.
+// the writer's cost per op is taken from its own cpu clock as well as the wall clock, because when there are
+// fewer cores than threads the readers also take turns on the writer's core. staleness is the time from the end
+// of the op that published a record to a reader first holding it, and every record a reader holds is checked
+// for a torn read: levels out of order or a crossed book
+void benchmark_top_of_book(int num_operations, int num_runs = 3) {
+    vector<Command> commands = generate_deep_book_flow(num_operations);
+    unique_ptr<Orderbook> book(new Orderbook());
+    TopOfBookSlot slot;
+    vector<uint64_t> op_sequence(commands.size());
+    vector<uint64_t> op_tsc(commands.size());
+    double scale = 1.0 / tsc_ticks_per_ns();
+
+    struct Reader {
+        thread worker;
+        uint64_t reads = 0;
+        uint64_t retries = 0;
+        uint64_t torn = 0;
+        vector<pair<uint64_t, uint64_t>> seen;  // (sequence, tsc) of each new record
+    };
+
+    cout << "Top of Book Benchmark (" << num_operations << " mixed operations, " << num_runs << " runs, "
+         << thread::hardware_concurrency() << " cores):" << endl;
+
+    double base_wall = 0;
+    double base_cpu = 0;
+    for (int num_readers : {-1, 0, 1, 2, 4, 8}) {
+        // -1 runs without publishing
+        vector<double> wall_ns;
+        vector<double> cpu_ns;
+        vector<double> reads_per_sec;
+        LatencyHistogram staleness;
+        uint64_t published = 0;
+        uint64_t seen = 0;
+        uint64_t torn = 0;
+
+        for (int run = 0; run < num_runs; run++) {
+            book->publish_top(nullptr);
+            book->clear();
+            book->publish_top(num_readers >= 0 ? &slot : nullptr);
+            uint64_t start_sequence = book->last_sequence();
+            uint64_t start_stores = slot.stores();
+
+            atomic<bool> stop{false};
+            atomic<int> ready{0};
+            vector<Reader> readers(max(num_readers, 0));
+            for (Reader& reader : readers) {
+                reader.seen.reserve(commands.size());
+                reader.worker = thread([&slot, &stop, &ready, &reader] {
+                    ready.fetch_add(1);
+                    uint64_t last = UINT64_MAX;
+                    TopOfBook top;
+                    while (!stop.load(memory_order_relaxed)) {
+                        if (!slot.try_load(top)) {
+                            ++reader.retries;
+                            continue;
+                        }
+                        ++reader.reads;
+                        if (top.sequence != last) {
+                            last = top.sequence;
+                            if (reader.seen.size() < reader.seen.capacity()) {
+                                reader.seen.push_back({top.sequence, tsc_now()});
+                            }
+                            bool ordered = top.bids[0].price == 0 || top.asks[0].price == 0 || top.bids[0].price < top.asks[0].price;
+                            for (uint32_t i = 1; i < TOP_LEVELS; i++) {
+                                ordered = ordered && (top.bids[i].price == 0 || top.bids[i].price < top.bids[i - 1].price) &&
+                                          (top.asks[i].price == 0 || top.asks[i].price > top.asks[i - 1].price);
+                            }
+                            reader.torn += !ordered;
+                        }
+                    }
+                });
+            }
+            while (ready.load() < num_readers) {
+                this_thread::yield();
+            }
+
+            timespec cpu_start;
+            timespec cpu_end;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+            auto start = high_resolution_clock::now();
+            for (size_t i = 0; i < commands.size(); i++) {
+                apply_command(*book, commands[i]);
+                op_sequence[i] = book->last_sequence();
+                op_tsc[i] = tsc_now();
+            }
+            auto end = high_resolution_clock::now();
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+            stop.store(true);
+
+            double seconds = duration_cast<nanoseconds>(end - start).count() / 1e9;
+            wall_ns.push_back(seconds * 1e9 / commands.size());
+            cpu_ns.push_back(((cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec)) / commands.size());
+            published += slot.stores() - start_stores;
+
+            for (Reader& reader : readers) {
+                reader.worker.join();
+                reads_per_sec.push_back(reader.reads / seconds);
+                torn += reader.torn;
+                for (const auto& [sequence, seen_tsc] : reader.seen) {
+                    if (sequence <= start_sequence) {
+                        continue;
+                    }
+                    size_t op = lower_bound(op_sequence.begin(), op_sequence.end(), sequence) - op_sequence.begin();
+                    staleness.record(seen_tsc > op_tsc[op] ? seen_tsc - op_tsc[op] : 0);
+                    ++seen;
+                }
+            }
+        }
+
+        BenchmarkStats wall = calculate_stats(wall_ns);
+        BenchmarkStats cpu = calculate_stats(cpu_ns);
+        if (num_readers < 0) {
+            base_wall = wall.mean;
+            base_cpu = cpu.mean;
+            cout << "  not publishing: " << fixed << setprecision(1) << wall.mean << " ns/op wall, "
+                 << cpu.mean << " ns/op cpu" << endl;
+            continue;
+        }
+        cout << "  " << num_readers << (num_readers == 1 ? " reader: " : " readers: ") << fixed << setprecision(1)
+             << wall.mean << " ns/op wall (" << showpos << (wall.mean / base_wall - 1) * 100 << "%), "
+             << noshowpos << cpu.mean << " ns/op cpu (" << showpos << (cpu.mean / base_cpu - 1) * 100 << "%)"
+             << noshowpos << ", " << published / num_runs << " records per run" << endl;
+        if (num_readers > 0) {
+            cout << "    " << setprecision(2) << calculate_stats(reads_per_sec).mean / 1e6 << "M reads/s per reader, "
+                 << setprecision(1) << 100.0 * seen / (published * num_readers) << "% of records seen, staleness p50 "
+                 << staleness.percentile(50) * scale << " ns, p99 " << staleness.percentile(99) * scale
+                 << " ns, p99.9 " << staleness.percentile(99.9) * scale << " ns" << endl;
+        }
+        if (torn > 0) {
+            cout << "  ✗ FAIL: " << torn << " torn reads" << endl;
+        }
+    }
+    cout << endl;
+}
+
+// one pass of commands through a router of Spec books, prices in the commands are in ticks and are scaled
+// by the tick size here. returns ns per command and the levels left in overflow across every book
+template <typename Spec>
+pair<double, uint32_t> run_book_config(uint32_t num_books, const vector<Command>& commands) {
+    using Router = BasicSymbolRouter<NullSink, Spec>;
+    unique_ptr<Router> router(new Router());
+    for (uint32_t b = 0; b < num_books; b++) {
+        router->add_symbol("SYM" + to_string(b));
+    }
+    vector<Command> scaled(commands);
+    for (Command& command : scaled) {
+        command.price *= Spec::TICK_SIZE;
+    }
+
+    auto start = high_resolution_clock::now();
+    for (const Command& command : scaled) {
+        router->apply(command);
+    }
+    auto end = high_resolution_clock::now();
+
+    uint32_t overflow = 0;
+    for (uint32_t b = 0; b < num_books; b++) {
+        overflow += router->book(b).levels().overflow_levels();
+    }
+    return {duration_cast<nanoseconds>(end - start).count() / (double)commands.size(), overflow};
+}
+
+// adds, cancels, modifies and executes over num_books books, every order within spread ticks of a fixed mid,
+// a few of them marketable. ids are drawn from the orders still resting, so nothing is wasted on misses
+vector<Command> book_config_commands(uint32_t num_books, uint32_t spread, int num_operations, uint32_t seed) {
+    mt19937 gen(seed);
+    uniform_int_distribution<uint32_t> book_dist(0, num_books - 1);
+    uniform_int_distribution<uint32_t> offset_dist(1, spread);
+    uniform_int_distribution<uint32_t> qty_dist(1, 100);
+    uniform_int_distribution<> op_dist(0, 9);
+    const uint32_t mid = 100000;
+
+    vector<Command> commands;
+    vector<uint64_t> resting;
+    uint64_t next_order_id = 1;
+    for (int i = 0; i < num_operations; i++) {
+        int op = op_dist(gen);
+        Command command{};
+        if (op < 5 || resting.empty()) {
+            command.type = CommandType::ADD;
+            command.order_id = next_order_id++;
+            command.symbol = book_dist(gen);
+            command.side = gen() % 2 ? Side::BUY : Side::SELL;
+            // one add in twenty crosses the mid by a few ticks
+            int32_t offset = gen() % 20 == 0 ? -int32_t(gen() % 3) : int32_t(offset_dist(gen));
+            command.price = command.side == Side::BUY ? mid - offset : mid + offset;
+            command.quantity = qty_dist(gen);
+            resting.push_back(command.order_id);
+        } else {
+            size_t idx = gen() % resting.size();
+            command.order_id = resting[idx];
+            command.quantity = qty_dist(gen);
+            if (op < 8) {
+                command.type = CommandType::CANCEL;
+                resting[idx] = resting.back();
+                resting.pop_back();
+            } else {
+                command.type = op == 8 ? CommandType::MODIFY : CommandType::EXECUTE;
+            }
+        }
+        commands.push_back(command);
+    }
+    return commands;
+}
+
+// the same flow through books specialized differently. the ladder window sets the book's footprint: many
+// instruments trading near the touch fit a narrow one, and a book that rests orders further out than its
+// window pays for the overflow instead. a tick size of 5 price units with prices normalized to ticks lets the
+// window cover five times the price range of a book indexing raw price units
+void benchmark_book_configs(int num_operations, int num_runs = 5) {
+    struct Row {
+        const char* name;
+        size_t book_bytes;
+        function<pair<double, uint32_t>(uint32_t, const vector<Command>&)> run;
+    };
+    auto print_rows = [&](uint32_t num_books, uint32_t spread, const vector<Row>& rows) {
+        vector<Command> commands = book_config_commands(num_books, spread, num_operations, 42);
+        cout << "  " << num_books << (num_books == 1 ? " book" : " books") << ", orders up to " << spread
+             << " ticks from the mid:" << endl;
+        for (const Row& row : rows) {
+            vector<double> ns;
+            uint32_t overflow = 0;
+            for (int run = 0; run < num_runs; run++) {
+                auto [run_ns, run_overflow] = row.run(num_books, commands);
+                ns.push_back(run_ns);
+                overflow = run_overflow;
+            }
+            print_stats(string("  ") + row.name, calculate_stats(ns), "ns/op");
+            cout << "      " << fixed << setprecision(1) << row.book_bytes / 1024.0 << " KB per book, "
+                 << row.book_bytes * num_books / 1048576.0 << " MB of books, " << overflow
+                 << " levels in overflow at the end" << endl;
+        }
+    };
+
+    using Tick1 = BookSpec<1>;
+    using Tick1Narrow = BookSpec<1, 256>;
+    using Tick1Tiny = BookSpec<1, 64>;
+    using Tick1Wide = BookSpec<1, 8192>;
+    using Tick5 = BookSpec<5>;
+    using Tick5Narrow = BookSpec<5, 512>;
+
+    cout << "Book Configuration Benchmark (" << num_operations << " operations, " << num_runs << " runs):" << endl;
+    print_rows(1000, 50, {
+        {"tick 1, 2048 levels", sizeof(BasicOrderbook<NullSink, Tick1>), run_book_config<Tick1>},
+        {"tick 1, 8192 levels", sizeof(BasicOrderbook<NullSink, Tick1Wide>), run_book_config<Tick1Wide>},
+        {"tick 1, 256 levels", sizeof(BasicOrderbook<NullSink, Tick1Narrow>), run_book_config<Tick1Narrow>},
+        {"tick 1, 64 levels", sizeof(BasicOrderbook<NullSink, Tick1Tiny>), run_book_config<Tick1Tiny>},
+    });
+
+    // the commands are in ticks of 5 units, the tick 1 book sees them as raw prices 5 apart
+    print_rows(1, 1000, {
+        {"tick 1, 2048 levels", sizeof(BasicOrderbook<NullSink, Tick1>),
+         [](uint32_t books, const vector<Command>& commands) {
+             vector<Command> units(commands);
+             for (Command& command : units) {
+                 command.price *= 5;
+             }
+             return run_book_config<Tick1>(books, units);
+         }},
+        {"tick 5, 2048 levels", sizeof(BasicOrderbook<NullSink, Tick5>), run_book_config<Tick5>},
+        {"tick 5, 512 levels", sizeof(BasicOrderbook<NullSink, Tick5Narrow>), run_book_config<Tick5Narrow>},
+    });
+    cout << endl;
+}
+
+// range analytics on a book 200 ticks deep a side with a quarter of the ticks empty: quantity up to a price
+// 100 ticks out, the cost of filling the quantity of about 100 levels, and the imbalance over the top 10 and
+// 100 levels. each query is answered by walking the levels, by the scalar kernels over the dense quantities
+// and by the vectorized ones, and all three must agree
+void benchmark_analytics(int num_queries = 1000000, int num_runs = 5) {
+    unique_ptr<Orderbook> book(new Orderbook());
+    mt19937 gen(42);
+    uniform_int_distribution<> qty_dist(1, 100);
+    uint64_t order_id = 1;
+    for (uint32_t tick = 1; tick <= 200; tick++) {
+        for (Side side : {Side::BUY, Side::SELL}) {
+            if (gen() % 4 == 0) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                book->add_order(order_id++, side, side == Side::BUY ? 10000 - tick : 10000 + tick, qty_dist(gen));
+            }
+        }
+    }
+    const PriceLadder& ladder = book->levels();
+    uint64_t fill_quantity = quantity_to_price(ladder, Side::SELL, 10100);
+
+    // the parameters vary a little per query so nothing is hoisted out of the loop
+    auto walk_quantity = [&](Side side, uint32_t price) {
+        uint64_t total = 0;
+        auto visit = [&](const PriceLevel& level) {
+            if (side == Side::BUY ? level.price < price : level.price > price) {
+                return false;
+            }
+            total += level.total_quantity;
+            return true;
+        };
+        side == Side::BUY ? ladder.walk_bids(visit) : ladder.walk_asks(visit);
+        return total;
+    };
+    auto walk_fill = [&](uint64_t quantity) {
+        FillEstimate fill;
+        ladder.walk_asks([&](const PriceLevel& level) {
+            uint64_t taken = min<uint64_t>(quantity, level.total_quantity);
+            quantity -= taken;
+            fill.quantity += taken;
+            fill.notional += taken * level.price;
+            return quantity > 0;
+        });
+        return fill;
+    };
+    auto walk_imbalance = [&](uint32_t levels) {
+        uint64_t side_total[2] = {0, 0};
+        for (Side side : {Side::BUY, Side::SELL}) {
+            uint32_t seen = 0;
+            uint64_t& total = side_total[side == Side::BUY ? 0 : 1];
+            auto visit = [&](const PriceLevel& level) {
+                if (level.total_quantity > 0) {
+                    total += level.total_quantity;
+                    ++seen;
+                }
+                return seen < levels;
+            };
+            side == Side::BUY ? ladder.walk_bids(visit) : ladder.walk_asks(visit);
+        }
+        return (double(side_total[0]) - double(side_total[1])) / double(side_total[0] + side_total[1]);
+    };
+
+    struct Query {
+        const char* name;
+        function<double(int)> walk;
+        function<double(int)> scalar;
+        function<double(int)> simd;
+    };
+    vector<Query> queries = {
+        {"quantity to price, 100 ticks",
+         [&](int i) { return double(walk_quantity(Side::SELL, 10100 - (i & 3))); },
+         [&](int i) { return double(quantity_to_price<ScalarKernels>(ladder, Side::SELL, 10100 - (i & 3))); },
+         [&](int i) { return double(quantity_to_price(ladder, Side::SELL, 10100 - (i & 3))); }},
+        {"VWAP to fill ~100 levels",
+         [&](int i) { return walk_fill(fill_quantity - (i & 3)).vwap(); },
+         [&](int i) { return estimate_fill<ScalarKernels>(ladder, Side::BUY, fill_quantity - (i & 3)).vwap(); },
+         [&](int i) { return estimate_fill(ladder, Side::BUY, fill_quantity - (i & 3)).vwap(); }},
+        {"imbalance, top 10 levels",
+         [&](int i) { return walk_imbalance(10 - (i & 1)); },
+         [&](int i) { return level_imbalance<ScalarKernels>(ladder, 10 - (i & 1)); },
+         [&](int i) { return level_imbalance(ladder, 10 - (i & 1)); }},
+        {"imbalance, top 100 levels",
+         [&](int i) { return walk_imbalance(100 - (i & 1)); },
+         [&](int i) { return level_imbalance<ScalarKernels>(ladder, 100 - (i & 1)); },
+         [&](int i) { return level_imbalance(ladder, 100 - (i & 1)); }},
+    };
+
+#if defined(__AVX2__)
+    const char* kernels = "AVX2";
+#else
+    const char* kernels = "scalar fallback";
+#endif
+    cout << "Analytics Benchmark (" << num_queries << " queries per run, " << num_runs << " runs, " << kernels
+         << " kernels):" << endl;
+
+    // std::function keeps the three variants behind the same call, the query itself is inlined inside it
+    auto time_queries = [&](const function<double(int)>& query, double& checksum) {
+        auto start = high_resolution_clock::now();
+        for (int i = 0; i < num_queries; i++) {
+            checksum += query(i);
+        }
+        auto end = high_resolution_clock::now();
+        return duration_cast<nanoseconds>(end - start).count() / (double)num_queries;
+    };
+
+    for (const Query& query : queries) {
+        vector<double> walk_ns;
+        vector<double> scalar_ns;
+        vector<double> simd_ns;
+        double walk_sum = 0;
+        double scalar_sum = 0;
+        double simd_sum = 0;
+        for (int run = 0; run < num_runs; run++) {
+            walk_ns.push_back(time_queries(query.walk, walk_sum));
+            scalar_ns.push_back(time_queries(query.scalar, scalar_sum));
+            simd_ns.push_back(time_queries(query.simd, simd_sum));
+        }
+        BenchmarkStats walk = calculate_stats(walk_ns);
+        BenchmarkStats simd = calculate_stats(simd_ns);
+        cout << "  " << query.name << ":" << endl;
+        print_stats("  level walk", walk, "ns");
+        print_stats("  dense scalar", calculate_stats(scalar_ns), "ns");
+        print_stats("  dense " + string(kernels), simd, "ns");
+        cout << "    " << fixed << setprecision(2) << walk.mean / simd.mean << "x over the level walk" << endl;
+        if (walk_sum != scalar_sum || walk_sum != simd_sum) {
+            cout << "  ✗ FAIL: the three answers differ" << endl;
+        }
+    }
+    cout << endl;
+}
+
+// keeps every report, for checks on exactly what a book said
+struct ReportLogSink {
+    vector<ExecutionReport>* log;
+
+    inline void on_report(const ExecutionReport& report) { log->push_back(report); }
+};
+
+// what the risk stage and self-trade prevention do to a few hand-built books, each check printed as it passes
+// or fails, then their cost on the deep-book flow. every order belongs to one of 1024 accounts, and the flow
+// runs bare, with the limit checks (set high enough that nothing is rejected), and with the limits, a price
+// band and self-trade prevention together. the same configurations are then timed on adds that only rest,
+// so the risk stage is the whole difference, and the check alone over random accounts. costs are medians
+// over interleaved rounds, the differences are a few nanoseconds against a run-to-run spread of several
+void benchmark_risk(int num_operations, int num_runs = 15) {
+    using LoggedBook = BasicOrderbook<ReportLogSink>;
+    cout << "Risk Benchmark (" << num_operations << " operations, " << num_runs << " runs):" << endl;
+
+    vector<ExecutionReport> log;
+    auto rejected = [&](uint64_t order_id, RejectReason reason) {
+        return any_of(log.begin(), log.end(), [&](const ExecutionReport& r) {
+            return r.type == ReportType::REJECT && r.order_id == order_id && r.reason == reason;
+        });
+    };
+    auto acked = [&](uint64_t order_id) {
+        return any_of(log.begin(), log.end(), [&](const ExecutionReport& r) {
+            return r.type == ReportType::ACK && r.order_id == order_id;
+        });
+    };
+    auto expect = [](bool ok, const char* what) {
+        if (ok) {
+            cout << "  ✓ " << what << endl;
+        } else {
+            cout << "  ✗ FAIL: " << what << endl;
+        }
+    };
+
+    {
+        RiskTable table(16);
+        AccountLimits limits;
+        limits.max_order_quantity = 100;
+        limits.max_notional = 1000000;
+        limits.max_open_quantity = 150;
+        table.set_limits(1, limits);
+        unique_ptr<LoggedBook> book(new LoggedBook(1024, ReportLogSink{&log}));
+        book->set_risk(&table);
+        book->set_price_band(100);
+
+        book->add_order(1, Side::BUY, 9000, 101, TimeInForce::DAY, 1);
+        book->add_order(2, Side::BUY, 10000, 101, TimeInForce::DAY, 1);
+        expect(rejected(1, RejectReason::ORDER_QUANTITY) && !acked(1), "order size limit, rejected before the ack");
+
+        limits.max_order_quantity = 1000;
+        table.set_limits(1, limits);
+        book->add_order(3, Side::BUY, 10000, 101, TimeInForce::DAY, 1);
+        expect(rejected(3, RejectReason::NOTIONAL), "notional limit");
+
+        book->add_order(4, Side::BUY, 9000, 100, TimeInForce::DAY, 1);
+        book->add_order(5, Side::BUY, 9000, 60, TimeInForce::DAY, 1);
+        book->add_order(6, Side::SELL, 9000, 30, TimeInForce::DAY, 2);
+        book->add_order(7, Side::BUY, 9000, 60, TimeInForce::DAY, 1);
+        expect(rejected(5, RejectReason::OPEN_QUANTITY) && !rejected(7, RejectReason::OPEN_QUANTITY) &&
+               table.open_quantity(1) == 130, "open quantity limit, released by a fill");
+        book->cancel_order(4);
+        book->modify_order(7, 20);
+        expect(table.open_quantity(1) == 20, "open quantity released by cancel and modify");
+        book->add_order(12, Side::BUY, 9000, 100, TimeInForce::DAY, 1);
+        book->modify_order(7, 200);
+        book->modify_order(7, 60);
+        book->modify_order(7, 40);
+        expect(rejected(7, RejectReason::NOTIONAL) && rejected(7, RejectReason::OPEN_QUANTITY) &&
+               table.open_quantity(1) == 140 && book->get_quote().bid_quantity == 140,
+               "modify up checked, rejected over the notional and open limits");
+
+        book->add_order(8, Side::SELL, 10000, 10, TimeInForce::DAY, 2);
+        book->add_order(9, Side::BUY, 10101, 5, TimeInForce::DAY, 3);
+        book->add_order(10, Side::BUY, 10100, 5, TimeInForce::DAY, 3);
+        expect(rejected(9, RejectReason::PRICE_BAND) && !rejected(10, RejectReason::PRICE_BAND),
+               "price band of 1% over the best ask");
+        book->add_order(11, Side::SELL, 100, 5, TimeInForce::DAY, 20);
+        expect(rejected(11, RejectReason::ACCOUNT), "account outside the table");
+
+        // order 8 still rests at 10000, a buy reusing its id must not trade against it
+        size_t before = log.size();
+        uint32_t ask_quantity = book->get_quote().ask_quantity;
+        book->add_order(8, Side::BUY, 10000, 10, TimeInForce::DAY, 3);
+        bool untouched = all_of(log.begin() + before, log.end(), [](const ExecutionReport& r) {
+            return r.type == ReportType::REJECT && r.reason == RejectReason::DUPLICATE;
+        });
+        expect(log.size() == before + 1 && untouched && book->get_quote().ask_quantity == ask_quantity,
+               "duplicate id rejected whole, before the ack and any fill");
+    }
+
+    // account 1 rests 50 at the touch ahead of account 2's 30, then buys 70 through them
+    auto self_trade = [&](SelfTradePrevention mode, Quote expected, uint32_t prevented, uint64_t open) {
+        RiskTable table(16);
+        AccountLimits limits;
+        limits.self_trade = mode;
+        table.set_limits(1, limits);
+        log.clear();
+        unique_ptr<LoggedBook> book(new LoggedBook(1024, ReportLogSink{&log}));
+        book->set_risk(&table);
+        book->add_order(1, Side::SELL, 10000, 50, TimeInForce::DAY, 1);
+        book->add_order(2, Side::SELL, 10000, 30, TimeInForce::DAY, 2);
+        book->add_order(3, Side::BUY, 10000, 70, TimeInForce::DAY, 1);
+        Quote q = book->get_quote();
+        uint32_t rejected_quantity = 0;
+        for (const ExecutionReport& r : log) {
+            if (r.type == ReportType::REJECT && r.reason == RejectReason::SELF_TRADE) {
+                rejected_quantity += r.quantity;
+            }
+            if (r.type == ReportType::FILL && r.contra_order_id == 1) {
+                rejected_quantity = UINT32_MAX;
+            }
+        }
+        return q.bid_price == expected.bid_price && q.bid_quantity == expected.bid_quantity &&
+               q.ask_price == expected.ask_price && q.ask_quantity == expected.ask_quantity &&
+               rejected_quantity == prevented && table.open_quantity(1) == open;
+    };
+    expect(self_trade(SelfTradePrevention::CANCEL_NEWEST, Quote(0, 0, 10000, 80), 70, 50),
+           "self-trade prevention, cancel newest");
+    expect(self_trade(SelfTradePrevention::CANCEL_OLDEST, Quote(10000, 40, 0, 0), 0, 40),
+           "self-trade prevention, cancel oldest");
+    expect(self_trade(SelfTradePrevention::DECREMENT, Quote(0, 0, 10000, 10), 50, 0),
+           "self-trade prevention, decrement");
+
+    const uint32_t accounts = 1024;
+    vector<Command> commands = generate_deep_book_flow(num_operations);
+    uint64_t adds = count_if(commands.begin(), commands.end(),
+                             [](const Command& c) { return c.type == CommandType::ADD; });
+
+    // adds that only rest, bids under 10000 and asks over it within the band, so none reaches the matching
+    // loop and what the risk stage adds is all that differs: the check, the band and the open quantity charge
+    const int num_resting = 200000;
+    vector<Command> resting(num_resting);
+    mt19937 gen(42);
+    for (int i = 0; i < num_resting; i++) {
+        Command& command = resting[i];
+        command.type = CommandType::ADD;
+        command.order_id = i + 1;
+        command.side = i % 2 ? Side::SELL : Side::BUY;
+        command.price = command.side == Side::BUY ? 9999 - gen() % 400 : 10001 + gen() % 400;
+        command.quantity = 1 + gen() % 100;
+        command.account = gen() % accounts;
+    }
+
+    // orders of one account sit on both sides of the book, so some adds of the flow do meet their own account
+    enum { BARE, LIMITS, FULL, CONFIGS };
+    const char* names[CONFIGS] = {"no risk stage", "limit checks", "limits, band and self-trade prevention"};
+    unique_ptr<RiskTable> table(new RiskTable(accounts));
+    auto configure = [&](auto& book, int config) {
+        AccountLimits limits;
+        limits.max_order_quantity = 1000;
+        limits.max_notional = 100000000;
+        limits.max_open_quantity = 1000000;
+        limits.self_trade = config == FULL ? SelfTradePrevention::DECREMENT : SelfTradePrevention::NONE;
+        for (uint32_t a = 0; a < accounts; a++) {
+            table->set_limits(a, limits);
+        }
+        book.set_risk(config == BARE ? nullptr : table.get());
+        book.set_price_band(config == FULL ? 500 : 0);
+    };
+
+    // interleaved: each round runs every configuration once, starting from a different one each round, so
+    // drift over the run lands on all of them. a configuration's cost is the median over rounds of its
+    // difference to the bare book in the same round. both books are cleared and reused, and a first round
+    // that faults their memory in is not counted
+    uint64_t reports = 0;
+    uint64_t hash = 0;
+    unique_ptr<BasicOrderbook<ReportHashSink>> book(
+        new BasicOrderbook<ReportHashSink>(MAX_ORDERS, ReportHashSink{&hash, &reports}));
+    unique_ptr<Orderbook> quiet(new Orderbook());
+    vector<double> flow_ns[CONFIGS];
+    vector<double> flow_add_ns[CONFIGS];
+    vector<double> stage_ns[CONFIGS];
+    vector<double> stage_add_ns[CONFIGS];
+    bool all_rested = true;
+    for (int run = -1; run < num_runs; run++) {
+        double round_flow[CONFIGS];
+        double round_stage[CONFIGS];
+        for (int k = 0; k < CONFIGS; k++) {
+            int config = (run + 1 + k) % CONFIGS;
+
+            book->clear();
+            configure(*book, config);
+            auto start = high_resolution_clock::now();
+            for (const Command& command : commands) {
+                if (command.type == CommandType::ADD) {
+                    book->add_order(command.order_id, command.side, command.price, command.quantity,
+                                    TimeInForce::DAY, uint16_t(command.order_id % accounts));
+                } else {
+                    apply_command(*book, command);
+                }
+            }
+            auto end = high_resolution_clock::now();
+            round_flow[config] = duration_cast<nanoseconds>(end - start).count() / (double)commands.size();
+            if (config == FULL) {
+                uint64_t open = 0;
+                for (uint32_t a = 0; a < accounts; a++) {
+                    open += table->open_quantity(a);
+                }
+                // every resting order is charged to its account, so the open quantities add up to the book
+                uint64_t resting_quantity = 0;
+                book->levels().walk_bids([&](const PriceLevel& level) { resting_quantity += level.total_quantity; return true; });
+                book->levels().walk_asks([&](const PriceLevel& level) { resting_quantity += level.total_quantity; return true; });
+                if (open != resting_quantity) {
+                    cout << "  ✗ FAIL: open quantities " << open << " against " << resting_quantity << " resting" << endl;
+                }
+            }
+            book->set_risk(nullptr);
+
+            quiet->clear();
+            configure(*quiet, config);
+            start = high_resolution_clock::now();
+            for (const Command& command : resting) {
+                quiet->add_order(command.order_id, command.side, command.price, command.quantity, TimeInForce::DAY,
+                                 command.account);
+            }
+            end = high_resolution_clock::now();
+            round_stage[config] = duration_cast<nanoseconds>(end - start).count() / (double)num_resting;
+            all_rested = all_rested && quiet->live_orders() == uint32_t(num_resting);
+            quiet->set_risk(nullptr);
+        }
+        for (int config = 0; run >= 0 && config < CONFIGS; config++) {
+            flow_ns[config].push_back(round_flow[config]);
+            flow_add_ns[config].push_back((round_flow[config] - round_flow[BARE]) * commands.size() / adds);
+            stage_ns[config].push_back(round_stage[config]);
+            stage_add_ns[config].push_back(round_stage[config] - round_stage[BARE]);
+        }
+    }
+
+    cout << "  Deep-book flow, " << num_runs << " interleaved rounds:" << endl;
+    for (int config = 0; config < CONFIGS; config++) {
+        print_median(names[config], calculate_median(flow_ns[config]), "ns/op");
+        if (config != BARE) {
+            MedianStats over = calculate_median(flow_add_ns[config]);
+            cout << "    " << fixed << setprecision(2) << over.median << " ns per add over no risk stage (IQR: "
+                 << over.p25 << " to " << over.p75 << ")" << endl;
+        }
+    }
+    cout << "  Resting adds only, " << num_resting << " per round:" << endl;
+    for (int config = 0; config < CONFIGS; config++) {
+        print_median(names[config], calculate_median(stage_ns[config]), "ns/add");
+        if (config != BARE) {
+            MedianStats over = calculate_median(stage_add_ns[config]);
+            cout << "    " << fixed << setprecision(2) << over.median << " ns per add over no risk stage (IQR: "
+                 << over.p25 << " to " << over.p75 << ")" << endl;
+        }
+    }
+    if (!all_rested) {
+        cout << "  ✗ FAIL: a resting add was rejected" << endl;
+    }
+
+    // the check on its own, on accounts drawn at random from the table
+    vector<uint16_t> picks(1 << 16);
+    for (uint16_t& pick : picks) {
+        pick = gen() % accounts;
+    }
+    vector<double> check_ns;
+    uint64_t passed = 0;
+    for (int run = 0; run < num_runs; run++) {
+        auto start = high_resolution_clock::now();
+        for (int i = 0; i < num_operations; i++) {
+            passed += table->check(picks[i & 0xFFFF], 10000 + (i & 63), 1 + (i & 127)) == RejectReason::NONE;
+        }
+        auto end = high_resolution_clock::now();
+        check_ns.push_back(duration_cast<nanoseconds>(end - start).count() / (double)num_operations);
+    }
+    print_stats("RiskTable::check alone", calculate_stats(check_ns), "ns");
+    cout << "    " << passed / num_runs << " of " << num_operations << " passed" << endl;
+    cout << endl;
+}
+
+// the baseline for benchmark_stops: armed stops kept in arrival order and scanned whenever the last trade
+// moves, entered as plain adds in the order the book's trigger ladder uses
+struct ScannedStop {
+    uint64_t order_id;
+    uint32_t trigger;
+    uint32_t limit;  // 0 for a stop market
+    uint32_t quantity;
+    Side side;
+};
+
+template <typename Book>
+void run_scanned_stops(Book& book, vector<ScannedStop>& armed, vector<ScannedStop>& queue, uint32_t& checked) {
+    size_t next = 0;
+    while (true) {
+        uint32_t last = book.last_trade_price();
+        if (last != checked) {
+            checked = last;
+            size_t first = queue.size();
+            size_t kept = 0;
+            for (const ScannedStop& stop : armed) {
+                if (stop.side == Side::BUY ? stop.trigger <= last : stop.trigger >= last) {
+                    queue.push_back(stop);
+                } else {
+                    armed[kept++] = stop;
+                }
+            }
+            armed.resize(kept);
+            stable_sort(queue.begin() + first, queue.end(), [](const ScannedStop& a, const ScannedStop& b) {
+                return a.side == Side::BUY ? a.trigger < b.trigger : a.trigger > b.trigger;
+            });
+        }
+        if (next == queue.size()) {
+            break;
+        }
+        const ScannedStop& stop = queue[next++];
+        uint32_t price = stop.limit ? stop.limit : stop.side == Side::BUY ? MAX_PRICE - 1 : 1;
+        book.add_order(stop.order_id, stop.side, price, stop.quantity);
+    }
+    queue.clear();
+}
+
+// stop orders: a few hand-built books check triggering, cascades and the stop lifecycle, each check printed as
+// it passes or fails. then a cascading run through num_stops armed sell stops, two to a tick below the touch,
+// each selling exactly what is left of the bid level its predecessors stopped at, so one aggressive sell sets
+// off every stop in turn. it runs on the book's trigger ladder and against a vector of stops scanned whenever
+// the last trade moves, and both must end with the same book. last, what num_stops stops armed far from the
+// market cost the deep-book flow
+void benchmark_stops(int num_stops, int num_operations, int num_runs = 5) {
+    using LoggedBook = BasicOrderbook<ReportLogSink>;
+    cout << "Stop Order Benchmark (" << num_stops << " stops, " << num_runs << " runs):" << endl;
+
+    vector<ExecutionReport> log;
+    auto reported = [&](ReportType type, uint64_t order_id, RejectReason reason = RejectReason::NONE) {
+        return any_of(log.begin(), log.end(), [&](const ExecutionReport& r) {
+            return r.type == type && r.order_id == order_id && r.reason == reason;
+        });
+    };
+    auto expect = [](bool ok, const char* what) {
+        if (ok) {
+            cout << "  ✓ " << what << endl;
+        } else {
+            cout << "  ✗ FAIL: " << what << endl;
+        }
+    };
+
+    {
+        unique_ptr<LoggedBook> book(new LoggedBook(1024, ReportLogSink{&log}));
+        for (uint32_t i = 0; i < 5; i++) {
+            book->add_order(100 + i, Side::BUY, 10000 - i, 10);
+        }
+        book->add_order(200, Side::SELL, 10010, 10);
+        book->add_stop(1, Side::SELL, 9999, 9998, 25);
+        book->add_stop(2, Side::SELL, 9998, 0, 40);
+        book->add_stop(3, Side::SELL, 9999, 0, 5);
+        book->add_stop(4, Side::BUY, 10010, 0, 5, TimeInForce::GTC);
+        book->add_stop(5, Side::BUY, 10020, 10020, 5);
+        expect(book->armed_stops() == 5 && book->live_orders() == 6, "stops armed beside the resting orders");
+
+        book->add_order(300, Side::SELL, 10000, 10);
+        expect(book->armed_stops() == 5 && book->last_trade_price() == 10000, "a trade short of every trigger");
+
+        log.clear();
+        book->add_order(301, Side::SELL, 9999, 5);
+        vector<uint64_t> order;
+        for (const ExecutionReport& r : log) {
+            if (r.type == ReportType::TRIGGER) {
+                order.push_back(r.order_id);
+            }
+        }
+        // 1 and 3 are set off by the trade at 9999, 2 by 1's fill at 9998 and after them. 2 then sweeps the bids
+        expect(order == vector<uint64_t>{1, 3, 2}, "cascade in trigger then arrival order");
+        expect(book->get_quote().bid_quantity == 0 && book->get_quote().ask_price == 9998 &&
+               book->get_quote().ask_quantity == 10, "stop limit rests what it did not fill at its limit");
+        expect(reported(ReportType::REJECT, 2, RejectReason::LIQUIDITY), "stop market remainder rejected");
+
+        book->add_stop(6, Side::SELL, 9996, 0, 1);
+        book->add_stop(5, Side::SELL, 9000, 0, 1);
+        expect(reported(ReportType::REJECT, 6, RejectReason::TRIGGER) &&
+               reported(ReportType::REJECT, 5, RejectReason::DUPLICATE), "reached trigger and duplicate id rejected");
+
+        book->modify_order(5, 3);
+        book->roll_session();
+        expect(book->armed_stops() == 1 && reported(ReportType::CANCEL, 5) && !reported(ReportType::CANCEL, 4),
+               "modify, and DAY stops purged at rollover");
+
+        SymbolRouter router;
+        router.add_symbol("A");
+        router.add_symbol("B");
+        router.add_stop(1, 7, Side::BUY, 10000, 0, 5);
+        router.cancel_order(7);
+        expect(router.book(1).armed_stops() == 0 && !router.has_order(7), "router cancels a stop by id");
+    }
+
+    {
+        // account 1 may hold 100 open, armed stops included
+        RiskTable table(4);
+        AccountLimits limits;
+        limits.max_open_quantity = 100;
+        table.set_limits(1, limits);
+        log.clear();
+        unique_ptr<LoggedBook> book(new LoggedBook(1024, ReportLogSink{&log}));
+        book->set_risk(&table);
+        for (uint32_t i = 0; i < 5; i++) {
+            book->add_stop(10 + i, Side::SELL, 9990, 0, 100, TimeInForce::DAY, 1);
+        }
+        book->add_order(20, Side::SELL, 10100, 1, TimeInForce::DAY, 1);
+        bool rejected = reported(ReportType::REJECT, 20, RejectReason::OPEN_QUANTITY);
+        for (uint32_t i = 1; i < 5; i++) {
+            rejected = rejected && reported(ReportType::REJECT, 10 + i, RejectReason::OPEN_QUANTITY);
+        }
+        expect(rejected && book->armed_stops() == 1 && table.open_quantity(1) == 100,
+               "armed stop holds open quantity, later stops and orders rejected over it");
+
+        book->set_risk(nullptr);
+        bool detached = table.open_quantity(1) == 0;
+        book->set_risk(&table);
+        book->modify_order(10, 150);
+        bool modify_rejected = reported(ReportType::REJECT, 10, RejectReason::OPEN_QUANTITY);
+        book->modify_order(10, 50);
+        bool modified = table.open_quantity(1) == 50;
+        book->cancel_order(10);
+        expect(detached && modify_rejected && modified && table.open_quantity(1) == 0,
+               "stop's open quantity moved with the table, checked on modify up, released by cancel");
+
+        // a trade at 9990 sets the stop limit off, nothing bids for it so all of it rests
+        book->add_stop(30, Side::SELL, 9990, 9990, 100, TimeInForce::DAY, 1);
+        book->add_order(401, Side::BUY, 9990, 5, TimeInForce::DAY, 2);
+        book->add_order(402, Side::SELL, 9990, 5, TimeInForce::DAY, 3);
+        expect(reported(ReportType::TRIGGER, 30) && book->get_quote().ask_quantity == 100 &&
+               table.open_quantity(1) == 100, "triggered stop's open quantity carried to its remainder, not doubled");
+    }
+
+    const uint32_t top = 100000;
+    const uint32_t levels = num_stops / 2 + 100;
+    auto build = [&](auto& book) {
+        for (uint32_t i = 0; i < levels; i++) {
+            book.add_order(1 + i, Side::BUY, top - i, 10);
+        }
+    };
+    // stops 2k and 2k + 1 trigger at top - k, every other one a stop limit
+    auto stop_at = [&](uint32_t i) {
+        uint32_t trigger = top - i / 2;
+        return ScannedStop{levels + 1 + i, trigger, i % 2 ? trigger - 100 : 0, 5, Side::SELL};
+    };
+
+    {
+        // the order every stop entered in, on a logged run
+        log.clear();
+        unique_ptr<LoggedBook> book(new LoggedBook(MAX_ORDERS, ReportLogSink{&log}));
+        build(*book);
+        for (uint32_t i = 0; i < uint32_t(num_stops); i++) {
+            ScannedStop stop = stop_at(i);
+            book->add_stop(stop.order_id, stop.side, stop.trigger, stop.limit, stop.quantity);
+        }
+        log.clear();
+        book->add_order(UINT32_MAX, Side::SELL, top, 10);
+        uint64_t expected = levels + 1;
+        bool in_order = true;
+        for (const ExecutionReport& r : log) {
+            if (r.type == ReportType::TRIGGER) {
+                in_order = in_order && r.order_id == expected++;
+            }
+        }
+        expect(in_order && expected == levels + 1 + num_stops && book->armed_stops() == 0,
+               "every stop of the cascade set off, in trigger then arrival order");
+    }
+
+    // every book runs the cascade once and is cleared before the timed run, so neither pays for first
+    // touching the order store
+    uint64_t hash = 0;
+    uint64_t reports = 0;
+    using Book = BasicOrderbook<ReportHashSink>;
+    vector<double> arm_ns, ladder_us, scan_us;
+    vector<ScannedStop> armed, queue;
+    bool same = true;
+    for (int run = 0; run < num_runs; run++) {
+        unique_ptr<Book> ladder_book(new Book(MAX_ORDERS, ReportHashSink{&hash, &reports}));
+        unique_ptr<Book> scan_book(new Book(MAX_ORDERS, ReportHashSink{&hash, &reports}));
+        for (int pass = 0; pass < 2; pass++) {
+            ladder_book->clear();
+            scan_book->clear();
+            build(*ladder_book);
+            build(*scan_book);
+
+            auto start = high_resolution_clock::now();
+            for (uint32_t i = 0; i < uint32_t(num_stops); i++) {
+                ScannedStop stop = stop_at(i);
+                ladder_book->add_stop(stop.order_id, stop.side, stop.trigger, stop.limit, stop.quantity);
+            }
+            auto end = high_resolution_clock::now();
+            double arm = duration_cast<nanoseconds>(end - start).count() / (double)num_stops;
+
+            start = high_resolution_clock::now();
+            ladder_book->add_order(UINT32_MAX, Side::SELL, top, 10);
+            end = high_resolution_clock::now();
+            double ladder = duration_cast<nanoseconds>(end - start).count() / 1000.0;
+
+            armed.clear();
+            for (uint32_t i = 0; i < uint32_t(num_stops); i++) {
+                armed.push_back(stop_at(i));
+            }
+            uint32_t checked = scan_book->last_trade_price();
+            start = high_resolution_clock::now();
+            scan_book->add_order(UINT32_MAX, Side::SELL, top, 10);
+            run_scanned_stops(*scan_book, armed, queue, checked);
+            end = high_resolution_clock::now();
+
+            if (pass == 1) {
+                arm_ns.push_back(arm);
+                ladder_us.push_back(ladder);
+                scan_us.push_back(duration_cast<nanoseconds>(end - start).count() / 1000.0);
+            }
+            Depth a, b;
+            ladder_book->get_depth(100, a);
+            scan_book->get_depth(100, b);
+            same = same && same_depth(a, b) && ladder_book->live_orders() == scan_book->live_orders() &&
+                   armed.empty();
+        }
+    }
+    expect(same, "trigger ladder and scanned stops leave the same book");
+    print_stats("arm a stop", calculate_stats(arm_ns), "ns");
+    BenchmarkStats ladder = calculate_stats(ladder_us);
+    BenchmarkStats scan = calculate_stats(scan_us);
+    print_stats("cascade, trigger ladder", ladder, "us");
+    cout << "    " << fixed << setprecision(1) << ladder.mean * 1000 / num_stops << " ns per stop" << endl;
+    print_stats("cascade, scanned after every trade", scan, "us");
+    cout << "    " << fixed << setprecision(1) << scan.mean * 1000 / num_stops << " ns per stop" << endl;
+
+    // stops armed 10% away on either side never trigger, the flow only pays for looking at the ladder when
+    // the last trade moves, or for the scan
+    vector<Command> commands = generate_deep_book_flow(num_operations);
+    enum { NONE, LADDER, SCANNED, CONFIGS };
+    const char* names[CONFIGS] = {"deep-book flow, no stops", "with stops on the trigger ladder",
+                                  "with stops scanned after every trade"};
+    vector<double> ns[CONFIGS];
+    for (int run = 0; run < num_runs; run++) {
+        for (int config = 0; config < CONFIGS; config++) {
+            unique_ptr<Book> book(new Book(MAX_ORDERS, ReportHashSink{&hash, &reports}));
+            for (int pass = 0; pass < 2; pass++) {
+                book->clear();
+                armed.clear();
+                for (uint32_t i = 0; i < uint32_t(num_stops); i++) {
+                    Side side = i % 2 ? Side::BUY : Side::SELL;
+                    uint32_t trigger = side == Side::BUY ? 11000 + i / 2 % 500 : 9000 - i / 2 % 500;
+                    uint64_t order_id = (1ull << 40) + i;
+                    if (config == LADDER) {
+                        book->add_stop(order_id, side, trigger, 0, 10);
+                    } else if (config == SCANNED) {
+                        armed.push_back(ScannedStop{order_id, trigger, 0, 10, side});
+                    }
+                }
+                uint32_t checked = 0;
+                auto start = high_resolution_clock::now();
+                for (const Command& command : commands) {
+                    apply_command(*book, command);
+                    if (config == SCANNED && command.type == CommandType::ADD) {
+                        run_scanned_stops(*book, armed, queue, checked);
+                    }
+                }
+                auto end = high_resolution_clock::now();
+                if (pass == 1) {
+                    ns[config].push_back(duration_cast<nanoseconds>(end - start).count() / (double)commands.size());
+                }
+            }
+        }
+    }
+    BenchmarkStats bare = calculate_stats(ns[NONE]);
+    for (int config = 0; config < CONFIGS; config++) {
+        BenchmarkStats stats = calculate_stats(ns[config]);
+        print_stats(names[config], stats, "ns/op");
+        if (config != NONE) {
+            cout << "    " << fixed << setprecision(2) << stats.mean - bare.mean << " ns/op over no stops" << endl;
+        }
+    }
+    cout << endl;
+}
+
+// page faults taken by this process so far, minor and major
+uint64_t page_faults() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+// bytes the heap has handed out and not taken back, mmap'd blocks included
+uint64_t heap_bytes() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// the first num_orders adds into a fresh book, with the store's memory lazy as by default, prefaulted, and
+// provisioned (huge pages, prefaulted, locked, overflow reserved). every add is timed on its own, page faults
+// are counted with getrusage and heap use with mallinfo2 around the run. adds rest 1-1000 ticks off 10000,
+// one in 20 crosses and one in 1000 lands 1100-3000 ticks out, past the ladder window. the provisioned
+// store's arenas are then listed with their page size and the TLB entries it takes to map them
+void benchmark_memory(int num_orders, int num_runs = 3) {
+    cout << "Memory Provisioning Benchmark (" << num_orders << " orders, " << num_runs << " runs):" << endl;
+
+    mt19937 gen(42);
+    uniform_int_distribution<> offset_dist(1, 1000);
+    uniform_int_distribution<> far_dist(1100, 3000);
+    uniform_int_distribution<> qty_dist(1, 100);
+    vector<Command> commands(num_orders);
+    for (int i = 0; i < num_orders; i++) {
+        Command& command = commands[i];
+        command.type = CommandType::ADD;
+        command.order_id = i + 1;
+        command.side = gen() % 2 ? Side::BUY : Side::SELL;
+        int offset = gen() % 20 == 0 ? -5 : gen() % 1000 == 0 ? far_dist(gen) : offset_dist(gen);
+        command.price = command.side == Side::BUY ? 10000 - offset : 10000 + offset;
+        command.quantity = qty_dist(gen);
+    }
+
+    // the same kind of flow through a small book first, so the code itself is paged in before anything counts
+    {
+        unique_ptr<Orderbook> warm(new Orderbook(1 << 16));
+        for (int i = 0; i < min(num_orders, 1 << 15); i++) {
+            apply_command(*warm, commands[i]);
+        }
+    }
+
+    auto expect = [](bool ok, const char* what) {
+        if (ok) {
+            cout << "  ✓ " << what << endl;
+        } else {
+            cout << "  ✗ FAIL: " << what << endl;
+        }
+    };
+
+    MemoryOptions prefaulted;
+    prefaulted.prefault = true;
+    prefaulted.reserved_levels = 4096;
+    const char* names[] = {"lazy (default)", "prefaulted, 4 KB pages", "huge pages, prefaulted, locked"};
+    MemoryOptions configs[] = {MemoryOptions(), prefaulted, provisioned_memory()};
+
+    cout << "  " << left << setw(32) << "memory" << right << setw(10) << "setup ms" << setw(13) << "setup faults"
+         << setw(13) << "run faults" << setw(12) << "heap bytes" << setw(9) << "ns/add" << setw(8) << "p50"
+         << setw(8) << "p99" << setw(9) << "p99.9" << setw(10) << "max ns" << endl;
+
+    unique_ptr<LatencyHistogram> histogram(new LatencyHistogram());
+    uint64_t provisioned_faults = 0;
+    uint64_t provisioned_heap = 0;
+    for (int config = 0; config < 3; config++) {
+        double setup_ms = 0;
+        double ns_per_add = 0;
+        uint64_t setup_faults = 0;
+        uint64_t run_faults = 0;
+        int64_t heap = 0;
+        *histogram = LatencyHistogram();
+        for (int run = 0; run < num_runs; run++) {
+            uint64_t faults_before = page_faults();
+            auto start = high_resolution_clock::now();
+            unique_ptr<OrderStore> store(new OrderStore(MAX_ORDERS, configs[config]));
+            unique_ptr<Orderbook> book(new Orderbook(*store, 0));
+            auto end = high_resolution_clock::now();
+            setup_ms += duration_cast<microseconds>(end - start).count() / 1000.0 / num_runs;
+            setup_faults += page_faults() - faults_before;
+
+            faults_before = page_faults();
+            uint64_t heap_before = heap_bytes();
+            uint64_t run_start = tsc_now();
+            for (const Command& command : commands) {
+                uint64_t t0 = tsc_now();
+                book->add_order(command.order_id, command.side, command.price, command.quantity);
+                histogram->record(tsc_now() - t0);
+            }
+            uint64_t run_ticks = tsc_now() - run_start;
+            run_faults += page_faults() - faults_before;
+            heap += int64_t(heap_bytes() - heap_before);
+            ns_per_add += run_ticks / tsc_ticks_per_ns() / num_orders / num_runs;
+
+            if (config == 2 && run == 0) {
+                cout << endl;
+                for (const auto& [name, arena] : {pair<const char*, const MemoryArena*>{"order pool", &store->pool.memory()},
+                                                  {"order index", &store->index.memory()},
+                                                  {"stop pool", &store->stops.memory()}}) {
+                    cout << "  " << left << setw(12) << name << right << fixed << setprecision(1) << setw(7)
+                         << arena->mapped_bytes() / double(1 << 20) << " MB on " << backing_name(arena->backing())
+                         << " pages (" << arena->huge_bytes() / double(1 << 20) << " MB huge), "
+                         << (arena->is_locked() ? "locked" : "not locked") << ", " << arena->tlb_entries()
+                         << " TLB entries against " << arena->mapped_bytes() / SMALL_PAGE << " on 4 KB pages" << endl;
+                }
+                cout << endl;
+            }
+        }
+        if (config == 2) {
+            provisioned_faults = run_faults;
+            provisioned_heap = heap;
+        }
+        LatencySummary latency = summarize("memory", names[config], *histogram);
+        cout << "  " << left << setw(32) << names[config] << right << fixed << setprecision(1) << setw(10) << setup_ms
+             << setw(13) << setup_faults / num_runs << setw(13) << run_faults / num_runs << setw(12) << heap / num_runs
+             << setw(9) << ns_per_add << setw(8) << latency.p50 << setw(8) << latency.p99 << setw(9) << latency.p999
+             << setw(10) << latency.max << endl;
+    }
+    expect(provisioned_faults == 0, "no page faults in the first orders on provisioned memory");
+    expect(provisioned_heap == 0, "no heap growth in the first orders on provisioned memory");
+
+    // a size no mapping can satisfy must stop the process at construction, not leave a null store for the
+    // first add to fault on. tried in a child so the abort is observed rather than suffered
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        freopen("/dev/null", "w", stderr);
+        MemoryArena impossible(SIZE_MAX / 2, provisioned_memory());
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    expect(child > 0 && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, "an arena that cannot be mapped aborts");
+    cout << endl;
+}
+
+// per-operation percentiles from every latency benchmark, written out by main with --csv/--json
+vector<LatencySummary> latency_results;
+
+void print_latency(const LatencySummary& row) {
+    cout << "  " << left << setw(16) << row.operation << right << fixed << setprecision(1)
+         << " p50 " << setw(7) << row.p50 << "  p90 " << setw(7) << row.p90
+         << "  p99 " << setw(7) << row.p99 << "  p99.9 " << setw(8) << row.p999
+         << "  max " << setw(10) << row.max << " ns  (" << row.count << ")" << endl;
+}
+
+// every operation of the deep-book flow timed on its own with the cycle counter. adds that cross the spread
+// are reported apart from passive adds, every other modify is replaced by an execution, and a quote and a
+// depth-10 snapshot are taken after each operation. the first run warms up and is not recorded.
+void benchmark_latency([[maybe_unused]] int num_operations, [[maybe_unused]] int num_runs = 5) {
+#if ORDERBOOK_LATENCY
+    enum { PROBE, ADD, ADD_CROSSING, CANCEL, MODIFY, EXECUTE, QUOTE, DEPTH, OPS };
+    const char* names[OPS] = {"empty probe", "add", "add (crossing)", "cancel", "modify", "execute",
+                              "get_quote", "get_depth(10)"};
+
+    vector<Command> commands = generate_deep_book_flow(num_operations);
+    bool execute = false;
+    for (Command& command : commands) {
+        if (command.type == CommandType::MODIFY && (execute = !execute)) {
+            command.type = CommandType::EXECUTE;
+        }
+    }
+
+    unique_ptr<LatencyHistogram[]> histograms(new LatencyHistogram[OPS]);
+    unique_ptr<Orderbook> book(new Orderbook());
+    Depth depth;
+    uint64_t checksum = 0;
+
+    for (int run = 0; run <= num_runs; run++) {
+        book->clear();
+        if (run == 1) {
+            for (int op = 0; op < OPS; op++) {
+                histograms[op].reset();
+            }
+        }
+
+        for (const Command& command : commands) {
+            {
+                LATENCY_SCOPE(histograms[PROBE]);
+            }
+            switch (command.type) {
+                case CommandType::ADD: {
+                    Quote q = book->get_quote();
+                    bool crossing = command.side == Side::BUY ? (q.ask_quantity > 0 && command.price >= q.ask_price)
+                                                              : (q.bid_quantity > 0 && command.price <= q.bid_price);
+                    LATENCY_SCOPE(histograms[crossing ? ADD_CROSSING : ADD]);
+                    book->add_order(command.order_id, command.side, command.price, command.quantity);
+                    break;
+                }
+                case CommandType::CANCEL: {
+                    LATENCY_SCOPE(histograms[CANCEL]);
+                    book->cancel_order(command.order_id);
+                    break;
+                }
+                case CommandType::MODIFY: {
+                    LATENCY_SCOPE(histograms[MODIFY]);
+                    book->modify_order(command.order_id, command.quantity);
+                    break;
+                }
+                case CommandType::EXECUTE: {
+                    LATENCY_SCOPE(histograms[EXECUTE]);
+                    book->execute_order(command.order_id, command.quantity);
+                    break;
+                }
+                case CommandType::ADD_STOP:  // the flow arms none
+                    break;
+            }
+            {
+                LATENCY_SCOPE(histograms[QUOTE]);
+                checksum += book->get_quote().bid_price;
+            }
+            {
+                LATENCY_SCOPE(histograms[DEPTH]);
+                book->get_depth(10, depth);
+            }
+            checksum += depth.asks.size();
+        }
+    }
+
+    string benchmark = "latency_" + to_string(num_operations);
+    cout << "Latency Benchmark (" << num_operations << " mixed operations, " << num_runs << " runs, "
+         << fixed << setprecision(2) << tsc_ticks_per_ns() << " ticks/ns, checksum " << checksum % 1000 << "):" << endl;
+    for (int op = 0; op < OPS; op++) {
+        LatencySummary row = summarize(benchmark, names[op], histograms[op]);
+        print_latency(row);
+        latency_results.push_back(row);
+    }
+    cout << endl;
+#else
+    cout << "Latency Benchmark: built without ORDERBOOK_LATENCY, no probes compiled in" << endl << endl;
+#endif
+}
+
 #endif // TESTING_H
\ No newline at end of file